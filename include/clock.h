@@ -0,0 +1,30 @@
+/*
+ * Vecs Project: Header Clock
+ * (include/clock.h)
+ *
+ * Orologio "grossolano" in secondi aggiornato dal loop eventi: le scadenze
+ * (TTL di L1 e L2) lo leggono invece di chiamare time() a ogni operazione.
+ */
+#ifndef VECS_CLOCK_H
+#define VECS_CLOCK_H
+
+#include <time.h>
+#include <stdint.h>
+
+/**
+ * @brief Rilegge l'ora di sistema. Da chiamare dal loop eventi a ogni risveglio
+ * (al più ~1s di ritardo con il timeout di el_poll).
+ */
+void clock_update(void);
+
+/**
+ * @brief Ora corrente (secondi) dell'ultimo clock_update().
+ * Alla prima chiamata, se il loop non è ancora partito, legge l'ora di sistema.
+ * Sicura da qualunque thread.
+ */
+time_t clock_now(void);
+
+// Tempo monotono in microsecondi (budget di lavoro, non per le scadenze)
+uint64_t clock_monotonic_us(void);
+
+#endif // VECS_CLOCK_H
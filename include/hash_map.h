@@ -8,6 +8,7 @@
 #include <stddef.h> // Per size_t
 #include <time.h>   // Per time_t
 #include <stdio.h>
+#include "value_store.h"
 
 /*
  * Struttura di un nodo nella hash map (gestione collisioni con linked list)
@@ -25,9 +26,10 @@ typedef struct hash_map_s hash_map_t;
  * @brief Crea una nuova hash map.
  * * @param initial_capacity La capacità iniziale (numero di bucket).
  * Una potenza di 2 è raccomandata per performance migliori.
+ * @param values Value store condiviso con la L2 (NULL = store privato della mappa).
  * @return Un puntatore alla nuova hash_map_t o NULL in caso di errore.
  */
-hash_map_t *hash_map_create(size_t initial_capacity);
+hash_map_t *hash_map_create(size_t initial_capacity, value_store_t *values);
 
 /**
  * @brief Distrugge una hash map e libera tutta la memoria.
@@ -37,13 +39,15 @@ void hash_map_destroy(hash_map_t *map);
 
 /**
  * @brief Inserisce o aggiorna una coppia chiave-valore nella mappa.
- * La funzione crea copie interne sia della chiave che del valore.
+ * La funzione copia la chiave; il valore viene internato nel value store
+ * (condiviso con le altre entry che hanno la stessa risposta).
  * * @param map La mappa.
  * @param key La chiave (stringa C).
+ * @param ns Namespace della chiave, per hash_map_delete_namespace (copiato; NULL = nessuno).
  * @param value Il valore (stringa C).
  * @return 0 in caso di successo, -1 in caso di errore (es. allocazione memoria).
  */
-int hash_map_set(hash_map_t *map, const char *key, const char *value, int ttl_seconds);
+int hash_map_set(hash_map_t *map, const char *key, const char *ns, const char *value, int ttl_seconds);
 
 /**
  * @brief Recupera un valore dalla mappa usando la chiave.
@@ -62,6 +66,25 @@ const char *hash_map_get(hash_map_t *map, const char *key);
  */
 void hash_map_delete(hash_map_t *map, const char *key);
 
+/**
+ * @brief Rimuove tutte le chiavi inserite con il namespace ns (confronto esatto).
+ * Costo proporzionale alle chiavi del namespace, non alla dimensione della mappa.
+ * * @param map La mappa.
+ * @param ns Il namespace (es. i <params>).
+ * @return Numero di chiavi rimosse.
+ */
+size_t hash_map_delete_namespace(hash_map_t *map, const char *ns);
+
+/**
+ * @brief Ciclo di scadenza attivo: esamina al più max_buckets bucket, ripartendo
+ * dal punto in cui si era fermata la chiamata precedente, e rimuove le chiavi scadute.
+ * * @param map La mappa.
+ * @param max_buckets Budget di bucket da esaminare.
+ * @param examined Se non NULL, riceve il numero di chiavi esaminate.
+ * @return Numero di chiavi rimosse.
+ */
+size_t hash_map_expire_cycle(hash_map_t *map, size_t max_buckets, size_t *examined);
+
 /**
  * @brief Svuota la cache.
  * * @param map La mappa.
@@ -71,7 +94,8 @@ void hash_map_clear(hash_map_t *map);
 // Salva tutto il contenuto su un file aperto
 int hash_map_save(hash_map_t *map, FILE *f);
 
-// Carica contenuto da file (ignora chiavi scadute)
+// Carica contenuto da file (ignora chiavi scadute). Negli snapshot senza namespace
+// il namespace è il testo dopo l'ultimo '|' della chiave (formato "<prompt>|<params>")
 int hash_map_load(hash_map_t *map, FILE *f);
 
 #endif // VECS_HASH_MAP_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+/*
+ * Vecs Project: Header Filtro a Parole Chiave
+ * (include/keyword_filter.h)
+ *
+ * Dizionario di parole chiave raggruppate per feature (es. "negation"),
+ * compilato in un automa Aho-Corasick: un solo passaggio sul testo produce
+ * la bitmask delle feature presenti. Usato dai filtri ibridi della cache L2.
+ *
+ * Formato del dizionario (una feature per riga, '#' per i commenti):
+ *     negation: not, never, don't, non, mai
+ * Le parole chiave (anche di più parole) vanno in minuscolo e corrispondono
+ * solo a parole intere; il confronto ignora maiuscole/minuscole ASCII.
+ */
+#ifndef VECS_KEYWORD_FILTER_H
+#define VECS_KEYWORD_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KWF_MAX_FEATURES 32 // Bit della maschera restituita da kwf_match
+
+typedef struct keyword_filter_s keyword_filter_t;
+
+keyword_filter_t *kwf_create(void);
+
+void kwf_destroy(keyword_filter_t *kwf);
+
+/**
+ * @brief Aggiunge una parola chiave alla feature indicata (creata se nuova).
+ * Da chiamare prima di kwf_compile.
+ * @return Bit della feature, -1 se le feature sono esaurite o in caso di OOM.
+ */
+int kwf_add(keyword_filter_t *kwf, const char *feature, const char *keyword);
+
+/**
+ * @brief Aggiunge le parole chiave di un dizionario in formato testo.
+ * @return Numero di parole chiave aggiunte, -1 in caso di errore di sintassi o OOM.
+ */
+int kwf_load_string(keyword_filter_t *kwf, const char *spec);
+
+// Come kwf_load_string, leggendo il dizionario da file
+int kwf_load_file(keyword_filter_t *kwf, const char *path);
+
+/**
+ * @brief Costruisce l'automa (transizioni complete, niente failure link a runtime).
+ * @return 0 in caso di successo, -1 in caso di OOM.
+ */
+int kwf_compile(keyword_filter_t *kwf);
+
+/**
+ * @brief Scansione in un solo passaggio: bitmask delle feature trovate nel testo.
+ * * @param len Se non NULL, riceve la lunghezza del testo (evita uno strlen a parte).
+ */
+uint32_t kwf_match(const keyword_filter_t *kwf, const char *text, size_t *len);
+
+int kwf_feature_count(const keyword_filter_t *kwf);
+
+const char *kwf_feature_name(const keyword_filter_t *kwf, int bit);
+
+#endif // VECS_KEYWORD_FILTER_H
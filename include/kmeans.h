@@ -0,0 +1,37 @@
+/*
+ * Vecs Project: Header K-Means
+ * (include/kmeans.h)
+ *
+ * Clustering usato per addestrare i quantizzatori della cache L2
+ * (codebook PQ, centroidi IVF). Tutti i buffer sono allocati dal chiamante.
+ */
+#ifndef VECS_KMEANS_H
+#define VECS_KMEANS_H
+
+#include <stddef.h>
+#include "vec_kernels.h"
+
+/**
+ * @brief K-Means di Lloyd (distanza euclidea) con inizializzazione k-means++.
+ * * @param data Matrice row-major [n x dim] (con stride `stride` float per riga).
+ * @param centroids Output [k x dim], contiguo.
+ * @param spherical Se 1 i centroidi vengono rinormalizzati (similarità coseno).
+ * @return 0 in caso di successo, -1 se n < k o in caso di OOM.
+ */
+int kmeans_train(const vec_kernels_t *vk, const float *data, size_t n, size_t stride, int dim,
+                 int k, int iterations, int spherical, float *centroids);
+
+/**
+ * @brief K-Means mini-batch: ad ogni iterazione `batch` punti casuali spostano il
+ * proprio centroide con learning rate 1/conteggio. Costo indipendente da n
+ * (a parte l'inizializzazione k-means++), adatto al ri-addestramento in background.
+ */
+int kmeans_train_minibatch(const vec_kernels_t *vk, const float *data, size_t n, size_t stride, int dim,
+                           int k, size_t batch, int iterations, int spherical, float *centroids);
+
+/**
+ * @brief Indice del centroide più vicino (distanza euclidea) a x.
+ */
+int kmeans_nearest(const vec_kernels_t *vk, const float *x, const float *centroids, int k, int dim);
+
+#endif // VECS_KMEANS_H
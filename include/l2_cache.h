@@ -4,26 +4,233 @@
 #include <stddef.h>
 #include <time.h>   // <--- AGGIUNGI QUESTO (per time_t)
 #include <stdio.h>
+#include <stdint.h>
+#include "value_store.h"
 
 typedef struct l2_cache_s l2_cache_t;
 
+// Formato di memorizzazione dei vettori in L2
+typedef enum {
+    L2_STORAGE_F32 = 0,  // float32 (default, esatto)
+    L2_STORAGE_INT8,     // int8 con scala per-vettore: ~4x entry a parità di RAM
+    L2_STORAGE_F16,      // fp16 IEEE: metà memoria, errore ~1e-3 (nessun re-ranking necessario)
+    L2_STORAGE_BF16      // bfloat16: metà memoria, conversione a costo zero, errore ~1e-2
+} l2_storage_t;
+
+// Modalità di scan dei cluster sondati
+typedef enum {
+    L2_PREFILTER_NONE = 0,  // Score diretto su ogni riga
+    L2_PREFILTER_BINARY,    // Hamming su codici di segno a 1 bit, poi re-ranking dei migliori
+    L2_PREFILTER_REDUCED    // Copia float a poche dimensioni (anche per i centroidi), poi re-ranking
+} l2_prefilter_t;
+
+// Proiezione del prefiltro ridotto
+typedef enum {
+    L2_PROJECTION_PCA = 0,  // Componenti principali apprese dalle entry presenti
+    L2_PROJECTION_PREFIX    // Prime dimensioni del vettore (modelli Matryoshka)
+} l2_projection_t;
+
+// Struttura dell'indice
+typedef enum {
+    L2_INDEX_IVF = 0,    // IVFFlat: righe complete (f32/int8) nei cluster
+    L2_INDEX_IVFPQ,      // IVF-PQ: residui codificati in M byte, scan con tabelle ADC
+    L2_INDEX_HNSW        // Grafo HNSW: ricerca logaritmica, delete con tombstone
+} l2_index_t;
+
+// Politica di eviction quando la cache è piena
+typedef enum {
+    L2_EVICT_NONE = 0,   // Rifiuta i nuovi inserimenti
+    L2_EVICT_LRU,        // LRU approssimato: tra alcune entry a campione si rimuove la meno usata di recente
+    L2_EVICT_LFU,        // LFU con decadimento: si rimuove la meno richiesta
+    L2_EVICT_TTL         // Si rimuove la entry più vicina alla scadenza
+} l2_eviction_t;
+
+// Esito di l2_cache_upsert
+typedef enum {
+    L2_UPSERT_INSERTED = 0, // Nuova entry
+    L2_UPSERT_DEDUPED,      // Esisteva già un'entry equivalente (nessuna modifica, non conta come HIT)
+    L2_UPSERT_REJECTED,     // Partizione piena senza eviction, limite di partizioni o OOM
+    L2_UPSERT_BUSY          // wait = 0 e write lock occupato: nulla è stato fatto
+} l2_upsert_t;
+
+#define L2_BUSY (-1) // Delete con wait = 0 e write lock occupato dai lettori: nulla è stato fatto
+
+typedef struct {
+    int vector_dim;
+    size_t max_capacity; // Entry massime della cache, budget condiviso da tutte le partizioni
+    l2_eviction_t eviction;
+    l2_storage_t storage;
+    l2_prefilter_t prefilter;
+    int rerank_k;        // Candidati dello scan approssimato rivalutati con la query float (0 = default)
+    int reduced_dim;     // Prefiltro ridotto: dimensioni della copia compatta (0 = default)
+    l2_projection_t projection; // Prefiltro ridotto: PCA o prefisso
+    l2_index_t index;
+    int cluster_size;    // IVF: righe target per cluster, guida split/merge (0 = automatico dalla cache L2)
+    int nprobe;          // IVF: cluster sondati al massimo per ricerca, recall vs latenza (0 = default)
+    int search_threads;  // IVF: thread che dividono lo scan di una query grande, chiamante incluso (<= 1 = seriale)
+    size_t parallel_min_rows; // IVF: righe da scandire oltre cui la query va in parallelo (0 = default)
+    int pq_m;            // Sottoquantizzatori PQ (0 = automatico, dim/16)
+    int pq_rerank;       // IVF-PQ: 1 = mantiene la copia in formato `storage` per il re-ranking
+    int hnsw_m;          // HNSW: vicini per nodo (0 = default)
+    int hnsw_ef_search;  // HNSW: ampiezza della beam search in query (0 = default)
+    int drop_prompts;    // 1 = non conserva il testo dei prompt in RAM (i filtri usano feature precalcolate)
+    const char *filter_dict; // Dizionario delle feature dei filtri ibridi (NULL = predefinito, negazioni multilingua)
+    value_store_t *values;   // Store delle risposte condiviso con la L1 (NULL = privato, in RAM)
+    int max_partitions;  // Namespace con un indice proprio (<= 1 = un solo indice, namespace ignorato)
+    int lexical;         // 1 = indice invertito BM25 sui prompt (richiede i prompt conservati)
+    float lexical_weight; // Peso del BM25 nello score fuso: (1 - w) * coseno + w * BM25 (0 = solo shortcut)
+    float lexical_shortcut; // Score BM25 normalizzato oltre cui si risponde senza scan vettoriale (> 1 = mai)
+} l2_config_t;
+
+#define L2_MAX_TOPK 64 // Risultati massimi di una ricerca top-K
+#define L2_MAX_BATCH 16 // Query massime di una ricerca a batch
+#define L2_STATS_NAME 128 // Byte del nome di una partizione riportati nelle statistiche
+
+// Statistiche di una partizione (namespace) L2
+typedef struct {
+    char name[L2_STATS_NAME]; // Namespace (troncato), "" = predefinito
+    size_t entries;
+    uint64_t searches;       // Query cercate nella partizione
+    uint64_t hits;           // Query con almeno un risultato
+    uint64_t inserts;
+} l2_partition_stats_t;
+
+// Risultato di una ricerca top-K. I puntatori restano validi fino alla prossima
+// modifica della cache (inserimento, delete, manutenzione, scadenza), cioè
+// finché il chiamante tiene il read lock
+typedef struct {
+    const char *response;
+    const char *prompt;      // NULL se i prompt non sono conservati
+    float score;             // Similarità vettoriale grezza (BM25 normalizzato per lo shortcut lessicale)
+    float penalized_score;   // Score dopo i filtri ibridi e la fusione BM25 (confrontato con la threshold)
+    time_t expire_at;
+    uint64_t loc;            // Posizione opaca nell'indice, per registrare l'HIT (L2_LOC_NONE = da ritrovare)
+} l2_search_result_t;
+
+#define L2_LOC_NONE UINT64_MAX // Risultato senza posizione nell'indice (shortcut lessicale)
+
 // Crea la cache L2
-l2_cache_t *l2_cache_create(int vector_dim, size_t max_capacity);
+l2_cache_t *l2_cache_create(const l2_config_t *config);
 
 // Distrugge la cache
 void l2_cache_destroy(l2_cache_t *cache);
 
-// Inserisce un embedding, IL PROMPT ORIGINALE, e la risposta
-int l2_cache_insert(l2_cache_t *cache, const float *vector, const char *prompt_text, const char *response, int ttl_seconds);
+// Namespace: con max_partitions > 1 ogni namespace (es. i <params> di SET/QUERY) ha il
+// proprio indice, e le ricerche vedono solo le entry del proprio. NULL = "" (predefinito)
+
+// Inserisce un embedding, IL PROMPT ORIGINALE, e la risposta nella partizione del namespace.
+// A cache piena libera un posto secondo la policy di eviction, nella partizione più grande
+// (-1 se L2_EVICT_NONE, OOM o limite di partizioni raggiunto)
+int l2_cache_insert(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt_text,
+                    const char *response, int ttl_seconds);
+
+/**
+ * @brief Inserisce l'entry solo se il namespace non ne contiene già una equivalente
+ * (score penalizzato >= dedupe_threshold, come l2_cache_search con il prompt come testo).
+ * Ricerca e inserimento avvengono sotto lo stesso write lock; l'indice IVF confronta
+ * i centroidi una volta sola per entrambi. Il duplicato non viene toccato: non conta
+ * come HIT per l'eviction e la sua scadenza resta quella originale.
+ * * @param wait 0 = non attende le ricerche in corso (L2_UPSERT_BUSY se il lock è occupato).
+ * @return L'esito (inserita, duplicato, rifiutata, occupata).
+ */
+l2_upsert_t l2_cache_upsert(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt_text,
+                            const char *response, int ttl_seconds, float dedupe_threshold, int wait);
+
+/**
+ * @brief Sezione di lettura: più thread possono cercare in parallelo, le modifiche
+ * (inserimento, delete, manutenzione, scadenza, FLUSH) attendono l'uscita di tutti.
+ * Le ricerche vanno eseguite dentro la sezione quando altri thread usano la cache,
+ * e i risultati (puntatori nell'indice) vanno copiati prima di l2_cache_read_unlock.
+ * Non annidabile, e chi la tiene non può modificare la cache.
+ */
+void l2_cache_read_lock(l2_cache_t *cache);
+
+void l2_cache_read_unlock(l2_cache_t *cache);
+
+// Cerca il vettore più simile usando anche il testo per filtri ibridi (un HIT aggiorna le statistiche d'uso)
+const char *l2_cache_search(l2_cache_t *cache, const char *ns, const float *query_vector, const char *query_text,
+                            float threshold);
+
+/**
+ * @brief Ricerca delle k entry migliori (score penalizzato >= threshold), in ordine
+ * decrescente di score penalizzato. Ogni risultato restituito conta come HIT per
+ * l'eviction (anche quelli dello shortcut lessicale); i candidati scartati dalla fusione BM25 no.
+ * * @param results Array di almeno k elementi.
+ * @param k Numero di risultati richiesti (ridotto a L2_MAX_TOPK).
+ * @return Numero di risultati scritti.
+ */
+int l2_cache_search_topk(l2_cache_t *cache, const char *ns, const float *query_vector, const char *query_text,
+                         float threshold, l2_search_result_t *results, int k);
+
+/**
+ * @brief Ricerca top-K di più query insieme: l'indice IVF legge ogni cluster sondato
+ * una volta per tutte le query dello stesso namespace invece che una volta per query
+ * (con l'indice lessicale le query si cercano una alla volta). Risultati come l2_cache_search_topk, query per query.
+ * * @param namespaces Namespace di ogni query (NULL = tutte nel predefinito).
+ * @param results Array di nq * k elementi: i risultati della query j partono da results[j * k].
+ * @param k Risultati massimi di una query (il più grande tra quelli chiesti).
+ * @param ks Risultati chiesti da ogni query, al più k (NULL = k per tutte): solo questi contano come HIT.
+ * @param counts Riceve il numero di risultati di ogni query (al più ks[j]).
+ * @param nq Numero di query (al più L2_MAX_BATCH).
+ * @return 0 in caso di successo, -1 in caso di OOM o argomenti non validi.
+ */
+int l2_cache_search_batch(l2_cache_t *cache, const char *const *namespaces, const float *const *query_vectors,
+                          const char *const *query_texts, int nq, float threshold,
+                          l2_search_result_t *results, int k, const int *ks, int *counts);
+
+// Rimuove un elemento semanticamente equivalente dal namespace (wait come l2_cache_delete_prompt)
+int l2_cache_delete_semantic(l2_cache_t *cache, const char *ns, const float *query_vector, int wait);
+
+/**
+ * @brief Rimuove dal namespace le entry salvate con questo prompt (a meno di maiuscole,
+ * punteggiatura e spazi, come normalize_text): nessun embedding e nessuno scan,
+ * la posizione viene dall'indice dei prompt. Senza partizioni il namespace è ignorato.
+ * * @param wait 0 = non attende le ricerche in corso: L2_BUSY se il write lock è occupato.
+ * @return Numero di entry rimosse, o L2_BUSY.
+ */
+int l2_cache_delete_prompt(l2_cache_t *cache, const char *ns, const char *prompt, int wait);
+
+// Svuota cache l2 (tutti i namespace). wait come l2_cache_delete_prompt: 0, o L2_BUSY
+int l2_cache_clear(l2_cache_t *cache, int wait);
+
+/**
+ * @brief Svuota un solo namespace liberandone l'indice (costo proporzionale alle sue entry).
+ * * @param wait 0 = non attende le ricerche in corso: L2_BUSY se il write lock è occupato.
+ * @return Entry rimosse (0 se la cache non è partizionata: le entry non hanno namespace), o L2_BUSY.
+ */
+long l2_cache_clear_namespace(l2_cache_t *cache, const char *ns, int wait);
+
+/**
+ * @brief Statistiche delle partizioni esistenti.
+ * * @param stats Array di almeno max elementi.
+ * @return Numero di partizioni scritte (al più max).
+ */
+int l2_cache_get_stats(l2_cache_t *cache, l2_partition_stats_t *stats, int max);
+
+// Inserimenti rifiutati perché il namespace era nuovo e il limite di partizioni già raggiunto
+uint64_t l2_cache_partition_rejects(l2_cache_t *cache);
 
-// Cerca il vettore più simile usando anche il testo per filtri ibridi
-const char *l2_cache_search(l2_cache_t *cache, const float *query_vector, const char *query_text, float threshold);
+// Entry di tutte le partizioni, da confrontare con il budget condiviso max_capacity
+size_t l2_cache_entries(l2_cache_t *cache);
 
-// Rimuove un elemento semanticamente equivalente
-int l2_cache_delete_semantic(l2_cache_t *cache, const float *query_vector);
+/**
+ * @brief Manutenzione incrementale (es. ri-addestramento dei centroidi IVF).
+ * Da chiamare periodicamente dal thread che possiede la cache; ogni chiamata
+ * esegue una quantità limitata di lavoro. Non attende le ricerche in corso:
+ * con il lock occupato non fa nulla e chiede di essere richiamata.
+ * @return 1 se c'è altro lavoro in sospeso (richiamare a breve), 0 altrimenti.
+ */
+int l2_cache_maintenance(l2_cache_t *cache);
 
-// Svuota cache l2
-void l2_cache_clear(l2_cache_t *cache);
+/**
+ * @brief Ciclo di scadenza attivo: rimuove le entry scadute esaminando al più
+ * budget righe (i cluster IVF senza scadenze possibili vengono saltati).
+ * Le partizioni rimaste vuote vengono liberate. Non attende le ricerche in corso:
+ * con il lock occupato non esamina nulla (examined = 0).
+ * * @param examined Se non NULL, riceve il numero di righe esaminate.
+ * @return Numero di entry rimosse.
+ */
+size_t l2_cache_expire_cycle(l2_cache_t *cache, size_t budget, size_t *examined);
 
 // Salva cache vettoriale
 int l2_cache_save(l2_cache_t *cache, FILE *f);
@@ -32,6 +239,7 @@ int l2_cache_save(l2_cache_t *cache, FILE *f);
 int l2_cache_load(l2_cache_t *cache, FILE *f);
 
 // Funzione helper interna per inserire direttamente dati grezzi senza embedding
-int l2_cache_insert_raw(l2_cache_t *cache, float *vector, const char *prompt, const char *resp, time_t expire_at);
+int l2_cache_insert_raw(l2_cache_t *cache, const char *ns, float *vector, const char *prompt, const char *resp,
+                        time_t expire_at);
 
 #endif // VECS_L2_CACHE_H
\ No newline at end of file
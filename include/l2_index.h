@@ -0,0 +1,162 @@
+/*
+ * Vecs Project: Interfaccia degli indici L2
+ * (include/l2_index.h)
+ *
+ * l2_cache.c espone l'API pubblica (l2_cache.h) e delega ogni operazione
+ * all'indice scelto in configurazione (IVF, IVF-PQ, HNSW) tramite questa
+ * tabella di funzioni. Formato snapshot e filtri ibridi restano condivisi.
+ */
+#ifndef VECS_L2_INDEX_H
+#define VECS_L2_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "l2_cache.h"
+#include "keyword_filter.h"
+#include "value_store.h"
+#include "task_pool.h"
+
+// --- FILTRI IBRIDI (condivisi dai backend) ---
+
+// Feature testuali dei filtri ibridi: calcolate una sola volta per ogni entry
+// (inserimento/caricamento, salvate accanto alle scadenze) e per ogni query
+typedef struct {
+    uint32_t len;            // Lunghezza del prompt in byte
+    uint32_t features;       // Bitmask delle feature del dizionario (es. negazione) presenti nel prompt
+} l2_text_filter_t;
+
+// Estrae le feature da un testo con un passaggio dell'automa (NULL = testo vuoto)
+void l2_text_filter_init(l2_text_filter_t *filter, const keyword_filter_t *kwf, const char *text);
+
+// Filtri Logici (Feature del dizionario / Lunghezza) - Penalità sullo score vettoriale
+static inline float l2_apply_hybrid_filters(const l2_text_filter_t *query, const l2_text_filter_t *entry, float dot) {
+    if (dot > 0.6f) {
+        uint32_t longest = query->len > entry->len ? query->len : entry->len;
+        uint32_t diff = query->len > entry->len ? query->len - entry->len : entry->len - query->len;
+        if (longest > 0 && (float)diff / (float)longest > 0.5f) dot *= 0.8f;
+
+        // Una penalità per ogni feature presente in uno solo dei due testi
+        for (uint32_t mismatch = query->features ^ entry->features; mismatch; mismatch &= mismatch - 1) {
+            dot *= 0.75f;
+        }
+    }
+    return dot;
+}
+
+// Candidato di una ricerca (posizione nell'indice + score), per le liste top-k dei backend
+typedef struct {
+    int cluster;             // IVF: slot del cluster (HNSW: 0)
+    size_t row;              // IVF: riga nel cluster (HNSW: id del nodo)
+    float score;             // Chiave di ordinamento (score penalizzato, o approssimato prima del re-ranking)
+    float raw;               // Similarità vettoriale prima dei filtri ibridi
+} l2_candidate_t;
+
+// Inserimento ordinato (decrescente) in una lista limitata a k elementi; a parità vince il primo
+static inline int l2_candidate_push(l2_candidate_t *list, int count, int k, int cluster, size_t row,
+                                    float score, float raw) {
+    if (count == k && score <= list[k - 1].score) return count;
+    int pos = (count < k) ? count++ : k - 1;
+    while (pos > 0 && list[pos - 1].score < score) {
+        list[pos] = list[pos - 1];
+        pos--;
+    }
+    list[pos].cluster = cluster;
+    list[pos].row = row;
+    list[pos].score = score;
+    list[pos].raw = raw;
+    return count;
+}
+
+// Callback di iterazione sulle entry vive (usata dal salvataggio su disco).
+// prompt è NULL se la cache non conserva il testo dei prompt; key è la chiave del
+// delete esatto (l2_keys.h), che resta disponibile anche senza prompt
+typedef void (*l2_entry_fn)(void *ctx, const float *vector, const char *prompt, uint64_t key,
+                            const l2_text_filter_t *features, const char *response, time_t expire_at);
+
+typedef struct l2_lex_s l2_lex_t; // Indice lessicale BM25 (l2_lex.h)
+
+// Risorse della facciata condivise dagli indici di tutte le partizioni (sopravvivono agli indici)
+typedef struct {
+    value_store_t *values;   // Store delle risposte (vs_intern/vs_release)
+    task_pool_t *search_pool; // Thread dello scan parallelo (NULL = ricerca seriale)
+} l2_shared_t;
+
+/**
+ * @brief Operazioni che ogni backend dell'indice L2 deve implementare.
+ * La semantica di ciascuna è quella della corrispondente funzione l2_cache_*.
+ */
+typedef struct {
+    const char *name;
+    void *(*create)(const l2_config_t *config, const l2_shared_t *shared);
+    void (*destroy)(void *index);
+    // prompt può essere NULL (testo non conservato): le feature bastano ai filtri, la
+    // chiave (l2_keys_hash del prompt, calcolata dalla facciata) al delete esatto
+    int (*insert)(void *index, const float *vector, const char *prompt, uint64_t key,
+                  const l2_text_filter_t *features, const char *response, time_t expire_at);
+    // Top-k in ordine decrescente; le feature della query sono già estratte dalla facciata (dizionario condiviso).
+    // record_hits = 0: i risultati non contano come HIT per l'eviction (ricerca della deduplica)
+    int (*search)(void *index, const float *query_vector, const l2_text_filter_t *query, float threshold,
+                  l2_search_result_t *results, int k, int record_hits);
+    // Deduplica + inserimento in un passaggio, ritorna un l2_upsert_t; il duplicato trovato
+    // non conta come HIT (opzionale: senza, la facciata chiama search senza HIT e insert;
+    // mai usato con l'indice lessicale, che cambia la ricerca)
+    int (*upsert)(void *index, const float *vector, const char *prompt, uint64_t key,
+                  const l2_text_filter_t *features, const char *response, time_t expire_at, float threshold);
+    // Registra come HIT per l'eviction i risultati di una ricerca fatta sotto lo stesso read lock
+    // (quella con record_hits = 0 della fusione BM25 o del batch, o lo shortcut lessicale: senza
+    // loc la posizione si ritrova dall'indice dei prompt, a parità di chiave quella con la stessa risposta)
+    void (*touch)(void *index, const l2_search_result_t *results, int n);
+    // Più query in un passaggio sui dati, senza registrare HIT (opzionale: senza, la facciata
+    // chiama search per ognuna)
+    int (*search_batch)(void *index, const float *const *queries, const l2_text_filter_t *filters, int nq,
+                        float threshold, l2_search_result_t *results, int k, int *counts);
+    int (*delete_semantic)(void *index, const float *query_vector);
+    // Rimuove una entry secondo la policy di eviction (budget di capacità condiviso dalle
+    // partizioni): 0, o -1 se l'indice è vuoto
+    int (*evict)(void *index);
+    // Rimuove tutte le entry con questa chiave del prompt (indice dei prompt, nessuno scan)
+    int (*delete_key)(void *index, uint64_t key);
+    void (*clear)(void *index);
+    // Ritorna il numero di entry visitate
+    int (*foreach)(void *index, l2_entry_fn fn, void *ctx);
+    // Entry presenti (anche scadute non ancora rimosse)
+    size_t (*count)(void *index);
+    // Lavoro incrementale dal loop eventi (opzionale): 1 se resta lavoro in sospeso
+    int (*maintenance)(void *index);
+    // Rimozione attiva delle entry scadute entro un budget di righe (opzionale)
+    size_t (*expire)(void *index, size_t budget, size_t *examined);
+    // Indice lessicale sui prompt, mantenuto dal backend (opzionale: NULL se disattivato)
+    const l2_lex_t *(*lexicon)(void *index);
+} l2_index_ops_t;
+
+extern const l2_index_ops_t l2_ivf_ops;   // IVFFlat / IVF-PQ (src/cache/l2_ivf.c)
+extern const l2_index_ops_t l2_hnsw_ops;  // HNSW (src/cache/l2_hnsw.c)
+
+// --- EVICTION (condivisa dai backend) ---
+
+#define L2_EVICTION_SAMPLES 8 // Entry esaminate per ogni eviction (costo O(1), qualità ~LRU/LFU esatti)
+
+// Statistiche d'uso di una entry. Il clock è logico: avanza a ogni inserimento e HIT.
+// Atomici perché le ricerche concorrenti registrano i propri HIT (un aggiornamento
+// perso in una gara è accettabile: le statistiche guidano solo l'eviction)
+typedef struct {
+    _Atomic uint32_t last_access;
+    _Atomic uint32_t hits;   // Contatore LFU, dimezzato ogni `decay` tick di inattività
+} l2_usage_t;
+
+// Registra un accesso (HIT o inserimento); sicura anche da più lettori in parallelo
+void l2_usage_touch(l2_usage_t *usage, uint32_t clock, uint32_t decay);
+
+/**
+ * @brief Valore di conservazione di una entry secondo la policy: tra i campioni
+ * si rimuove quella con il valore più basso.
+ */
+double l2_eviction_rank(l2_eviction_t policy, const l2_usage_t *usage, time_t expire_at,
+                        uint32_t clock, uint32_t decay);
+
+const char *l2_eviction_name(l2_eviction_t policy);
+
+#endif // VECS_L2_INDEX_H
@@ -0,0 +1,58 @@
+/*
+ * Vecs Project: Header Indice dei Prompt (delete esatto)
+ * (include/l2_keys.h)
+ *
+ * Tabella hash dall'hash del prompt normalizzato alla posizione dell'entry
+ * nell'indice L2, mantenuta dal backend a ogni inserimento, spostamento
+ * (swap-remove, migrazione) e rimozione. Permette di cancellare un prompt
+ * senza calcolarne l'embedding. La posizione è opaca (la codifica è del
+ * backend); più entry possono avere la stessa chiave.
+ * Il server la usa anche per i SET in coda ai worker (posizione = job).
+ * Non thread-safe: modifiche sotto il write lock della facciata.
+ */
+#ifndef VECS_L2_KEYS_H
+#define VECS_L2_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define L2_KEY_NONE 0ULL // Entry senza chiave (prompt non disponibile)
+
+typedef struct l2_keys_s l2_keys_t;
+
+l2_keys_t *l2_keys_create(void);
+
+void l2_keys_destroy(l2_keys_t *keys);
+
+// Svuota la tabella (la memoria torna alla dimensione iniziale)
+void l2_keys_clear(l2_keys_t *keys);
+
+/**
+ * @brief Chiave di un prompt: hash a 64 bit dell'output di normalize_text,
+ * quindi maiuscole, punteggiatura e spazi non contano.
+ * @return La chiave, o L2_KEY_NONE se prompt è NULL.
+ */
+uint64_t l2_keys_hash(const char *prompt);
+
+/**
+ * @brief Registra la posizione di un'entry.
+ * * @param key Chiave del prompt (L2_KEY_NONE = nessuna operazione).
+ * @return 0 se registrata, -1 in caso di OOM (l'entry resta raggiungibile solo dal delete semantico).
+ */
+int l2_keys_add(l2_keys_t *keys, uint64_t key, uint64_t loc);
+
+// Toglie la coppia (key, loc) se presente
+void l2_keys_remove(l2_keys_t *keys, uint64_t key, uint64_t loc);
+
+// Aggiorna la posizione di un'entry spostata (nessuna operazione se la coppia non c'è)
+void l2_keys_move(l2_keys_t *keys, uint64_t key, uint64_t old_loc, uint64_t new_loc);
+
+/**
+ * @brief Posizioni registrate per una chiave.
+ * @return Numero di posizioni trovate (al più max).
+ */
+int l2_keys_find(const l2_keys_t *keys, uint64_t key, uint64_t *locs, int max);
+
+size_t l2_keys_count(const l2_keys_t *keys);
+
+#endif // VECS_L2_KEYS_H
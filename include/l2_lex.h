@@ -0,0 +1,81 @@
+/*
+ * Vecs Project: Header Indice Lessicale (BM25 ibrido)
+ * (include/l2_lex.h)
+ *
+ * Indice invertito sui token dei prompt L2 (output di normalize_text diviso
+ * sugli spazi), mantenuto dall'indice L2 a ogni inserimento e rimozione.
+ * Serve a due cose: uno shortcut per le query con un match lessicale quasi
+ * identico (codici di errore, nomi di prodotto) prima dello scan vettoriale,
+ * e lo score BM25 da fondere con la similarità coseno dei candidati.
+ *
+ * Gli score BM25 sono normalizzati in [0, 1] dividendo per lo score che
+ * avrebbe un prompt identico alla query. Le entry conservano puntatori al
+ * prompt e alla risposta dell'indice L2 (validi finché l'entry esiste).
+ * Modifiche sotto il write lock della facciata; le query sono in sola
+ * lettura e possono girare in parallelo.
+ */
+#ifndef VECS_L2_LEX_H
+#define VECS_L2_LEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "l2_index.h"
+
+#define L2_LEX_NONE UINT32_MAX  // Entry non indicizzata (prompt vuoto o OOM)
+#define L2_LEX_MAX_QUERY_TERMS 32 // Termini distinti considerati in una query
+
+// Termine di una query preparata
+typedef struct {
+    uint32_t term;           // Id nell'indice (L2_LEX_NONE = mai visto: abbassa solo lo score massimo)
+    uint32_t qtf;            // Occorrenze nella query
+    uint32_t df;             // Entry che contengono il termine
+    float idf;
+} l2_lex_term_t;
+
+// Query preparata una volta e riusata per shortcut e fusione
+typedef struct {
+    l2_lex_term_t terms[L2_LEX_MAX_QUERY_TERMS]; // Ordinati per id
+    int count;
+    float max_score;         // BM25 di un prompt identico alla query (normalizzazione)
+} l2_lex_query_t;
+
+l2_lex_t *l2_lex_create(void);
+
+void l2_lex_destroy(l2_lex_t *lex);
+
+/**
+ * @brief Indicizza il prompt di una entry.
+ * * @param prompt Testo del prompt conservato dall'indice L2 (non copiato).
+ * @param response Risposta dell'entry (non copiata, nessun riferimento in più).
+ * @param features Feature dei filtri ibridi, per lo shortcut.
+ * @return Id dell'entry nell'indice lessicale, o L2_LEX_NONE.
+ */
+uint32_t l2_lex_add(l2_lex_t *lex, const char *prompt, const vs_value_t *response,
+                    const l2_text_filter_t *features, time_t expire_at);
+
+// Toglie un'entry (L2_LEX_NONE = nessuna operazione)
+void l2_lex_remove(l2_lex_t *lex, uint32_t doc);
+
+// Entry indicizzate
+size_t l2_lex_count(const l2_lex_t *lex);
+
+/**
+ * @brief Prepara una query: normalizzazione, token e idf.
+ * @return Numero di termini della query (0 = testo senza token).
+ */
+int l2_lex_query_init(const l2_lex_t *lex, l2_lex_query_t *query, const char *text);
+
+// Score BM25 normalizzato di un testo qualunque (es. il prompt di un candidato vettoriale)
+float l2_lex_score_text(const l2_lex_t *lex, const l2_lex_query_t *query, const char *text);
+
+/**
+ * @brief Shortcut lessicale: le entry con score normalizzato (dopo i filtri ibridi)
+ * >= threshold, in ordine decrescente. I candidati vengono dalle liste dei termini
+ * più rari della query, entro un budget fisso: il costo non cresce con la cache.
+ * @return Numero di risultati (score e penalized_score sono lo score lessicale).
+ */
+int l2_lex_search(const l2_lex_t *lex, const l2_lex_query_t *query, const l2_text_filter_t *filter,
+                  float threshold, time_t now, l2_search_result_t *results, int k);
+
+#endif // VECS_L2_LEX_H
@@ -0,0 +1,69 @@
+/*
+ * Vecs Project: Header Product Quantizer (IVF-PQ)
+ * (include/l2_pq.h)
+ *
+ * Quantizzatore prodotto per i residui (vettore - centroide IVF):
+ * il residuo viene diviso in M sottovettori, ciascuno codificato con
+ * l'indice (1 byte) del centroide più vicino del proprio codebook.
+ */
+#ifndef VECS_L2_PQ_H
+#define VECS_L2_PQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec_kernels.h"
+
+#define PQ_KSUB 256 // Centroidi per sottospazio (codici a 8 bit)
+
+typedef struct l2_pq_s l2_pq_t;
+
+/**
+ * @brief Crea un quantizzatore (non addestrato) per vettori di dimensione dim.
+ * * @param m Numero di sottoquantizzatori (0 = automatico, dim/16). Viene ridotto
+ * fino a un divisore di dim.
+ */
+l2_pq_t *l2_pq_create(int dim, int m);
+
+void l2_pq_destroy(l2_pq_t *pq);
+
+// Numero di sottoquantizzatori (= byte per codice)
+int l2_pq_get_m(const l2_pq_t *pq);
+
+int l2_pq_is_trained(const l2_pq_t *pq);
+
+// Dimenticare i codebook (es. dopo un FLUSH che resetta i centroidi IVF)
+void l2_pq_reset(l2_pq_t *pq);
+
+/**
+ * @brief Addestra i codebook con k-means per sottospazio.
+ * * @param residuals Matrice [n x dim] dei residui di addestramento.
+ * @return 0 se addestrato, -1 se n < PQ_KSUB o OOM.
+ */
+int l2_pq_train(l2_pq_t *pq, const float *residuals, size_t n);
+
+// Codifica un residuo in m byte
+void l2_pq_encode(const l2_pq_t *pq, const float *residual, uint8_t *code);
+
+// Ricostruisce (in modo approssimato) il residuo codificato
+void l2_pq_decode(const l2_pq_t *pq, const uint8_t *code, float *residual);
+
+/**
+ * @brief Tabella ADC per una query: lut[j * PQ_KSUB + k] = q_j . codebook_j[k].
+ * Con il prodotto scalare la tabella non dipende dal cluster: q.(c + r) = q.c + sum lut.
+ * lut deve contenere m * PQ_KSUB float.
+ */
+void l2_pq_build_lut(const l2_pq_t *pq, const float *query, float *lut);
+
+// Distanza asimmetrica: somma dei valori della LUT selezionati dal codice
+static inline float l2_pq_adc(const float *lut, const uint8_t *code, int m) {
+    float s0 = 0.0f, s1 = 0.0f;
+    int j = 0;
+    for (; j + 2 <= m; j += 2) {
+        s0 += lut[j * PQ_KSUB + code[j]];
+        s1 += lut[(j + 1) * PQ_KSUB + code[j + 1]];
+    }
+    if (j < m) s0 += lut[j * PQ_KSUB + code[j]];
+    return s0 + s1;
+}
+
+#endif // VECS_L2_PQ_H
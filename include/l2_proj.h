@@ -0,0 +1,50 @@
+/*
+ * Vecs Project: Header Proiezione Ridotta (prefiltro L2)
+ * (include/l2_proj.h)
+ *
+ * Proiezione dei vettori in uno spazio di poche dimensioni (64-256) per il
+ * prefiltro della cache L2: lo scan dei cluster e lo score dei centroidi
+ * leggono la copia ridotta, i migliori candidati vengono poi rivalutati sul
+ * vettore completo. Due modalità: PCA appresa sui dati (componenti principali
+ * del momento secondo) oppure prefisso del vettore, per i modelli Matryoshka
+ * in cui le prime dimensioni sono già un embedding valido.
+ */
+#ifndef VECS_L2_PROJ_H
+#define VECS_L2_PROJ_H
+
+#include <stddef.h>
+#include "l2_cache.h"
+#include "vec_kernels.h"
+
+typedef struct l2_proj_s l2_proj_t;
+
+/**
+ * @brief Crea una proiezione da dim a out_dim dimensioni.
+ * La modalità prefisso è subito utilizzabile, la PCA solo dopo l2_proj_train.
+ */
+l2_proj_t *l2_proj_create(int dim, int out_dim, l2_projection_t mode);
+
+void l2_proj_destroy(l2_proj_t *proj);
+
+int l2_proj_get_dim(const l2_proj_t *proj);
+
+int l2_proj_is_trained(const l2_proj_t *proj);
+
+// Dimenticare la PCA (es. righe non proiettabili per OOM); il prefisso resta pronto
+void l2_proj_reset(l2_proj_t *proj);
+
+const char *l2_proj_name(const l2_proj_t *proj);
+
+/**
+ * @brief PCA: calcola le prime out_dim componenti principali del campione
+ * (iterazione a sottospazio sulla matrice dei momenti secondi). No-op per il prefisso.
+ * * @param sample Matrice [n x dim] dei vettori di addestramento.
+ * @return 0 se addestrata, -1 se n < out_dim o OOM.
+ */
+int l2_proj_train(l2_proj_t *proj, const float *sample, size_t n);
+
+// Proietta v (dim float) in out (out_dim float) e normalizza: il dot tra due
+// proiezioni approssima la similarità coseno dei vettori completi
+void l2_proj_apply(const l2_proj_t *proj, const float *v, float *out);
+
+#endif // VECS_L2_PROJ_H
@@ -0,0 +1,45 @@
+/*
+ * Vecs Project: Header Value Log (tier freddo delle risposte L2)
+ * (include/l2_vlog.h)
+ *
+ * Le risposte sono di solito molto più grandi dei vettori: con il value log
+ * restano in RAM solo vettori, feature e risposte corte, mentre quelle lunghe
+ * vengono accodate in un file su disco mappato in memoria (segmenti a
+ * dimensione fissa, append-only). Le pagine vengono lette solo su HIT o dal
+ * salvataggio: la page cache del kernel fa da working set caldo, e la
+ * capacità della L2 può superare la RAM fisica.
+ *
+ * Il file è solo spazio di lavoro (il contenuto si ricostruisce dallo
+ * snapshot): viene troncato all'apertura e rimosso alla chiusura.
+ * Non thread-safe: le chiamate avvengono sotto il lock del value store (value_store.h).
+ */
+#ifndef VECS_L2_VLOG_H
+#define VECS_L2_VLOG_H
+
+#include <stddef.h>
+
+typedef struct l2_vlog_s l2_vlog_t;
+
+/**
+ * @brief Apre (o crea) il value log.
+ * * @param path File di lavoro (troncato).
+ * @param inline_max Le risposte più corte di inline_max byte restano in RAM.
+ * @return Il log, o NULL in caso di errore.
+ */
+l2_vlog_t *l2_vlog_open(const char *path, size_t inline_max);
+
+// Chiude il log e rimuove il file: i valori ancora nel log non sono più leggibili
+void l2_vlog_close(l2_vlog_t *log);
+
+/**
+ * @brief Copia una risposta: in coda al log se abbastanza lunga, altrimenti in RAM
+ * (anche con log NULL, o se il disco è pieno). Il puntatore resta valido fino a
+ * l2_vlog_release.
+ * @return La copia terminata da '\0', o NULL in caso di OOM.
+ */
+char *l2_vlog_store(l2_vlog_t *log, const char *value);
+
+// Libera un valore di l2_vlog_store (un segmento senza valori vivi torna riutilizzabile)
+void l2_vlog_release(l2_vlog_t *log, char *value);
+
+#endif // VECS_L2_VLOG_H
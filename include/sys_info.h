@@ -23,4 +23,10 @@ void sys_get_memory_info(char *buffer, size_t size);
  */
 void sys_get_gpu_info(char *buffer, size_t size);
 
+/**
+ * @brief Dimensione in byte della cache L2 (per core) della CPU.
+ * Ritorna 0 se non è possibile rilevarla.
+ */
+size_t sys_get_l2_cache_size(void);
+
 #endif // VECS_SYS_INFO_H
\ No newline at end of file
@@ -0,0 +1,38 @@
+/*
+ * Vecs Project: Header Task Pool (fork-join)
+ * (include/task_pool.h)
+ *
+ * Pool di thread per parallelizzare un singolo lavoro (es. lo scan dei cluster
+ * di una ricerca L2): il chiamante divide il lavoro in task indipendenti,
+ * tp_run li distribuisce tra i thread del pool e il chiamante stesso, e
+ * ritorna quando sono tutti completati.
+ */
+#ifndef VECS_TASK_POOL_H
+#define VECS_TASK_POOL_H
+
+typedef struct task_pool_s task_pool_t;
+
+// Esegue il task numero `task` (0..num_tasks-1) del lavoro corrente
+typedef void (*task_fn)(void *ctx, int task);
+
+/**
+ * @brief Crea il pool.
+ * * @param num_threads Thread di supporto (il chiamante di tp_run lavora anche lui).
+ * @return Il pool, o NULL se num_threads <= 0 o in caso di errore.
+ */
+task_pool_t *tp_create(int num_threads);
+
+void tp_destroy(task_pool_t *pool);
+
+// Thread che partecipano a un tp_run (pool + chiamante)
+int tp_parallelism(const task_pool_t *pool);
+
+/**
+ * @brief Esegue fn(ctx, 0..num_tasks-1) e attende la fine di tutti i task.
+ * I task vengono presi dinamicamente: conviene crearne più dei thread.
+ * Con pool NULL, o se il pool è già impegnato da un altro thread, esegue tutto
+ * nel chiamante: più thread possono chiamarla in parallelo.
+ */
+void tp_run(task_pool_t *pool, task_fn fn, void *ctx, int num_tasks);
+
+#endif // VECS_TASK_POOL_H
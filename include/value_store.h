@@ -0,0 +1,55 @@
+/*
+ * Vecs Project: Header Value Store (risposte condivise L1/L2)
+ * (include/value_store.h)
+ *
+ * Le risposte vengono internate per contenuto: un SET che finisce sia in L1
+ * sia in L2, o prompt diversi con la stessa risposta, puntano alla stessa
+ * copia con un contatore di riferimenti. I byte stanno in RAM o, se
+ * configurato, nel value log su disco (l2_vlog.h) e non cambiano mai:
+ * possono essere letti senza lock finché si tiene un riferimento.
+ */
+#ifndef VECS_VALUE_STORE_H
+#define VECS_VALUE_STORE_H
+
+#include <stddef.h>
+
+typedef struct value_store_s value_store_t;
+typedef struct vs_value_s vs_value_t;
+
+// Statistiche del value store (fotografia al momento della chiamata)
+typedef struct {
+    size_t values;           // Valori distinti conservati
+    size_t refs;             // Riferimenti totali (entry L1 + L2 che li usano)
+    size_t bytes;            // Byte conservati (una copia per valore)
+    size_t dedup_bytes;      // Byte risparmiati: copie che senza condivisione sarebbero in memoria
+} vs_stats_t;
+
+/**
+ * @brief Crea il value store.
+ * * @param log_path File del value log su disco (NULL o vuoto = tutto in RAM).
+ * @param inline_max Con il log, i valori più corti di inline_max byte restano in RAM.
+ * @return Lo store, o NULL in caso di errore (un log non apribile non è un errore: si resta in RAM).
+ */
+value_store_t *vs_create(const char *log_path, size_t inline_max);
+
+// Distrugge lo store: tutti i riferimenti devono essere già stati rilasciati
+void vs_destroy(value_store_t *store);
+
+/**
+ * @brief Restituisce il valore con questo contenuto, creandolo se non esiste,
+ * con un riferimento in più. Thread-safe.
+ * @return Il valore, o NULL in caso di OOM.
+ */
+vs_value_t *vs_intern(value_store_t *store, const char *value);
+
+// Rilascia un riferimento di vs_intern (l'ultimo libera il valore). Thread-safe
+void vs_release(value_store_t *store, vs_value_t *value);
+
+// Byte del valore terminati da '\0', validi finché si tiene il riferimento
+const char *vs_data(const vs_value_t *value);
+
+size_t vs_len(const vs_value_t *value);
+
+void vs_get_stats(value_store_t *store, vs_stats_t *stats);
+
+#endif // VECS_VALUE_STORE_H
@@ -0,0 +1,98 @@
+/*
+ * Vecs Project: Header Kernel Vettoriali (SIMD)
+ * (include/vec_kernels.h)
+ *
+ * Kernel per i loop caldi della cache L2 (dot product, aggiornamento centroidi).
+ * L'implementazione viene scelta a runtime dal CPUID (AVX-512, AVX2/FMA, NEON)
+ * con fallback scalare, e specializzata per le dimensioni di embedding comuni.
+ */
+#ifndef VECS_VEC_KERNELS_H
+#define VECS_VEC_KERNELS_H
+
+#include <stdint.h>
+
+// Prodotto scalare tra due vettori float
+typedef float (*vk_dot_fn)(const float *a, const float *b, int dim);
+
+// Prodotto scalare di a contro 4 query (q[0..3]) in un solo passaggio su a:
+// micro-kernel delle ricerche a batch (il vettore memorizzato si legge una volta)
+typedef void (*vk_dot4_fn)(const float *a, const float *const *q, float *out, int dim);
+
+// y = y * alpha + x * beta (in-place)
+typedef void (*vk_axpby_fn)(float *y, const float *x, float alpha, float beta, int dim);
+
+// y = y * s (in-place)
+typedef void (*vk_scale_fn)(float *y, float s, int dim);
+
+// Prodotto scalare intero tra due vettori quantizzati int8 (risultato esatto)
+typedef int32_t (*vk_dot_i8_fn)(const int8_t *a, const int8_t *b, int dim);
+
+// Prodotto scalare asimmetrico: query float contro codici int8 (scala esclusa)
+typedef float (*vk_dot_f32_i8_fn)(const float *a, const int8_t *b, int dim);
+
+// Prodotto scalare asimmetrico: query float contro un vettore a 16 bit (fp16 o bf16),
+// convertito in float dentro il kernel
+typedef float (*vk_dot_f32_h_fn)(const float *a, const uint16_t *b, int dim);
+
+// Distanza di Hamming tra due codici binari di `words` parole a 64 bit
+typedef int (*vk_hamming_fn)(const uint64_t *a, const uint64_t *b, int words);
+
+/**
+ * @brief Tabella dei kernel selezionati per una specifica dimensione vettoriale.
+ * Va ottenuta una volta (es. alla creazione della cache) e riusata nei loop.
+ */
+typedef struct {
+    const char *isa;      // Nome del set di istruzioni scelto (es. "avx2")
+    int specialized;      // 1 se dot è la versione srotolata per questa dim
+    vk_dot_fn dot;
+    vk_dot4_fn dot4;
+    vk_axpby_fn axpby;
+    vk_scale_fn scale;
+    const char *isa_i8;   // Kernel intero scelto (es. "avx512vnni")
+    vk_dot_i8_fn dot_i8;
+    vk_dot_f32_i8_fn dot_f32_i8;
+    vk_hamming_fn hamming;
+    const char *isa_f16;  // Conversione a mezza precisione scelta (es. "avx2+f16c")
+    vk_dot_f32_h_fn dot_f32_f16;
+    vk_dot_f32_h_fn dot_f32_bf16;
+} vec_kernels_t;
+
+/**
+ * @brief Rileva le capacità della CPU e restituisce i kernel migliori per dim.
+ * Thread-safe e idempotente (il rilevamento CPUID avviene una sola volta).
+ * * @param dim Dimensione dei vettori che verranno processati.
+ */
+void vec_kernels_select(vec_kernels_t *out, int dim);
+
+/**
+ * @brief Normalizza v a norma unitaria usando i kernel indicati.
+ * Non fa nulla se la norma è ~0.
+ */
+void vec_kernels_normalize(const vec_kernels_t *vk, float *v, int dim);
+
+/**
+ * @brief Quantizzazione simmetrica per-vettore: out[i] = round(v[i] / scale).
+ * * @return La scala (v[i] ~= out[i] * scale), 0 se il vettore è nullo.
+ */
+float vec_kernels_quantize_i8(const float *v, int8_t *out, int dim);
+
+/**
+ * @brief Codice binario a 1 bit per dimensione (bit = segno > 0).
+ * out deve contenere (dim + 63) / 64 parole; i bit di padding restano a zero.
+ */
+void vec_kernels_sign_bits(const float *v, uint64_t *out, int dim);
+
+/**
+ * @brief Conversione float32 -> fp16 IEEE (arrotondamento al pari più vicino).
+ * Range +-65504: ampiamente sufficiente per vettori normalizzati.
+ */
+void vec_kernels_to_f16(const float *v, uint16_t *out, int dim);
+
+void vec_kernels_from_f16(const uint16_t *h, float *out, int dim);
+
+// Conversione float32 -> bfloat16 (esponente di float32, 8 bit di mantissa)
+void vec_kernels_to_bf16(const float *v, uint16_t *out, int dim);
+
+void vec_kernels_from_bf16(const uint16_t *h, float *out, int dim);
+
+#endif // VECS_VEC_KERNELS_H
@@ -3,6 +3,7 @@
 
 #include "server.h"
 #include "connection.h"
+#include "buffer.h"
 
 typedef struct worker_pool_s worker_pool_t;
 
@@ -11,11 +12,12 @@ typedef enum
 {
     JOB_SET,
     JOB_QUERY,
-    JOB_DELETE
+    JOB_DELETE,
+    JOB_FLUSH      // Solo nella coda delle scritture L2 differite (nessun embedding)
 } job_type_t;
 
 // Struttura del Job (Task)
-typedef struct
+typedef struct bg_job_s
 {
     job_type_t type;
 
@@ -31,13 +33,31 @@ typedef struct
     char *key_part_2;
     char *value;
     int ttl;
+    uint64_t pending_key;  // Chiave (prompt, namespace) del SET in attesa (vedi server.c)
+    int l2_cancelled;      // DELETE o FLUSH arrivato mentre il SET era in coda: niente inserimento L2
+    struct bg_job_s *set_prev; // Lista dei SET in coda, per FLUSH (vedi server.c)
+    struct bg_job_s *set_next;
+
+    // Dati per QUERY con risposta multipla (K n / WITHSCORES)
+    int top_k;         // 0 = risposta singola (bulk string)
+    int with_scores;
 
     // Output (Calcolato dal Worker)
     float *vector_result;
     int success;
+    buffer_t *reply;   // Risposta già pronta (QUERY cercata in L2 dal worker), NULL = da completare
+
+    // Scrittura L2 differita (lock occupato dalle ricerche dei worker, vedi server.c)
+    struct bg_job_s *next;
+    uint64_t deferred_us;
 
 } bg_job_t;
 
+// Parte di sola lettura dei job, eseguita dal worker subito dopo l'embedding: le
+// QUERY riuscite vengono cercate in L2 con una sola ricerca a batch, sotto il read
+// lock della cache, e la risposta finisce in job->reply. Implementata in server.c
+void server_run_job_lookup(vecs_server_t *server, bg_job_t **jobs, int count);
+
 // Inizializza il pool
 worker_pool_t *wp_create(vecs_server_t *server, int num_workers, int max_queue_size);
 
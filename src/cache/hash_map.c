@@ -2,24 +2,46 @@
  * Vecs Project: Implementazione Hash Map (Cache L1)
  * (src/cache/hash_map.c)
  * * Implementazione semplice con separate chaining.
+ * * Ogni chiave con namespace è anche in una lista doppia del proprio namespace:
+ * svuotare un namespace costa quanto le sue chiavi, non quanto la mappa.
  */
 
 #include "hash_map.h"
 #include "logger.h"
+#include "clock.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h> // Per uint64_t
 
+#define HM_NS_INITIAL_BUCKETS 16 // Raddoppiano quando i namespace superano i bucket
+#define HM_SECTION_V1 0x01       // Snapshot senza namespace
+#define HM_SECTION_NS 0x07       // Con il namespace di ogni chiave
+#define HM_LEGACY_NS_SEP '|'     // Sezioni V1: namespace dopo l'ultimo separatore (chiavi "<prompt>|<params>")
+
 // --- Definizione Strutture Interne ---
 
+/**
+ * @brief Namespace: lista delle sue chiavi (esiste finché ne ha almeno una).
+ */
+typedef struct hm_ns_s {
+    char *name;
+    uint64_t hash;
+    struct hm_node_s *head;
+    size_t count;
+    struct hm_ns_s *next;    // Catena del bucket dei namespace
+} hm_ns_t;
+
 /**
  * @brief Nodo della linked list per la gestione delle collisioni.
  */
 struct hm_node_s {
     char *key;
-    char *value;
+    vs_value_t *value;       // Risposta internata nel value store
     time_t expire_at;
     struct hm_node_s *next;
+    hm_ns_t *ns;             // NULL = chiave senza namespace
+    struct hm_node_s *ns_prev;
+    struct hm_node_s *ns_next;
 };
 
 /**
@@ -29,6 +51,12 @@ struct hash_map_s {
     size_t capacity;
     size_t size;
     hm_node_t **buckets; // Array di puntatori a nodi
+    size_t expire_cursor; // Prossimo bucket del ciclo di scadenza attivo
+    value_store_t *values; // Store delle risposte (condiviso con la L2)
+    int owns_values;     // 1 = store privato, distrutto con la mappa
+    hm_ns_t **ns_buckets; // Namespace esistenti (allocati al primo)
+    size_t ns_capacity;
+    size_t ns_count;
 };
 
 
@@ -49,22 +77,112 @@ static uint64_t hash_djb2(const char *str) {
 }
 
 
+// --- Namespace ---
+
+static hm_ns_t *ns_find(const hash_map_t *map, const char *name, uint64_t hash) {
+    if (!map->ns_buckets) return NULL;
+    for (hm_ns_t *ns = map->ns_buckets[hash % map->ns_capacity]; ns; ns = ns->next) {
+        if (ns->hash == hash && strcmp(ns->name, name) == 0) return ns;
+    }
+    return NULL;
+}
+
+// Rialloca i bucket dei namespace (le catene vengono ridistribuite)
+static int ns_rehash(hash_map_t *map, size_t capacity) {
+    hm_ns_t **buckets = calloc(capacity, sizeof(hm_ns_t *));
+    if (!buckets) return -1;
+    for (size_t i = 0; map->ns_buckets && i < map->ns_capacity; i++) {
+        hm_ns_t *ns = map->ns_buckets[i];
+        while (ns) {
+            hm_ns_t *next = ns->next;
+            ns->next = buckets[ns->hash % capacity];
+            buckets[ns->hash % capacity] = ns;
+            ns = next;
+        }
+    }
+    free(map->ns_buckets);
+    map->ns_buckets = buckets;
+    map->ns_capacity = capacity;
+    return 0;
+}
+
+// Namespace esistente o nuovo (NULL in caso di OOM)
+static hm_ns_t *ns_get(hash_map_t *map, const char *name) {
+    uint64_t hash = hash_djb2(name);
+    hm_ns_t *ns = ns_find(map, name, hash);
+    if (ns) return ns;
+    if (!map->ns_buckets && ns_rehash(map, HM_NS_INITIAL_BUCKETS) != 0) return NULL;
+    // Oltre un namespace per bucket si raddoppia (se non c'è memoria le catene si allungano)
+    if (map->ns_count >= map->ns_capacity) ns_rehash(map, map->ns_capacity * 2);
+    ns = calloc(1, sizeof(hm_ns_t));
+    if (!ns) return NULL;
+    ns->name = strdup(name);
+    if (!ns->name) {
+        free(ns);
+        return NULL;
+    }
+    ns->hash = hash;
+    size_t index = hash % map->ns_capacity;
+    ns->next = map->ns_buckets[index];
+    map->ns_buckets[index] = ns;
+    map->ns_count++;
+    return ns;
+}
+
+// Toglie il nodo dalla lista del suo namespace (liberato se resta vuoto)
+static void ns_unlink(hash_map_t *map, hm_node_t *node) {
+    hm_ns_t *ns = node->ns;
+    if (!ns) return;
+    if (node->ns_prev) node->ns_prev->ns_next = node->ns_next;
+    else ns->head = node->ns_next;
+    if (node->ns_next) node->ns_next->ns_prev = node->ns_prev;
+    node->ns = NULL;
+    node->ns_prev = node->ns_next = NULL;
+    if (--ns->count > 0) return;
+
+    hm_ns_t **link = &map->ns_buckets[ns->hash % map->ns_capacity];
+    while (*link != ns) link = &(*link)->next;
+    *link = ns->next;
+    map->ns_count--;
+    free(ns->name);
+    free(ns);
+}
+
+// Collega il nodo al namespace (nessuna operazione se è già lì; senza memoria resta senza namespace)
+static void ns_link(hash_map_t *map, hm_node_t *node, const char *name) {
+    if (node->ns && (!name || strcmp(node->ns->name, name) != 0)) ns_unlink(map, node);
+    if (!name || node->ns) return;
+    hm_ns_t *ns = ns_get(map, name);
+    if (!ns) {
+        log_warn("hash_map: namespace '%s' non registrato (OOM), la chiave non sarà rimossa da FLUSH <params>", name);
+        return;
+    }
+    node->ns = ns;
+    node->ns_prev = NULL;
+    node->ns_next = ns->head;
+    if (ns->head) ns->head->ns_prev = node;
+    ns->head = node;
+    ns->count++;
+}
+
+
 // --- Funzioni Helper Interne ---
 
 /**
  * @brief Libera la memoria di un singolo nodo.
  */
-static void hm_node_destroy(hm_node_t *node) {
+static void hm_node_destroy(hash_map_t *map, hm_node_t *node) {
     if (!node) return;
+    ns_unlink(map, node);
     free(node->key);
-    free(node->value);
+    vs_release(map->values, node->value);
     free(node);
 }
 
 
 // --- Implementazione API Pubbliche ---
 
-hash_map_t* hash_map_create(size_t initial_capacity) {
+hash_map_t* hash_map_create(size_t initial_capacity, value_store_t *values) {
     if (initial_capacity == 0) {
         initial_capacity = 1024; // Default
     }
@@ -86,6 +204,17 @@ hash_map_t* hash_map_create(size_t initial_capacity) {
         return NULL;
     }
 
+    map->values = values;
+    if (!map->values) {
+        map->values = vs_create(NULL, 0);
+        map->owns_values = 1;
+        if (!map->values) {
+            free(map->buckets);
+            free(map);
+            return NULL;
+        }
+    }
+
     log_debug("Hash map creata con capacità %zu", initial_capacity);
     return map;
 }
@@ -97,23 +226,25 @@ void hash_map_destroy(hash_map_t *map) {
         hm_node_t *node = map->buckets[i];
         while (node) {
             hm_node_t *next = node->next;
-            hm_node_destroy(node);
+            hm_node_destroy(map, node);
             node = next;
         }
     }
     
     free(map->buckets);
+    free(map->ns_buckets); // I namespace sono stati liberati con le loro ultime chiavi
+    if (map->owns_values) vs_destroy(map->values);
     free(map);
     log_debug("Hash map distrutta.");
 }
 
-int hash_map_set(hash_map_t *map, const char *key, const char *value, int ttl_seconds) {
+int hash_map_set(hash_map_t *map, const char *key, const char *ns, const char *value, int ttl_seconds) {
     if (!map || !key || !value) return -1;
 
     uint64_t hash = hash_djb2(key);
     size_t index = hash % map->capacity;
 
-    time_t now = time(NULL);
+    time_t now = clock_now();
     time_t expire_at = now + ttl_seconds;
 
     hm_node_t *node = map->buckets[index];
@@ -123,14 +254,15 @@ int hash_map_set(hash_map_t *map, const char *key, const char *value, int ttl_se
     while (node) {
         if (strcmp(node->key, key) == 0) {
             // Trovato! Aggiorna il valore in-place.
-            char *new_value = strdup(value);
+            vs_value_t *new_value = vs_intern(map->values, value);
             if (!new_value) {
                 log_warn("hash_map_set: fallita allocazione per aggiornamento valore.");
                 return -1;
             }
-            free(node->value);
+            vs_release(map->values, node->value);
             node->value = new_value;
             node->expire_at = expire_at;
+            ns_link(map, node, ns);
             log_debug("L1 SET: Chiave '%s' aggiornata (TTL: %ds)", key, ttl_seconds);
             return 0;
         }
@@ -139,22 +271,23 @@ int hash_map_set(hash_map_t *map, const char *key, const char *value, int ttl_se
     }
 
     // 2. Chiave non trovata, crea un nuovo nodo
-    hm_node_t *new_node = malloc(sizeof(hm_node_t));
+    hm_node_t *new_node = calloc(1, sizeof(hm_node_t));
     if (!new_node) {
          log_warn("hash_map_set: fallita allocazione per nuovo nodo.");
          return -1;
     }
 
     new_node->key = strdup(key);
-    new_node->value = strdup(value);
+    new_node->value = vs_intern(map->values, value);
     new_node->expire_at = expire_at;
     new_node->next = NULL;
 
     if (!new_node->key || !new_node->value) {
         log_warn("hash_map_set: fallita allocazione per chiave/valore.");
-        hm_node_destroy(new_node); // Libera tutto
+        hm_node_destroy(map, new_node); // Libera tutto
         return -1;
     }
+    ns_link(map, new_node, ns);
     
     // 3. Aggiungi il nodo alla lista (head o tail)
     if (prev == NULL) {
@@ -178,7 +311,7 @@ const char* hash_map_get(hash_map_t *map, const char *key) {
 
     uint64_t hash = hash_djb2(key);
     size_t index = hash % map->capacity;
-    time_t now = time(NULL);
+    time_t now = clock_now();
 
     hm_node_t *node = map->buckets[index];
     hm_node_t *prev = NULL;
@@ -195,12 +328,12 @@ const char* hash_map_get(hash_map_t *map, const char *key) {
                 if (prev == NULL) map->buckets[index] = node->next;
                 else prev->next = node->next;
 
-                hm_node_destroy(node);
+                hm_node_destroy(map, node);
                 map->size--;
                 return NULL; // Tratta come MISS
             }
             // Trovato!
-            return node->value;
+            return vs_data(node->value);
         }
         prev = node;
         node = node->next;
@@ -229,7 +362,7 @@ void hash_map_delete(hash_map_t *map, const char *key) {
                 // Era in mezzo o in coda
                 prev->next = node->next;
             }
-            hm_node_destroy(node);
+            hm_node_destroy(map, node);
             map->size--;
             log_debug("Hash map: chiave '%s' rimossa.", key);
             return;
@@ -240,6 +373,59 @@ void hash_map_delete(hash_map_t *map, const char *key) {
     // Chiave non trovata, non fa nulla
 }
 
+// Toglie il nodo dalla catena del suo bucket
+static void bucket_unlink(hash_map_t *map, hm_node_t *node) {
+    hm_node_t **link = &map->buckets[hash_djb2(node->key) % map->capacity];
+    while (*link != node) link = &(*link)->next;
+    *link = node->next;
+}
+
+size_t hash_map_delete_namespace(hash_map_t *map, const char *ns) {
+    if (!map || !ns) return 0;
+    hm_ns_t *group = ns_find(map, ns, hash_djb2(ns));
+    if (!group) return 0;
+    // L'ultimo nodo libera anche il namespace: il conteggio si legge prima
+    size_t removed = group->count;
+    for (size_t i = 0; i < removed; i++) {
+        hm_node_t *node = group->head;
+        bucket_unlink(map, node);
+        hm_node_destroy(map, node);
+        map->size--;
+    }
+    return removed;
+}
+
+size_t hash_map_expire_cycle(hash_map_t *map, size_t max_buckets, size_t *examined) {
+    size_t removed = 0, seen = 0;
+    if (!map) {
+        if (examined) *examined = 0;
+        return 0;
+    }
+    time_t now = clock_now();
+    if (max_buckets > map->capacity) max_buckets = map->capacity;
+
+    for (size_t b = 0; b < max_buckets; b++) {
+        size_t index = map->expire_cursor;
+        map->expire_cursor = (map->expire_cursor + 1) % map->capacity;
+
+        hm_node_t **link = &map->buckets[index];
+        while (*link) {
+            hm_node_t *node = *link;
+            seen++;
+            if (now > node->expire_at) {
+                *link = node->next;
+                hm_node_destroy(map, node);
+                map->size--;
+                removed++;
+            } else {
+                link = &node->next;
+            }
+        }
+    }
+    if (examined) *examined = seen;
+    return removed;
+}
+
 void hash_map_clear(hash_map_t *map) {
     if (!map) return;
 
@@ -247,12 +433,12 @@ void hash_map_clear(hash_map_t *map) {
         hm_node_t *node = map->buckets[i];
         while (node) {
             hm_node_t *next = node->next;
-            hm_node_destroy(node);
+            hm_node_destroy(map, node);
             node = next;
         }
         map->buckets[i] = NULL;
     }
-    map->size = 0;
+    map->size = 0; // Anche i namespace sono stati liberati con le loro chiavi
     log_debug("L1 Cache svuotata.");
 }
 
@@ -260,13 +446,13 @@ int hash_map_save(hash_map_t *map, FILE *f) {
     if (!map || !f) return -1;
     
     int count = 0;
-    time_t now = time(NULL);
+    time_t now = clock_now();
 
     // Scriviamo un header per la sezione L1 (numero di elementi stimato o placeholder)
     // Per semplicità, iteriamo e scriviamo sequenzialmente.
     
     // Marcatore inizio sezione L1
-    uint8_t section_id = 0x01; 
+    uint8_t section_id = HM_SECTION_NS;
     fwrite(&section_id, sizeof(uint8_t), 1, f);
 
     for (size_t i = 0; i < map->capacity; i++) {
@@ -275,12 +461,15 @@ int hash_map_save(hash_map_t *map, FILE *f) {
             // Salva solo se non è già scaduto
             if (node->expire_at > now) {
                 int key_len = strlen(node->key);
-                int val_len = strlen(node->value);
+                int val_len = (int)vs_len(node->value);
 
                 fwrite(&key_len, sizeof(int), 1, f);
                 fwrite(node->key, sizeof(char), key_len, f);
+                int ns_len = node->ns ? (int)strlen(node->ns->name) : -1; // -1 = nessun namespace
+                fwrite(&ns_len, sizeof(int), 1, f);
+                if (ns_len > 0) fwrite(node->ns->name, sizeof(char), ns_len, f);
                 fwrite(&val_len, sizeof(int), 1, f);
-                fwrite(node->value, sizeof(char), val_len, f);
+                fwrite(vs_data(node->value), sizeof(char), val_len, f);
                 fwrite(&node->expire_at, sizeof(time_t), 1, f);
                 count++;
             }
@@ -299,13 +488,14 @@ int hash_map_save(hash_map_t *map, FILE *f) {
 
 int hash_map_load(hash_map_t *map, FILE *f) {
     uint8_t section_id;
-    if (fread(&section_id, sizeof(uint8_t), 1, f) != 1 || section_id != 0x01) {
+    if (fread(&section_id, sizeof(uint8_t), 1, f) != 1 ||
+        (section_id != HM_SECTION_V1 && section_id != HM_SECTION_NS)) {
         log_error("Formato file corrotto (L1 header missing)");
         return -1;
     }
 
     int loaded_count = 0;
-    time_t now = time(NULL);
+    time_t now = clock_now();
 
     while (1) {
         int key_len;
@@ -317,6 +507,20 @@ int hash_map_load(hash_map_t *map, FILE *f) {
         fread(key, sizeof(char), key_len, f);
         key[key_len] = '\0';
 
+        char *ns = NULL;
+        if (section_id == HM_SECTION_NS) {
+            int ns_len;
+            fread(&ns_len, sizeof(int), 1, f);
+            if (ns_len >= 0) {
+                ns = malloc(ns_len + 1);
+                fread(ns, sizeof(char), ns_len, f);
+                ns[ns_len] = '\0';
+            }
+        } else {
+            const char *sep = strrchr(key, HM_LEGACY_NS_SEP);
+            if (sep) ns = strdup(sep + 1);
+        }
+
         int val_len;
         fread(&val_len, sizeof(int), 1, f);
         char *val = malloc(val_len + 1);
@@ -330,11 +534,12 @@ int hash_map_load(hash_map_t *map, FILE *f) {
         if (expire_at > now) {
             // Calcoliamo il TTL rimanente
             int ttl = (int)(expire_at - now);
-            hash_map_set(map, key, val, ttl);
+            hash_map_set(map, key, ns, val, ttl);
             loaded_count++;
         }
 
         free(key);
+        free(ns);
         free(val);
     }
     
@@ -1,424 +1,843 @@
 /*
- * Vecs Project: IVFFlat Adaptive Cache (L2)
+ * Vecs Project: Semantic Cache (L2)
  * (src/cache/l2_cache.c)
+ *
+ * Facciata comune: delega all'indice configurato (IVF o HNSW) e gestisce
+ * le parti indipendenti dal backend (snapshot su disco, filtri ibridi,
+ * shortcut e fusione con lo score BM25 dell'indice lessicale).
+ *
+ * Concorrenza: le ricerche girano in parallelo sotto il read lock (preso dal
+ * chiamante con l2_cache_read_lock, perché i risultati puntano dentro l'indice);
+ * le modifiche prendono il write lock qui. Nessuna memoria viene quindi liberata
+ * (swap-remove, scadenza, eviction) mentre un lettore la sta usando.
+ * Il loop eventi non deve restare fermo dietro le ricerche dei worker: manutenzione
+ * e scadenza provano il lock senza attendere (si riprova al giro dopo), e le
+ * modifiche puntuali con wait = 0 ritornano L2_BUSY invece di bloccarsi.
  */
 
 #include "l2_cache.h"
+#include "l2_index.h"
+#include "l2_lex.h"
+#include "l2_keys.h"
 #include "logger.h"
+#include "clock.h"
+#include "vec_kernels.h"
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
-#include <ctype.h>
-#include <time.h>
 #include <stdint.h>
-#include <float.h>
+#include <pthread.h>
 
-// --- COSTANTI DI TUNING ---
-#define NUM_CLUSTERS 64      // Numero di "secchi"
-#define N_PROBE 4            // Quanti secchi controllare durante la ricerca (Precisione vs Velocità)
-#define ADAPT_RATE 0.1f      // Quanto velocemente i centroidi si adattano ai nuovi dati (0.1 = 10%)
+#define LEXICAL_POOL_FACTOR 4   // Fusione BM25: candidati vettoriali rivalutati per risultato richiesto
+#define LEXICAL_POOL_MIN 16
+#define LEXICAL_MAX_WEIGHT 0.9f // Oltre, la threshold vettoriale dello scan non avrebbe più senso
 
-// Struttura di una singola entry (come prima)
+// Partizione (namespace): indice, capacità e statistiche proprie
 typedef struct {
-    float* vector;
-    char* original_prompt;
-    char* response;
-    time_t expire_at;
-} l2_entry_t;
+    char *name;
+    uint64_t hash;
+    void *index;
+    _Atomic uint64_t searches; // Aggiornati dalle ricerche concorrenti (sotto il read lock)
+    _Atomic uint64_t hits;
+    uint64_t inserts;
+} l2_partition_t;
 
-// Struttura del Cluster (Bucket)
-typedef struct {
-    float *centroid;         // Il vettore "media" di questo cluster
-    l2_entry_t *entries;     // Array dinamico di entry
-    size_t size;
-    size_t capacity;
-    int is_initialized;      // 0 se il centroide è vuoto/random, 1 se ha dati reali
-} l2_cluster_t;
-
-// Struttura principale Cache
 struct l2_cache_s {
-    l2_cluster_t clusters[NUM_CLUSTERS];
+    const l2_index_ops_t *ops;
+    l2_config_t config;      // Configurazione degli indici delle nuove partizioni
+    l2_shared_t shared;      // Value store e pool dello scan, comuni a tutte le partizioni
+    l2_partition_t **parts;  // Modificato solo sotto il write lock
+    int num_parts;
+    int max_parts;           // 1 = cache non partizionata (un solo indice, namespace ignorato)
+    size_t entries;          // Entry di tutte le partizioni (budget max_capacity condiviso), sotto il write lock
+    int maintenance_cursor;  // Prossima partizione della manutenzione a turno
+    int expire_cursor;       // Prossima partizione del ciclo di scadenza
+    uint64_t partition_rejects; // Inserimenti rifiutati per il limite di partizioni (sotto il write lock)
     int vector_dim;
-    size_t total_count;      // Numero totale di elementi in tutti i cluster
-    size_t max_global_capacity;
+    int drop_prompts;
+    l2_storage_t snapshot_storage; // Codifica dei vettori nello snapshot (f32, o la forma a 16 bit dell'indice)
+    keyword_filter_t *keywords; // Dizionario dei filtri ibridi compilato (Aho-Corasick)
+    int owns_values;
+    pthread_rwlock_t lock;   // Lettori: ricerche e salvataggio. Scrittori: tutto il resto
 };
 
-// --- HELPER MATH ---
+// Write lock: con wait = 0 solo se libero subito (nessuna attesa dei lettori, e i
+// nuovi lettori non vengono fermati come da un writer in coda)
+static int write_lock(l2_cache_t *cache, int wait) {
+    if (wait) return pthread_rwlock_wrlock(&cache->lock);
+    return pthread_rwlock_trywrlock(&cache->lock);
+}
 
-// Prodotto scalare (Dot Product) ottimizzato
-static float vec_dot(const float *a, const float *b, int dim) {
-    float res = 0.0f;
-    for (int i = 0; i < dim; i++) {
-        res += a[i] * b[i];
-    }
-    return res;
+static void lock_init(pthread_rwlock_t *lock) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#if defined(__GLIBC__)
+    // Con un flusso continuo di ricerche il default di glibc lascerebbe a digiuno
+    // il thread principale (inserimenti, scadenza, manutenzione)
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
 }
 
-// Aggiorna il centroide (Media mobile esponenziale semplificata)
-// centroid = centroid * (1 - rate) + new_vec * rate
-static void update_centroid(float *centroid, const float *new_vec, int dim) {
-    for (int i = 0; i < dim; i++) {
-        centroid[i] = centroid[i] * (1.0f - ADAPT_RATE) + new_vec[i] * ADAPT_RATE;
-    }
-    // Rinormalizzazione (importante per cosine similarity)
-    float norm = 0.0f;
-    for (int i = 0; i < dim; i++) norm += centroid[i] * centroid[i];
-    norm = sqrtf(norm);
-    if (norm > 1e-9) {
-        for (int i = 0; i < dim; i++) centroid[i] /= norm;
+// --- FILTRI IBRIDI ---
+
+// Dizionario predefinito: negazioni in italiano, inglese, spagnolo, francese, tedesco, portoghese
+static const char *DEFAULT_FILTER_DICT =
+    "negation: non, no, mai, niente, nulla, nessuno, nessuna, senza\n"
+    "negation: not, never, nothing, nobody, none, without, cannot, can't, don't, doesn't, didn't,"
+    " isn't, aren't, wasn't, won't, shouldn't, wouldn't\n"
+    "negation: nunca, nada, nadie, jamás\n"
+    "negation: pas, jamais, rien, sans\n"
+    "negation: nicht, kein, keine, keinen, keiner, nie, niemals, ohne\n"
+    "negation: não\n";
+
+// Compila il dizionario da file o quello predefinito
+static keyword_filter_t *filter_dict_load(const char *path) {
+    keyword_filter_t *kwf = kwf_create();
+    if (!kwf) return NULL;
+    int added = (path && path[0]) ? kwf_load_file(kwf, path) : kwf_load_string(kwf, DEFAULT_FILTER_DICT);
+    if (added < 0 || kwf_compile(kwf) != 0) {
+        kwf_destroy(kwf);
+        return NULL;
     }
+    log_info("L2 Filtri: dizionario %s, %d parole chiave in %d feature",
+             (path && path[0]) ? path : "predefinito", added, kwf_feature_count(kwf));
+    return kwf;
 }
 
-// --- API ---
+void l2_text_filter_init(l2_text_filter_t *filter, const keyword_filter_t *kwf, const char *text) {
+    size_t len = 0;
+    filter->features = text ? kwf_match(kwf, text, &len) : 0;
+    filter->len = len < UINT32_MAX ? (uint32_t)len : UINT32_MAX;
+}
 
-l2_cache_t* l2_cache_create(int vector_dim, size_t max_capacity) {
-    l2_cache_t* cache = calloc(1, sizeof(l2_cache_t));
-    if (!cache) return NULL;
+// --- EVICTION ---
 
-    cache->vector_dim = vector_dim;
-    cache->max_global_capacity = max_capacity;
-    cache->total_count = 0;
+// Contatore LFU invecchiato: metà del valore per ogni periodo di decay senza accessi
+static uint32_t usage_decayed_hits(const l2_usage_t *usage, uint32_t clock, uint32_t decay) {
+    uint32_t last = atomic_load_explicit(&usage->last_access, memory_order_relaxed);
+    uint32_t periods = (clock - last) / (decay ? decay : 1);
+    return periods >= 32 ? 0 : atomic_load_explicit(&usage->hits, memory_order_relaxed) >> periods;
+}
 
-    // Inizializza i cluster
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        cache->clusters[i].centroid = calloc(vector_dim, sizeof(float));
-        // Capacità iniziale piccola per bucket (es. max / clusters * 1.5 buffer)
-        size_t bucket_cap = (max_capacity / NUM_CLUSTERS) + 16;
-        cache->clusters[i].entries = calloc(bucket_cap, sizeof(l2_entry_t));
-        cache->clusters[i].capacity = bucket_cap;
-        cache->clusters[i].size = 0;
-        cache->clusters[i].is_initialized = 0;
-    }
+void l2_usage_touch(l2_usage_t *usage, uint32_t clock, uint32_t decay) {
+    uint32_t hits = usage_decayed_hits(usage, clock, decay);
+    atomic_store_explicit(&usage->hits, hits < UINT32_MAX ? hits + 1 : hits, memory_order_relaxed);
+    atomic_store_explicit(&usage->last_access, clock, memory_order_relaxed);
+}
 
-    log_info("L2 Cache IVFFlat creata: %d Clusters, Dim %d", NUM_CLUSTERS, vector_dim);
-    return cache;
+double l2_eviction_rank(l2_eviction_t policy, const l2_usage_t *usage, time_t expire_at,
+                        uint32_t clock, uint32_t decay) {
+    // Inattività in tick (differenza modulo 2^32: corretta anche dopo il wrap-around del clock)
+    double idle = (double)(uint32_t)(clock - atomic_load_explicit(&usage->last_access, memory_order_relaxed));
+    switch (policy) {
+        case L2_EVICT_LFU:
+            // A parità di contatore vince la più recente (frazione in [0, 1))
+            return (double)usage_decayed_hits(usage, clock, decay) + 1.0 - idle / 4294967296.0;
+        case L2_EVICT_TTL:
+            return (double)expire_at;
+        default:
+            return -idle;
+    }
 }
 
-void l2_cache_destroy(l2_cache_t* cache) {
-    if (!cache) return;
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        for (size_t j = 0; j < cache->clusters[i].size; j++) {
-            free(cache->clusters[i].entries[j].vector);
-            free(cache->clusters[i].entries[j].original_prompt);
-            free(cache->clusters[i].entries[j].response);
-        }
-        free(cache->clusters[i].entries);
-        free(cache->clusters[i].centroid);
+const char *l2_eviction_name(l2_eviction_t policy) {
+    switch (policy) {
+        case L2_EVICT_LRU: return "lru";
+        case L2_EVICT_LFU: return "lfu";
+        case L2_EVICT_TTL: return "ttl";
+        default: return "none";
     }
-    free(cache);
 }
 
-// Inserimento "Intelligente"
-int l2_cache_insert(l2_cache_t* cache, const float* vector, const char* prompt_text, const char* response, int ttl_seconds) {
-    if (cache->total_count >= cache->max_global_capacity) {
-        // Policy semplificata: se pieno, rifiuta (per ora, o implementa LRU globale)
-        // log_warn("L2 Cache Piena (Max: %zu)", cache->max_global_capacity);
-        return -1; 
+// --- PARTIZIONI ---
+
+static uint64_t ns_hash(const char *ns) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char *)ns; *c; c++) {
+        hash ^= *c;
+        hash *= 0x100000001b3ULL;
     }
+    return hash;
+}
 
-    // 1. Trova il cluster migliore (Nearest Centroid)
-    int best_cluster_idx = -1;
-    float best_score = -2.0f; // Cosine va da -1 a 1
+// Partizione del namespace (NULL se non esiste). Le partizioni sono poche: scansione lineare
+static l2_partition_t *partition_find(const l2_cache_t *cache, const char *ns) {
+    if (cache->max_parts <= 1) return cache->num_parts > 0 ? cache->parts[0] : NULL;
+    if (!ns) ns = "";
+    uint64_t hash = ns_hash(ns);
+    for (int i = 0; i < cache->num_parts; i++) {
+        l2_partition_t *part = cache->parts[i];
+        if (part->hash == hash && strcmp(part->name, ns) == 0) return part;
+    }
+    return NULL;
+}
 
-    // Se ci sono cluster non inizializzati, usiamoli per bootstrappare
-    // Questo distribuisce i primi vettori uno per cluster.
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        if (!cache->clusters[i].is_initialized) {
-            best_cluster_idx = i;
-            break;
-        }
+// Crea la partizione del namespace (sotto il write lock, o durante la creazione della cache)
+static l2_partition_t *partition_create(l2_cache_t *cache, const char *ns) {
+    if (!ns || cache->max_parts <= 1) ns = "";
+    if (cache->num_parts >= cache->max_parts) {
+        cache->partition_rejects++;
+        log_warn("L2: limite di %d partizioni raggiunto, inserimento nel namespace '%s' rifiutato (%llu rifiuti)",
+                 cache->max_parts, ns, (unsigned long long)cache->partition_rejects);
+        return NULL;
+    }
+    l2_partition_t *part = calloc(1, sizeof(l2_partition_t));
+    if (!part) return NULL;
+    part->name = strdup(ns);
+    part->hash = ns_hash(ns);
+    part->index = part->name ? cache->ops->create(&cache->config, &cache->shared) : NULL;
+    if (!part->index) {
+        log_error("L2: creazione indice '%s' fallita", cache->ops->name);
+        free(part->name);
+        free(part);
+        return NULL;
+    }
+    cache->parts[cache->num_parts++] = part;
+    if (cache->max_parts > 1) {
+        log_info("L2: nuova partizione '%s' (%d/%d)", ns, cache->num_parts, cache->max_parts);
     }
+    return part;
+}
 
-    // Se tutti inizializzati, cerca il più simile
-    if (best_cluster_idx == -1) {
-        for (int i = 0; i < NUM_CLUSTERS; i++) {
-            float score = vec_dot(cache->clusters[i].centroid, vector, cache->vector_dim);
-            if (score > best_score) {
-                best_score = score;
-                best_cluster_idx = i;
-            }
+// Riallinea il totale delle entry dopo una modifica della partizione (before = count prima):
+// inserimenti, cancellazioni, eviction e scadenze costano O(1) invece di O(partizioni)
+static void entries_update(l2_cache_t *cache, const l2_partition_t *part, size_t before) {
+    cache->entries = cache->entries - before + cache->ops->count(part->index);
+}
+
+// Budget superato: si libera un posto nella partizione più grande, secondo la policy.
+// Un namespace rumoroso diventa il più grande e ricicla le proprie entry prima di quelle degli altri
+static void partition_evict_largest(l2_cache_t *cache) {
+    l2_partition_t *victim = NULL;
+    size_t largest = 0;
+    for (int i = 0; i < cache->num_parts; i++) {
+        size_t count = cache->ops->count(cache->parts[i]->index);
+        if (count > largest) {
+            largest = count;
+            victim = cache->parts[i];
         }
     }
+    if (victim) {
+        cache->ops->evict(victim->index);
+        entries_update(cache, victim, largest);
+    }
+}
 
-    l2_cluster_t *cluster = &cache->clusters[best_cluster_idx];
+static void partition_destroy(l2_cache_t *cache, l2_partition_t *part) {
+    cache->ops->destroy(part->index);
+    free(part->name);
+    free(part);
+}
 
-    // 2. Controllo spazio nel cluster (resize se necessario)
-    if (cluster->size >= cluster->capacity) {
-        size_t new_cap = cluster->capacity * 2;
-        l2_entry_t *new_entries = realloc(cluster->entries, new_cap * sizeof(l2_entry_t));
-        if (!new_entries) return -1;
-        cluster->entries = new_entries;
-        cluster->capacity = new_cap;
+// Toglie la partizione i (swap-remove) e la distrugge
+static void partition_remove(l2_cache_t *cache, int i) {
+    partition_destroy(cache, cache->parts[i]);
+    cache->parts[i] = cache->parts[--cache->num_parts];
+}
+
+// --- API ---
+
+l2_cache_t *l2_cache_create(const l2_config_t *config) {
+    l2_cache_t *cache = calloc(1, sizeof(l2_cache_t));
+    if (!cache) return NULL;
+
+    cache->ops = (config->index == L2_INDEX_HNSW) ? &l2_hnsw_ops : &l2_ivf_ops;
+    cache->config = *config;
+    cache->max_parts = config->max_partitions > 1 ? config->max_partitions : 1;
+    cache->vector_dim = config->vector_dim;
+    cache->drop_prompts = config->drop_prompts;
+    if (config->lexical && config->drop_prompts) {
+        // La fusione rilegge il testo dei candidati: senza prompt non c'è nulla da indicizzare
+        log_warn("L2: l'indice lessicale richiede i prompt conservati (VECS_L2_STORE_PROMPTS=1), disattivato");
+        cache->config.lexical = 0;
+    }
+    if (cache->config.lexical_weight < 0.0f) cache->config.lexical_weight = 0.0f;
+    if (cache->config.lexical_weight > LEXICAL_MAX_WEIGHT) cache->config.lexical_weight = LEXICAL_MAX_WEIGHT;
+    // Le righe a 16 bit si salvano come sono: nessuna perdita e metà spazio su disco
+    // (HNSW conserva sempre float32)
+    int half = config->storage == L2_STORAGE_F16 || config->storage == L2_STORAGE_BF16;
+    cache->snapshot_storage = (half && config->index != L2_INDEX_HNSW) ? config->storage : L2_STORAGE_F32;
+    cache->parts = calloc(cache->max_parts, sizeof(l2_partition_t *));
+    cache->keywords = filter_dict_load(config->filter_dict);
+    if (!cache->parts || !cache->keywords) {
+        log_error("L2: dizionario dei filtri non valido o memoria esaurita");
+        kwf_destroy(cache->keywords);
+        free(cache->parts);
+        free(cache);
+        return NULL;
+    }
+    cache->shared.values = config->values;
+    if (!cache->shared.values) {
+        cache->shared.values = vs_create(NULL, 0);
+        cache->owns_values = 1;
+    }
+    // Un solo pool per tutte le partizioni: tp_run lo cede a una ricerca alla volta
+    if (config->search_threads > 1 && config->index != L2_INDEX_HNSW) {
+        cache->shared.search_pool = tp_create(config->search_threads - 1);
+        if (!cache->shared.search_pool) log_warn("L2 IVF: thread dello scan parallelo non disponibili, ricerca seriale");
     }
+    // Senza partizioni l'unico indice esiste da subito; con le partizioni nasce al primo inserimento
+    if (!cache->shared.values || (cache->max_parts <= 1 && !partition_create(cache, NULL))) {
+        tp_destroy(cache->shared.search_pool);
+        if (cache->owns_values) vs_destroy(cache->shared.values);
+        kwf_destroy(cache->keywords);
+        free(cache->parts);
+        free(cache);
+        return NULL;
+    }
+    if (cache->max_parts > 1) {
+        log_info("L2 Partizioni: un indice '%s' per namespace (max %d, %zu entry in tutto)",
+                 cache->ops->name, cache->max_parts, config->max_capacity);
+    }
+    if (cache->config.lexical) {
+        log_info("L2 Lessicale: BM25 sui prompt, peso %.2f nella fusione, shortcut oltre %.2f",
+                 cache->config.lexical_weight, cache->config.lexical_shortcut);
+    }
+    lock_init(&cache->lock);
+    return cache;
+}
 
-    // 3. Inserimento effettivo
-    l2_entry_t *entry = &cluster->entries[cluster->size];
-    entry->vector = malloc(cache->vector_dim * sizeof(float));
-    memcpy(entry->vector, vector, cache->vector_dim * sizeof(float));
-    entry->original_prompt = strdup(prompt_text);
-    entry->response = strdup(response);
-    entry->expire_at = time(NULL) + ttl_seconds;
+void l2_cache_destroy(l2_cache_t *cache) {
+    if (!cache) return;
+    while (cache->num_parts > 0) partition_remove(cache, cache->num_parts - 1);
+    free(cache->parts);
+    tp_destroy(cache->shared.search_pool);
+    if (cache->owns_values) vs_destroy(cache->shared.values);
+    kwf_destroy(cache->keywords);
+    pthread_rwlock_destroy(&cache->lock);
+    free(cache);
+}
+
+void l2_cache_read_lock(l2_cache_t *cache) {
+    pthread_rwlock_rdlock(&cache->lock);
+}
 
-    cluster->size++;
-    cache->total_count++;
+void l2_cache_read_unlock(l2_cache_t *cache) {
+    pthread_rwlock_unlock(&cache->lock);
+}
 
-    // 4. Aggiorna il centroide (Learning)
-    if (!cluster->is_initialized) {
-        // Primo elemento: il centroide diventa il vettore stesso
-        memcpy(cluster->centroid, vector, cache->vector_dim * sizeof(float));
-        cluster->is_initialized = 1;
+static int partition_search(l2_cache_t *cache, l2_partition_t *part, const float *query_vector,
+                            const char *query_text, const l2_text_filter_t *filter, float threshold,
+                            l2_search_result_t *results, int k, int record_hits);
+
+// Le feature dei filtri e la chiave del prompt si calcolano qui, una volta sola
+// (o arrivano dallo snapshot); il backend conserva il prompt solo se richiesto dalla configurazione.
+// Con dedupe_threshold <= 1 l'entry si inserisce solo se nella partizione non c'è già
+// un duplicato: in un passaggio se il backend lo supporta, altrimenti ricerca + inserimento,
+// sempre sotto lo stesso write lock. Il duplicato resta com'è: niente HIT per l'eviction
+// e scadenza invariata (il nuovo TTL vale solo per la L1)
+static l2_upsert_t upsert_with_features(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt,
+                                        uint64_t key, const l2_text_filter_t *features, const char *response,
+                                        time_t expire_at, float dedupe_threshold, int wait) {
+    l2_text_filter_t computed;
+    if (!features) {
+        l2_text_filter_init(&computed, cache->keywords, prompt);
+        features = &computed;
+    }
+    if (key == L2_KEY_NONE) key = l2_keys_hash(prompt);
+    const char *stored_prompt = cache->drop_prompts ? NULL : prompt;
+    int dedupe = dedupe_threshold <= 1.0f;
+    if (write_lock(cache, wait) != 0) return L2_UPSERT_BUSY;
+    l2_partition_t *part = partition_find(cache, ns);
+    l2_upsert_t ret = L2_UPSERT_REJECTED;
+    // Partizioni: ogni indice arriva al più a max_capacity, ma il budget è di tutte insieme.
+    // Senza eviction, a budget esaurito resta solo da riconoscere un duplicato
+    int full = cache->max_parts > 1 && cache->config.eviction == L2_EVICT_NONE &&
+               cache->entries >= cache->config.max_capacity;
+    size_t before = part ? cache->ops->count(part->index) : 0;
+    if (full) {
+        l2_search_result_t existing;
+        if (part && dedupe && partition_search(cache, part, vector, prompt, features, dedupe_threshold, &existing, 1, 0) > 0) {
+            ret = L2_UPSERT_DEDUPED;
+        }
+    } else if (part && dedupe && cache->ops->upsert && !cache->config.lexical) {
+        ret = cache->ops->upsert(part->index, vector, stored_prompt, key, features, response, expire_at,
+                                 dedupe_threshold);
     } else {
-        // Elementi successivi: sposta il centroide verso il nuovo punto
-        update_centroid(cluster->centroid, vector, cache->vector_dim);
+        l2_search_result_t existing;
+        // Partizione ancora assente: nessun duplicato possibile
+        if (part && dedupe && partition_search(cache, part, vector, prompt, features, dedupe_threshold, &existing, 1, 0) > 0) {
+            ret = L2_UPSERT_DEDUPED;
+        } else {
+            if (!part) part = partition_create(cache, ns);
+            if (part && cache->ops->insert(part->index, vector, stored_prompt, key, features, response, expire_at) == 0) {
+                ret = L2_UPSERT_INSERTED;
+            }
+        }
     }
+    if (ret == L2_UPSERT_INSERTED) {
+        part->inserts++;
+        // Il backend può aver fatto spazio da sé (eviction interna): si rilegge il count
+        entries_update(cache, part, before);
+        if (cache->max_parts > 1 && cache->entries > cache->config.max_capacity) {
+            partition_evict_largest(cache);
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    return ret;
+}
 
-    return 0;
+// Threshold irraggiungibile: inserimento senza deduplica
+#define NO_DEDUPE 2.0f
+
+static int insert_with_features(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt,
+                                uint64_t key, const l2_text_filter_t *features, const char *response,
+                                time_t expire_at) {
+    return upsert_with_features(cache, ns, vector, prompt, key, features, response, expire_at, NO_DEDUPE, 1)
+        == L2_UPSERT_INSERTED ? 0 : -1;
 }
 
-// Helper per gestire negazioni e lunghezza (dal codice precedente)
-static int has_negation(const char* text) {
-    char buffer[1024];
-    strncpy(buffer, text, 1023);
-    for(int i=0; buffer[i]; i++) buffer[i] = tolower(buffer[i]);
-    if (strstr(buffer, " non ") || strstr(buffer, " no ") || strstr(buffer, " not ") || strstr(buffer, " mai ")) return 1;
-    return 0;
+int l2_cache_insert(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt_text,
+                    const char *response, int ttl_seconds) {
+    return insert_with_features(cache, ns, vector, prompt_text, L2_KEY_NONE, NULL, response,
+                                clock_now() + ttl_seconds);
 }
 
-// Struttura helper per ordinare i cluster durante la ricerca
-typedef struct {
-    int index;
-    float score;
-} cluster_score_t;
+l2_upsert_t l2_cache_upsert(l2_cache_t *cache, const char *ns, const float *vector, const char *prompt_text,
+                            const char *response, int ttl_seconds, float dedupe_threshold, int wait) {
+    return upsert_with_features(cache, ns, vector, prompt_text, L2_KEY_NONE, NULL, response,
+                                clock_now() + ttl_seconds, dedupe_threshold, wait);
+}
 
-int compare_clusters(const void *a, const void *b) {
-    float score_a = ((cluster_score_t*)a)->score;
-    float score_b = ((cluster_score_t*)b)->score;
-    // Ordinamento decrescente (score più alto prima)
-    return (score_b > score_a) - (score_b < score_a);
+const char *l2_cache_search(l2_cache_t *cache, const char *ns, const float *query_vector, const char *query_text,
+                            float threshold) {
+    l2_search_result_t best;
+    return l2_cache_search_topk(cache, ns, query_vector, query_text, threshold, &best, 1) > 0 ? best.response : NULL;
 }
 
-const char* l2_cache_search(l2_cache_t* cache, const float* query_vector, const char* query_text, float threshold) {
-    if (cache->total_count == 0) return NULL;
+static void partition_count_search(l2_partition_t *part, int found) {
+    atomic_fetch_add_explicit(&part->searches, 1, memory_order_relaxed);
+    if (found > 0) atomic_fetch_add_explicit(&part->hits, 1, memory_order_relaxed);
+}
 
-    // 1. Fase "Coarse Search": Trova i bucket candidati
-    cluster_score_t candidates[NUM_CLUSTERS];
-    int active_clusters = 0;
+// Ricerca in una partizione. Con l'indice lessicale: prima lo shortcut sui match
+// BM25 quasi identici (nessuno scan vettoriale), poi lo score fuso
+// (1 - w) * vettoriale + w * BM25 sui candidati dello scan
+static int partition_search(l2_cache_t *cache, l2_partition_t *part, const float *query_vector,
+                            const char *query_text, const l2_text_filter_t *filter, float threshold,
+                            l2_search_result_t *results, int k, int record_hits) {
+    const l2_lex_t *lex = cache->ops->lexicon ? cache->ops->lexicon(part->index) : NULL;
+    l2_lex_query_t query;
+    if (!lex || l2_lex_query_init(lex, &query, query_text) == 0) {
+        return cache->ops->search(part->index, query_vector, filter, threshold, results, k, record_hits);
+    }
 
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        if (cache->clusters[i].is_initialized && cache->clusters[i].size > 0) {
-            candidates[active_clusters].index = i;
-            candidates[active_clusters].score = vec_dot(cache->clusters[i].centroid, query_vector, cache->vector_dim);
-            active_clusters++;
+    // Lo shortcut non scende mai sotto la threshold della chiamata (es. quella della deduplica)
+    float shortcut = cache->config.lexical_shortcut > threshold ? cache->config.lexical_shortcut : threshold;
+    int found = shortcut <= 1.0f ? l2_lex_search(lex, &query, filter, shortcut, clock_now(), results, k) : 0;
+    if (found > 0) {
+        if (record_hits) {
+            cache->ops->touch(part->index, results, found);
+            log_info("HIT L2 (BM25 Score: %.4f) senza scan vettoriale", results[0].penalized_score);
         }
+        return found;
     }
+    float w = cache->config.lexical_weight;
+    if (w <= 0.0f) return cache->ops->search(part->index, query_vector, filter, threshold, results, k, record_hits);
+
+    // Lo scan scende fino allo score vettoriale che con un BM25 pieno arriverebbe alla threshold.
+    // I candidati non contano come HIT: solo quelli che superano la threshold con lo score fuso
+    float vector_threshold = (threshold - w) / (1.0f - w);
+    int pool = k * LEXICAL_POOL_FACTOR;
+    if (pool < LEXICAL_POOL_MIN) pool = LEXICAL_POOL_MIN;
+    if (pool > L2_MAX_TOPK) pool = L2_MAX_TOPK;
+    l2_search_result_t candidates[L2_MAX_TOPK];
+    int n = cache->ops->search(part->index, query_vector, filter, vector_threshold, candidates, pool, 0);
+    for (int i = 0; i < n; i++) {
+        float lexical = l2_lex_score_text(lex, &query, candidates[i].prompt);
+        float fused = (1.0f - w) * candidates[i].penalized_score + w * lexical;
+        if (fused < threshold || (found == k && fused <= results[k - 1].penalized_score)) continue;
+        int pos = found < k ? found++ : k - 1;
+        while (pos > 0 && results[pos - 1].penalized_score < fused) {
+            results[pos] = results[pos - 1];
+            pos--;
+        }
+        results[pos] = candidates[i];
+        results[pos].penalized_score = fused;
+    }
+    if (found > 0 && record_hits) {
+        cache->ops->touch(part->index, results, found);
+        log_info("HIT L2 (Score fuso: %.4f)%s", results[0].penalized_score, found > 1 ? " (top-k)" : "");
+    }
+    return found;
+}
 
-    if (active_clusters == 0) return NULL;
-
-    // Ordina i cluster per somiglianza col centroide
-    qsort(candidates, active_clusters, sizeof(cluster_score_t), compare_clusters);
-
-    // 2. Fase "Fine Search": Cerca solo nei top N_PROBE cluster
-    float max_score = -1.0f;
-    int best_cluster_idx = -1;
-    int best_entry_idx = -1;
-
-    int probes = (active_clusters < N_PROBE) ? active_clusters : N_PROBE;
-    
-    // Prepariamo dati ausiliari query
-    int query_has_neg = has_negation(query_text);
-    size_t query_len = strlen(query_text);
-    time_t now = time(NULL);
-
-    for (int k = 0; k < probes; k++) {
-        int c_idx = candidates[k].index;
-        l2_cluster_t *cluster = &cache->clusters[c_idx];
-
-        // Se lo score del centroide è troppo basso rispetto alla threshold, 
-        // è inutile cercare dentro (Pruning euristico), a meno che non siamo disperati.
-        // Ottimizzazione: se il centroide dista 0.5 e cerchiamo 0.9, è difficile trovare match dentro.
-        // Ma per sicurezza controlliamo comunque i top probes.
-
-        for (size_t i = 0; i < cluster->size; i++) {
-            l2_entry_t *entry = &cluster->entries[i];
-
-            // Lazy Deletion
-            if (now > entry->expire_at) {
-                // Swap with last
-                free(entry->vector); free(entry->original_prompt); free(entry->response);
-                cluster->entries[i] = cluster->entries[cluster->size - 1];
-                cluster->size--;
-                cache->total_count--;
-                i--; 
-                continue;
-            }
+int l2_cache_search_topk(l2_cache_t *cache, const char *ns, const float *query_vector, const char *query_text,
+                         float threshold, l2_search_result_t *results, int k) {
+    if (k <= 0) return 0;
+    if (k > L2_MAX_TOPK) k = L2_MAX_TOPK;
+    l2_partition_t *part = partition_find(cache, ns);
+    if (!part) return 0; // Namespace senza entry: MISS senza toccare gli altri
+    l2_text_filter_t filter;
+    l2_text_filter_init(&filter, cache->keywords, query_text);
+    int found = partition_search(cache, part, query_vector, query_text, &filter, threshold, results, k, 1);
+    partition_count_search(part, found);
+    return found;
+}
 
-            // Calcolo Score Vettoriale
-            float dot = vec_dot(query_vector, entry->vector, cache->vector_dim);
-            
-            // Filtri Logici (Negazione / Lunghezza) - Penalità
-            if (dot > 0.6f) {
-                 size_t entry_len = strlen(entry->original_prompt);
-                 long diff = (long)query_len - (long)entry_len;
-                 if (diff < 0) diff = -diff;
-                 float len_ratio = (float)diff / (float)(query_len > entry_len ? query_len : entry_len);
-                 
-                 if (len_ratio > 0.5f) dot *= 0.8f;
-
-                 int entry_has_neg = has_negation(entry->original_prompt);
-                 if (query_has_neg != entry_has_neg) dot *= 0.75f;
-            }
+// Batch di query della stessa partizione: il backend non registra HIT, qui si tiene
+// e si tocca solo il prefisso chiesto da ogni query (una QUERY semplice nello stesso
+// batch di una QUERY K 64 non rende "calde" le entry che non restituisce)
+static int search_batch_partition(l2_cache_t *cache, l2_partition_t *part, const float *const *query_vectors,
+                                  const l2_text_filter_t *filters, int nq, float threshold,
+                                  l2_search_result_t *results, int k, const int *ks, int *counts) {
+    int ret = 0;
+    if (cache->ops->search_batch) {
+        ret = cache->ops->search_batch(part->index, query_vectors, filters, nq, threshold, results, k, counts);
+    } else {
+        for (int j = 0; j < nq; j++) {
+            counts[j] = cache->ops->search(part->index, query_vectors[j], &filters[j], threshold,
+                                           results + (size_t)j * k, ks ? ks[j] : k, 0);
+        }
+    }
+    if (ret == 0) {
+        for (int j = 0; j < nq; j++) {
+            if (ks && counts[j] > ks[j]) counts[j] = ks[j];
+            if (counts[j] > 0) cache->ops->touch(part->index, results + (size_t)j * k, counts[j]);
+            partition_count_search(part, counts[j]);
+        }
+    }
+    return ret;
+}
 
-            if (dot > max_score) {
-                max_score = dot;
-                best_cluster_idx = c_idx;
-                best_entry_idx = i;
-            }
+int l2_cache_search_batch(l2_cache_t *cache, const char *const *namespaces, const float *const *query_vectors,
+                          const char *const *query_texts, int nq, float threshold,
+                          l2_search_result_t *results, int k, const int *ks, int *counts) {
+    if (nq <= 0 || nq > L2_MAX_BATCH || k <= 0 || k > L2_MAX_TOPK) return -1;
+    for (int j = 0; ks && j < nq; j++) {
+        if (ks[j] <= 0 || ks[j] > k) return -1;
+    }
+    if (cache->config.lexical) {
+        // Shortcut e fusione sono per query: il batch si risolve una query alla volta
+        for (int j = 0; j < nq; j++) {
+            counts[j] = l2_cache_search_topk(cache, namespaces ? namespaces[j] : NULL, query_vectors[j],
+                                             query_texts[j], threshold, results + (size_t)j * k, ks ? ks[j] : k);
         }
+        return 0;
+    }
+    l2_text_filter_t filters[L2_MAX_BATCH];
+    l2_partition_t *parts[L2_MAX_BATCH];
+    int same = 1;
+    for (int j = 0; j < nq; j++) {
+        l2_text_filter_init(&filters[j], cache->keywords, query_texts[j]);
+        parts[j] = partition_find(cache, namespaces ? namespaces[j] : NULL);
+        if (parts[j] != parts[0]) same = 0;
+    }
+    // Caso comune: tutto il batch nella stessa partizione
+    if (same) {
+        if (!parts[0]) {
+            memset(counts, 0, nq * sizeof(int));
+            return 0;
+        }
+        return search_batch_partition(cache, parts[0], query_vectors, filters, nq, threshold, results, k, ks, counts);
     }
 
-    if (best_entry_idx != -1 && max_score >= threshold) {
-        log_info("HIT L2 (IVF Score: %.4f) Cluster %d", max_score, best_cluster_idx);
-        return cache->clusters[best_cluster_idx].entries[best_entry_idx].response;
+    // Namespace misti: un sotto-batch per partizione, risultati ricopiati al posto della query
+    l2_search_result_t *group_results = malloc((size_t)nq * k * sizeof(l2_search_result_t));
+    if (!group_results) return -1;
+    int done[L2_MAX_BATCH] = { 0 };
+    for (int j = 0; j < nq; j++) {
+        if (done[j]) continue;
+        int members[L2_MAX_BATCH], group_counts[L2_MAX_BATCH], group_ks[L2_MAX_BATCH], n = 0;
+        const float *group_vectors[L2_MAX_BATCH];
+        l2_text_filter_t group_filters[L2_MAX_BATCH];
+        for (int i = j; i < nq; i++) {
+            if (done[i] || parts[i] != parts[j]) continue;
+            done[i] = 1;
+            members[n] = i;
+            group_vectors[n] = query_vectors[i];
+            group_filters[n] = filters[i];
+            group_ks[n] = ks ? ks[i] : k;
+            n++;
+        }
+        if (!parts[j]) {
+            for (int g = 0; g < n; g++) counts[members[g]] = 0;
+            continue;
+        }
+        if (search_batch_partition(cache, parts[j], group_vectors, group_filters, n, threshold,
+                                   group_results, k, group_ks, group_counts) != 0) {
+            free(group_results);
+            return -1;
+        }
+        for (int g = 0; g < n; g++) {
+            counts[members[g]] = group_counts[g];
+            memcpy(results + (size_t)members[g] * k, group_results + (size_t)g * k,
+                   group_counts[g] * sizeof(l2_search_result_t));
+        }
     }
+    free(group_results);
+    return 0;
+}
 
-    return NULL;
+int l2_cache_delete_semantic(l2_cache_t *cache, const char *ns, const float *query_vector, int wait) {
+    if (write_lock(cache, wait) != 0) return L2_BUSY;
+    l2_partition_t *part = partition_find(cache, ns);
+    int deleted = 0;
+    if (part) {
+        size_t before = cache->ops->count(part->index);
+        deleted = cache->ops->delete_semantic(part->index, query_vector);
+        entries_update(cache, part, before);
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    return deleted;
 }
 
-// Cancellazione semantica (scan su nprobe cluster)
-int l2_cache_delete_semantic(l2_cache_t* cache, const float* query_vector) {
-    float threshold = 0.99f;
-    
-    // Logica duplicata dalla search ma per delete: cerchiamo nei cluster migliori
-    cluster_score_t candidates[NUM_CLUSTERS];
-    int active = 0;
-    for(int i=0; i<NUM_CLUSTERS; i++) {
-        if(cache->clusters[i].is_initialized) {
-            candidates[active].index = i;
-            candidates[active].score = vec_dot(cache->clusters[i].centroid, query_vector, cache->vector_dim);
-            active++;
-        }
+int l2_cache_delete_prompt(l2_cache_t *cache, const char *ns, const char *prompt, int wait) {
+    uint64_t key = l2_keys_hash(prompt);
+    if (!cache || key == L2_KEY_NONE) return 0;
+    if (write_lock(cache, wait) != 0) return L2_BUSY;
+    l2_partition_t *part = partition_find(cache, ns);
+    int deleted = 0;
+    if (part) {
+        size_t before = cache->ops->count(part->index);
+        deleted = cache->ops->delete_key(part->index, key);
+        entries_update(cache, part, before);
     }
-    qsort(candidates, active, sizeof(cluster_score_t), compare_clusters);
-    
-    int probes = (active < N_PROBE) ? active : N_PROBE;
-    
-    for(int k=0; k<probes; k++) {
-        l2_cluster_t *c = &cache->clusters[candidates[k].index];
-        for(size_t i=0; i<c->size; i++) {
-            float dot = vec_dot(query_vector, c->entries[i].vector, cache->vector_dim);
-            if(dot >= threshold) {
-                // Delete
-                free(c->entries[i].vector);
-                free(c->entries[i].original_prompt);
-                free(c->entries[i].response);
-                c->entries[i] = c->entries[c->size-1];
-                c->size--;
-                cache->total_count--;
-                log_info("L2 Semantic Delete OK.");
-                return 1;
-            }
-        }
+    pthread_rwlock_unlock(&cache->lock);
+    return deleted;
+}
+
+int l2_cache_clear(l2_cache_t *cache, int wait) {
+    if (!cache) return 0;
+    if (write_lock(cache, wait) != 0) return L2_BUSY;
+    if (cache->max_parts <= 1) {
+        cache->ops->clear(cache->parts[0]->index);
+    } else {
+        // Con le partizioni si libera tutto: gli indici rinascono al prossimo inserimento
+        while (cache->num_parts > 0) partition_remove(cache, cache->num_parts - 1);
     }
+    cache->entries = 0;
+    pthread_rwlock_unlock(&cache->lock);
     return 0;
 }
 
-// Clear completo
-void l2_cache_clear(l2_cache_t *cache) {
-    if (!cache) return;
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        for (size_t j = 0; j < cache->clusters[i].size; j++) {
-            free(cache->clusters[i].entries[j].vector);
-            free(cache->clusters[i].entries[j].original_prompt);
-            free(cache->clusters[i].entries[j].response);
+long l2_cache_clear_namespace(l2_cache_t *cache, const char *ns, int wait) {
+    if (!cache || cache->max_parts <= 1) return 0;
+    long removed = 0;
+    if (write_lock(cache, wait) != 0) return L2_BUSY;
+    l2_partition_t *part = partition_find(cache, ns);
+    for (int i = 0; part && i < cache->num_parts; i++) {
+        if (cache->parts[i] != part) continue;
+        removed = (long)cache->ops->count(cache->parts[i]->index);
+        cache->entries -= (size_t)removed;
+        partition_remove(cache, i);
+        break;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    return removed;
+}
+
+int l2_cache_get_stats(l2_cache_t *cache, l2_partition_stats_t *stats, int max) {
+    pthread_rwlock_rdlock(&cache->lock);
+    int count = cache->num_parts < max ? cache->num_parts : max;
+    for (int i = 0; i < count; i++) {
+        l2_partition_t *part = cache->parts[i];
+        snprintf(stats[i].name, sizeof(stats[i].name), "%s", part->name);
+        stats[i].entries = cache->ops->count(part->index);
+        stats[i].searches = atomic_load_explicit(&part->searches, memory_order_relaxed);
+        stats[i].hits = atomic_load_explicit(&part->hits, memory_order_relaxed);
+        stats[i].inserts = part->inserts;
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    return count;
+}
+
+uint64_t l2_cache_partition_rejects(l2_cache_t *cache) {
+    pthread_rwlock_rdlock(&cache->lock);
+    uint64_t rejects = cache->partition_rejects;
+    pthread_rwlock_unlock(&cache->lock);
+    return rejects;
+}
+
+size_t l2_cache_entries(l2_cache_t *cache) {
+    pthread_rwlock_rdlock(&cache->lock);
+    size_t entries = cache->entries;
+    pthread_rwlock_unlock(&cache->lock);
+    return entries;
+}
+
+// Una partizione per chiamata, a turno: il lavoro sotto il write lock resta limitato
+// anche con molti namespace. Con il lock occupato dai lettori si riprova al giro dopo
+int l2_cache_maintenance(l2_cache_t *cache) {
+    if (!cache || !cache->ops->maintenance) return 0;
+    if (write_lock(cache, 0) != 0) return 1;
+    int pending = 0;
+    for (int n = 0; n < cache->num_parts && !pending; n++) {
+        if (cache->maintenance_cursor >= cache->num_parts) cache->maintenance_cursor = 0;
+        // La manutenzione scarta anche le righe scadute incontrate (migrazione, merge)
+        l2_partition_t *part = cache->parts[cache->maintenance_cursor++];
+        size_t before = cache->ops->count(part->index);
+        pending = cache->ops->maintenance(part->index);
+        entries_update(cache, part, before);
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    return pending;
+}
+
+size_t l2_cache_expire_cycle(l2_cache_t *cache, size_t budget, size_t *examined) {
+    if (examined) *examined = 0;
+    if (!cache || !cache->ops->expire) return 0;
+    size_t removed = 0, seen = 0;
+    if (write_lock(cache, 0) != 0) return 0; // Lettori in corso: nulla esaminato, si riprova al prossimo ciclo
+    // Il budget si divide tra le partizioni a turno, ripartendo da dove si era fermato
+    for (int n = cache->num_parts; n > 0 && seen < budget; n--) {
+        if (cache->expire_cursor >= cache->num_parts) cache->expire_cursor = 0;
+        int i = cache->expire_cursor;
+        size_t part_seen = 0;
+        size_t before = cache->ops->count(cache->parts[i]->index);
+        removed += cache->ops->expire(cache->parts[i]->index, budget - seen, &part_seen);
+        entries_update(cache, cache->parts[i], before);
+        seen += part_seen;
+        if (cache->max_parts > 1 && cache->ops->count(cache->parts[i]->index) == 0) {
+            // Namespace senza più entry: l'indice viene liberato (rinasce al prossimo SET)
+            partition_remove(cache, i);
+        } else {
+            cache->expire_cursor++;
         }
-        cache->clusters[i].size = 0;
-        cache->clusters[i].is_initialized = 0; 
-        // Nota: non liberiamo i centroidi qui, li resettiamo logicamente
-        memset(cache->clusters[i].centroid, 0, cache->vector_dim * sizeof(float));
     }
-    cache->total_count = 0;
-    log_debug("L2 Cache (IVF) svuotata.");
+    pthread_rwlock_unlock(&cache->lock);
+    if (examined) *examined = seen;
+    return removed;
 }
 
-// Helper per il caricamento/salvataggio (raw insert specifico per il clustering)
-int l2_cache_insert_raw(l2_cache_t *cache, float *vector, const char *prompt, const char *resp, time_t expire_at) {
-    // Riutilizziamo la logica di insert normale per assegnare il cluster corretto
-    // anche durante il caricamento da disco. Questo "ri-addestra" i centroidi al boot.
-    return l2_cache_insert(cache, vector, prompt, resp, (int)(expire_at - time(NULL)));
+// Helper per il caricamento/salvataggio (raw insert con scadenza assoluta)
+int l2_cache_insert_raw(l2_cache_t *cache, const char *ns, float *vector, const char *prompt, const char *resp,
+                        time_t expire_at) {
+    // L'indice assegna la posizione corretta anche durante il caricamento da disco.
+    // Questo "ri-addestra" i centroidi (IVF) o ricostruisce il grafo (HNSW) al boot.
+    return insert_with_features(cache, ns, vector, prompt, L2_KEY_NONE, NULL, resp, expire_at);
+}
+
+// Scrittura di una entry nello stream (callback di foreach)
+typedef struct {
+    FILE *f;
+    int vector_dim;
+    l2_storage_t storage;
+    uint16_t *half;          // Buffer del vettore convertito (solo snapshot compatto)
+} l2_save_ctx_t;
+
+static void save_entry(void *ctx, const float *vector, const char *prompt, uint64_t key,
+                       const l2_text_filter_t *features, const char *response, time_t expire_at) {
+    l2_save_ctx_t *s = ctx;
+    uint8_t valid = 1;
+    fwrite(&valid, sizeof(uint8_t), 1, s->f);
+    if (s->storage == L2_STORAGE_F16) {
+        vec_kernels_to_f16(vector, s->half, s->vector_dim);
+        fwrite(s->half, sizeof(uint16_t), s->vector_dim, s->f);
+    } else if (s->storage == L2_STORAGE_BF16) {
+        vec_kernels_to_bf16(vector, s->half, s->vector_dim);
+        fwrite(s->half, sizeof(uint16_t), s->vector_dim, s->f);
+    } else {
+        fwrite(vector, sizeof(float), s->vector_dim, s->f);
+    }
+
+    // Prompt non conservato: si salva vuoto, le feature viaggiano a parte
+    int p_len = prompt ? strlen(prompt) : 0;
+    fwrite(&p_len, sizeof(int), 1, s->f);
+    if (p_len > 0) fwrite(prompt, sizeof(char), p_len, s->f);
+    fwrite(&features->len, sizeof(uint32_t), 1, s->f);
+    fwrite(&features->features, sizeof(uint32_t), 1, s->f);
+    fwrite(&key, sizeof(uint64_t), 1, s->f);
+
+    int r_len = strlen(response);
+    fwrite(&r_len, sizeof(int), 1, s->f);
+    fwrite(response, sizeof(char), r_len, s->f);
+
+    fwrite(&expire_at, sizeof(time_t), 1, s->f);
 }
 
-// SAVE: Salva come stream piatto (il formato su disco non cambia!)
+// Sezioni dello snapshot L2: la 0x03 aggiunge le feature dei filtri a ogni entry
+// (necessarie quando il prompt non è conservato); la 0x04 è la 0x03 con la codifica
+// dei vettori (l2_storage_t: f32, f16 o bf16) in un byte dopo la dimensione; la 0x05
+// raggruppa le entry per namespace: per ogni partizione un byte 1, il nome
+// (lunghezza + byte) e le sue entry chiuse da 0, poi un byte 0 finale; la 0x06 è
+// la 0x05 con la chiave del prompt (uint64) dopo le feature, per il delete esatto
+// delle entry senza prompt conservato.
+// Le precedenti restano leggibili (le prime tre nel namespace predefinito)
+#define L2_SECTION_V1 0x02
+#define L2_SECTION_FEATURES 0x03
+#define L2_SECTION_COMPACT 0x04
+#define L2_SECTION_PARTITIONS 0x05
+#define L2_SECTION_KEYS 0x06
+
+// SAVE: Salva come stream piatto (il formato su disco non dipende dall'indice)
 int l2_cache_save(l2_cache_t *cache, FILE *f) {
     if (!cache || !f) return -1;
-    uint8_t section_id = 0x02;
+    l2_save_ctx_t ctx = { f, cache->vector_dim, cache->snapshot_storage, NULL };
+    if (ctx.storage != L2_STORAGE_F32) {
+        ctx.half = malloc(cache->vector_dim * sizeof(uint16_t));
+        if (!ctx.half) ctx.storage = L2_STORAGE_F32; // OOM: snapshot in float32, sempre valido
+    }
+    uint8_t section_id = L2_SECTION_KEYS;
     fwrite(&section_id, sizeof(uint8_t), 1, f);
     fwrite(&cache->vector_dim, sizeof(int), 1, f);
+    uint8_t encoding = (uint8_t)ctx.storage;
+    fwrite(&encoding, sizeof(uint8_t), 1, f);
 
     int count = 0;
-    time_t now = time(NULL);
-
-    // Itera su tutti i cluster e salva linearmente
-    for (int i = 0; i < NUM_CLUSTERS; i++) {
-        l2_cluster_t *c = &cache->clusters[i];
-        for (size_t j = 0; j < c->size; j++) {
-            l2_entry_t *e = &c->entries[j];
-            if (e->expire_at > now) {
-                uint8_t valid = 1;
-                fwrite(&valid, sizeof(uint8_t), 1, f);
-                fwrite(e->vector, sizeof(float), cache->vector_dim, f);
-                
-                int p_len = strlen(e->original_prompt);
-                fwrite(&p_len, sizeof(int), 1, f);
-                fwrite(e->original_prompt, sizeof(char), p_len, f);
-
-                int r_len = strlen(e->response);
-                fwrite(&r_len, sizeof(int), 1, f);
-                fwrite(e->response, sizeof(char), r_len, f);
-
-                fwrite(&e->expire_at, sizeof(time_t), 1, f);
-                count++;
-            }
-        }
+    uint8_t marker = 1, end_marker = 0;
+    pthread_rwlock_rdlock(&cache->lock);
+    for (int i = 0; i < cache->num_parts && count >= 0; i++) {
+        const l2_partition_t *part = cache->parts[i];
+        int name_len = strlen(part->name);
+        fwrite(&marker, sizeof(uint8_t), 1, f);
+        fwrite(&name_len, sizeof(int), 1, f);
+        fwrite(part->name, sizeof(char), name_len, f);
+        int saved = cache->ops->foreach(part->index, save_entry, &ctx);
+        fwrite(&end_marker, sizeof(uint8_t), 1, f);
+        count = saved < 0 ? -1 : count + saved;
     }
-    uint8_t end_marker = 0;
+    pthread_rwlock_unlock(&cache->lock);
+    free(ctx.half);
+
     fwrite(&end_marker, sizeof(uint8_t), 1, f);
-    log_info("L2 Cache salvata (IVF Flat): %d vettori totali.", count);
+    if (count < 0) return -1;
+    log_info("L2 Cache salvata (%s): %d vettori totali in %d partizioni.", cache->ops->name, count, cache->num_parts);
     return 0;
 }
 
-// LOAD: Carica e reinserisce (ricostruendo i cluster)
-int l2_cache_load(l2_cache_t *cache, FILE *f) {
-    // La logica di load in l2_cache.h può rimanere la stessa se chiama l2_cache_insert_raw
-    // Siccome ho ridefinito l2_cache_insert_raw qui sopra per usare l'inserimento clusterizzato,
-    // possiamo copiare il corpo della funzione load dal vecchio file o includerla qui.
-    
-    // COPIA-INCOLLA la funzione load dal vecchio file, 
-    // assicurandoti che chiami la NUOVA l2_cache_insert_raw definita qui sopra.
-    
-    uint8_t section_id;
-    if (fread(&section_id, sizeof(uint8_t), 1, f) != 1 || section_id != 0x02) {
-        log_error("L2 Load: Section ID mismatch"); return -1;
-    }
-    int dim_check;
-    fread(&dim_check, sizeof(int), 1, f);
-    if (dim_check != cache->vector_dim) return -1;
-
+// Legge le entry di un namespace fino al marcatore 0 e le reinserisce (ricostruendo l'indice)
+static int load_entries(l2_cache_t *cache, FILE *f, uint8_t section_id, uint8_t encoding, const char *ns,
+                        float *tmp_vec, uint16_t *half) {
     int loaded = 0;
-    time_t now = time(NULL);
-    float *tmp_vec = malloc(cache->vector_dim * sizeof(float));
-
+    time_t now = clock_now();
     while (1) {
         uint8_t valid;
         if (fread(&valid, sizeof(uint8_t), 1, f) != 1) break;
         if (valid == 0) break;
 
-        fread(tmp_vec, sizeof(float), cache->vector_dim, f);
+        if (encoding == L2_STORAGE_F16) {
+            fread(half, sizeof(uint16_t), cache->vector_dim, f);
+            vec_kernels_from_f16(half, tmp_vec, cache->vector_dim);
+        } else if (encoding == L2_STORAGE_BF16) {
+            fread(half, sizeof(uint16_t), cache->vector_dim, f);
+            vec_kernels_from_bf16(half, tmp_vec, cache->vector_dim);
+        } else {
+            fread(tmp_vec, sizeof(float), cache->vector_dim, f);
+        }
 
         int p_len; fread(&p_len, sizeof(int), 1, f);
         char *prompt = malloc(p_len + 1);
         fread(prompt, sizeof(char), p_len, f);
         prompt[p_len] = '\0';
 
+        // Con il prompt disponibile le feature si ricalcolano (il dizionario può
+        // essere cambiato); quelle salvate servono quando il prompt non è stato conservato
+        l2_text_filter_t features;
+        int has_features = section_id != L2_SECTION_V1;
+        if (has_features) {
+            fread(&features.len, sizeof(uint32_t), 1, f);
+            fread(&features.features, sizeof(uint32_t), 1, f);
+        }
+        if (!has_features || p_len > 0) {
+            l2_text_filter_init(&features, cache->keywords, prompt);
+        }
+        // Stessa regola per la chiave: con il prompt si ricalcola (L2_KEY_NONE)
+        uint64_t key = L2_KEY_NONE;
+        if (section_id >= L2_SECTION_KEYS) fread(&key, sizeof(uint64_t), 1, f);
+        if (p_len > 0) key = L2_KEY_NONE;
+
         int r_len; fread(&r_len, sizeof(int), 1, f);
         char *resp = malloc(r_len + 1);
         fread(resp, sizeof(char), r_len, f);
@@ -428,13 +847,57 @@ int l2_cache_load(l2_cache_t *cache, FILE *f) {
         fread(&expire_at, sizeof(time_t), 1, f);
 
         if (expire_at > now) {
-            // Qui avviene la magia: ricalcola i cluster mentre carica!
-            l2_cache_insert(cache, tmp_vec, prompt, resp, (int)(expire_at - now));
+            // Qui avviene la magia: ricalcola l'indice mentre carica!
+            insert_with_features(cache, ns, tmp_vec, p_len > 0 ? prompt : NULL, key, &features, resp, expire_at);
             loaded++;
         }
         free(prompt); free(resp);
     }
+    return loaded;
+}
+
+// LOAD: Carica e reinserisce (ricostruendo l'indice)
+int l2_cache_load(l2_cache_t *cache, FILE *f) {
+    uint8_t section_id;
+    if (fread(&section_id, sizeof(uint8_t), 1, f) != 1 || section_id < L2_SECTION_V1 ||
+        section_id > L2_SECTION_KEYS) {
+        log_error("L2 Load: Section ID mismatch"); return -1;
+    }
+    int dim_check;
+    fread(&dim_check, sizeof(int), 1, f);
+    if (dim_check != cache->vector_dim) return -1;
+    uint8_t encoding = L2_STORAGE_F32;
+    if (section_id >= L2_SECTION_COMPACT &&
+        (fread(&encoding, sizeof(uint8_t), 1, f) != 1 ||
+         (encoding != L2_STORAGE_F32 && encoding != L2_STORAGE_F16 && encoding != L2_STORAGE_BF16))) {
+        log_error("L2 Load: codifica dei vettori sconosciuta"); return -1;
+    }
+
+    float *tmp_vec = malloc(cache->vector_dim * sizeof(float));
+    uint16_t *half = malloc(cache->vector_dim * sizeof(uint16_t));
+    if (!tmp_vec || !half) {
+        free(tmp_vec); free(half);
+        return -1;
+    }
+
+    int loaded = 0;
+    if (section_id < L2_SECTION_PARTITIONS) {
+        loaded = load_entries(cache, f, section_id, encoding, NULL, tmp_vec, half);
+    } else {
+        uint8_t marker;
+        while (fread(&marker, sizeof(uint8_t), 1, f) == 1 && marker != 0) {
+            int name_len;
+            if (fread(&name_len, sizeof(int), 1, f) != 1 || name_len < 0) break;
+            char *ns = malloc(name_len + 1);
+            if (!ns) break;
+            fread(ns, sizeof(char), name_len, f);
+            ns[name_len] = '\0';
+            loaded += load_entries(cache, f, section_id, encoding, ns, tmp_vec, half);
+            free(ns);
+        }
+    }
     free(tmp_vec);
-    log_info("L2 Cache caricata e re-indicizzata: %d vettori.", loaded);
+    free(half);
+    log_info("L2 Cache caricata e re-indicizzata (%s): %d vettori.", cache->ops->name, loaded);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,875 @@
+/*
+ * Vecs Project: HNSW Graph Index (L2)
+ * (src/cache/l2_hnsw.c)
+ *
+ * Hierarchical Navigable Small World: ogni nodo ha un livello casuale
+ * (distribuzione geometrica); la ricerca scende greedy dai livelli alti e
+ * termina con una beam search di ampiezza ef al livello 0.
+ * Le cancellazioni marcano il nodo (tombstone); una riparazione periodica
+ * ricollega le liste che puntano a nodi morti e ricicla i loro slot.
+ * Le ricerche non modificano il grafo e usano buffer propri (hnsw_ctx_t):
+ * possono girare in parallelo sotto il read lock della facciata.
+ */
+
+#include "l2_index.h"
+#include "logger.h"
+#include "vec_kernels.h"
+#include "l2_lex.h"
+#include "l2_keys.h"
+#include "clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// --- COSTANTI DI TUNING ---
+#define HNSW_DEFAULT_M 16          // Vicini per nodo ai livelli > 0 (2*M al livello 0)
+#define HNSW_DEFAULT_EF_SEARCH 64  // Ampiezza della beam search in query
+#define HNSW_EF_CONSTRUCTION 128   // Ampiezza della beam search in inserimento
+#define HNSW_MAX_LEVEL 16
+#define HNSW_MIN_CAP 64            // Capacità iniziale (nodi)
+#define HNSW_REPAIR_MIN 32         // Tombstone minimi prima di una riparazione
+#define HNSW_REPAIR_RATIO 8        // Riparazione quando i tombstone superano 1/8 dei nodi
+#define HNSW_DELETE_THRESHOLD 0.99f
+
+// Dati "freddi" di una entry: letti solo su HIT e dal salvataggio su disco
+typedef struct {
+    char *original_prompt;   // NULL se i prompt non sono conservati
+    vs_value_t *response;    // Internata nel value store (condivisa con la L1)
+    uint64_t key;            // Chiave del prompt nell'indice dei prompt (L2_KEY_NONE se assente)
+    uint32_t lex_doc;        // Entry nell'indice lessicale (L2_LEX_NONE se assente)
+} l2_text_t;
+
+// Candidato (nodo + score) delle code di priorità
+typedef struct {
+    float score;
+    uint32_t id;
+} hnsw_cand_t;
+
+// Heap binario: max-heap (migliore in cima) o min-heap (peggiore in cima)
+typedef struct {
+    hnsw_cand_t *data;
+    size_t size;
+    size_t cap;
+} hnsw_heap_t;
+
+// Stato di lavoro di una beam search: uno per il thread scrittore, gli altri
+// riusati dalle ricerche concorrenti
+typedef struct hnsw_ctx_s {
+    uint32_t *visited;       // Visited set a epoche: visited[id] == epoch
+    size_t visited_cap;      // Nodi coperti (cresce con il grafo alla prima ricerca successiva)
+    uint32_t epoch;
+    hnsw_heap_t cand;
+    hnsw_heap_t res;
+    hnsw_cand_t *scratch;    // Risultati ordinati, selezione/riparazione dei vicini
+    size_t scratch_cap;
+    struct hnsw_ctx_s *next; // Lista dei contesti liberi
+} hnsw_ctx_t;
+
+typedef struct {
+    int vector_dim;
+    int m;                   // Vicini massimi ai livelli > 0
+    int m0;                  // Vicini massimi al livello 0
+    int ef_search;
+    int ef_construction;
+    double level_mult;       // 1 / ln(M)
+    size_t max_capacity;
+    l2_eviction_t eviction;
+    _Atomic uint32_t clock;  // Clock logico degli accessi (LRU/LFU), avanzato anche dalle ricerche
+
+    // Nodi in layout Structure-of-Arrays (indice = id del nodo)
+    float *vectors;          // [capacity x vector_dim]
+    uint32_t *links0;        // [capacity x (1 + m0)]: conteggio + vicini del livello 0
+    uint32_t **links_up;     // Per nodo: [level x (1 + m)], NULL se il nodo è solo al livello 0
+    uint8_t *levels;
+    uint8_t *deleted;        // 1 = tombstone (o slot libero): navigabile ma mai restituito
+    time_t *expire_at;
+    l2_text_filter_t *features; // Feature dei filtri ibridi (precalcolate all'inserimento)
+    l2_usage_t *usage;       // Statistiche d'uso per l'eviction
+    l2_text_t *texts;
+    size_t count;            // Slot usati (vivi + tombstone + liberi)
+    size_t capacity;
+    size_t live;
+    size_t tombstones;
+    uint32_t *free_ids;      // Slot riciclati dalla riparazione
+    size_t free_count;
+    size_t expire_cursor;    // Prossimo slot del ciclo di scadenza attivo
+
+    uint32_t entry;          // Punto di ingresso (nodo al livello più alto)
+    int max_level;           // -1 = grafo vuoto
+
+    hnsw_ctx_t writer;       // Inserimento, riparazione e delete (thread scrittore)
+    hnsw_ctx_t *spare_ctx;   // Contesti liberi delle ricerche
+    pthread_mutex_t ctx_lock;
+
+    unsigned int seed;
+    vec_kernels_t vk;
+    value_store_t *values;   // Store delle risposte
+    l2_lex_t *lex;           // Indice lessicale sui prompt (NULL se disattivato)
+    l2_keys_t *keys;         // Indice dei prompt per il delete esatto (posizione = id del nodo, stabile)
+} l2_hnsw_t;
+
+// --- HELPER ---
+
+static inline const float *node_vec(const l2_hnsw_t *h, uint32_t id) {
+    return h->vectors + (size_t)id * h->vector_dim;
+}
+
+static inline float node_dot(const l2_hnsw_t *h, const float *q, uint32_t id) {
+    return h->vk.dot(q, node_vec(h, id), h->vector_dim);
+}
+
+// Lista dei vicini del nodo al livello indicato: [0] = conteggio, poi gli id
+static inline uint32_t *node_links(const l2_hnsw_t *h, uint32_t id, int level) {
+    if (level == 0) return h->links0 + (size_t)id * (1 + h->m0);
+    return h->links_up[id] + (size_t)(level - 1) * (1 + h->m);
+}
+
+static inline int level_max_links(const l2_hnsw_t *h, int level) {
+    return level == 0 ? h->m0 : h->m;
+}
+
+static inline int heap_before(const hnsw_cand_t *a, const hnsw_cand_t *b, int max) {
+    return max ? a->score > b->score : a->score < b->score;
+}
+
+static int heap_push(hnsw_heap_t *hp, float score, uint32_t id, int max) {
+    if (hp->size == hp->cap) {
+        size_t new_cap = hp->cap ? hp->cap * 2 : 256;
+        hnsw_cand_t *data = realloc(hp->data, new_cap * sizeof(hnsw_cand_t));
+        if (!data) return -1;
+        hp->data = data;
+        hp->cap = new_cap;
+    }
+    size_t i = hp->size++;
+    hnsw_cand_t item = { score, id };
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap_before(&item, &hp->data[parent], max)) break;
+        hp->data[i] = hp->data[parent];
+        i = parent;
+    }
+    hp->data[i] = item;
+    return 0;
+}
+
+static hnsw_cand_t heap_pop(hnsw_heap_t *hp, int max) {
+    hnsw_cand_t top = hp->data[0];
+    hnsw_cand_t last = hp->data[--hp->size];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= hp->size) break;
+        if (child + 1 < hp->size && heap_before(&hp->data[child + 1], &hp->data[child], max)) child++;
+        if (!heap_before(&hp->data[child], &last, max)) break;
+        hp->data[i] = hp->data[child];
+        i = child;
+    }
+    if (hp->size > 0) hp->data[i] = last;
+    return top;
+}
+
+static int compare_cand_desc(const void *a, const void *b) {
+    float sa = ((const hnsw_cand_t *)a)->score;
+    float sb = ((const hnsw_cand_t *)b)->score;
+    return (sb > sa) - (sb < sa);
+}
+
+static int scratch_reserve(hnsw_ctx_t *ctx, size_t n) {
+    if (n <= ctx->scratch_cap) return 0;
+    hnsw_cand_t *s = realloc(ctx->scratch, n * sizeof(hnsw_cand_t));
+    if (!s) return -1;
+    ctx->scratch = s;
+    ctx->scratch_cap = n;
+    return 0;
+}
+
+// Nuova epoca del visited set, esteso prima a tutti gli slot del grafo
+// (azzeramento completo solo al wrap-around)
+static int visited_reset(const l2_hnsw_t *h, hnsw_ctx_t *ctx) {
+    if (ctx->visited_cap < h->capacity) {
+        uint32_t *visited = realloc(ctx->visited, h->capacity * sizeof(uint32_t));
+        if (!visited) return -1;
+        memset(visited + ctx->visited_cap, 0, (h->capacity - ctx->visited_cap) * sizeof(uint32_t));
+        ctx->visited = visited;
+        ctx->visited_cap = h->capacity;
+    }
+    if (++ctx->epoch == 0) {
+        memset(ctx->visited, 0, ctx->visited_cap * sizeof(uint32_t));
+        ctx->epoch = 1;
+    }
+    return 0;
+}
+
+static void ctx_release_buffers(hnsw_ctx_t *ctx) {
+    free(ctx->visited);
+    free(ctx->cand.data);
+    free(ctx->res.data);
+    free(ctx->scratch);
+}
+
+// Contesto per una ricerca concorrente: riusato se disponibile (NULL in caso di OOM)
+static hnsw_ctx_t *ctx_acquire(l2_hnsw_t *h) {
+    pthread_mutex_lock(&h->ctx_lock);
+    hnsw_ctx_t *ctx = h->spare_ctx;
+    if (ctx) h->spare_ctx = ctx->next;
+    pthread_mutex_unlock(&h->ctx_lock);
+    return ctx ? ctx : calloc(1, sizeof(hnsw_ctx_t));
+}
+
+static void ctx_release(l2_hnsw_t *h, hnsw_ctx_t *ctx) {
+    pthread_mutex_lock(&h->ctx_lock);
+    ctx->next = h->spare_ctx;
+    h->spare_ctx = ctx;
+    pthread_mutex_unlock(&h->ctx_lock);
+}
+
+static int random_level(l2_hnsw_t *h) {
+    double u = ((double)rand_r(&h->seed) + 1.0) / ((double)RAND_MAX + 2.0);
+    int level = (int)(-log(u) * h->level_mult);
+    return level > HNSW_MAX_LEVEL ? HNSW_MAX_LEVEL : level;
+}
+
+// --- RICERCA NEL GRAFO ---
+
+// Discesa greedy su un livello: si sposta sul vicino migliore finché migliora
+static uint32_t greedy_step(const l2_hnsw_t *h, const float *q, uint32_t cur, int level) {
+    float cur_score = node_dot(h, q, cur);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        const uint32_t *links = node_links(h, cur, level);
+        for (uint32_t i = 0; i < links[0]; i++) {
+            float s = node_dot(h, q, links[1 + i]);
+            if (s > cur_score) {
+                cur_score = s;
+                cur = links[1 + i];
+                changed = 1;
+            }
+        }
+    }
+    return cur;
+}
+
+// Beam search a un livello: al termine ctx->res contiene (min-heap) i migliori ef nodi
+static int search_layer(const l2_hnsw_t *h, hnsw_ctx_t *ctx, const float *q, uint32_t ep, int ef, int level) {
+    if (visited_reset(h, ctx) != 0) return -1;
+    ctx->cand.size = 0;
+    ctx->res.size = 0;
+
+    float s = node_dot(h, q, ep);
+    ctx->visited[ep] = ctx->epoch;
+    if (heap_push(&ctx->cand, s, ep, 1) != 0 || heap_push(&ctx->res, s, ep, 0) != 0) return -1;
+
+    while (ctx->cand.size > 0) {
+        hnsw_cand_t c = heap_pop(&ctx->cand, 1);
+        if (ctx->res.size >= (size_t)ef && c.score < ctx->res.data[0].score) break;
+
+        const uint32_t *links = node_links(h, c.id, level);
+        for (uint32_t i = 0; i < links[0]; i++) {
+            uint32_t nb = links[1 + i];
+            if (ctx->visited[nb] == ctx->epoch) continue;
+            ctx->visited[nb] = ctx->epoch;
+
+            float ns = node_dot(h, q, nb);
+            if (ctx->res.size < (size_t)ef || ns > ctx->res.data[0].score) {
+                if (heap_push(&ctx->cand, ns, nb, 1) != 0 || heap_push(&ctx->res, ns, nb, 0) != 0) return -1;
+                if (ctx->res.size > (size_t)ef) heap_pop(&ctx->res, 0);
+            }
+        }
+    }
+    return 0;
+}
+
+// Svuota ctx->res in ctx->scratch, ordinato per score decrescente. Ritorna il numero
+static size_t results_sorted(hnsw_ctx_t *ctx) {
+    size_t n = ctx->res.size;
+    if (scratch_reserve(ctx, n) != 0) return 0;
+    for (size_t i = n; i > 0; i--) ctx->scratch[i - 1] = heap_pop(&ctx->res, 0);
+    return n;
+}
+
+// Euristica di selezione dei vicini (HNSW, alg. 4): un candidato entra solo se
+// è più vicino alla base che a ogni vicino già scelto. Mantiene il grafo navigabile
+// tra cluster diversi invece di concentrare i link in un'unica zona densa.
+static int select_neighbors(const l2_hnsw_t *h, const hnsw_cand_t *sorted, size_t n, int max_links, uint32_t *out) {
+    int selected = 0;
+    for (size_t i = 0; i < n && selected < max_links; i++) {
+        if (h->deleted[sorted[i].id]) continue; // Mai nuovi link verso tombstone
+        int good = 1;
+        for (int j = 0; j < selected; j++) {
+            if (h->vk.dot(node_vec(h, sorted[i].id), node_vec(h, out[j]), h->vector_dim) > sorted[i].score) {
+                good = 0;
+                break;
+            }
+        }
+        if (good) out[selected++] = sorted[i].id;
+    }
+    return selected;
+}
+
+// Aggiunge il link nb -> id; se la lista è piena la riduce con l'euristica
+static void add_link(l2_hnsw_t *h, uint32_t nb, uint32_t id, int level) {
+    uint32_t *links = node_links(h, nb, level);
+    int max_links = level_max_links(h, level);
+    if ((int)links[0] < max_links) {
+        links[1 + links[0]++] = id;
+        return;
+    }
+
+    // Lo scratch dello scrittore è libero: i vicini selezionati sono già stati copiati dal chiamante
+    if (scratch_reserve(&h->writer, (size_t)max_links + 1) != 0) return;
+    hnsw_cand_t *c = h->writer.scratch;
+    const float *base = node_vec(h, nb);
+    int n = 0;
+    for (uint32_t i = 0; i < links[0]; i++) {
+        c[n].id = links[1 + i];
+        c[n].score = h->vk.dot(base, node_vec(h, links[1 + i]), h->vector_dim);
+        n++;
+    }
+    c[n].id = id;
+    c[n].score = h->vk.dot(base, node_vec(h, id), h->vector_dim);
+    n++;
+    qsort(c, n, sizeof(hnsw_cand_t), compare_cand_desc);
+    links[0] = (uint32_t)select_neighbors(h, c, n, max_links, links + 1);
+}
+
+// --- STORAGE DEI NODI ---
+
+static int hnsw_reserve(l2_hnsw_t *h, size_t new_cap) {
+    float *vectors = realloc(h->vectors, new_cap * h->vector_dim * sizeof(float));
+    if (!vectors) return -1;
+    h->vectors = vectors;
+    uint32_t *links0 = realloc(h->links0, new_cap * (1 + h->m0) * sizeof(uint32_t));
+    if (!links0) return -1;
+    h->links0 = links0;
+    uint32_t **links_up = realloc(h->links_up, new_cap * sizeof(uint32_t *));
+    if (!links_up) return -1;
+    h->links_up = links_up;
+    uint8_t *levels = realloc(h->levels, new_cap);
+    if (!levels) return -1;
+    h->levels = levels;
+    uint8_t *deleted = realloc(h->deleted, new_cap);
+    if (!deleted) return -1;
+    h->deleted = deleted;
+    time_t *expire_at = realloc(h->expire_at, new_cap * sizeof(time_t));
+    if (!expire_at) return -1;
+    h->expire_at = expire_at;
+    l2_text_filter_t *features = realloc(h->features, new_cap * sizeof(l2_text_filter_t));
+    if (!features) return -1;
+    h->features = features;
+    l2_usage_t *usage = realloc(h->usage, new_cap * sizeof(l2_usage_t));
+    if (!usage) return -1;
+    h->usage = usage;
+    l2_text_t *texts = realloc(h->texts, new_cap * sizeof(l2_text_t));
+    if (!texts) return -1;
+    h->texts = texts;
+    uint32_t *free_ids = realloc(h->free_ids, new_cap * sizeof(uint32_t));
+    if (!free_ids) return -1;
+    h->free_ids = free_ids;
+    h->capacity = new_cap;
+    return 0;
+}
+
+// Marca il nodo come tombstone (testi liberati subito, i link restano fino alla riparazione)
+static void node_kill(l2_hnsw_t *h, uint32_t id) {
+    l2_keys_remove(h->keys, h->texts[id].key, id);
+    h->texts[id].key = L2_KEY_NONE;
+    l2_lex_remove(h->lex, h->texts[id].lex_doc);
+    h->texts[id].lex_doc = L2_LEX_NONE;
+    free(h->texts[id].original_prompt);
+    vs_release(h->values, h->texts[id].response);
+    h->texts[id].original_prompt = NULL;
+    h->texts[id].response = NULL;
+    h->deleted[id] = 1;
+    h->live--;
+    h->tombstones++;
+}
+
+static void hnsw_reset_graph(l2_hnsw_t *h) {
+    for (size_t i = 0; i < h->count; i++) {
+        if (!h->deleted[i]) {
+            l2_lex_remove(h->lex, h->texts[i].lex_doc);
+            free(h->texts[i].original_prompt);
+            vs_release(h->values, h->texts[i].response);
+        }
+        free(h->links_up[i]);
+    }
+    l2_keys_clear(h->keys);
+    h->count = 0;
+    h->live = 0;
+    h->tombstones = 0;
+    h->free_count = 0;
+    h->max_level = -1;
+    h->entry = 0;
+}
+
+// Ricollega una lista che punta a tombstone: candidati = vicini vivi + vicini vivi dei morti
+static int repair_list(l2_hnsw_t *h, uint32_t id, int level) {
+    uint32_t *links = node_links(h, id, level);
+    int dead = 0;
+    for (uint32_t i = 0; i < links[0]; i++) dead += h->deleted[links[1 + i]];
+    if (!dead) return 0;
+
+    int max_links = level_max_links(h, level);
+    hnsw_ctx_t *ctx = &h->writer;
+    if (scratch_reserve(ctx, (size_t)max_links * (max_links + 1)) != 0 || visited_reset(h, ctx) != 0) return -1;
+    ctx->visited[id] = ctx->epoch;
+
+    const float *base = node_vec(h, id);
+    size_t n = 0;
+    for (uint32_t i = 0; i < links[0]; i++) {
+        uint32_t nb = links[1 + i];
+        if (h->deleted[nb]) {
+            // Eredita i vicini vivi del nodo morto (se presente a questo livello)
+            if (h->levels[nb] < level) continue;
+            const uint32_t *dl = node_links(h, nb, level);
+            for (uint32_t j = 0; j < dl[0]; j++) {
+                uint32_t x = dl[1 + j];
+                if (h->deleted[x] || ctx->visited[x] == ctx->epoch) continue;
+                ctx->visited[x] = ctx->epoch;
+                ctx->scratch[n].id = x;
+                ctx->scratch[n].score = h->vk.dot(base, node_vec(h, x), h->vector_dim);
+                n++;
+            }
+        } else if (ctx->visited[nb] != ctx->epoch) {
+            ctx->visited[nb] = ctx->epoch;
+            ctx->scratch[n].id = nb;
+            ctx->scratch[n].score = h->vk.dot(base, node_vec(h, nb), h->vector_dim);
+            n++;
+        }
+    }
+    qsort(ctx->scratch, n, sizeof(hnsw_cand_t), compare_cand_desc);
+    links[0] = (uint32_t)select_neighbors(h, ctx->scratch, n, max_links, links + 1);
+    return 0;
+}
+
+// Riparazione periodica: nessuna lista punta più a tombstone, i loro slot tornano liberi
+static void hnsw_repair(l2_hnsw_t *h) {
+    if (h->live == 0) {
+        hnsw_reset_graph(h);
+        return;
+    }
+
+    for (size_t i = 0; i < h->count; i++) {
+        if (h->deleted[i]) continue;
+        for (int l = 0; l <= h->levels[i]; l++) {
+            if (repair_list(h, (uint32_t)i, l) != 0) return; // OOM: si riprova alla prossima
+        }
+    }
+
+    // Nuovo entry point se quello attuale è morto: il nodo vivo più alto
+    if (h->deleted[h->entry]) {
+        int best_level = -1;
+        for (size_t i = 0; i < h->count; i++) {
+            if (!h->deleted[i] && h->levels[i] > best_level) {
+                best_level = h->levels[i];
+                h->entry = (uint32_t)i;
+            }
+        }
+        h->max_level = best_level;
+    }
+
+    // Slot dei tombstone riciclabili (free_count non distingue gli slot già liberi)
+    h->free_count = 0;
+    for (size_t i = 0; i < h->count; i++) {
+        if (!h->deleted[i]) continue;
+        free(h->links_up[i]);
+        h->links_up[i] = NULL;
+        h->levels[i] = 0;
+        h->free_ids[h->free_count++] = (uint32_t)i;
+    }
+    log_debug("L2 HNSW riparato: %zu tombstone rimossi, %zu nodi vivi", h->tombstones, h->live);
+    h->tombstones = 0;
+}
+
+static void hnsw_maybe_repair(l2_hnsw_t *h) {
+    if (h->tombstones >= HNSW_REPAIR_MIN && h->tombstones * HNSW_REPAIR_RATIO >= h->count) {
+        hnsw_repair(h);
+    }
+}
+
+// --- EVICTION ---
+
+// Periodo di decay del contatore LFU: una capacità intera di tick senza accessi
+static inline uint32_t usage_decay(const l2_hnsw_t *h) {
+    return h->max_capacity < UINT32_MAX ? (uint32_t)h->max_capacity : UINT32_MAX;
+}
+
+// Eviction a campione (O(1)): L2_EVICTION_SAMPLES nodi vivi casuali, diventa tombstone
+// quello con il valore più basso per la policy. Un nodo già scaduto viene preso subito
+static int hnsw_evict_one(l2_hnsw_t *h) {
+    time_t now = clock_now();
+    uint32_t decay = usage_decay(h);
+    long victim = -1;
+    double victim_rank = 0.0;
+    int taken = 0;
+    // I tombstone sono al più 1/8 degli slot (riparazione): pochi tentativi a vuoto
+    for (int attempt = 0; attempt < L2_EVICTION_SAMPLES * 8 && taken < L2_EVICTION_SAMPLES; attempt++) {
+        uint32_t id = (uint32_t)((size_t)rand_r(&h->seed) % h->count);
+        if (h->deleted[id]) continue;
+        taken++;
+        if (now > h->expire_at[id]) {
+            victim = id;
+            break;
+        }
+        double rank = l2_eviction_rank(h->eviction, &h->usage[id], h->expire_at[id], h->clock, decay);
+        if (victim == -1 || rank < victim_rank) {
+            victim = id;
+            victim_rank = rank;
+        }
+    }
+    if (victim == -1) return -1;
+    node_kill(h, (uint32_t)victim);
+    return 0;
+}
+
+static int hnsw_evict(void *index) {
+    l2_hnsw_t *h = index;
+    return h->live > 0 ? hnsw_evict_one(h) : -1;
+}
+
+// --- API ---
+
+static void *hnsw_create(const l2_config_t *config, const l2_shared_t *shared) {
+    l2_hnsw_t *h = calloc(1, sizeof(l2_hnsw_t));
+    if (!h) return NULL;
+    h->values = shared->values;
+
+    h->vector_dim = config->vector_dim;
+    h->m = config->hnsw_m > 1 ? config->hnsw_m : HNSW_DEFAULT_M;
+    h->m0 = 2 * h->m;
+    h->ef_search = config->hnsw_ef_search > 0 ? config->hnsw_ef_search : HNSW_DEFAULT_EF_SEARCH;
+    h->ef_construction = HNSW_EF_CONSTRUCTION > h->ef_search ? HNSW_EF_CONSTRUCTION : h->ef_search;
+    h->level_mult = 1.0 / log((double)h->m);
+    h->max_capacity = config->max_capacity;
+    h->eviction = config->eviction;
+    h->max_level = -1;
+    h->seed = 0x45a5;
+    vec_kernels_select(&h->vk, h->vector_dim);
+
+    if (hnsw_reserve(h, HNSW_MIN_CAP) != 0) {
+        free(h->vectors); free(h->links0); free(h->links_up); free(h->levels); free(h->deleted);
+        free(h->expire_at); free(h->features); free(h->usage); free(h->texts); free(h->free_ids);
+        free(h);
+        return NULL;
+    }
+    pthread_mutex_init(&h->ctx_lock, NULL);
+    // Senza indice lessicale si continua: ricerca solo vettoriale
+    if (config->lexical && !(h->lex = l2_lex_create())) {
+        log_warn("L2 HNSW: indice lessicale non disponibile, ricerca solo vettoriale");
+    }
+    if (!(h->keys = l2_keys_create())) {
+        log_warn("L2 HNSW: indice dei prompt non disponibile, DELETE solo semantico");
+    }
+
+    log_info("L2 Cache HNSW creata: Dim %d, M=%d, efSearch=%d, efConstruction=%d",
+             h->vector_dim, h->m, h->ef_search, h->ef_construction);
+    log_info("L2 Kernel: %s%s", h->vk.isa, h->vk.specialized ? " (srotolato per questa dim)" : "");
+    log_info("L2 Eviction: %s (%d campioni)", l2_eviction_name(h->eviction), L2_EVICTION_SAMPLES);
+    if (config->storage != L2_STORAGE_F32 || config->prefilter != L2_PREFILTER_NONE) {
+        log_warn("L2 HNSW: VECS_L2_STORAGE/VECS_L2_PREFILTER valgono solo per l'indice IVF (vettori float32)");
+    }
+    return h;
+}
+
+static void hnsw_destroy(void *index) {
+    l2_hnsw_t *h = index;
+    if (!h) return;
+    // Tutto va distrutto: inutile togliere le entry lessicali una alla volta
+    l2_lex_destroy(h->lex);
+    h->lex = NULL;
+    l2_keys_destroy(h->keys);
+    h->keys = NULL;
+    hnsw_reset_graph(h);
+    free(h->vectors);
+    free(h->links0);
+    free(h->links_up);
+    free(h->levels);
+    free(h->deleted);
+    free(h->expire_at);
+    free(h->features);
+    free(h->usage);
+    free(h->texts);
+    free(h->free_ids);
+    ctx_release_buffers(&h->writer);
+    while (h->spare_ctx) {
+        hnsw_ctx_t *next = h->spare_ctx->next;
+        ctx_release_buffers(h->spare_ctx);
+        free(h->spare_ctx);
+        h->spare_ctx = next;
+    }
+    pthread_mutex_destroy(&h->ctx_lock);
+    free(h);
+}
+
+static int hnsw_insert(void *index, const float *vector, const char *prompt_text, uint64_t key,
+                       const l2_text_filter_t *features, const char *response, time_t expire_at) {
+    l2_hnsw_t *h = index;
+    if (h->live >= h->max_capacity) {
+        // Grafo pieno: si libera un posto secondo la policy (o si rifiuta)
+        if (h->eviction == L2_EVICT_NONE || h->count == 0 || hnsw_evict_one(h) != 0) return -1;
+    }
+    h->clock++;
+
+    hnsw_maybe_repair(h);
+
+    uint32_t id;
+    if (h->free_count > 0) {
+        id = h->free_ids[--h->free_count];
+    } else {
+        if (h->count == h->capacity && hnsw_reserve(h, h->capacity * 2) != 0) return -1;
+        id = (uint32_t)h->count;
+    }
+
+    char *p = prompt_text ? strdup(prompt_text) : NULL;
+    vs_value_t *r = vs_intern(h->values, response);
+    int level = random_level(h);
+    uint32_t *up = NULL;
+    if (level > 0) up = calloc((size_t)level * (1 + h->m), sizeof(uint32_t));
+    if ((prompt_text && !p) || !r || (level > 0 && !up)) {
+        free(p); vs_release(h->values, r); free(up);
+        if (id < h->count) h->free_ids[h->free_count++] = id;
+        return -1;
+    }
+
+    if (id == h->count) h->count++;
+    memcpy(h->vectors + (size_t)id * h->vector_dim, vector, h->vector_dim * sizeof(float));
+    h->links0[(size_t)id * (1 + h->m0)] = 0;
+    h->links_up[id] = up;
+    h->levels[id] = (uint8_t)level;
+    h->deleted[id] = 0;
+    h->expire_at[id] = expire_at;
+    h->features[id] = *features;
+    h->usage[id].last_access = 0;
+    h->usage[id].hits = 0;
+    l2_usage_touch(&h->usage[id], h->clock, usage_decay(h));
+    h->texts[id].original_prompt = p;
+    h->texts[id].response = r;
+    h->texts[id].lex_doc = l2_lex_add(h->lex, p, r, features, expire_at);
+    // Senza posizione registrata (OOM) il nodo resta raggiungibile dal delete semantico
+    h->texts[id].key = l2_keys_add(h->keys, key, id) == 0 ? key : L2_KEY_NONE;
+    h->live++;
+
+    if (h->max_level < 0) {
+        h->entry = id;
+        h->max_level = level;
+        return 0;
+    }
+
+    // 1. Discesa greedy fino al livello del nuovo nodo
+    uint32_t cur = h->entry;
+    for (int l = h->max_level; l > level; l--) cur = greedy_step(h, vector, cur, l);
+
+    // 2. Collegamento livello per livello (beam search ef_construction)
+    uint32_t *selected = malloc(h->m0 * sizeof(uint32_t));
+    if (!selected) return 0; // Nodo inserito ma non collegato: raggiungibile dopo la riparazione
+    hnsw_ctx_t *ctx = &h->writer;
+    for (int l = (level < h->max_level ? level : h->max_level); l >= 0; l--) {
+        if (search_layer(h, ctx, vector, cur, h->ef_construction, l) != 0) break;
+        size_t n = results_sorted(ctx);
+        if (n == 0) break;
+        cur = ctx->scratch[0].id;
+
+        int count = select_neighbors(h, ctx->scratch, n, h->m, selected);
+        uint32_t *links = node_links(h, id, l);
+        links[0] = (uint32_t)count;
+        for (int i = 0; i < count; i++) {
+            links[1 + i] = selected[i];
+            add_link(h, selected[i], id, l);
+        }
+    }
+    free(selected);
+
+    if (level > h->max_level) {
+        h->max_level = level;
+        h->entry = id;
+    }
+    return 0;
+}
+
+// Beam search completa (discesa + livello 0); risultati ordinati in ctx->scratch
+static size_t hnsw_knn(const l2_hnsw_t *h, hnsw_ctx_t *ctx, const float *query_vector, int ef) {
+    if (h->max_level < 0 || h->live == 0) return 0;
+    uint32_t cur = h->entry;
+    for (int l = h->max_level; l > 0; l--) cur = greedy_step(h, query_vector, cur, l);
+    if (search_layer(h, ctx, query_vector, cur, ef, 0) != 0) return 0;
+    return results_sorted(ctx);
+}
+
+static int hnsw_search(void *index, const float *query_vector, const l2_text_filter_t *filter, float threshold,
+                       l2_search_result_t *results, int top_k, int record_hits) {
+    l2_hnsw_t *h = index;
+    hnsw_ctx_t *ctx = ctx_acquire(h);
+    if (!ctx) return 0;
+    // La beam search deve restituire almeno top_k candidati
+    size_t n = hnsw_knn(h, ctx, query_vector, h->ef_search > top_k ? h->ef_search : top_k);
+
+    time_t now = clock_now();
+
+    l2_candidate_t best[L2_MAX_TOPK];
+    int best_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t id = ctx->scratch[i].id;
+        // I nodi scaduti si saltano: li rende tombstone il ciclo di scadenza attivo
+        if (h->deleted[id] || now > h->expire_at[id]) continue;
+        float dot = ctx->scratch[i].score;
+        float penalized = l2_apply_hybrid_filters(filter, &h->features[id], dot);
+        best_count = l2_candidate_push(best, best_count, top_k, 0, id, penalized, dot);
+    }
+    ctx_release(h, ctx);
+
+    int found = 0;
+    while (found < best_count && best[found].score >= threshold) {
+        size_t id = best[found].row;
+        if (record_hits) {
+            uint32_t tick = atomic_fetch_add_explicit(&h->clock, 1, memory_order_relaxed) + 1;
+            l2_usage_touch(&h->usage[id], tick, usage_decay(h));
+        }
+        results[found].response = vs_data(h->texts[id].response);
+        results[found].prompt = h->texts[id].original_prompt;
+        results[found].score = best[found].raw;
+        results[found].penalized_score = best[found].score;
+        results[found].expire_at = h->expire_at[id];
+        results[found].loc = id;
+        found++;
+    }
+    if (found > 0 && record_hits) {
+        log_info("HIT L2 (HNSW Score: %.4f) Node %zu%s", best[0].score, best[0].row, found > 1 ? " (top-k)" : "");
+    }
+    return found;
+}
+
+// HIT dei risultati scelti dalla facciata. Gli id sono stabili; senza posizione
+// (shortcut lessicale) il nodo vivo con la stessa chiave del prompt e la stessa risposta
+static void hnsw_touch(void *index, const l2_search_result_t *results, int n) {
+    l2_hnsw_t *h = index;
+    for (int i = 0; i < n; i++) {
+        uint64_t ids[16];
+        int m = 1;
+        uint64_t key = L2_KEY_NONE;
+        ids[0] = results[i].loc;
+        if (results[i].loc == L2_LOC_NONE) {
+            key = l2_keys_hash(results[i].prompt);
+            m = key != L2_KEY_NONE ? l2_keys_find(h->keys, key, ids, 16) : 0;
+        }
+        for (int j = 0; j < m; j++) {
+            if (ids[j] >= h->count || h->deleted[ids[j]]) continue;
+            uint32_t id = (uint32_t)ids[j];
+            if (key != L2_KEY_NONE &&
+                (h->texts[id].key != key || vs_data(h->texts[id].response) != results[i].response)) {
+                continue;
+            }
+            uint32_t tick = atomic_fetch_add_explicit(&h->clock, 1, memory_order_relaxed) + 1;
+            l2_usage_touch(&h->usage[id], tick, usage_decay(h));
+            break;
+        }
+    }
+}
+
+static int hnsw_delete_semantic(void *index, const float *query_vector) {
+    l2_hnsw_t *h = index;
+    hnsw_ctx_t *ctx = &h->writer;
+    size_t n = hnsw_knn(h, ctx, query_vector, h->ef_search);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t id = ctx->scratch[i].id;
+        if (h->deleted[id]) continue;
+        if (ctx->scratch[i].score < HNSW_DELETE_THRESHOLD) break; // Ordinati: nessun altro match
+        node_kill(h, id);
+        log_info("L2 Semantic Delete OK.");
+        hnsw_maybe_repair(h);
+        return 1;
+    }
+    return 0;
+}
+
+// Delete esatto: gli id dei nodi non cambiano, le posizioni si leggono tutte insieme
+static int hnsw_delete_key(void *index, uint64_t key) {
+    l2_hnsw_t *h = index;
+    int deleted = 0;
+    uint64_t ids[16];
+    int n;
+    while ((n = l2_keys_find(h->keys, key, ids, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            uint32_t id = (uint32_t)ids[i];
+            if (ids[i] >= h->count || h->deleted[id] || h->texts[id].key != key) {
+                log_warn("L2 HNSW: posizione non valida nell'indice dei prompt, ignorata");
+                l2_keys_remove(h->keys, key, ids[i]);
+                continue;
+            }
+            node_kill(h, id);
+            deleted++;
+        }
+    }
+    if (deleted > 0) hnsw_maybe_repair(h);
+    return deleted;
+}
+
+static void hnsw_clear(void *index) {
+    l2_hnsw_t *h = index;
+    if (!h) return;
+    hnsw_reset_graph(h);
+    log_debug("L2 Cache (HNSW) svuotata.");
+}
+
+// Ciclo di scadenza attivo: scorre gli slot a rotazione e rende tombstone i nodi
+// scaduti; la riparazione del grafo scatta con le stesse soglie della cancellazione
+static size_t hnsw_expire(void *index, size_t budget, size_t *examined) {
+    l2_hnsw_t *h = index;
+    time_t now = clock_now();
+    size_t removed = 0, seen = 0;
+    if (budget > h->count) budget = h->count;
+
+    for (size_t n = 0; n < budget; n++) {
+        if (h->expire_cursor >= h->count) h->expire_cursor = 0;
+        uint32_t id = (uint32_t)h->expire_cursor++;
+        if (h->deleted[id]) continue;
+        seen++;
+        if (now > h->expire_at[id]) {
+            node_kill(h, id);
+            removed++;
+        }
+    }
+    if (removed > 0) hnsw_maybe_repair(h);
+    if (examined) *examined = seen;
+    return removed;
+}
+
+static int hnsw_foreach(void *index, l2_entry_fn fn, void *ctx) {
+    l2_hnsw_t *h = index;
+    int count = 0;
+    time_t now = clock_now();
+    for (size_t i = 0; i < h->count; i++) {
+        if (h->deleted[i] || h->expire_at[i] <= now) continue;
+        fn(ctx, node_vec(h, (uint32_t)i), h->texts[i].original_prompt, h->texts[i].key, &h->features[i],
+           vs_data(h->texts[i].response), h->expire_at[i]);
+        count++;
+    }
+    return count;
+}
+
+static size_t hnsw_count(void *index) {
+    return ((l2_hnsw_t *)index)->live;
+}
+
+static const l2_lex_t *hnsw_lexicon(void *index) {
+    return ((l2_hnsw_t *)index)->lex;
+}
+
+const l2_index_ops_t l2_hnsw_ops = {
+    .name = "hnsw",
+    .create = hnsw_create,
+    .destroy = hnsw_destroy,
+    .insert = hnsw_insert,
+    .search = hnsw_search,
+    .touch = hnsw_touch,
+    .delete_semantic = hnsw_delete_semantic,
+    .evict = hnsw_evict,
+    .delete_key = hnsw_delete_key,
+    .clear = hnsw_clear,
+    .foreach = hnsw_foreach,
+    .count = hnsw_count,
+    .expire = hnsw_expire,
+    .lexicon = hnsw_lexicon,
+};
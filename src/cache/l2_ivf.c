@@ -0,0 +1,2255 @@
+/*
+ * Vecs Project: IVFFlat / IVF-PQ Adaptive Index (L2)
+ * (src/cache/l2_ivf.c)
+ */
+
+#include "l2_index.h"
+#include "logger.h"
+#include "vec_kernels.h"
+#include "l2_pq.h"
+#include "l2_proj.h"
+#include "l2_lex.h"
+#include "l2_keys.h"
+#include "kmeans.h"
+#include "sys_info.h"
+#include "clock.h"
+#include "task_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <float.h>
+#include <pthread.h>
+
+// --- COSTANTI DI TUNING ---
+#define NUM_CLUSTERS 64      // Numero massimo di "secchi" del bootstrap (poi split/merge)
+#define MIN_CLUSTERS N_PROBE // Sotto questa soglia (con nprobe di default) la ricerca è già esaustiva
+#define MAX_CLUSTERS 8192
+#define N_PROBE 4            // Default: quanti secchi controllare al massimo durante la ricerca (Precisione vs Velocità)
+#define RADIUS_SLACK 0.01f   // Margine sul bound del raggio (errore di int8 e arrotondamenti)
+#define SPLIT_FACTOR 2       // Split (2-means locale) oltre 2x la dimensione target
+#define MERGE_FACTOR 8       // Merge sotto 1/8 della dimensione target
+#define SPLIT_ITERATIONS 8
+#define MIN_TARGET_ROWS 64   // Dimensione target minima di un cluster
+#define DEFAULT_L2_BYTES (1024 * 1024) // Cache L2 ipotizzata se non rilevabile
+#define ADAPT_RATE 0.1f      // Quanto velocemente i centroidi si adattano ai nuovi dati (0.1 = 10%)
+#define MIN_CLUSTER_CAP 16   // Capacità minima (in righe) di un cluster allocato
+#define ROW_ALIGN 64         // Allineamento righe della matrice (cache line / AVX-512)
+#define DEFAULT_RERANK_K 16  // Candidati int8 rivalutati con la query float
+#define MAX_RERANK_K 256
+#define BINARY_PROBE_FACTOR 4 // Con il prefiltro binario si sondano 4x cluster a parità di latenza
+#define PQ_TRAIN_MIN 1024    // Entry necessarie prima di addestrare i codebook PQ
+#define PQ_TRAIN_SAMPLE 4096 // Residui usati al massimo per l'addestramento
+#define DEFAULT_REDUCED_DIM 128 // Prefiltro ridotto: dimensioni della copia compatta
+#define MIN_REDUCED_DIM 16
+#define REDUCE_TRAIN_MIN 1024 // Entry necessarie prima di addestrare la PCA
+#define REDUCE_TRAIN_SAMPLE 2048 // Vettori usati al massimo per la PCA
+#define CENTROID_SHORTLIST 4 // Prefiltro ridotto: cluster per probe rivalutati sul centroide completo
+#define NEAREST_SHORTLIST 4  // Prefiltro ridotto: centroidi rivalutati per scegliere il cluster di una riga
+#define RETRAIN_MIN 1024     // Entry necessarie prima del primo k-means dei centroidi
+#define RETRAIN_SAMPLE 16384 // Vettori campionati per il k-means in background
+#define RETRAIN_BATCH 1024   // Dimensione del mini-batch
+#define RETRAIN_ITERATIONS 64
+#define MIGRATE_BUDGET 1024  // Righe spostate (migrazione, split, merge) per ciclo di manutenzione
+#define PARALLEL_MIN_ROWS 32768 // Default: righe sondate oltre cui lo scan si divide tra i thread
+#define MIN_SLICE_ROWS 2048  // Righe minime di una fetta dello scan parallelo
+#define SLICES_PER_THREAD 4  // Fette per thread: bilanciano cluster di dimensioni diverse
+
+// Dati "freddi" di una entry: letti solo su HIT e dal salvataggio su disco
+typedef struct {
+    char *original_prompt;   // NULL se i prompt non sono conservati
+    vs_value_t *response;    // Internata nel value store (condivisa con la L1)
+    uint64_t key;            // Chiave del prompt nell'indice dei prompt (L2_KEY_NONE se assente)
+    uint32_t lex_doc;        // Entry nell'indice lessicale (L2_LEX_NONE se assente)
+} l2_text_t;
+
+// Struttura del Cluster (Bucket) in layout Structure-of-Arrays:
+// la riga i di ogni array descrive la stessa entry.
+typedef struct {
+    float *centroid;         // Il vettore "media" di questo cluster
+    float *rcentroid;        // Centroide nello spazio ridotto (solo prefiltro ridotto attivo)
+    uint8_t *codes;          // Matrice row-major [capacity x row_bytes], allineata a ROW_ALIGN
+    float *scales;           // Scala per-vettore (solo L2_STORAGE_INT8)
+    uint64_t *bits;          // Codici di segno [capacity x code_words] (solo prefiltro binario)
+    uint8_t *pq_codes;       // Codici PQ dei residui [capacity x pq_m] (solo IVF-PQ addestrato)
+    float *reduced;          // Copie ridotte normalizzate [capacity x reduced_dim] (solo prefiltro ridotto attivo)
+    time_t *expire_at;       // Scadenze (hot, lette durante lo scan)
+    l2_text_filter_t *features; // Feature dei filtri ibridi (hot, precalcolate all'inserimento)
+    l2_usage_t *usage;       // Statistiche d'uso per l'eviction (fredde: toccate su HIT)
+    l2_text_t *texts;        // Storage freddo (prompt/risposta)
+    size_t size;
+    size_t capacity;
+    int is_initialized;      // 0 se il centroide è vuoto/random, 1 se ha dati reali
+    size_t split_floor;      // Split degenere: non si ritenta finché il cluster non supera questa dimensione
+    float min_sim;           // Raggio: similarità minima entry/centroide (-1 = ignoto, centroide in movimento)
+    time_t min_expire;       // Bound inferiore delle scadenze: prima di allora nessuna riga è scaduta
+} l2_cluster_t;
+
+// Cosa addestra il thread in background
+typedef enum {
+    RETRAIN_CENTROIDS = 0,   // k-means dei centroidi IVF
+    RETRAIN_PQ,              // Codebook PQ dei residui
+    RETRAIN_PCA              // Proiezione del prefiltro ridotto
+} retrain_kind_t;
+
+// Job di ri-addestramento: il thread lavora solo su copie private (campione e
+// modello di output), il main thread le legge dopo aver visto done = 1.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int done;
+    int discard;             // FLUSH durante il calcolo: risultato da scartare
+    retrain_kind_t kind;
+    float *sample;           // [n x dim] (residui per i codebook PQ)
+    size_t n;
+    int dim;
+    int k;
+    float *centroids;        // [k x dim] (solo centroidi)
+    l2_pq_t *pq;             // Quantizzatore privato da addestrare (solo PQ)
+    l2_proj_t *proj;         // Proiezione privata da addestrare (solo PCA)
+    int rc;
+    vec_kernels_t vk;
+} l2_retrain_t;
+
+// Struttura principale dell'indice
+typedef struct {
+    l2_cluster_t *clusters;  // Cluster attivi (ricevono gli inserimenti)
+    int num_clusters;
+    l2_cluster_t *draining;  // Generazione precedente: ancora cercata, svuotata dalla manutenzione
+    int num_draining;
+    l2_retrain_t *retrain;   // k-means in background in corso (NULL se nessuno)
+    int generation;          // Ri-addestramenti applicati (0 = centroidi da bootstrap + EMA)
+    size_t inserts_since_train;
+    size_t trained_count;    // Entry presenti all'avvio dell'ultimo ri-addestramento
+    float *migrate_buf;      // Vettore decodificato durante la migrazione
+    size_t target_rows;      // Dimensione target dei cluster (0 = automatica)
+    size_t l2_budget;        // Byte di scan per cluster che stanno nella cache L2 della CPU
+    time_t last_rebalance;   // Ultimo controllo split/merge
+    int rebalance_pending;   // Split/merge interrotti per esaurimento del budget
+    int nprobe;              // Cluster sondati al massimo per ricerca (recall vs latenza)
+    int initial_clusters;    // Cluster del bootstrap (ripristinati dal FLUSH)
+    int expire_cursor;       // Prossimo cluster del ciclo di scadenza attivo
+    int vector_dim;
+    l2_storage_t storage;    // Formato delle righe (float32 o int8)
+    int rerank_k;
+    l2_prefilter_t prefilter;
+    int code_words;          // Parole a 64 bit per codice binario
+    size_t row_bytes;        // Byte per riga (vettore codificato arrotondato a ROW_ALIGN), 0 = nessuna copia
+    l2_pq_t *pq;             // Quantizzatore dei residui (solo IVF-PQ)
+    int pq_m;                // Byte per codice PQ
+    int pq_rerank;           // Mantiene le righe complete anche dopo l'addestramento PQ
+    size_t pq_next_train;    // Soglia di entry per il prossimo tentativo di addestramento
+    float *pq_scratch;       // Buffer residuo per l'inserimento
+    l2_proj_t *proj;         // Proiezione del prefiltro ridotto (NULL se non configurato)
+    int reduced_dim;
+    size_t reduce_next_train; // Soglia di entry per il prossimo tentativo di PCA
+    float *reduce_buf;       // Vettore proiettato per la scelta del cluster (solo scritture)
+    vec_kernels_t rvk;       // Kernel per reduced_dim
+    size_t total_count;      // Numero totale di elementi in tutti i cluster
+    size_t max_global_capacity;
+    l2_eviction_t eviction;
+    _Atomic uint32_t clock;  // Clock logico degli accessi (LRU/LFU), avanzato anche dalle ricerche
+    unsigned int seed;       // Campionamento dell'eviction
+    vec_kernels_t vk;        // Kernel SIMD scelti a runtime per vector_dim
+    task_pool_t *search_pool; // Thread dello scan parallelo, della facciata (NULL = sempre seriale)
+    size_t parallel_min_rows;
+    value_store_t *values;   // Store delle risposte
+    l2_lex_t *lex;           // Indice lessicale sui prompt (NULL se disattivato)
+    l2_keys_t *keys;         // Indice dei prompt per il delete esatto (posizioni: row_loc)
+} l2_ivf_t;
+
+// --- HELPER MATH ---
+
+// Prodotto scalare (Dot Product): dispatch al kernel SIMD scelto alla creazione
+static inline float vec_dot(const l2_ivf_t *cache, const float *a, const float *b) {
+    return cache->vk.dot(a, b, cache->vector_dim);
+}
+
+// Cluster attivi e in svuotamento condividono lo spazio degli indici: [attivi | draining]
+static inline int cluster_slots(const l2_ivf_t *cache) {
+    return cache->num_clusters + cache->num_draining;
+}
+
+static inline l2_cluster_t *cluster_at(const l2_ivf_t *cache, int idx) {
+    return idx < cache->num_clusters ? &cache->clusters[idx] : &cache->draining[idx - cache->num_clusters];
+}
+
+// Posizione di una riga nell'indice dei prompt: generazione dei centroidi (16 bit),
+// cluster nel proprio array (16 bit) e riga (32 bit). I cluster attivi hanno la
+// generazione corrente, quelli in svuotamento la precedente: l'installazione di
+// nuovi centroidi non sposta nessuna posizione, e gli array in svuotamento perdono
+// solo l'ultimo cluster. Cambiano posizione le righe dello swap-remove, delle
+// migrazioni e del cluster che prende il posto di uno fuso
+static inline uint64_t loc_pack(int generation, int idx, size_t row) {
+    return ((uint64_t)(generation & 0xffff) << 48) | ((uint64_t)idx << 32) | (uint32_t)row;
+}
+
+static uint64_t row_loc(const l2_ivf_t *cache, const l2_cluster_t *c, size_t row) {
+    if (c >= cache->clusters && c < cache->clusters + cache->num_clusters) {
+        return loc_pack(cache->generation, (int)(c - cache->clusters), row);
+    }
+    return loc_pack(cache->generation - 1, (int)(c - cache->draining), row);
+}
+
+// Cluster e riga di una posizione (NULL se non corrisponde a nessuna riga)
+static l2_cluster_t *loc_resolve(const l2_ivf_t *cache, uint64_t loc, size_t *row) {
+    int generation = (int)(loc >> 48);
+    int idx = (int)((loc >> 32) & 0xffff);
+    l2_cluster_t *c = NULL;
+    if (generation == (cache->generation & 0xffff) && idx < cache->num_clusters) {
+        c = &cache->clusters[idx];
+    } else if (generation == ((cache->generation - 1) & 0xffff) && idx < cache->num_draining) {
+        c = &cache->draining[idx];
+    }
+    *row = (uint32_t)loc;
+    return (c && *row < c->size) ? c : NULL;
+}
+
+// Aggiorna il centroide (Media mobile esponenziale semplificata)
+// centroid = centroid * (1 - rate) + new_vec * rate
+static void update_centroid(const l2_ivf_t *cache, float *centroid, const float *new_vec) {
+    cache->vk.axpby(centroid, new_vec, 1.0f - ADAPT_RATE, ADAPT_RATE, cache->vector_dim);
+    // Rinormalizzazione (importante per cosine similarity)
+    vec_kernels_normalize(&cache->vk, centroid, cache->vector_dim);
+}
+
+// --- CODIFICA RIGHE ---
+
+static const char *storage_name(l2_storage_t storage) {
+    switch (storage) {
+        case L2_STORAGE_INT8: return "int8";
+        case L2_STORAGE_F16: return "f16";
+        case L2_STORAGE_BF16: return "bf16";
+        default: return "f32";
+    }
+}
+
+static size_t storage_elem_size(l2_storage_t storage) {
+    switch (storage) {
+        case L2_STORAGE_INT8: return sizeof(int8_t);
+        case L2_STORAGE_F16:
+        case L2_STORAGE_BF16: return sizeof(uint16_t);
+        default: return sizeof(float);
+    }
+}
+
+static size_t storage_row_bytes(l2_storage_t storage, int dim) {
+    size_t used = (size_t)dim * storage_elem_size(storage);
+    return (used + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+}
+
+// IVF-PQ attivo: codebook addestrati e codici presenti in ogni cluster
+static inline int pq_active(const l2_ivf_t *cache) {
+    return cache->pq && l2_pq_is_trained(cache->pq);
+}
+
+// Prefiltro ridotto attivo: proiezione pronta (prefisso subito, PCA dopo l'addestramento)
+// e copie ridotte presenti in ogni cluster
+static inline int reduce_active(const l2_ivf_t *cache) {
+    return cache->proj && l2_proj_is_trained(cache->proj);
+}
+
+// Byte letti dallo scan per ogni riga: codice PQ, codice di segno, copia ridotta o riga completa
+static size_t scan_row_bytes(const l2_ivf_t *cache) {
+    if (pq_active(cache)) return cache->pq_m;
+    if (cache->prefilter == L2_PREFILTER_BINARY) return cache->code_words * sizeof(uint64_t);
+    if (reduce_active(cache)) return cache->reduced_dim * sizeof(float);
+    return cache->row_bytes;
+}
+
+// Dimensione target dei cluster per n entry: quella configurata, oppure il punto in cui
+// la scansione dei centroidi costa quanto quella degli nprobe cluster sondati, limitato
+// al budget L2 (lo scan di un probe non esce dalla cache)
+static size_t cluster_target(const l2_ivf_t *cache, size_t n) {
+    if (cache->target_rows > 0) return cache->target_rows;
+    size_t row = scan_row_bytes(cache);
+    int centroid_dim = reduce_active(cache) ? cache->reduced_dim : cache->vector_dim;
+    double centroid_bytes = (double)centroid_dim * sizeof(float);
+    size_t rows = (size_t)sqrt((double)n * centroid_bytes / ((double)cache->nprobe * row));
+    size_t l2_rows = cache->l2_budget / row;
+    if (rows > l2_rows) rows = l2_rows;
+    return rows < MIN_TARGET_ROWS ? MIN_TARGET_ROWS : rows;
+}
+
+// Numero di cluster adatto a n entry
+static int clusters_for(const l2_ivf_t *cache, size_t n) {
+    size_t k = n / cluster_target(cache, n);
+    if (k < MIN_CLUSTERS) k = MIN_CLUSTERS;
+    if (k > MAX_CLUSTERS) k = MAX_CLUSTERS;
+    return (int)k;
+}
+
+// Query preparata una volta per ricerca (quantizzata solo per lo scan int8)
+typedef struct {
+    const float *vec;
+    int8_t *q8;
+    float q8_scale;
+    uint64_t *bits;      // Codice di segno della query (solo prefiltro binario)
+    float *lut;          // Tabella ADC [pq_m x PQ_KSUB] (solo IVF-PQ)
+    float pq_base;       // q . centroide del cluster in scansione (solo IVF-PQ)
+    float *reduced;      // Query proiettata (solo prefiltro ridotto)
+} l2_query_t;
+
+static int query_prepare(const l2_ivf_t *cache, l2_query_t *q, const float *vec) {
+    q->vec = vec;
+    q->q8 = NULL;
+    q->q8_scale = 0.0f;
+    q->bits = NULL;
+    q->lut = NULL;
+    q->pq_base = 0.0f;
+    q->reduced = NULL;
+    if (pq_active(cache)) {
+        // Tabella costruita una volta per query, condivisa da tutti i cluster sondati
+        q->lut = malloc((size_t)cache->pq_m * PQ_KSUB * sizeof(float));
+        if (!q->lut) return -1;
+        l2_pq_build_lut(cache->pq, vec, q->lut);
+    } else if (reduce_active(cache)) {
+        q->reduced = malloc(cache->reduced_dim * sizeof(float));
+        if (!q->reduced) return -1;
+        l2_proj_apply(cache->proj, vec, q->reduced);
+    } else if (cache->prefilter == L2_PREFILTER_BINARY) {
+        q->bits = malloc(cache->code_words * sizeof(uint64_t));
+        if (!q->bits) return -1;
+        vec_kernels_sign_bits(vec, q->bits, cache->vector_dim);
+    } else if (cache->storage == L2_STORAGE_INT8) {
+        q->q8 = malloc(cache->vector_dim);
+        if (!q->q8) return -1;
+        q->q8_scale = vec_kernels_quantize_i8(vec, q->q8, cache->vector_dim);
+    }
+    return 0;
+}
+
+static void query_release(l2_query_t *q) {
+    free(q->q8);
+    free(q->bits);
+    free(q->lut);
+    free(q->reduced);
+    q->q8 = NULL;
+    q->bits = NULL;
+    q->lut = NULL;
+    q->reduced = NULL;
+}
+
+// Scan approssimato (PQ, int8, Hamming o spazio ridotto): i migliori vanno rivalutati
+static inline int scan_approximate(const l2_ivf_t *cache, const l2_query_t *q) {
+    return q->lut || q->reduced || cache->storage == L2_STORAGE_INT8 || cache->prefilter == L2_PREFILTER_BINARY;
+}
+
+// --- STORAGE DEI CLUSTER (SoA) ---
+
+static inline uint8_t *cluster_row(const l2_ivf_t *cache, const l2_cluster_t *c, size_t i) {
+    return c->codes + i * cache->row_bytes;
+}
+
+// Score "esatto" riga/query: float32 pieno, oppure query float contro codici int8
+// o righe a 16 bit (convertite nel kernel)
+static inline float row_score(const l2_ivf_t *cache, const l2_cluster_t *c, size_t i, const float *q) {
+    switch (cache->storage) {
+        case L2_STORAGE_INT8:
+            return cache->vk.dot_f32_i8(q, (const int8_t *)cluster_row(cache, c, i), cache->vector_dim) * c->scales[i];
+        case L2_STORAGE_F16:
+            return cache->vk.dot_f32_f16(q, (const uint16_t *)cluster_row(cache, c, i), cache->vector_dim);
+        case L2_STORAGE_BF16:
+            return cache->vk.dot_f32_bf16(q, (const uint16_t *)cluster_row(cache, c, i), cache->vector_dim);
+        default:
+            return vec_dot(cache, q, (const float *)cluster_row(cache, c, i));
+    }
+}
+
+// Score approssimato per lo scan: ADC sui codici PQ, coseno sulle copie ridotte,
+// Hamming sui codici di segno, prodotto intero in int8, score della riga altrimenti
+static inline float row_score_fast(const l2_ivf_t *cache, const l2_cluster_t *c, size_t i, const l2_query_t *q) {
+    if (q->lut) {
+        return q->pq_base + l2_pq_adc(q->lut, c->pq_codes + i * cache->pq_m, cache->pq_m);
+    }
+    if (q->reduced) {
+        return cache->rvk.dot(q->reduced, c->reduced + i * cache->reduced_dim, cache->reduced_dim);
+    }
+    if (cache->prefilter == L2_PREFILTER_BINARY) {
+        int h = cache->vk.hamming(c->bits + i * cache->code_words, q->bits, cache->code_words);
+        return 1.0f - 2.0f * (float)h / (float)cache->vector_dim;
+    }
+    if (cache->storage == L2_STORAGE_INT8) {
+        int32_t d = cache->vk.dot_i8((const int8_t *)cluster_row(cache, c, i), q->q8, cache->vector_dim);
+        return (float)d * q->q8_scale * c->scales[i];
+    }
+    return row_score(cache, c, i, q->vec);
+}
+
+// Ricostruisce il vettore float della riga (per il salvataggio su disco)
+static void row_decode(const l2_ivf_t *cache, const l2_cluster_t *c, size_t i, float *out) {
+    if (cache->row_bytes == 0) {
+        // Solo codice PQ: centroide + residuo ricostruito
+        l2_pq_decode(cache->pq, c->pq_codes + i * cache->pq_m, out);
+        cache->vk.axpby(out, c->centroid, 1.0f, 1.0f, cache->vector_dim);
+    } else if (cache->storage == L2_STORAGE_INT8) {
+        const int8_t *row = (const int8_t *)cluster_row(cache, c, i);
+        for (int d = 0; d < cache->vector_dim; d++) out[d] = (float)row[d] * c->scales[i];
+    } else if (cache->storage == L2_STORAGE_F16) {
+        vec_kernels_from_f16((const uint16_t *)cluster_row(cache, c, i), out, cache->vector_dim);
+    } else if (cache->storage == L2_STORAGE_BF16) {
+        vec_kernels_from_bf16((const uint16_t *)cluster_row(cache, c, i), out, cache->vector_dim);
+    } else {
+        memcpy(out, cluster_row(cache, c, i), cache->vector_dim * sizeof(float));
+    }
+}
+
+// Porta la capacità del cluster a new_cap righe (cresce o restituisce memoria)
+static int cluster_reserve(const l2_ivf_t *cache, l2_cluster_t *c, size_t new_cap) {
+    if (new_cap < c->size) return -1;
+
+    size_t row_bytes = cache->row_bytes;
+    uint8_t *codes = NULL;
+    if (new_cap > 0 && row_bytes > 0) {
+        codes = aligned_alloc(ROW_ALIGN, new_cap * row_bytes);
+        if (!codes) return -1;
+        if (c->size > 0) memcpy(codes, c->codes, c->size * row_bytes);
+    }
+
+    if (cache->storage == L2_STORAGE_INT8 && row_bytes > 0) {
+        float *scales = realloc(c->scales, (new_cap ? new_cap : 1) * sizeof(float));
+        if (!scales) { free(codes); return -1; }
+        c->scales = scales;
+    }
+
+    if (cache->prefilter == L2_PREFILTER_BINARY) {
+        uint64_t *bits = realloc(c->bits, (new_cap ? new_cap : 1) * cache->code_words * sizeof(uint64_t));
+        if (!bits) { free(codes); return -1; }
+        c->bits = bits;
+    }
+
+    if (pq_active(cache)) {
+        uint8_t *pq_codes = realloc(c->pq_codes, (new_cap ? new_cap : 1) * cache->pq_m);
+        if (!pq_codes) { free(codes); return -1; }
+        c->pq_codes = pq_codes;
+    }
+
+    if (reduce_active(cache)) {
+        float *reduced = realloc(c->reduced, (new_cap ? new_cap : 1) * cache->reduced_dim * sizeof(float));
+        if (!reduced) { free(codes); return -1; }
+        c->reduced = reduced;
+    }
+
+    time_t *expire_at = realloc(c->expire_at, (new_cap ? new_cap : 1) * sizeof(time_t));
+    if (!expire_at) { free(codes); return -1; }
+    c->expire_at = expire_at;
+
+    l2_text_filter_t *features = realloc(c->features, (new_cap ? new_cap : 1) * sizeof(l2_text_filter_t));
+    if (!features) { free(codes); return -1; }
+    c->features = features;
+
+    l2_usage_t *usage = realloc(c->usage, (new_cap ? new_cap : 1) * sizeof(l2_usage_t));
+    if (!usage) { free(codes); return -1; }
+    c->usage = usage;
+
+    l2_text_t *texts = realloc(c->texts, (new_cap ? new_cap : 1) * sizeof(l2_text_t));
+    if (!texts) { free(codes); return -1; }
+    c->texts = texts;
+
+    free(c->codes);
+    c->codes = codes;
+    c->capacity = new_cap;
+    return 0;
+}
+
+// Accoda una riga al cluster prendendo possesso dei testi (anche della loro entry
+// lessicale, che non dipende dalla posizione). Ritorna l'indice della riga o -1 (OOM)
+static long cluster_push_owned(const l2_ivf_t *cache, l2_cluster_t *c, const float *vector,
+                               const l2_text_t *text, const l2_text_filter_t *features,
+                               time_t expire_at, const l2_usage_t *usage) {
+    if (c->size >= c->capacity) {
+        size_t new_cap = c->capacity ? c->capacity * 2 : MIN_CLUSTER_CAP;
+        if (cluster_reserve(cache, c, new_cap) != 0) return -1;
+    }
+
+    size_t i = c->size;
+    if (cache->row_bytes > 0) {
+        uint8_t *row = cluster_row(cache, c, i);
+        size_t used = (size_t)cache->vector_dim * storage_elem_size(cache->storage);
+        if (cache->storage == L2_STORAGE_INT8) {
+            c->scales[i] = vec_kernels_quantize_i8(vector, (int8_t *)row, cache->vector_dim);
+        } else if (cache->storage == L2_STORAGE_F16) {
+            vec_kernels_to_f16(vector, (uint16_t *)row, cache->vector_dim);
+        } else if (cache->storage == L2_STORAGE_BF16) {
+            vec_kernels_to_bf16(vector, (uint16_t *)row, cache->vector_dim);
+        } else {
+            memcpy(row, vector, used);
+        }
+        // Padding a zero: i kernel possono leggere l'intera riga senza sporcare il risultato
+        if (cache->row_bytes > used) memset(row + used, 0, cache->row_bytes - used);
+    }
+    if (pq_active(cache)) {
+        // Residuo rispetto al centroide (congelato dopo l'addestramento)
+        float *res = cache->pq_scratch;
+        memcpy(res, vector, cache->vector_dim * sizeof(float));
+        cache->vk.axpby(res, c->centroid, 1.0f, -1.0f, cache->vector_dim);
+        l2_pq_encode(cache->pq, res, c->pq_codes + i * cache->pq_m);
+    }
+    if (c->bits) vec_kernels_sign_bits(vector, c->bits + i * cache->code_words, cache->vector_dim);
+    if (c->reduced) l2_proj_apply(cache->proj, vector, c->reduced + i * cache->reduced_dim);
+    // Le righe rimosse non allargano il raggio: il minimo resta un bound valido
+    float sim = vec_dot(cache, vector, c->centroid);
+    if (sim < c->min_sim) c->min_sim = sim;
+    // Come per il raggio, le righe rimosse lasciano il bound valido (solo più prudente)
+    if (i == 0 || expire_at < c->min_expire) c->min_expire = expire_at;
+    c->expire_at[i] = expire_at;
+    c->features[i] = *features;
+    c->usage[i] = *usage;
+    c->texts[i] = *text;
+    c->size++;
+    return (long)i;
+}
+
+// Periodo di decay del contatore LFU: una capacità intera di tick senza accessi
+static inline uint32_t usage_decay(const l2_ivf_t *cache) {
+    return cache->max_global_capacity < UINT32_MAX ? (uint32_t)cache->max_global_capacity : UINT32_MAX;
+}
+
+// Accoda una nuova entry copiando prompt e risposta
+static long cluster_push(const l2_ivf_t *cache, l2_cluster_t *c, const float *vector, const char *prompt,
+                         uint64_t key, const l2_text_filter_t *features, const char *response, time_t expire_at) {
+    l2_text_t text = { prompt ? strdup(prompt) : NULL, vs_intern(cache->values, response), key, L2_LEX_NONE };
+    if ((prompt && !text.original_prompt) || !text.response) {
+        free(text.original_prompt);
+        vs_release(cache->values, text.response);
+        return -1;
+    }
+    l2_usage_t usage = { 0, 0 };
+    l2_usage_touch(&usage, cache->clock, usage_decay(cache));
+    long i = cluster_push_owned(cache, c, vector, &text, features, expire_at, &usage);
+    if (i < 0) {
+        free(text.original_prompt);
+        vs_release(cache->values, text.response);
+        return -1;
+    }
+    c->texts[i].lex_doc = l2_lex_add(cache->lex, text.original_prompt, text.response, features, expire_at);
+    // Senza posizione registrata (OOM) l'entry resta raggiungibile dal delete semantico
+    if (l2_keys_add(cache->keys, key, row_loc(cache, c, i)) != 0) c->texts[i].key = L2_KEY_NONE;
+    return i;
+}
+
+// Stacca la riga i spostandoci l'ultima (swap-remove): la matrice resta densa.
+// I testi e la posizione della riga i nell'indice dei prompt restano al chiamante
+static void cluster_detach_row(const l2_ivf_t *cache, l2_cluster_t *c, size_t i) {
+    size_t last = c->size - 1;
+    if (i != last) {
+        l2_keys_move(cache->keys, c->texts[last].key, row_loc(cache, c, last), row_loc(cache, c, i));
+        if (cache->row_bytes > 0) memcpy(cluster_row(cache, c, i), cluster_row(cache, c, last), cache->row_bytes);
+        if (c->scales) c->scales[i] = c->scales[last];
+        if (c->pq_codes) memcpy(c->pq_codes + i * cache->pq_m, c->pq_codes + last * cache->pq_m, cache->pq_m);
+        if (c->bits) {
+            memcpy(c->bits + i * cache->code_words, c->bits + last * cache->code_words,
+                   cache->code_words * sizeof(uint64_t));
+        }
+        if (c->reduced) {
+            memcpy(c->reduced + i * cache->reduced_dim, c->reduced + last * cache->reduced_dim,
+                   cache->reduced_dim * sizeof(float));
+        }
+        c->expire_at[i] = c->expire_at[last];
+        c->features[i] = c->features[last];
+        c->usage[i] = c->usage[last];
+        c->texts[i] = c->texts[last];
+    }
+    c->size--;
+
+    // Restituisce memoria quando il cluster si è svuotato per 3/4
+    if (c->capacity > MIN_CLUSTER_CAP && c->size < c->capacity / 4) {
+        size_t new_cap = c->capacity / 2;
+        if (new_cap < MIN_CLUSTER_CAP) new_cap = MIN_CLUSTER_CAP;
+        cluster_reserve(cache, c, new_cap); // Se fallisce si resta con la capacità attuale
+    }
+}
+
+// Rimuove (e libera) la riga i
+static void cluster_remove_row(const l2_ivf_t *cache, l2_cluster_t *c, size_t i) {
+    l2_keys_remove(cache->keys, c->texts[i].key, row_loc(cache, c, i));
+    l2_lex_remove(cache->lex, c->texts[i].lex_doc);
+    free(c->texts[i].original_prompt);
+    vs_release(cache->values, c->texts[i].response);
+    cluster_detach_row(cache, c, i);
+}
+
+// Sposta la riga i di src in coda a dst (vettore già decodificato), con testi,
+// feature e posizione nell'indice dei prompt. Ritorna 0, o -1 (OOM: la riga resta in src)
+static int cluster_move_row(const l2_ivf_t *cache, l2_cluster_t *src, size_t i, l2_cluster_t *dst,
+                            const float *vector) {
+    long j = cluster_push_owned(cache, dst, vector, &src->texts[i], &src->features[i], src->expire_at[i],
+                                &src->usage[i]);
+    if (j < 0) return -1;
+    l2_keys_move(cache->keys, src->texts[i].key, row_loc(cache, src, i), row_loc(cache, dst, (size_t)j));
+    cluster_detach_row(cache, src, i);
+    return 0;
+}
+
+// Libera tutte le righe e la memoria del cluster (il centroide resta). L'indice dei
+// prompt non viene toccato: i cluster rilasciati sono già vuoti, o si svuota tutto
+static void cluster_release(const l2_ivf_t *cache, l2_cluster_t *c) {
+    for (size_t j = 0; j < c->size; j++) {
+        l2_lex_remove(cache->lex, c->texts[j].lex_doc);
+        free(c->texts[j].original_prompt);
+        vs_release(cache->values, c->texts[j].response);
+    }
+    free(c->codes);
+    free(c->scales);
+    free(c->bits);
+    free(c->pq_codes);
+    free(c->reduced);
+    free(c->expire_at);
+    free(c->features);
+    free(c->usage);
+    free(c->texts);
+    c->codes = NULL;
+    c->scales = NULL;
+    c->bits = NULL;
+    c->pq_codes = NULL;
+    c->reduced = NULL;
+    c->expire_at = NULL;
+    c->features = NULL;
+    c->usage = NULL;
+    c->texts = NULL;
+    c->size = 0;
+    c->capacity = 0;
+}
+
+// Libera il centroide e la sua proiezione (cluster eliminato)
+static void cluster_free_centroid(l2_cluster_t *c) {
+    free(c->centroid);
+    free(c->rcentroid);
+    c->centroid = NULL;
+    c->rcentroid = NULL;
+}
+
+// --- IVF-PQ ---
+
+// Campione uniforme (ogni step-esima riga di tutti i cluster) dei vettori decodificati,
+// o dei residui rispetto al centroide del loro cluster. Ritorna le righe copiate
+static size_t sample_rows(const l2_ivf_t *cache, float *out, size_t n, int residuals) {
+    int dim = cache->vector_dim;
+    size_t step = cache->total_count / n;
+    size_t taken = 0, seen = 0;
+    for (int k = 0; k < cluster_slots(cache) && taken < n; k++) {
+        l2_cluster_t *c = cluster_at(cache, k);
+        for (size_t i = 0; i < c->size && taken < n; i++, seen++) {
+            if (seen % step != 0) continue;
+            float *r = out + taken * dim;
+            row_decode(cache, c, i, r);
+            if (residuals) cache->vk.axpby(r, c->centroid, 1.0f, -1.0f, dim);
+            taken++;
+        }
+    }
+    return taken;
+}
+
+// Codebook addestrati in background: si installano e si codificano le righe presenti.
+// Da qui in poi i centroidi IVF restano fermi (i residui dipendono da essi).
+// Ritorna -1 in caso di OOM (nulla cambia)
+static int pq_install(l2_ivf_t *cache, l2_pq_t *pq) {
+    int dim = cache->vector_dim;
+    for (int k = 0; k < cluster_slots(cache); k++) {
+        l2_cluster_t *c = cluster_at(cache, k);
+        if (c->capacity == 0) continue;
+        c->pq_codes = malloc(c->capacity * cache->pq_m);
+        if (!c->pq_codes) {
+            // OOM: si resta IVFFlat finché il prossimo tentativo non riesce
+            for (int j = 0; j <= k; j++) {
+                free(cluster_at(cache, j)->pq_codes);
+                cluster_at(cache, j)->pq_codes = NULL;
+            }
+            return -1;
+        }
+    }
+    l2_pq_destroy(cache->pq);
+    cache->pq = pq;
+
+    // Codifica delle righe esistenti
+    for (int k = 0; k < cluster_slots(cache); k++) {
+        l2_cluster_t *c = cluster_at(cache, k);
+        for (size_t i = 0; i < c->size; i++) {
+            float *res = cache->pq_scratch;
+            row_decode(cache, c, i, res);
+            cache->vk.axpby(res, c->centroid, 1.0f, -1.0f, dim);
+            l2_pq_encode(cache->pq, res, c->pq_codes + i * cache->pq_m);
+        }
+    }
+
+    if (!cache->pq_rerank) {
+        // Niente copia completa: restano solo i codici PQ
+        for (int k = 0; k < cluster_slots(cache); k++) {
+            l2_cluster_t *c = cluster_at(cache, k);
+            free(c->codes);
+            free(c->scales);
+            c->codes = NULL;
+            c->scales = NULL;
+        }
+        cache->row_bytes = 0;
+    }
+    return 0;
+}
+
+// --- PREFILTRO RIDOTTO ---
+
+// Proietta il centroide dopo ogni suo spostamento. Con OOM il cluster resta senza
+// proiezione e la coarse search lo rivaluta sempre sul centroide completo
+static void cluster_sync_centroid(const l2_ivf_t *cache, l2_cluster_t *c) {
+    if (!reduce_active(cache)) return;
+    if (!c->rcentroid) {
+        c->rcentroid = malloc(cache->reduced_dim * sizeof(float));
+        if (!c->rcentroid) return;
+    }
+    l2_proj_apply(cache->proj, c->centroid, c->rcentroid);
+}
+
+// PCA addestrata in background: si installa e si proiettano righe e centroidi.
+// Fino ad allora scan e coarse search usano i vettori completi.
+// Ritorna -1 in caso di OOM (nulla cambia)
+static int reduce_install(l2_ivf_t *cache, l2_proj_t *proj) {
+    int rdim = cache->reduced_dim;
+    for (int k = 0; k < cluster_slots(cache); k++) {
+        l2_cluster_t *c = cluster_at(cache, k);
+        if (c->capacity == 0) continue;
+        c->reduced = malloc(c->capacity * rdim * sizeof(float));
+        if (!c->reduced) {
+            // OOM: si resta sullo scan completo finché il prossimo tentativo non riesce
+            for (int j = 0; j <= k; j++) {
+                free(cluster_at(cache, j)->reduced);
+                cluster_at(cache, j)->reduced = NULL;
+            }
+            return -1;
+        }
+    }
+    l2_proj_destroy(cache->proj);
+    cache->proj = proj;
+
+    for (int k = 0; k < cluster_slots(cache); k++) {
+        l2_cluster_t *c = cluster_at(cache, k);
+        cluster_sync_centroid(cache, c);
+        for (size_t i = 0; i < c->size; i++) {
+            row_decode(cache, c, i, cache->migrate_buf);
+            l2_proj_apply(cache->proj, cache->migrate_buf, c->reduced + i * rdim);
+        }
+    }
+    return 0;
+}
+
+// --- RI-ADDESTRAMENTO DEI CENTROIDI (k-means in background) ---
+
+// Cluster attivo più vicino al vettore escluso skip (i cluster non inizializzati non contano).
+// Con il prefiltro ridotto i centroidi si confrontano nello spazio ridotto e solo i
+// NEAREST_SHORTLIST migliori sul vettore completo
+static int nearest_cluster_except(const l2_ivf_t *cache, const float *vector, int skip) {
+    int shortlist[NEAREST_SHORTLIST];
+    int listed = 0;
+    if (reduce_active(cache) && cache->num_clusters > NEAREST_SHORTLIST * 2) {
+        float scores[NEAREST_SHORTLIST];
+        l2_proj_apply(cache->proj, vector, cache->reduce_buf);
+        for (int i = 0; i < cache->num_clusters; i++) {
+            const l2_cluster_t *c = &cache->clusters[i];
+            if (i == skip || !c->is_initialized) continue;
+            // Senza proiezione (OOM) il cluster passa sempre alla rivalutazione
+            float score = c->rcentroid ? cache->rvk.dot(c->rcentroid, cache->reduce_buf, cache->reduced_dim) : 2.0f;
+            if (listed == NEAREST_SHORTLIST && score <= scores[listed - 1]) continue;
+            int pos = listed < NEAREST_SHORTLIST ? listed++ : listed - 1;
+            while (pos > 0 && scores[pos - 1] < score) {
+                scores[pos] = scores[pos - 1];
+                shortlist[pos] = shortlist[pos - 1];
+                pos--;
+            }
+            scores[pos] = score;
+            shortlist[pos] = i;
+        }
+    }
+
+    int best = skip == 0 ? 1 : 0;
+    float best_score = -2.0f; // Cosine va da -1 a 1
+    int count = listed > 0 ? listed : cache->num_clusters;
+    for (int k = 0; k < count; k++) {
+        int i = listed > 0 ? shortlist[k] : k;
+        if (i == skip || !cache->clusters[i].is_initialized) continue;
+        float score = vec_dot(cache, cache->clusters[i].centroid, vector);
+        if (score > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int nearest_cluster(const l2_ivf_t *cache, const float *vector) {
+    return nearest_cluster_except(cache, vector, -1);
+}
+
+static void *retrain_routine(void *arg) {
+    l2_retrain_t *job = arg;
+    int rc;
+    switch (job->kind) {
+        case RETRAIN_PQ:
+            rc = l2_pq_train(job->pq, job->sample, job->n);
+            break;
+        case RETRAIN_PCA:
+            rc = l2_proj_train(job->proj, job->sample, job->n);
+            break;
+        default:
+            rc = kmeans_train_minibatch(&job->vk, job->sample, job->n, job->dim, job->dim, job->k,
+                                        RETRAIN_BATCH, RETRAIN_ITERATIONS, 1, job->centroids);
+            break;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->rc = rc;
+    job->done = 1;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void retrain_free(l2_retrain_t *job) {
+    pthread_mutex_destroy(&job->lock);
+    free(job->sample);
+    free(job->centroids);
+    l2_pq_destroy(job->pq);
+    l2_proj_destroy(job->proj);
+    free(job);
+}
+
+// Avvia il thread del job (campione già copiato). Ritorna 0, o -1 (job liberato)
+static int retrain_launch(l2_ivf_t *cache, l2_retrain_t *job) {
+    job->vk = cache->vk;
+    pthread_mutex_init(&job->lock, NULL);
+    if (pthread_create(&job->thread, NULL, retrain_routine, job) != 0) {
+        log_warn("L2 IVF: impossibile avviare il thread di ri-addestramento");
+        retrain_free(job);
+        return -1;
+    }
+    cache->retrain = job;
+    return 0;
+}
+
+// Ri-addestramento dovuto: primo k-means dopo il bootstrap oppure dati raddoppiati
+// dall'ultimo (i singoli cluster fuori misura li gestiscono split e merge)
+static int retrain_due(const l2_ivf_t *cache) {
+    if (cache->retrain || cache->num_draining > 0) return 0;
+    if (cache->total_count < RETRAIN_MIN) return 0;
+    // Senza copia completa i residui PQ non si possono ricalcolare sui nuovi centroidi
+    if (pq_active(cache) && cache->row_bytes == 0) return 0;
+    if (cache->generation == 0) return 1;
+    return cache->inserts_since_train >= cache->trained_count;
+}
+
+// Copia un campione dei vettori e avvia il k-means su un thread dedicato.
+// Il thread non tocca mai le strutture della cache.
+static void retrain_start(l2_ivf_t *cache) {
+    int dim = cache->vector_dim;
+    size_t n = cache->total_count < RETRAIN_SAMPLE ? cache->total_count : RETRAIN_SAMPLE;
+    size_t step = cache->total_count / n;
+    cache->inserts_since_train = 0;
+    cache->trained_count = cache->total_count;
+
+    l2_retrain_t *job = calloc(1, sizeof(l2_retrain_t));
+    if (!job) return;
+    job->sample = malloc(n * dim * sizeof(float));
+    // Il numero di cluster segue i dati: total_count / dimensione target. In IVF-PQ senza
+    // copia completa i cluster restano fissi dopo l'addestramento PQ: si dimensiona sulla capacità
+    size_t sizing = cache->total_count;
+    if (cache->pq && !cache->pq_rerank && !pq_active(cache)) sizing = cache->max_global_capacity;
+    int k = clusters_for(cache, sizing);
+    if ((size_t)k > n) k = (int)n;
+    job->centroids = malloc((size_t)k * dim * sizeof(float));
+    if (!job->sample || !job->centroids) {
+        free(job->sample); free(job->centroids); free(job);
+        return;
+    }
+
+    size_t taken = 0, seen = 0;
+    for (int k = 0; k < cache->num_clusters && taken < n; k++) {
+        l2_cluster_t *c = &cache->clusters[k];
+        for (size_t i = 0; i < c->size && taken < n; i++, seen++) {
+            if (seen % step != 0) continue;
+            row_decode(cache, c, i, job->sample + taken * dim);
+            taken++;
+        }
+    }
+    job->n = taken;
+    job->dim = dim;
+    job->k = k;
+    if (retrain_launch(cache, job) == 0) {
+        log_info("L2 IVF: k-means in background su %zu vettori (%d cluster)", taken, job->k);
+    }
+}
+
+// IVF-PQ: codebook da addestrare appena ci sono abbastanza residui, calcolati sui
+// centroidi del k-means (non su quelli del bootstrap)
+static int pq_train_due(const l2_ivf_t *cache) {
+    return cache->pq && !pq_active(cache) && cache->total_count >= cache->pq_next_train &&
+           cache->generation > 0 && !cache->retrain && cache->num_draining == 0;
+}
+
+// Copia un campione dei residui e addestra i codebook su un'istanza privata nel
+// thread in background; l'installazione (codifica delle righe) avviene in retrain_poll
+static void pq_train_start(l2_ivf_t *cache) {
+    size_t n = cache->total_count < PQ_TRAIN_SAMPLE ? cache->total_count : PQ_TRAIN_SAMPLE;
+    l2_retrain_t *job = calloc(1, sizeof(l2_retrain_t));
+    if (job) {
+        job->kind = RETRAIN_PQ;
+        job->pq = l2_pq_create(cache->vector_dim, cache->pq_m);
+        job->sample = malloc(n * cache->vector_dim * sizeof(float));
+    }
+    if (!job || !job->pq || !job->sample) {
+        if (job) { l2_pq_destroy(job->pq); free(job->sample); free(job); }
+        cache->pq_next_train = cache->total_count * 2;
+        return;
+    }
+    job->n = sample_rows(cache, job->sample, n, 1);
+    job->dim = cache->vector_dim;
+    if (retrain_launch(cache, job) == 0) {
+        log_info("L2 IVF-PQ: addestramento dei codebook in background su %zu residui", job->n);
+    } else {
+        cache->pq_next_train = cache->total_count * 2;
+    }
+}
+
+// Prefiltro ridotto con PCA: proiezione da apprendere appena ci sono abbastanza entry
+static int reduce_train_due(const l2_ivf_t *cache) {
+    return cache->proj && !reduce_active(cache) && cache->total_count >= cache->reduce_next_train &&
+           !cache->retrain;
+}
+
+// Copia un campione dei vettori e addestra la PCA su un'istanza privata nel thread
+// in background; l'installazione (proiezione delle righe) avviene in retrain_poll
+static void reduce_train_start(l2_ivf_t *cache) {
+    size_t n = cache->total_count < REDUCE_TRAIN_SAMPLE ? cache->total_count : REDUCE_TRAIN_SAMPLE;
+    l2_retrain_t *job = calloc(1, sizeof(l2_retrain_t));
+    if (job) {
+        job->kind = RETRAIN_PCA;
+        job->proj = l2_proj_create(cache->vector_dim, cache->reduced_dim, L2_PROJECTION_PCA);
+        job->sample = malloc(n * cache->vector_dim * sizeof(float));
+    }
+    if (!job || !job->proj || !job->sample) {
+        if (job) { l2_proj_destroy(job->proj); free(job->sample); free(job); }
+        cache->reduce_next_train = cache->total_count * 2;
+        return;
+    }
+    job->n = sample_rows(cache, job->sample, n, 0);
+    job->dim = cache->vector_dim;
+    if (retrain_launch(cache, job) == 0) {
+        log_info("L2 Prefiltro ridotto: PCA in background su %zu vettori", job->n);
+    } else {
+        cache->reduce_next_train = cache->total_count * 2;
+    }
+}
+
+// Se l'addestramento è terminato, ne installa il risultato. Nuovi centroidi: i cluster
+// attuali passano in svuotamento e restano cercabili finché la migrazione non li vuota.
+// Codebook PQ e PCA: installazione e codifica/proiezione delle righe in un passo
+static void retrain_poll(l2_ivf_t *cache) {
+    l2_retrain_t *job = cache->retrain;
+    pthread_mutex_lock(&job->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    if (!done) return;
+
+    pthread_join(job->thread, NULL);
+    cache->retrain = NULL;
+    if (job->discard) {
+        retrain_free(job);
+        return;
+    }
+    if (job->kind == RETRAIN_PQ) {
+        if (job->rc != 0 || pq_install(cache, job->pq) != 0) {
+            log_warn("L2 IVF-PQ: addestramento fallito, nuovo tentativo a %zu entry", cache->total_count * 2);
+            cache->pq_next_train = cache->total_count * 2;
+        } else {
+            job->pq = NULL; // Ora è della cache
+            log_info("L2 IVF-PQ addestrato su %zu residui: %d byte/codice%s", job->n, cache->pq_m,
+                     cache->pq_rerank ? ", re-ranking sulla copia completa" : "");
+        }
+        retrain_free(job);
+        return;
+    }
+    if (job->kind == RETRAIN_PCA) {
+        if (job->rc != 0 || reduce_install(cache, job->proj) != 0) {
+            log_warn("L2 Prefiltro ridotto: PCA fallita, nuovo tentativo a %zu entry", cache->total_count * 2);
+            cache->reduce_next_train = cache->total_count * 2;
+        } else {
+            job->proj = NULL; // Ora è della cache
+            log_info("L2 Prefiltro ridotto: PCA addestrata su %zu vettori (%d -> %d dim)", job->n,
+                     cache->vector_dim, cache->reduced_dim);
+        }
+        retrain_free(job);
+        return;
+    }
+    if (job->rc != 0) {
+        retrain_free(job);
+        return;
+    }
+
+    l2_cluster_t *fresh = calloc(job->k, sizeof(l2_cluster_t));
+    if (!fresh) {
+        retrain_free(job);
+        return;
+    }
+    for (int j = 0; j < job->k; j++) {
+        fresh[j].centroid = malloc(job->dim * sizeof(float));
+        if (!fresh[j].centroid) {
+            for (int i = 0; i < j; i++) free(fresh[i].centroid);
+            free(fresh);
+            retrain_free(job);
+            return;
+        }
+        memcpy(fresh[j].centroid, job->centroids + (size_t)j * job->dim, job->dim * sizeof(float));
+        fresh[j].is_initialized = 1;
+        fresh[j].min_sim = 1.0f;
+        cluster_sync_centroid(cache, &fresh[j]);
+    }
+
+    cache->draining = cache->clusters;
+    cache->num_draining = cache->num_clusters;
+    cache->clusters = fresh;
+    cache->num_clusters = job->k;
+    cache->generation++;
+    log_info("L2 IVF: nuovi centroidi installati (generazione %d), migrazione di %zu entry",
+             cache->generation, cache->total_count);
+    retrain_free(job);
+}
+
+// Sposta al più budget righe dai cluster in svuotamento a quelli attivi
+static void migrate_step(l2_ivf_t *cache, int budget) {
+    time_t now = clock_now();
+    while (budget > 0 && cache->num_draining > 0) {
+        l2_cluster_t *c = &cache->draining[cache->num_draining - 1];
+        if (c->size == 0) {
+            cluster_release(cache, c);
+            cluster_free_centroid(c);
+            if (--cache->num_draining == 0) {
+                free(cache->draining);
+                cache->draining = NULL;
+                log_info("L2 IVF: migrazione verso i nuovi centroidi completata");
+            }
+            continue;
+        }
+
+        size_t i = c->size - 1;
+        budget--;
+        if (now > c->expire_at[i]) {
+            // Scaduta: inutile migrarla
+            cluster_remove_row(cache, c, i);
+            cache->total_count--;
+            continue;
+        }
+        row_decode(cache, c, i, cache->migrate_buf);
+        l2_cluster_t *dst = &cache->clusters[nearest_cluster(cache, cache->migrate_buf)];
+        if (cluster_move_row(cache, c, i, dst, cache->migrate_buf) != 0) {
+            return; // OOM: si riprova al prossimo ciclo
+        }
+    }
+}
+
+// --- SPLIT / MERGE DEI CLUSTER ---
+
+// Split e merge spostano righe tra centroidi: i residui PQ vanno ricalcolati dalla
+// copia completa. Durante bootstrap e migrazione i cluster non si toccano, e con un
+// k-means in corso sarebbe lavoro sprecato (i suoi centroidi sostituiranno tutto).
+static int rebalance_allowed(const l2_ivf_t *cache) {
+    if (cache->retrain || cache->num_draining > 0) return 0;
+    if (pq_active(cache) && cache->row_bytes == 0) return 0;
+    // Il bootstrap riempie i cluster in ordine: l'ultimo inizializzato lo chiude
+    return cache->clusters[cache->num_clusters - 1].is_initialized;
+}
+
+// Ricodifica i residui PQ del cluster dopo lo spostamento del suo centroide
+static void cluster_recode_pq(const l2_ivf_t *cache, l2_cluster_t *c) {
+    float *res = cache->migrate_buf;
+    for (size_t i = 0; i < c->size; i++) {
+        row_decode(cache, c, i, res);
+        cache->vk.axpby(res, c->centroid, 1.0f, -1.0f, cache->vector_dim);
+        l2_pq_encode(cache->pq, res, c->pq_codes + i * cache->pq_m);
+    }
+}
+
+// Ricalcola il raggio dopo lo spostamento del centroide
+static void cluster_refresh_radius(const l2_ivf_t *cache, l2_cluster_t *c) {
+    c->min_sim = 1.0f;
+    for (size_t i = 0; i < c->size; i++) {
+        float sim = row_score(cache, c, i, c->centroid);
+        if (sim < c->min_sim) c->min_sim = sim;
+    }
+}
+
+// Divide il cluster idx con un 2-means locale: le righe del secondo centroide
+// passano a un nuovo cluster in coda. Ritorna 0 se lo split è riuscito
+static int cluster_split(l2_ivf_t *cache, int idx) {
+    int dim = cache->vector_dim;
+    l2_cluster_t *c = &cache->clusters[idx];
+    size_t n = c->size;
+    float *data = malloc(n * dim * sizeof(float));
+    float *centroids = malloc(2 * dim * sizeof(float));
+    uint8_t *side = malloc(n);
+    float *centroid = malloc(dim * sizeof(float));
+    int rc = -1;
+    if (!data || !centroids || !side || !centroid) goto done;
+
+    for (size_t i = 0; i < n; i++) row_decode(cache, c, i, data + i * dim);
+    if (kmeans_train(&cache->vk, data, n, dim, dim, 2, SPLIT_ITERATIONS, 1, centroids) != 0) goto done;
+
+    size_t second = 0;
+    for (size_t i = 0; i < n; i++) {
+        const float *v = data + i * dim;
+        side[i] = vec_dot(cache, v, centroids + dim) > vec_dot(cache, v, centroids);
+        second += side[i];
+    }
+    // Split degenere (es. vettori quasi identici): una metà minuscola verrebbe subito ri-fusa
+    size_t smaller = second < n - second ? second : n - second;
+    if (smaller < n / MERGE_FACTOR) goto done;
+
+    l2_cluster_t *grown = realloc(cache->clusters, (cache->num_clusters + 1) * sizeof(l2_cluster_t));
+    if (!grown) goto done;
+    cache->clusters = grown;
+    c = &cache->clusters[idx];
+    l2_cluster_t *dst = &cache->clusters[cache->num_clusters++];
+    memset(dst, 0, sizeof(l2_cluster_t));
+    memcpy(centroid, centroids + dim, dim * sizeof(float));
+    dst->centroid = centroid;
+    dst->is_initialized = 1;
+    dst->min_sim = 1.0f;
+    centroid = NULL;
+    memcpy(c->centroid, centroids, dim * sizeof(float));
+    cluster_sync_centroid(cache, c);
+    cluster_sync_centroid(cache, dst);
+
+    // A ritroso: lo swap-remove porta in i solo righe già esaminate
+    for (size_t i = n; i-- > 0;) {
+        if (!side[i]) continue;
+        // OOM: la riga resta dov'è (sempre raggiungibile, solo meno vicina al centroide)
+        if (cluster_move_row(cache, c, i, dst, data + i * dim) != 0) break;
+    }
+    if (pq_active(cache)) cluster_recode_pq(cache, c);
+    cluster_refresh_radius(cache, c);
+    rc = 0;
+
+done:
+    free(data);
+    free(centroids);
+    free(side);
+    free(centroid);
+    return rc;
+}
+
+// Svuota il cluster idx nei cluster vicini e lo elimina (l'ultimo prende il suo posto).
+// Ritorna 0 se il cluster è stato eliminato
+static int cluster_merge(l2_ivf_t *cache, int idx) {
+    l2_cluster_t *c = &cache->clusters[idx];
+    time_t now = clock_now();
+    while (c->size > 0) {
+        size_t i = c->size - 1;
+        if (now > c->expire_at[i]) {
+            cluster_remove_row(cache, c, i);
+            cache->total_count--;
+            continue;
+        }
+        row_decode(cache, c, i, cache->migrate_buf);
+        l2_cluster_t *dst = &cache->clusters[nearest_cluster_except(cache, cache->migrate_buf, idx)];
+        if (cluster_move_row(cache, c, i, dst, cache->migrate_buf) != 0) {
+            return -1; // OOM: le righe rimaste restano cercabili, si riprova più tardi
+        }
+    }
+    cluster_release(cache, c);
+    cluster_free_centroid(c);
+    int last = --cache->num_clusters;
+    if (idx != last) {
+        cache->clusters[idx] = cache->clusters[last];
+        c = &cache->clusters[idx];
+        for (size_t i = 0; i < c->size; i++) {
+            l2_keys_move(cache->keys, c->texts[i].key, loc_pack(cache->generation, last, i),
+                         loc_pack(cache->generation, idx, i));
+        }
+    }
+    return 0;
+}
+
+// Divide i cluster oltre SPLIT_FACTOR x target e fonde quelli sotto target / MERGE_FACTOR,
+// spostando al più budget righe. Ritorna 1 se restano cluster fuori misura
+static int rebalance_step(l2_ivf_t *cache, long budget) {
+    if (!rebalance_allowed(cache)) return 0;
+    size_t target = cluster_target(cache, cache->total_count);
+    int before = cache->num_clusters;
+    int pending = 0;
+    int k = 0;
+    while (k < cache->num_clusters) {
+        l2_cluster_t *c = &cache->clusters[k];
+        size_t size = c->size;
+        if (size > target * SPLIT_FACTOR && size > c->split_floor && cache->num_clusters < MAX_CLUSTERS) {
+            if (budget <= 0) { pending = 1; break; }
+            budget -= (long)size;
+            // Se fallisce si ritenta solo quando il cluster sarà raddoppiato
+            if (cluster_split(cache, k) != 0) cache->clusters[k].split_floor = size * 2;
+            continue; // Le due metà possono essere ancora fuori misura
+        }
+        if (size < target / MERGE_FACTOR && cache->num_clusters > MIN_CLUSTERS) {
+            if (budget <= 0) { pending = 1; break; }
+            budget -= (long)size + 1;
+            if (cluster_merge(cache, k) == 0) continue; // Ora in k c'è un altro cluster
+        }
+        k++;
+    }
+    if (cache->num_clusters != before) {
+        log_debug("L2 IVF: %d -> %d cluster (target %zu righe)", before, cache->num_clusters, target);
+    }
+    return pending;
+}
+
+// --- API ---
+
+static void *ivf_create(const l2_config_t *config, const l2_shared_t *shared) {
+    l2_ivf_t *cache = calloc(1, sizeof(l2_ivf_t));
+    if (!cache) return NULL;
+    cache->values = shared->values;
+    cache->search_pool = shared->search_pool;
+
+    int vector_dim = config->vector_dim;
+    cache->vector_dim = vector_dim;
+    cache->max_global_capacity = config->max_capacity;
+    cache->total_count = 0;
+    cache->eviction = config->eviction;
+    cache->seed = 0x1f2e;
+    cache->storage = config->storage;
+    cache->rerank_k = config->rerank_k > 0 ? config->rerank_k : DEFAULT_RERANK_K;
+    if (cache->rerank_k > MAX_RERANK_K) cache->rerank_k = MAX_RERANK_K;
+    cache->prefilter = config->prefilter;
+    cache->nprobe = config->nprobe > 0 ? config->nprobe : N_PROBE;
+    cache->parallel_min_rows = config->parallel_min_rows > 0 ? config->parallel_min_rows : PARALLEL_MIN_ROWS;
+    cache->code_words = (vector_dim + 63) / 64;
+    cache->row_bytes = storage_row_bytes(cache->storage, vector_dim);
+    vec_kernels_select(&cache->vk, vector_dim);
+
+    // Metà della L2 per lo scan di un cluster: il resto a query, LUT e centroidi
+    size_t l2_bytes = sys_get_l2_cache_size();
+    cache->l2_budget = (l2_bytes > 0 ? l2_bytes : DEFAULT_L2_BYTES) / 2;
+    cache->target_rows = config->cluster_size > 0 ? (size_t)config->cluster_size : 0;
+
+    // Bootstrap dimensionato sulla capacità: le cache piccole non sprecano probe,
+    // quelle grandi crescono poi con gli split
+    int initial = clusters_for(cache, cache->max_global_capacity);
+    cache->initial_clusters = initial < NUM_CLUSTERS ? initial : NUM_CLUSTERS;
+    cache->num_clusters = cache->initial_clusters;
+    cache->clusters = calloc(cache->num_clusters, sizeof(l2_cluster_t));
+    cache->migrate_buf = malloc(vector_dim * sizeof(float));
+    if (!cache->clusters || !cache->migrate_buf) {
+        free(cache->clusters);
+        free(cache->migrate_buf);
+        free(cache);
+        return NULL;
+    }
+
+    if (config->index == L2_INDEX_IVFPQ) {
+        cache->pq = l2_pq_create(vector_dim, config->pq_m);
+        cache->pq_scratch = malloc(vector_dim * sizeof(float));
+        if (!cache->pq || !cache->pq_scratch) {
+            l2_pq_destroy(cache->pq);
+            free(cache->pq_scratch);
+            free(cache->clusters);
+            free(cache->migrate_buf);
+            free(cache);
+            return NULL;
+        }
+        cache->pq_m = l2_pq_get_m(cache->pq);
+        cache->pq_rerank = config->pq_rerank;
+        cache->pq_next_train = PQ_TRAIN_MIN;
+        if (cache->prefilter != L2_PREFILTER_NONE) {
+            log_warn("L2 IVF-PQ: prefiltro ignorato (lo scan usa già i codici PQ)");
+            cache->prefilter = L2_PREFILTER_NONE;
+        }
+    }
+
+    if (cache->prefilter == L2_PREFILTER_REDUCED) {
+        // Multiplo di 16 float (righe allineate per i kernel), sotto la dimensione piena
+        int rdim = config->reduced_dim > 0 ? config->reduced_dim : DEFAULT_REDUCED_DIM;
+        if (rdim >= vector_dim) rdim = vector_dim / 2;
+        rdim -= rdim % MIN_REDUCED_DIM;
+        if (rdim < MIN_REDUCED_DIM || rdim >= vector_dim) {
+            log_warn("L2 Prefiltro ridotto: dimensione %d troppo piccola, prefiltro disattivato", vector_dim);
+            cache->prefilter = L2_PREFILTER_NONE;
+        } else {
+            cache->reduced_dim = rdim;
+            cache->proj = l2_proj_create(vector_dim, rdim, config->projection);
+            cache->reduce_buf = malloc(rdim * sizeof(float));
+            if (!cache->proj || !cache->reduce_buf) {
+                l2_proj_destroy(cache->proj);
+                free(cache->reduce_buf);
+                l2_pq_destroy(cache->pq);
+                free(cache->pq_scratch);
+                free(cache->clusters);
+                free(cache->migrate_buf);
+                free(cache);
+                return NULL;
+            }
+            vec_kernels_select(&cache->rvk, rdim);
+            cache->reduce_next_train = REDUCE_TRAIN_MIN;
+        }
+    }
+
+    // Senza indice lessicale si continua: ricerca solo vettoriale
+    if (config->lexical && !(cache->lex = l2_lex_create())) {
+        log_warn("L2 IVF: indice lessicale non disponibile, ricerca solo vettoriale");
+    }
+    if (!(cache->keys = l2_keys_create())) {
+        log_warn("L2 IVF: indice dei prompt non disponibile, DELETE solo semantico");
+    }
+
+    // Inizializza i cluster: la matrice viene allocata al primo inserimento
+    for (int i = 0; i < cache->num_clusters; i++) {
+        cache->clusters[i].centroid = calloc(vector_dim, sizeof(float));
+        cache->clusters[i].size = 0;
+        cache->clusters[i].capacity = 0;
+        cache->clusters[i].is_initialized = 0;
+        cache->clusters[i].min_sim = 1.0f;
+    }
+
+    log_info("L2 Cache IVFFlat creata: %d Clusters, Dim %d, Storage %s (%zu byte/vettore)",
+             cache->num_clusters, vector_dim, storage_name(cache->storage), cache->row_bytes);
+    log_info("L2 IVF: nprobe max %d, stop adattivo e pruning sul raggio dei cluster", cache->nprobe);
+    if (cache->search_pool) {
+        log_info("L2 IVF: scan parallelo su %d thread oltre %zu righe sondate",
+                 tp_parallelism(cache->search_pool), cache->parallel_min_rows);
+    }
+    log_info("L2 Eviction: %s (%d campioni)", l2_eviction_name(cache->eviction), L2_EVICTION_SAMPLES);
+    log_info("L2 IVF: cluster target %zu righe a pieno carico (%s, budget L2 %zu KB), split oltre %dx, merge sotto 1/%d",
+             cluster_target(cache, cache->max_global_capacity),
+             cache->target_rows ? "configurato" : "automatico", cache->l2_budget / 1024,
+             SPLIT_FACTOR, MERGE_FACTOR);
+    if (cache->pq) {
+        log_info("L2 IVF-PQ: M=%d (%d byte/codice), addestramento a %d entry, re-ranking %s",
+                 cache->pq_m, cache->pq_m, PQ_TRAIN_MIN,
+                 cache->pq_rerank ? "su copia completa" : "disattivo");
+    }
+    if (cache->prefilter == L2_PREFILTER_BINARY) {
+        log_info("L2 Prefiltro binario: %d byte/codice, %d probe, rerank top-%d",
+                 cache->code_words * 8, cache->nprobe * BINARY_PROBE_FACTOR, cache->rerank_k);
+    }
+    if (cache->proj) {
+        log_info("L2 Prefiltro ridotto: %s a %d dim (%zu byte/riga), centroidi rivalutati top-%d/probe, rerank top-%d%s",
+                 l2_proj_name(cache->proj), cache->reduced_dim, cache->reduced_dim * sizeof(float),
+                 CENTROID_SHORTLIST, cache->rerank_k,
+                 reduce_active(cache) ? "" : ", attivo dopo l'addestramento");
+    }
+    if (cache->storage == L2_STORAGE_INT8) {
+        log_info("L2 Kernel: %s (scan int8: %s, rerank top-%d)", cache->vk.isa, cache->vk.isa_i8, cache->rerank_k);
+    } else if (cache->storage != L2_STORAGE_F32) {
+        log_info("L2 Kernel: %s (scan %s, conversione %s)", cache->vk.isa, storage_name(cache->storage),
+                 cache->vk.isa_f16);
+    } else {
+        log_info("L2 Kernel: %s%s", cache->vk.isa, cache->vk.specialized ? " (srotolato per questa dim)" : "");
+    }
+    return cache;
+}
+
+static void ivf_destroy(void *index) {
+    l2_ivf_t *cache = index;
+    if (!cache) return;
+    if (cache->retrain) {
+        // Il thread lavora su copie private: basta attenderne la fine
+        pthread_join(cache->retrain->thread, NULL);
+        retrain_free(cache->retrain);
+    }
+    // Tutto va distrutto: inutile togliere le entry lessicali una alla volta
+    l2_lex_destroy(cache->lex);
+    cache->lex = NULL;
+    l2_keys_destroy(cache->keys);
+    for (int i = 0; i < cluster_slots(cache); i++) {
+        cluster_release(cache, cluster_at(cache, i));
+        cluster_free_centroid(cluster_at(cache, i));
+    }
+    free(cache->clusters);
+    free(cache->draining);
+    l2_pq_destroy(cache->pq);
+    free(cache->pq_scratch);
+    l2_proj_destroy(cache->proj);
+    free(cache->reduce_buf);
+    free(cache->migrate_buf);
+    free(cache);
+}
+
+// Cluster (attivo o in svuotamento) estratto con probabilità proporzionale alla
+// dimensione: rigetto rispetto alla dimensione massima attesa (split/merge tengono
+// i cluster vicini al target, quindi pochi tentativi in media)
+static l2_cluster_t *sample_cluster(l2_ivf_t *cache) {
+    size_t bound = cluster_target(cache, cache->total_count) * SPLIT_FACTOR;
+    l2_cluster_t *fallback = NULL;
+    for (int attempt = 0; attempt < 64; attempt++) {
+        l2_cluster_t *c = cluster_at(cache, rand_r(&cache->seed) % cluster_slots(cache));
+        if (c->size == 0) continue;
+        fallback = c;
+        if (c->size >= bound || (size_t)rand_r(&cache->seed) % bound < c->size) return c;
+    }
+    return fallback;
+}
+
+// Eviction a campione (O(1)): L2_EVICTION_SAMPLES righe casuali, si rimuove quella
+// con il valore più basso per la policy. Una riga già scaduta viene presa subito
+static int evict_one(l2_ivf_t *cache) {
+    time_t now = clock_now();
+    uint32_t decay = usage_decay(cache);
+    l2_cluster_t *victim = NULL;
+    size_t victim_row = 0;
+    double victim_rank = 0.0;
+
+    for (int s = 0; s < L2_EVICTION_SAMPLES; s++) {
+        l2_cluster_t *c = sample_cluster(cache);
+        if (!c) break;
+        size_t i = (size_t)rand_r(&cache->seed) % c->size;
+        if (now > c->expire_at[i]) {
+            victim = c;
+            victim_row = i;
+            break;
+        }
+        double rank = l2_eviction_rank(cache->eviction, &c->usage[i], c->expire_at[i], cache->clock, decay);
+        if (!victim || rank < victim_rank) {
+            victim = c;
+            victim_row = i;
+            victim_rank = rank;
+        }
+    }
+    if (!victim) return -1;
+    cluster_remove_row(cache, victim, victim_row);
+    cache->total_count--;
+    return 0;
+}
+
+static int ivf_evict(void *index) {
+    l2_ivf_t *cache = index;
+    return cache->total_count > 0 ? evict_one(cache) : -1;
+}
+
+// Inserimento "Intelligente". nearest: cluster attivo più vicino se già noto
+// (collect_clusters dell'upsert), -1 per calcolarlo qui
+static int insert_into(l2_ivf_t *cache, int nearest, const float *vector, const char *prompt_text, uint64_t key,
+                       const l2_text_filter_t *features, const char *response, time_t expire_at) {
+    if (cache->total_count >= cache->max_global_capacity) {
+        // Cache piena: si libera un posto secondo la policy (o si rifiuta)
+        if (cache->eviction == L2_EVICT_NONE || evict_one(cache) != 0) return -1;
+    }
+    cache->clock++;
+
+    // 1. Trova il cluster migliore (Nearest Centroid)
+    int best_cluster_idx = -1;
+
+    // Se ci sono cluster non inizializzati, usiamoli per bootstrappare
+    // Questo distribuisce i primi vettori uno per cluster.
+    for (int i = 0; i < cache->num_clusters; i++) {
+        if (!cache->clusters[i].is_initialized) {
+            best_cluster_idx = i;
+            break;
+        }
+    }
+
+    // Se tutti inizializzati, cerca il più simile
+    if (best_cluster_idx == -1) best_cluster_idx = nearest >= 0 ? nearest : nearest_cluster(cache, vector);
+
+    l2_cluster_t *cluster = &cache->clusters[best_cluster_idx];
+
+    // 2-3. Inserimento effettivo (la matrice cresce da sola se necessario)
+    if (cluster_push(cache, cluster, vector, prompt_text, key, features, response, expire_at) < 0) {
+        return -1;
+    }
+    cache->total_count++;
+    cache->inserts_since_train++;
+
+    // 4. Aggiorna il centroide (Learning). Dopo il primo k-means i centroidi
+    // cambiano solo con il ri-addestramento in background
+    if (!cluster->is_initialized) {
+        // Primo elemento: il centroide diventa il vettore stesso
+        memcpy(cluster->centroid, vector, cache->vector_dim * sizeof(float));
+        cluster->is_initialized = 1;
+        cluster_sync_centroid(cache, cluster);
+    } else if (!pq_active(cache) && cache->generation == 0) {
+        // Elementi successivi: sposta il centroide verso il nuovo punto
+        update_centroid(cache, cluster->centroid, vector);
+        cluster->min_sim = -1.0f; // Il raggio non vale più: niente pruning su questo cluster
+        cluster_sync_centroid(cache, cluster);
+    }
+
+    return 0;
+}
+
+static int ivf_insert(void *index, const float *vector, const char *prompt_text, uint64_t key,
+                      const l2_text_filter_t *features, const char *response, time_t expire_at) {
+    return insert_into(index, -1, vector, prompt_text, key, features, response, expire_at);
+}
+
+// Struttura helper per ordinare i cluster durante la ricerca
+typedef struct {
+    int index;
+    float score;             // q . centroide
+    float bound;             // Massimo score raggiungibile da un'entry del cluster
+} cluster_score_t;
+
+// Bound superiore di q . x per ogni x del cluster (vettori unitari): se l'angolo
+// query/centroide è theta e il raggio angolare è alpha, allora q . x <= cos(theta - alpha)
+static inline float cluster_upper_bound(float score, float min_sim) {
+    if (min_sim <= -1.0f || score >= min_sim) return 1.0f; // Query dentro il cono del cluster
+    float sin_s = sqrtf(fmaxf(0.0f, 1.0f - score * score));
+    float sin_r = sqrtf(fmaxf(0.0f, 1.0f - min_sim * min_sim));
+    return score * min_sim + sin_s * sin_r + RADIUS_SLACK;
+}
+
+// Candidati sondabili: cluster non vuoti il cui bound raggiunge la threshold.
+// Con nearest != NULL, nello stesso passaggio, il cluster attivo più vicino (anche
+// vuoto) come nearest_cluster, o -1. Ritorna quanti candidati sono stati scritti in out
+static int collect_clusters(const l2_ivf_t *cache, const float *query_vector, float threshold,
+                            cluster_score_t *out, int *nearest) {
+    int n = 0;
+    float nearest_score = -2.0f;
+    if (nearest) *nearest = -1;
+    for (int i = 0; i < cluster_slots(cache); i++) {
+        l2_cluster_t *c = cluster_at(cache, i);
+        if (!c->is_initialized || (c->size == 0 && !nearest)) continue;
+        float score = vec_dot(cache, c->centroid, query_vector);
+        if (nearest && i < cache->num_clusters && score > nearest_score) {
+            nearest_score = score;
+            *nearest = i;
+        }
+        if (c->size == 0) continue;
+        float bound = cluster_upper_bound(score, c->min_sim);
+        if (bound < threshold) continue; // Nessuna entry può superare la threshold
+        out[n].index = i;
+        out[n].score = score;
+        out[n].bound = bound;
+        n++;
+    }
+    return n;
+}
+
+// Selezione parziale: porta in testa i p candidati con score più alto, ordinati
+// (quickselect + insertion sort sui p scelti, invece di ordinare tutti i centroidi)
+static void select_top_clusters(cluster_score_t *c, int n, int p) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi && p < n) {
+        float pivot = c[(lo + hi) / 2].score;
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (c[i].score > pivot) i++;
+            while (c[j].score < pivot) j--;
+            if (i <= j) {
+                cluster_score_t t = c[i]; c[i] = c[j]; c[j] = t;
+                i++; j--;
+            }
+        }
+        if (p - 1 <= j) hi = j;
+        else if (p - 1 >= i) lo = i;
+        else break;
+    }
+    for (int i = 1; i < p; i++) {
+        cluster_score_t t = c[i];
+        int j = i;
+        while (j > 0 && c[j - 1].score < t.score) { c[j] = c[j - 1]; j--; }
+        c[j] = t;
+    }
+}
+
+// --- SCAN PARALLELO ---
+// Con molte righe da sondare lo scan si divide in fette (intervalli di righe di un
+// cluster): ogni fetta tiene i propri migliori e il chiamante li unisce.
+
+typedef struct {
+    int cluster;
+    float pq_base;           // q . centroide del cluster (ADC)
+    size_t begin, end;
+    l2_candidate_t *list;    // Migliori della fetta (top_k esatti o rerank_k approssimati)
+    int count;
+} scan_slice_t;
+
+typedef struct {
+    const l2_ivf_t *cache;
+    const l2_query_t *q;
+    const l2_text_filter_t *filter;
+    scan_slice_t *slices;
+    int approximate;
+    int k;                   // Lunghezza delle liste delle fette
+    time_t now;
+} scan_job_t;
+
+static void scan_slice(void *ctx, int task) {
+    scan_job_t *job = ctx;
+    scan_slice_t *s = &job->slices[task];
+    const l2_cluster_t *cluster = cluster_at(job->cache, s->cluster);
+    l2_query_t q = *job->q;
+    q.pq_base = s->pq_base;
+    int check_expiry = job->now > cluster->min_expire;
+
+    for (size_t i = s->begin; i < s->end; i++) {
+        if (check_expiry && job->now > cluster->expire_at[i]) continue;
+        float dot = row_score_fast(job->cache, cluster, i, &q);
+        float score = job->approximate ? dot : l2_apply_hybrid_filters(job->filter, &cluster->features[i], dot);
+        s->count = l2_candidate_push(s->list, s->count, job->k, s->cluster, i, score, dot);
+    }
+}
+
+// Scan parallelo dei cluster sondati: unisce i migliori delle fette in `out`
+// (lista di lunghezza k, già eventualmente popolata). Ritorna il nuovo conteggio,
+// -1 in caso di OOM (il chiamante ripiega sullo scan seriale)
+static int parallel_scan(const l2_ivf_t *cache, const cluster_score_t *candidates, int probes, size_t rows,
+                         const l2_query_t *q, const l2_text_filter_t *filter, int approximate,
+                         l2_candidate_t *out, int count, int k) {
+    size_t slice_rows = rows / ((size_t)tp_parallelism(cache->search_pool) * SLICES_PER_THREAD);
+    if (slice_rows < MIN_SLICE_ROWS) slice_rows = MIN_SLICE_ROWS;
+
+    int num_slices = 0;
+    for (int p = 0; p < probes; p++) {
+        num_slices += (int)((cluster_at(cache, candidates[p].index)->size + slice_rows - 1) / slice_rows);
+    }
+    scan_slice_t *slices = calloc(num_slices, sizeof(scan_slice_t));
+    l2_candidate_t *lists = malloc((size_t)num_slices * k * sizeof(l2_candidate_t));
+    if (!slices || !lists) { free(slices); free(lists); return -1; }
+
+    int n = 0;
+    for (int p = 0; p < probes; p++) {
+        size_t size = cluster_at(cache, candidates[p].index)->size;
+        for (size_t begin = 0; begin < size; begin += slice_rows) {
+            slices[n].cluster = candidates[p].index;
+            slices[n].pq_base = candidates[p].score;
+            slices[n].begin = begin;
+            slices[n].end = begin + slice_rows < size ? begin + slice_rows : size;
+            slices[n].list = lists + (size_t)n * k;
+            n++;
+        }
+    }
+
+    scan_job_t job = { cache, q, filter, slices, approximate, k, clock_now() };
+    tp_run(cache->search_pool, scan_slice, &job, num_slices);
+
+    for (int i = 0; i < num_slices; i++) {
+        for (int j = 0; j < slices[i].count; j++) {
+            const l2_candidate_t *c = &slices[i].list[j];
+            if (count == k && c->score <= out[k - 1].score) break; // Liste ordinate
+            count = l2_candidate_push(out, count, k, c->cluster, c->row, c->score, c->raw);
+        }
+    }
+    free(slices);
+    free(lists);
+    return count;
+}
+
+// Prefiltro ridotto: i centroidi si ordinano nello spazio ridotto e solo i primi
+// `shortlist` vengono rivalutati sul centroide completo (score e bound del raggio,
+// che vale solo per lo score esatto). Ritorna quanti candidati sono stati scritti in out
+static int collect_clusters_reduced(const l2_ivf_t *cache, const l2_query_t *q, float threshold,
+                                    cluster_score_t *out, int shortlist) {
+    int n = 0;
+    for (int i = 0; i < cluster_slots(cache); i++) {
+        l2_cluster_t *c = cluster_at(cache, i);
+        if (!c->is_initialized || c->size == 0) continue;
+        out[n].index = i;
+        // Senza proiezione (OOM) il cluster passa sempre alla rivalutazione
+        out[n].score = c->rcentroid ? cache->rvk.dot(c->rcentroid, q->reduced, cache->reduced_dim) : 2.0f;
+        n++;
+    }
+    if (n > shortlist) {
+        select_top_clusters(out, n, shortlist);
+        n = shortlist;
+    }
+
+    int kept = 0;
+    for (int k = 0; k < n; k++) {
+        l2_cluster_t *c = cluster_at(cache, out[k].index);
+        float score = vec_dot(cache, c->centroid, q->vec);
+        float bound = cluster_upper_bound(score, c->min_sim);
+        if (bound < threshold) continue;
+        out[kept].index = out[k].index;
+        out[kept].score = score;
+        out[kept].bound = bound;
+        kept++;
+    }
+    return kept;
+}
+
+// Fase "Coarse Search": bucket candidati (attivi e in svuotamento) scartando quelli
+// che per raggio non possono raggiungere la threshold, poi i migliori in testa a
+// candidates (cluster_slots elementi). nearest come in collect_clusters (-1 con il
+// prefiltro ridotto, che non confronta tutti i centroidi completi). Ritorna quanti cluster sondare
+static int select_probes(const l2_ivf_t *cache, const l2_query_t *q, float threshold,
+                         cluster_score_t *candidates, int *nearest) {
+    if (nearest) *nearest = -1;
+    int max_probes = (cache->prefilter == L2_PREFILTER_BINARY) ? cache->nprobe * BINARY_PROBE_FACTOR : cache->nprobe;
+    // Durante una migrazione un'entry può stare in un cluster vecchio o nuovo: si sonda il doppio
+    if (cache->num_draining > 0) max_probes *= 2;
+
+    int active_clusters = q->reduced
+        ? collect_clusters_reduced(cache, q, threshold, candidates, max_probes * CENTROID_SHORTLIST)
+        : collect_clusters(cache, q->vec, threshold, candidates, nearest);
+    if (active_clusters == 0) return 0;
+
+    int probes = (active_clusters < max_probes) ? active_clusters : max_probes;
+
+    // Selezione parziale dei cluster più simili al centroide; poi, a ritroso, il bound
+    // diventa il massimo sui cluster non ancora sondati (criterio di stop adattivo)
+    select_top_clusters(candidates, active_clusters, probes);
+    for (int k = probes - 2; k >= 0; k--) {
+        if (candidates[k + 1].bound > candidates[k].bound) candidates[k].bound = candidates[k + 1].bound;
+    }
+    return probes;
+}
+
+// Re-ranking dei candidati dello scan approssimato: score con la query float sul
+// vettore memorizzato (niente errore di quantizzazione della query) e solo dopo i
+// filtri ibridi. In IVF-PQ senza copia completa resta lo score ADC.
+// Poi i risultati sopra la threshold, registrati come HIT per l'eviction se record_hits
+static int collect_results(l2_ivf_t *cache, const float *query_vector, const l2_text_filter_t *filter,
+                           float threshold, l2_candidate_t *best, int best_count, const l2_candidate_t *rerank,
+                           int rerank_count, l2_search_result_t *results, int top_k, int record_hits) {
+    for (int r = 0; r < rerank_count; r++) {
+        l2_cluster_t *cluster = cluster_at(cache, rerank[r].cluster);
+        float dot = cache->row_bytes > 0 ? row_score(cache, cluster, rerank[r].row, query_vector)
+                                         : rerank[r].score;
+        float penalized = l2_apply_hybrid_filters(filter, &cluster->features[rerank[r].row], dot);
+        best_count = l2_candidate_push(best, best_count, top_k, rerank[r].cluster, rerank[r].row, penalized, dot);
+    }
+
+    // La lista è ordinata: i risultati sono il prefisso sopra la threshold
+    int found = 0;
+    while (found < best_count && best[found].score >= threshold) {
+        l2_cluster_t *hit = cluster_at(cache, best[found].cluster);
+        size_t row = best[found].row;
+        if (record_hits) {
+            uint32_t tick = atomic_fetch_add_explicit(&cache->clock, 1, memory_order_relaxed) + 1;
+            l2_usage_touch(&hit->usage[row], tick, usage_decay(cache));
+        }
+        results[found].response = vs_data(hit->texts[row].response);
+        results[found].prompt = hit->texts[row].original_prompt;
+        results[found].score = best[found].raw;
+        results[found].penalized_score = best[found].score;
+        results[found].expire_at = hit->expire_at[row];
+        results[found].loc = row_loc(cache, hit, row);
+        found++;
+    }
+    if (found > 0 && record_hits) {
+        log_info("HIT L2 (IVF Score: %.4f) Cluster %d%s", best[0].score, best[0].cluster,
+                 found > 1 ? " (top-k)" : "");
+    }
+    return found;
+}
+
+// Fasi "Fine Search" e re-ranking sui probes cluster in testa a candidates
+static int search_probes(l2_ivf_t *cache, l2_query_t *q, const cluster_score_t *candidates, int probes,
+                         const l2_text_filter_t *filter, float threshold, l2_search_result_t *results, int top_k,
+                         int record_hits) {
+    // 2. Fase "Fine Search": Cerca solo nei top nprobe cluster, tenendo i top_k migliori
+    l2_candidate_t best[L2_MAX_TOPK];
+    int best_count = 0;
+
+    time_t now = clock_now();
+
+    // Scan approssimato (PQ, int8, Hamming o spazio ridotto) + re-ranking dei migliori candidati
+    int approximate = scan_approximate(cache, q);
+    l2_candidate_t rerank[MAX_RERANK_K];
+    int rerank_count = 0;
+    int rerank_k = cache->rerank_k > top_k ? cache->rerank_k : top_k;
+
+    // Query grandi: i cluster sondati si dividono tra i thread dello scan parallelo
+    // (niente stop adattivo: le fette procedono in contemporanea)
+    int scanned = 0;
+    if (cache->search_pool) {
+        size_t rows = 0;
+        for (int k = 0; k < probes; k++) rows += cluster_at(cache, candidates[k].index)->size;
+        if (rows >= cache->parallel_min_rows) {
+            int merged = approximate
+                ? parallel_scan(cache, candidates, probes, rows, q, filter, 1, rerank, 0, rerank_k)
+                : parallel_scan(cache, candidates, probes, rows, q, filter, 0, best, 0, top_k);
+            if (merged >= 0) {
+                if (approximate) rerank_count = merged;
+                else best_count = merged;
+                scanned = 1;
+            }
+        }
+    }
+
+    for (int k = 0; k < probes && !scanned; k++) {
+        int c_idx = candidates[k].index;
+        l2_cluster_t *cluster = cluster_at(cache, c_idx);
+
+        // Stop adattivo: nessun cluster rimasto può battere il k-esimo già trovato
+        // (i filtri ibridi abbassano soltanto lo score). Con lo scan approssimato i
+        // migliori sono noti solo dopo il re-ranking, quindi vale solo il pruning sulla threshold
+        if (!approximate && best_count == top_k && best[top_k - 1].score >= candidates[k].bound) break;
+
+        // ADC: q.(c + r) = q.c + q.r, il primo termine è lo score del centroide
+        q->pq_base = candidates[k].score;
+        // Nessuna riga può essere scaduta prima di min_expire: si salta il controllo
+        int check_expiry = now > cluster->min_expire;
+
+        for (size_t i = 0; i < cluster->size; i++) {
+            // La ricerca non modifica i cluster (lettori concorrenti): le righe
+            // scadute si saltano e le rimuove il ciclo di scadenza attivo
+            if (check_expiry && now > cluster->expire_at[i]) continue;
+
+            // Calcolo Score Vettoriale (righe contigue: accesso sequenziale)
+            float dot = row_score_fast(cache, cluster, i, q);
+
+            if (approximate) {
+                // Si tengono solo i migliori, rivalutati dopo lo scan
+                rerank_count = l2_candidate_push(rerank, rerank_count, rerank_k, c_idx, i, dot, dot);
+                continue;
+            }
+
+            float penalized = l2_apply_hybrid_filters(filter, &cluster->features[i], dot);
+            best_count = l2_candidate_push(best, best_count, top_k, c_idx, i, penalized, dot);
+        }
+    }
+
+    // 3. Re-ranking e risultati
+    return collect_results(cache, q->vec, filter, threshold, best, best_count, rerank, rerank_count,
+                           results, top_k, record_hits);
+}
+
+static int ivf_search(void *index, const float *query_vector, const l2_text_filter_t *filter, float threshold,
+                      l2_search_result_t *results, int top_k, int record_hits) {
+    l2_ivf_t *cache = index;
+    if (cache->total_count == 0) return 0;
+
+    // 1. Fase "Coarse Search" (con il prefiltro ridotto serve già la query proiettata)
+    l2_query_t q;
+    if (query_prepare(cache, &q, query_vector) != 0) { query_release(&q); return 0; }
+    cluster_score_t *candidates = malloc(cluster_slots(cache) * sizeof(cluster_score_t));
+    if (!candidates) { query_release(&q); return 0; }
+    int probes = select_probes(cache, &q, threshold, candidates, NULL);
+    int found = probes > 0
+        ? search_probes(cache, &q, candidates, probes, filter, threshold, results, top_k, record_hits) : 0;
+    query_release(&q);
+    free(candidates);
+    return found;
+}
+
+// Riga di un risultato: la posizione, o (shortcut lessicale) la riga con la stessa
+// chiave del prompt e la stessa risposta
+static l2_cluster_t *result_row(const l2_ivf_t *cache, const l2_search_result_t *result, size_t *row) {
+    if (result->loc != L2_LOC_NONE) return loc_resolve(cache, result->loc, row);
+    uint64_t key = l2_keys_hash(result->prompt);
+    uint64_t locs[16];
+    int n = key != L2_KEY_NONE ? l2_keys_find(cache->keys, key, locs, 16) : 0;
+    for (int i = 0; i < n; i++) {
+        l2_cluster_t *c = loc_resolve(cache, locs[i], row);
+        if (c && c->texts[*row].key == key && vs_data(c->texts[*row].response) == result->response) return c;
+    }
+    return NULL;
+}
+
+// HIT dei risultati scelti dalla facciata (sotto il read lock della ricerca che li ha prodotti)
+static void ivf_touch(void *index, const l2_search_result_t *results, int n) {
+    l2_ivf_t *cache = index;
+    for (int i = 0; i < n; i++) {
+        size_t row;
+        l2_cluster_t *c = result_row(cache, &results[i], &row);
+        if (!c) continue;
+        uint32_t tick = atomic_fetch_add_explicit(&cache->clock, 1, memory_order_relaxed) + 1;
+        l2_usage_touch(&c->usage[row], tick, usage_decay(cache));
+    }
+}
+
+// Deduplica e inserimento in un passaggio: i centroidi si confrontano una volta sola,
+// per scegliere i cluster da sondare (i soli che per raggio possono contenere un
+// duplicato) e il cluster che riceverà la riga. Il duplicato non conta come HIT:
+// SET ripetuti non devono proteggere dall'eviction entry che nessuno interroga
+static int ivf_upsert(void *index, const float *vector, const char *prompt_text, uint64_t key,
+                      const l2_text_filter_t *features, const char *response, time_t expire_at, float threshold) {
+    l2_ivf_t *cache = index;
+    int nearest = -1;
+    if (cache->total_count > 0) {
+        l2_query_t q;
+        cluster_score_t *candidates = malloc(cluster_slots(cache) * sizeof(cluster_score_t));
+        if (!candidates || query_prepare(cache, &q, vector) != 0) {
+            if (candidates) query_release(&q);
+            free(candidates);
+            return L2_UPSERT_REJECTED;
+        }
+        int probes = select_probes(cache, &q, threshold, candidates, &nearest);
+        l2_search_result_t existing;
+        int found = probes > 0 ? search_probes(cache, &q, candidates, probes, features, threshold, &existing, 1, 0) : 0;
+        query_release(&q);
+        free(candidates);
+        if (found > 0) return L2_UPSERT_DEDUPED;
+    }
+    return insert_into(cache, nearest, vector, prompt_text, key, features, response, expire_at) == 0
+        ? L2_UPSERT_INSERTED : L2_UPSERT_REJECTED;
+}
+
+// --- RICERCA A BATCH ---
+// Le query del batch si raggruppano per cluster sondato: ogni cluster viene letto
+// una volta sola e ogni riga è confrontata con tutte le sue query (a blocchi di 4
+// con il kernel dot4 per le righe float32 e le copie ridotte). Niente stop adattivo: il cluster è
+// scandito per tutte le query che lo sondano.
+
+typedef struct {
+    l2_query_t q;
+    l2_candidate_t best[L2_MAX_TOPK];
+    int best_count;
+    l2_candidate_t rerank[MAX_RERANK_K];
+    int rerank_count;
+} batch_query_t;
+
+// Coppia (query, cluster) nella lista delle query di un cluster
+typedef struct {
+    int query;
+    float pq_base;
+    int next;                // Prossima coppia dello stesso cluster (-1 = fine)
+} batch_probe_t;
+
+static inline void batch_push(batch_query_t *st, const l2_text_filter_t *filter, const l2_cluster_t *cluster,
+                              int approximate, int c_idx, size_t i, float dot, int top_k, int rerank_k) {
+    if (approximate) {
+        st->rerank_count = l2_candidate_push(st->rerank, st->rerank_count, rerank_k, c_idx, i, dot, dot);
+    } else {
+        float penalized = l2_apply_hybrid_filters(filter, &cluster->features[i], dot);
+        st->best_count = l2_candidate_push(st->best, st->best_count, top_k, c_idx, i, penalized, dot);
+    }
+}
+
+static int ivf_search_batch(void *index, const float *const *queries, const l2_text_filter_t *filters, int nq,
+                            float threshold, l2_search_result_t *results, int top_k, int *counts) {
+    l2_ivf_t *cache = index;
+    for (int j = 0; j < nq; j++) counts[j] = 0;
+    if (cache->total_count == 0 || nq <= 0) return 0;
+    if (nq == 1) {
+        // Query singola: stop adattivo e scan parallelo restano disponibili
+        counts[0] = ivf_search(index, queries[0], &filters[0], threshold, results, top_k, 1);
+        return 0;
+    }
+
+    int slots = cluster_slots(cache);
+    cluster_score_t *candidates = malloc(slots * sizeof(cluster_score_t));
+    batch_query_t *state = calloc(nq, sizeof(batch_query_t));
+    batch_probe_t *pairs = malloc((size_t)nq * slots * sizeof(batch_probe_t));
+    int *head = malloc(slots * sizeof(int));
+    if (!candidates || !state || !pairs || !head) {
+        free(candidates); free(state); free(pairs); free(head);
+        return -1;
+    }
+
+    // 1. Coarse search per query, poi liste delle query di ogni cluster
+    for (int c = 0; c < slots; c++) head[c] = -1;
+    int num_pairs = 0;
+    int prepared = 0;
+    for (int j = 0; j < nq; j++) {
+        if (query_prepare(cache, &state[j].q, queries[j]) != 0) break;
+        prepared++;
+        int probes = select_probes(cache, &state[j].q, threshold, candidates, NULL);
+        for (int k = 0; k < probes; k++) {
+            int c = candidates[k].index;
+            pairs[num_pairs].query = j;
+            pairs[num_pairs].pq_base = candidates[k].score;
+            pairs[num_pairs].next = head[c];
+            head[c] = num_pairs++;
+        }
+    }
+    if (prepared < nq) {
+        for (int j = 0; j < prepared; j++) query_release(&state[j].q);
+        free(candidates); free(state); free(pairs); free(head);
+        return -1;
+    }
+
+    // 2. Fine search: un passaggio per cluster, tutte le sue query insieme
+    time_t now = clock_now();
+    int approximate = scan_approximate(cache, &state[0].q);
+    // Righe float lette 4 query alla volta: vettori completi, o copie ridotte col prefiltro ridotto
+    int reduced = state[0].q.reduced != NULL;
+    int float_rows = reduced || (!approximate && cache->storage == L2_STORAGE_F32);
+    const vec_kernels_t *fvk = reduced ? &cache->rvk : &cache->vk;
+    int fdim = reduced ? cache->reduced_dim : cache->vector_dim;
+    int rerank_k = cache->rerank_k > top_k ? cache->rerank_k : top_k;
+    int *members = malloc(nq * sizeof(int));
+    float *bases = malloc(nq * sizeof(float));
+    const float **vecs = malloc(nq * sizeof(float *));
+    int failed = !members || !bases || !vecs;
+    if (failed) num_pairs = 0;
+
+    for (int c = 0; c < slots && num_pairs > 0; c++) {
+        if (head[c] < 0) continue;
+        l2_cluster_t *cluster = cluster_at(cache, c);
+        int m = 0;
+        for (int p = head[c]; p >= 0; p = pairs[p].next) {
+            members[m] = pairs[p].query;
+            bases[m] = pairs[p].pq_base;
+            vecs[m] = reduced ? state[pairs[p].query].q.reduced : queries[pairs[p].query];
+            m++;
+        }
+        int check_expiry = now > cluster->min_expire;
+
+        for (size_t i = 0; i < cluster->size; i++) {
+            if (check_expiry && now > cluster->expire_at[i]) continue;
+            int j = 0;
+            if (float_rows) {
+                // Float32: la riga resta nei registri per 4 query alla volta
+                const float *row = reduced ? cluster->reduced + i * cache->reduced_dim
+                                           : (const float *)cluster_row(cache, cluster, i);
+                float dots[4];
+                for (; j + 4 <= m; j += 4) {
+                    fvk->dot4(row, vecs + j, dots, fdim);
+                    for (int t = 0; t < 4; t++) {
+                        batch_push(&state[members[j + t]], &filters[members[j + t]], cluster, approximate, c, i,
+                                   dots[t], top_k, rerank_k);
+                    }
+                }
+            }
+            for (; j < m; j++) {
+                batch_query_t *st = &state[members[j]];
+                st->q.pq_base = bases[j];
+                float dot = row_score_fast(cache, cluster, i, &st->q);
+                batch_push(st, &filters[members[j]], cluster, approximate, c, i, dot, top_k, rerank_k);
+            }
+        }
+    }
+
+    // 3. Re-ranking e risultati per query (gli HIT li registra la facciata: ogni query
+    // ne usa solo il prefisso che ha chiesto)
+    for (int j = 0; j < nq; j++) {
+        batch_query_t *st = &state[j];
+        counts[j] = collect_results(cache, queries[j], &filters[j], threshold, st->best, st->best_count,
+                                    st->rerank, st->rerank_count, results + (size_t)j * top_k, top_k, 0);
+        query_release(&st->q);
+    }
+    free(members); free(bases); free(vecs);
+    free(candidates); free(state); free(pairs); free(head);
+    return failed ? -1 : 0;
+}
+
+// Cancellazione semantica (scan su nprobe cluster)
+static int ivf_delete_semantic(void *index, const float *query_vector) {
+    l2_ivf_t *cache = index;
+    float threshold = 0.99f;
+    
+    // Logica duplicata dalla search ma per delete: cerchiamo nei cluster migliori
+    cluster_score_t *candidates = malloc(cluster_slots(cache) * sizeof(cluster_score_t));
+    if (!candidates) return 0;
+    int active = collect_clusters(cache, query_vector, threshold, candidates, NULL);
+    
+    int max_probes = cache->num_draining > 0 ? cache->nprobe * 2 : cache->nprobe;
+    int probes = (active < max_probes) ? active : max_probes;
+    select_top_clusters(candidates, active, probes);
+    float *decoded = NULL;
+    float *q_rec = NULL;
+    uint8_t *q_code = NULL;
+    if (cache->row_bytes == 0) {
+        // Solo codici PQ: si confrontano le ricostruzioni (simmetrico), così una
+        // query identica a un'entry ottiene lo stesso codice e score ~1
+        decoded = malloc(cache->vector_dim * sizeof(float));
+        q_rec = malloc(cache->vector_dim * sizeof(float));
+        q_code = malloc(cache->pq_m);
+        if (!decoded || !q_rec || !q_code) {
+            free(decoded); free(q_rec); free(q_code); free(candidates);
+            return 0;
+        }
+    }
+    
+    for(int k=0; k<probes; k++) {
+        l2_cluster_t *c = cluster_at(cache, candidates[k].index);
+        if (q_rec) {
+            memcpy(q_rec, query_vector, cache->vector_dim * sizeof(float));
+            cache->vk.axpby(q_rec, c->centroid, 1.0f, -1.0f, cache->vector_dim);
+            l2_pq_encode(cache->pq, q_rec, q_code);
+            l2_pq_decode(cache->pq, q_code, q_rec);
+            cache->vk.axpby(q_rec, c->centroid, 1.0f, 1.0f, cache->vector_dim);
+            vec_kernels_normalize(&cache->vk, q_rec, cache->vector_dim);
+        }
+        for(size_t i=0; i<c->size; i++) {
+            float dot;
+            if (decoded) {
+                row_decode(cache, c, i, decoded);
+                vec_kernels_normalize(&cache->vk, decoded, cache->vector_dim);
+                dot = vec_dot(cache, q_rec, decoded);
+            } else {
+                dot = row_score(cache, c, i, query_vector);
+            }
+            if(dot >= threshold) {
+                // Delete
+                cluster_remove_row(cache, c, i);
+                cache->total_count--;
+                log_info("L2 Semantic Delete OK.");
+                free(decoded); free(q_rec); free(q_code); free(candidates);
+                return 1;
+            }
+        }
+    }
+    free(decoded); free(q_rec); free(q_code); free(candidates);
+    return 0;
+}
+
+// Delete esatto: le posizioni vengono dall'indice dei prompt. Ogni rimozione può
+// spostare (swap-remove) un'altra riga con la stessa chiave: si rilegge la prima
+// posizione finché ce ne sono
+static int ivf_delete_key(void *index, uint64_t key) {
+    l2_ivf_t *cache = index;
+    int deleted = 0;
+    uint64_t loc;
+    while (l2_keys_find(cache->keys, key, &loc, 1) == 1) {
+        size_t row;
+        l2_cluster_t *c = loc_resolve(cache, loc, &row);
+        if (!c || c->texts[row].key != key) {
+            // Non dovrebbe succedere: la posizione si scarta (resta il delete semantico)
+            log_warn("L2 IVF: posizione non valida nell'indice dei prompt, ignorata");
+            l2_keys_remove(cache->keys, key, loc);
+            continue;
+        }
+        cluster_remove_row(cache, c, row);
+        cache->total_count--;
+        deleted++;
+    }
+    return deleted;
+}
+
+// Manutenzione dal loop eventi: installa centroidi, codebook o PCA addestrati in
+// background, migra un blocco di righe, avvia un nuovo addestramento se dovuto,
+// altrimenti divide/fonde i cluster fuori misura
+static int ivf_maintenance(void *index) {
+    l2_ivf_t *cache = index;
+    if (cache->retrain) retrain_poll(cache);
+    if (cache->num_draining > 0) {
+        migrate_step(cache, MIGRATE_BUDGET);
+    } else if (retrain_due(cache)) {
+        retrain_start(cache);
+    } else if (pq_train_due(cache)) {
+        pq_train_start(cache);
+    } else if (reduce_train_due(cache)) {
+        reduce_train_start(cache);
+    } else {
+        // Controllo delle dimensioni al più una volta al secondo, se non c'è lavoro arretrato
+        time_t now = clock_now();
+        if (cache->rebalance_pending || now != cache->last_rebalance) {
+            cache->last_rebalance = now;
+            cache->rebalance_pending = rebalance_step(cache, MIGRATE_BUDGET);
+        }
+    }
+    return cache->retrain != NULL || cache->num_draining > 0 || cache->rebalance_pending;
+}
+
+// Ciclo di scadenza attivo: visita i cluster a rotazione, salta quelli il cui bound
+// dice che nulla è scaduto e rimuove le righe scadute dagli altri (ricalcolando il bound).
+// Il budget è in righe esaminate; un cluster viene sempre completato
+static size_t ivf_expire(void *index, size_t budget, size_t *examined) {
+    l2_ivf_t *cache = index;
+    time_t now = clock_now();
+    size_t removed = 0, seen = 0;
+    int slots = cluster_slots(cache);
+
+    for (int visited = 0; visited < slots && seen < budget; visited++) {
+        // Split, merge e migrazioni cambiano il numero di cluster: il cursore si riallinea
+        if (cache->expire_cursor >= slots) cache->expire_cursor = 0;
+        l2_cluster_t *c = cluster_at(cache, cache->expire_cursor++);
+        if (c->size == 0 || now <= c->min_expire) continue;
+
+        time_t min_expire = 0;
+        for (size_t i = 0; i < c->size; i++) {
+            seen++;
+            if (now > c->expire_at[i]) {
+                cluster_remove_row(cache, c, i);
+                cache->total_count--;
+                removed++;
+                i--;
+                continue;
+            }
+            if (min_expire == 0 || c->expire_at[i] < min_expire) min_expire = c->expire_at[i];
+        }
+        c->min_expire = min_expire;
+    }
+    if (examined) *examined = seen;
+    return removed;
+}
+
+// Clear completo
+static void ivf_clear(void *index) {
+    l2_ivf_t *cache = index;
+    if (!cache) return;
+    // Split, merge e k-means cambiano il numero di cluster: si riparte da quello del bootstrap
+    for (int i = cache->initial_clusters; i < cache->num_clusters; i++) {
+        cluster_release(cache, &cache->clusters[i]);
+        cluster_free_centroid(&cache->clusters[i]);
+    }
+    if (cache->num_clusters > cache->initial_clusters) cache->num_clusters = cache->initial_clusters;
+    l2_cluster_t *grown = realloc(cache->clusters, cache->initial_clusters * sizeof(l2_cluster_t));
+    if (grown) {
+        cache->clusters = grown;
+        // OOM su un centroide: si resta con meno cluster, il bootstrap funziona comunque
+        while (cache->num_clusters < cache->initial_clusters) {
+            l2_cluster_t *c = &cache->clusters[cache->num_clusters];
+            memset(c, 0, sizeof(l2_cluster_t));
+            c->centroid = malloc(cache->vector_dim * sizeof(float));
+            if (!c->centroid) break;
+            cache->num_clusters++;
+        }
+    }
+    for (int i = 0; i < cache->num_clusters; i++) {
+        // Libera anche le matrici: dopo un FLUSH la memoria torna al sistema
+        cluster_release(cache, &cache->clusters[i]);
+        cache->clusters[i].is_initialized = 0; 
+        cache->clusters[i].split_floor = 0;
+        cache->clusters[i].min_sim = 1.0f;
+        // Nota: non liberiamo i centroidi qui, li resettiamo logicamente
+        memset(cache->clusters[i].centroid, 0, cache->vector_dim * sizeof(float));
+    }
+    for (int i = 0; i < cache->num_draining; i++) {
+        cluster_release(cache, &cache->draining[i]);
+        cluster_free_centroid(&cache->draining[i]);
+    }
+    free(cache->draining);
+    cache->draining = NULL;
+    cache->num_draining = 0;
+    // Un addestramento in corso lavora su dati ormai cancellati: il risultato verrà scartato
+    if (cache->retrain) cache->retrain->discard = 1;
+    cache->generation = 0;
+    l2_keys_clear(cache->keys);
+    cache->inserts_since_train = 0;
+    cache->trained_count = 0;
+    cache->total_count = 0;
+    if (cache->pq) {
+        // I centroidi ripartono da zero: i codebook dei residui non valgono più
+        l2_pq_reset(cache->pq);
+        cache->pq_next_train = PQ_TRAIN_MIN;
+        cache->row_bytes = storage_row_bytes(cache->storage, cache->vector_dim);
+    }
+    log_debug("L2 Cache (IVF) svuotata.");
+}
+
+// Visita le entry non scadute (vettore ricostruito in float)
+static int ivf_foreach(void *index, l2_entry_fn fn, void *ctx) {
+    l2_ivf_t *cache = index;
+    int count = 0;
+    time_t now = clock_now();
+    float *tmp_vec = malloc(cache->vector_dim * sizeof(float));
+    if (!tmp_vec) return -1;
+
+    for (int i = 0; i < cluster_slots(cache); i++) {
+        l2_cluster_t *c = cluster_at(cache, i);
+        for (size_t j = 0; j < c->size; j++) {
+            if (c->expire_at[j] > now) {
+                row_decode(cache, c, j, tmp_vec);
+                fn(ctx, tmp_vec, c->texts[j].original_prompt, c->texts[j].key, &c->features[j],
+                   vs_data(c->texts[j].response), c->expire_at[j]);
+                count++;
+            }
+        }
+    }
+    free(tmp_vec);
+    return count;
+}
+
+static size_t ivf_count(void *index) {
+    return ((l2_ivf_t *)index)->total_count;
+}
+
+static const l2_lex_t *ivf_lexicon(void *index) {
+    return ((l2_ivf_t *)index)->lex;
+}
+
+const l2_index_ops_t l2_ivf_ops = {
+    .name = "ivf",
+    .create = ivf_create,
+    .destroy = ivf_destroy,
+    .insert = ivf_insert,
+    .search = ivf_search,
+    .touch = ivf_touch,
+    .search_batch = ivf_search_batch,
+    .upsert = ivf_upsert,
+    .delete_semantic = ivf_delete_semantic,
+    .evict = ivf_evict,
+    .delete_key = ivf_delete_key,
+    .clear = ivf_clear,
+    .foreach = ivf_foreach,
+    .count = ivf_count,
+    .maintenance = ivf_maintenance,
+    .expire = ivf_expire,
+    .lexicon = ivf_lexicon,
+};
@@ -0,0 +1,174 @@
+/*
+ * Vecs Project: Indice dei Prompt (delete esatto)
+ * (src/cache/l2_keys.c)
+ *
+ * Open addressing con probing lineare: le chiavi sono già hash a 64 bit, lo
+ * slot vuoto è la chiave 0. La rimozione sposta indietro gli slot successivi
+ * della stessa sequenza (backward shift), quindi niente tombstone.
+ * Tutte le funzioni accettano keys NULL (indice non disponibile, es. OOM).
+ */
+
+#include "l2_keys.h"
+#include "text.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS_INITIAL_SLOTS 1024 // Potenza di 2: raddoppia oltre il 75% di riempimento
+#define KEYS_STACK_TEXT 1024    // Prompt normalizzati più lunghi usano un buffer allocato
+
+typedef struct {
+    uint64_t key;            // L2_KEY_NONE = slot vuoto
+    uint64_t loc;
+} l2_key_slot_t;
+
+struct l2_keys_s {
+    l2_key_slot_t *slots;
+    size_t mask;             // Slot - 1
+    size_t count;
+};
+
+static inline size_t slot_home(const l2_keys_t *keys, uint64_t key) {
+    return (size_t)(key ^ (key >> 29)) & keys->mask;
+}
+
+l2_keys_t *l2_keys_create(void) {
+    l2_keys_t *keys = calloc(1, sizeof(l2_keys_t));
+    if (!keys) return NULL;
+    keys->slots = calloc(KEYS_INITIAL_SLOTS, sizeof(l2_key_slot_t));
+    if (!keys->slots) {
+        free(keys);
+        return NULL;
+    }
+    keys->mask = KEYS_INITIAL_SLOTS - 1;
+    return keys;
+}
+
+void l2_keys_destroy(l2_keys_t *keys) {
+    if (!keys) return;
+    free(keys->slots);
+    free(keys);
+}
+
+void l2_keys_clear(l2_keys_t *keys) {
+    if (!keys) return;
+    if (keys->mask + 1 > KEYS_INITIAL_SLOTS) {
+        l2_key_slot_t *slots = calloc(KEYS_INITIAL_SLOTS, sizeof(l2_key_slot_t));
+        if (slots) {
+            free(keys->slots);
+            keys->slots = slots;
+            keys->mask = KEYS_INITIAL_SLOTS - 1;
+            keys->count = 0;
+            return;
+        }
+    }
+    memset(keys->slots, 0, (keys->mask + 1) * sizeof(l2_key_slot_t));
+    keys->count = 0;
+}
+
+uint64_t l2_keys_hash(const char *prompt) {
+    if (!prompt) return L2_KEY_NONE;
+    // normalize_text non allunga mai il testo
+    char stack_buf[KEYS_STACK_TEXT];
+    size_t size = strlen(prompt) + 1;
+    char *buf = size <= sizeof(stack_buf) ? stack_buf : malloc(size);
+    if (!buf) {
+        buf = stack_buf; // OOM: chiave sul prefisso (solo i prompt più lunghi del buffer possono collidere)
+        size = sizeof(stack_buf);
+    }
+    normalize_text(prompt, buf, size);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char *)buf; *c; c++) {
+        hash ^= *c;
+        hash *= 0x100000001b3ULL;
+    }
+    if (buf != stack_buf) free(buf);
+    return hash != L2_KEY_NONE ? hash : 1;
+}
+
+// Reinserisce tutte le coppie in una tabella di new_slots slot (potenza di 2)
+static int keys_resize(l2_keys_t *keys, size_t new_slots) {
+    l2_key_slot_t *slots = calloc(new_slots, sizeof(l2_key_slot_t));
+    if (!slots) return -1;
+    l2_key_slot_t *old = keys->slots;
+    size_t old_slots = keys->mask + 1;
+    keys->slots = slots;
+    keys->mask = new_slots - 1;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i].key == L2_KEY_NONE) continue;
+        size_t pos = slot_home(keys, old[i].key);
+        while (slots[pos].key != L2_KEY_NONE) pos = (pos + 1) & keys->mask;
+        slots[pos] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+int l2_keys_add(l2_keys_t *keys, uint64_t key, uint64_t loc) {
+    if (!keys) return -1;
+    if (key == L2_KEY_NONE) return 0;
+    if ((keys->count + 1) * 4 > (keys->mask + 1) * 3 && keys_resize(keys, (keys->mask + 1) * 2) != 0) {
+        // Oltre il 75% si continua finché resta uno slot vuoto (le sequenze si allungano)
+        if (keys->count + 1 > keys->mask) return -1;
+    }
+    size_t pos = slot_home(keys, key);
+    while (keys->slots[pos].key != L2_KEY_NONE) pos = (pos + 1) & keys->mask;
+    keys->slots[pos].key = key;
+    keys->slots[pos].loc = loc;
+    keys->count++;
+    return 0;
+}
+
+// Slot della coppia (key, loc), o -1
+static long keys_locate(const l2_keys_t *keys, uint64_t key, uint64_t loc) {
+    for (size_t pos = slot_home(keys, key); keys->slots[pos].key != L2_KEY_NONE; pos = (pos + 1) & keys->mask) {
+        if (keys->slots[pos].key == key && keys->slots[pos].loc == loc) return (long)pos;
+    }
+    return -1;
+}
+
+void l2_keys_remove(l2_keys_t *keys, uint64_t key, uint64_t loc) {
+    if (!keys || key == L2_KEY_NONE) return;
+    long found = keys_locate(keys, key, loc);
+    if (found < 0) return;
+
+    // Backward shift: ogni slot successivo che può stare nel buco ci viene spostato
+    size_t hole = (size_t)found;
+    size_t pos = hole;
+    while (1) {
+        pos = (pos + 1) & keys->mask;
+        if (keys->slots[pos].key == L2_KEY_NONE) break;
+        size_t home = slot_home(keys, keys->slots[pos].key);
+        // Lo slot può scendere nel buco se la sua home non cade in (hole, pos]
+        if (((pos - home) & keys->mask) >= ((pos - hole) & keys->mask)) {
+            keys->slots[hole] = keys->slots[pos];
+            hole = pos;
+        }
+    }
+    keys->slots[hole].key = L2_KEY_NONE;
+    keys->count--;
+
+    // Restituisce memoria quando la tabella si è svuotata per 7/8
+    size_t slots = keys->mask + 1;
+    if (slots > KEYS_INITIAL_SLOTS && keys->count < slots / 8) keys_resize(keys, slots / 2);
+}
+
+void l2_keys_move(l2_keys_t *keys, uint64_t key, uint64_t old_loc, uint64_t new_loc) {
+    if (!keys || key == L2_KEY_NONE) return;
+    long found = keys_locate(keys, key, old_loc);
+    if (found >= 0) keys->slots[found].loc = new_loc;
+}
+
+int l2_keys_find(const l2_keys_t *keys, uint64_t key, uint64_t *locs, int max) {
+    if (!keys || key == L2_KEY_NONE) return 0;
+    int count = 0;
+    for (size_t pos = slot_home(keys, key); keys->slots[pos].key != L2_KEY_NONE && count < max;
+         pos = (pos + 1) & keys->mask) {
+        if (keys->slots[pos].key == key) locs[count++] = keys->slots[pos].loc;
+    }
+    return count;
+}
+
+size_t l2_keys_count(const l2_keys_t *keys) {
+    return keys ? keys->count : 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * Vecs Project: Implementazione Indice Lessicale (BM25 ibrido)
+ * (src/cache/l2_lex.c)
+ *
+ * Dizionario dei termini (tabella hash a catene) con una posting list per
+ * termine; ogni entry conserva i propri termini ordinati per id, con tf e
+ * posizione nella posting list: la rimozione è uno swap-remove per termine,
+ * senza scandire le liste.
+ */
+
+#include "l2_lex.h"
+#include "text.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LEX_MAX_TEXT 1024        // Byte normalizzati considerati di un prompt
+#define LEX_MAX_DOC_TERMS 64     // Termini distinti indicizzati per entry
+#define LEX_MAX_TERM_LEN 48      // I token più lunghi vengono troncati
+#define LEX_MAX_CANDIDATES 256   // Posting lette al più da uno shortcut
+#define LEX_INITIAL_BUCKETS 1024 // Potenza di 2: la tabella raddoppia quando i termini superano i bucket
+#define BM25_K1 1.2f
+#define BM25_B 0.75f
+
+// Token di un testo (punta nel buffer normalizzato)
+typedef struct {
+    const char *text;
+    uint32_t len;
+    uint32_t tf;
+    uint64_t hash;
+} lex_token_t;
+
+typedef struct {
+    char *text;              // NULL = slot libero
+    uint32_t len;
+    uint64_t hash;
+    uint32_t *postings;      // Entry che contengono il termine
+    uint32_t df;
+    uint32_t cap;
+    uint32_t next;           // Catena del bucket (o dei liberi)
+} lex_term_t;
+
+typedef struct {
+    uint32_t term;
+    uint32_t tf;
+    uint32_t slot;           // Posizione nella posting list del termine
+} lex_doc_term_t;
+
+typedef struct {
+    lex_doc_term_t *terms;   // Ordinati per id del termine; NULL = slot libero
+    uint32_t nterms;
+    uint32_t len;            // Token totali del prompt (normalizzazione sulla lunghezza)
+    uint32_t next_free;
+    const char *prompt;
+    const vs_value_t *response;
+    l2_text_filter_t features;
+    time_t expire_at;
+} lex_doc_t;
+
+struct l2_lex_s {
+    lex_term_t *terms;
+    uint32_t num_terms;      // Slot usati (vivi + liberi)
+    uint32_t terms_cap;
+    uint32_t free_term;      // Testa della lista dei termini liberi
+    size_t live_terms;
+    uint32_t *buckets;
+    uint32_t num_buckets;    // Potenza di 2
+    lex_doc_t *docs;
+    uint32_t num_docs;       // Slot usati (vivi + liberi)
+    uint32_t docs_cap;
+    uint32_t free_doc;       // Testa della lista delle entry libere
+    size_t live_docs;
+    uint64_t total_len;      // Token totali delle entry vive (lunghezza media)
+};
+
+static uint64_t hash_fnv1a(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// --- TOKEN ---
+
+// Normalizza il testo in buf e ne estrae i termini distinti (al più max).
+// Ritorna i distinti; total riceve i token totali (anche oltre max)
+static int tokenize(const char *text, char *buf, size_t buf_size, lex_token_t *out, int max, uint32_t *total) {
+    *total = 0;
+    if (!text) return 0;
+    normalize_text(text, buf, buf_size);
+    int count = 0;
+    char *p = buf;
+    while (*p) {
+        char *end = strchr(p, ' ');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len > LEX_MAX_TERM_LEN) len = LEX_MAX_TERM_LEN;
+        uint64_t hash = hash_fnv1a(p, len);
+        (*total)++;
+        int found = 0;
+        for (int i = 0; i < count && !found; i++) {
+            if (out[i].hash == hash && out[i].len == len && memcmp(out[i].text, p, len) == 0) {
+                out[i].tf++;
+                found = 1;
+            }
+        }
+        if (!found && count < max) {
+            out[count].text = p;
+            out[count].len = (uint32_t)len;
+            out[count].tf = 1;
+            out[count].hash = hash;
+            count++;
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    return count;
+}
+
+// --- DIZIONARIO ---
+
+static uint32_t term_find(const l2_lex_t *lex, const lex_token_t *tok) {
+    uint32_t id = lex->buckets[tok->hash & (lex->num_buckets - 1)];
+    while (id != L2_LEX_NONE) {
+        const lex_term_t *t = &lex->terms[id];
+        if (t->hash == tok->hash && t->len == tok->len && memcmp(t->text, tok->text, tok->len) == 0) return id;
+        id = t->next;
+    }
+    return L2_LEX_NONE;
+}
+
+// Raddoppia i bucket (se l'allocazione fallisce si continua con catene più lunghe)
+static void buckets_grow(l2_lex_t *lex) {
+    uint32_t new_count = lex->num_buckets * 2;
+    uint32_t *buckets = malloc(new_count * sizeof(uint32_t));
+    if (!buckets) return;
+    memset(buckets, 0xff, new_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < lex->num_terms; id++) {
+        lex_term_t *t = &lex->terms[id];
+        if (!t->text) continue;
+        uint32_t b = t->hash & (new_count - 1);
+        t->next = buckets[b];
+        buckets[b] = id;
+    }
+    free(lex->buckets);
+    lex->buckets = buckets;
+    lex->num_buckets = new_count;
+}
+
+static uint32_t term_get_or_add(l2_lex_t *lex, const lex_token_t *tok) {
+    uint32_t id = term_find(lex, tok);
+    if (id != L2_LEX_NONE) return id;
+
+    char *text = malloc(tok->len + 1);
+    if (!text) return L2_LEX_NONE;
+    memcpy(text, tok->text, tok->len);
+    text[tok->len] = '\0';
+    if (lex->free_term != L2_LEX_NONE) {
+        id = lex->free_term;
+        lex->free_term = lex->terms[id].next;
+    } else {
+        if (lex->num_terms == lex->terms_cap) {
+            uint32_t new_cap = lex->terms_cap ? lex->terms_cap * 2 : 256;
+            lex_term_t *terms = realloc(lex->terms, new_cap * sizeof(lex_term_t));
+            if (!terms) { free(text); return L2_LEX_NONE; }
+            lex->terms = terms;
+            lex->terms_cap = new_cap;
+        }
+        id = lex->num_terms++;
+    }
+    lex_term_t *t = &lex->terms[id];
+    memset(t, 0, sizeof(lex_term_t));
+    t->text = text;
+    t->len = tok->len;
+    t->hash = tok->hash;
+    uint32_t b = tok->hash & (lex->num_buckets - 1);
+    t->next = lex->buckets[b];
+    lex->buckets[b] = id;
+    if (++lex->live_terms > lex->num_buckets) buckets_grow(lex);
+    return id;
+}
+
+// Termine senza più entry: fuori dalla tabella, slot riciclato
+static void term_release(l2_lex_t *lex, uint32_t id) {
+    lex_term_t *t = &lex->terms[id];
+    uint32_t *link = &lex->buckets[t->hash & (lex->num_buckets - 1)];
+    while (*link != id) link = &lex->terms[*link].next;
+    *link = t->next;
+    free(t->text);
+    free(t->postings);
+    memset(t, 0, sizeof(lex_term_t));
+    t->next = lex->free_term;
+    lex->free_term = id;
+    lex->live_terms--;
+}
+
+static int posting_append(lex_term_t *t, uint32_t doc) {
+    if (t->df == t->cap) {
+        uint32_t new_cap = t->cap ? t->cap * 2 : 4;
+        uint32_t *postings = realloc(t->postings, new_cap * sizeof(uint32_t));
+        if (!postings) return -1;
+        t->postings = postings;
+        t->cap = new_cap;
+    }
+    t->postings[t->df++] = doc;
+    return 0;
+}
+
+static int compare_doc_term(const void *a, const void *b) {
+    uint32_t x = ((const lex_doc_term_t *)a)->term, y = ((const lex_doc_term_t *)b)->term;
+    return (x > y) - (x < y);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// --- API ---
+
+l2_lex_t *l2_lex_create(void) {
+    l2_lex_t *lex = calloc(1, sizeof(l2_lex_t));
+    if (!lex) return NULL;
+    lex->num_buckets = LEX_INITIAL_BUCKETS;
+    lex->buckets = malloc(lex->num_buckets * sizeof(uint32_t));
+    if (!lex->buckets) {
+        free(lex);
+        return NULL;
+    }
+    memset(lex->buckets, 0xff, lex->num_buckets * sizeof(uint32_t));
+    lex->free_term = L2_LEX_NONE;
+    lex->free_doc = L2_LEX_NONE;
+    return lex;
+}
+
+void l2_lex_destroy(l2_lex_t *lex) {
+    if (!lex) return;
+    for (uint32_t i = 0; i < lex->num_terms; i++) {
+        free(lex->terms[i].text);
+        free(lex->terms[i].postings);
+    }
+    for (uint32_t i = 0; i < lex->num_docs; i++) free(lex->docs[i].terms);
+    free(lex->terms);
+    free(lex->docs);
+    free(lex->buckets);
+    free(lex);
+}
+
+uint32_t l2_lex_add(l2_lex_t *lex, const char *prompt, const vs_value_t *response,
+                    const l2_text_filter_t *features, time_t expire_at) {
+    if (!lex) return L2_LEX_NONE;
+    char buf[LEX_MAX_TEXT];
+    lex_token_t tokens[LEX_MAX_DOC_TERMS];
+    uint32_t total;
+    int count = tokenize(prompt, buf, sizeof(buf), tokens, LEX_MAX_DOC_TERMS, &total);
+    if (count == 0) return L2_LEX_NONE;
+
+    lex_doc_term_t *terms = malloc(count * sizeof(lex_doc_term_t));
+    if (!terms) return L2_LEX_NONE;
+    uint32_t doc;
+    if (lex->free_doc != L2_LEX_NONE) {
+        doc = lex->free_doc;
+        lex->free_doc = lex->docs[doc].next_free;
+    } else {
+        if (lex->num_docs == lex->docs_cap) {
+            uint32_t new_cap = lex->docs_cap ? lex->docs_cap * 2 : 256;
+            lex_doc_t *docs = realloc(lex->docs, new_cap * sizeof(lex_doc_t));
+            if (!docs) { free(terms); return L2_LEX_NONE; }
+            lex->docs = docs;
+            lex->docs_cap = new_cap;
+        }
+        doc = lex->num_docs++;
+    }
+
+    // OOM a metà: l'entry resta indicizzata con i termini aggiunti fin lì
+    uint32_t added = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t id = term_get_or_add(lex, &tokens[i]);
+        if (id == L2_LEX_NONE) continue;
+        lex_term_t *t = &lex->terms[id];
+        if (posting_append(t, doc) != 0) {
+            if (t->df == 0) term_release(lex, id);
+            continue;
+        }
+        terms[added].term = id;
+        terms[added].tf = tokens[i].tf;
+        terms[added].slot = t->df - 1;
+        added++;
+    }
+    qsort(terms, added, sizeof(lex_doc_term_t), compare_doc_term);
+
+    lex_doc_t *d = &lex->docs[doc];
+    d->terms = terms;
+    d->nterms = added;
+    d->len = total;
+    d->next_free = L2_LEX_NONE;
+    d->prompt = prompt;
+    d->response = response;
+    d->features = *features;
+    d->expire_at = expire_at;
+    lex->live_docs++;
+    lex->total_len += total;
+    return doc;
+}
+
+void l2_lex_remove(l2_lex_t *lex, uint32_t doc) {
+    if (!lex || doc == L2_LEX_NONE) return;
+    lex_doc_t *d = &lex->docs[doc];
+    for (uint32_t i = 0; i < d->nterms; i++) {
+        uint32_t id = d->terms[i].term;
+        lex_term_t *t = &lex->terms[id];
+        uint32_t slot = d->terms[i].slot;
+        uint32_t moved = t->postings[--t->df];
+        if (moved != doc) {
+            // L'ultima posting prende il posto della rimossa: si aggiorna la sua posizione
+            t->postings[slot] = moved;
+            lex_doc_t *m = &lex->docs[moved];
+            lex_doc_term_t key = { id, 0, 0 };
+            lex_doc_term_t *entry = bsearch(&key, m->terms, m->nterms, sizeof(lex_doc_term_t), compare_doc_term);
+            if (entry) entry->slot = slot;
+        }
+        if (t->df == 0) {
+            term_release(lex, id);
+        } else if (t->cap > 16 && t->df < t->cap / 4) {
+            uint32_t *postings = realloc(t->postings, (t->cap / 2) * sizeof(uint32_t));
+            if (postings) {
+                t->postings = postings;
+                t->cap /= 2;
+            }
+        }
+    }
+    free(d->terms);
+    lex->total_len -= d->len;
+    lex->live_docs--;
+    memset(d, 0, sizeof(lex_doc_t));
+    d->next_free = lex->free_doc;
+    lex->free_doc = doc;
+}
+
+size_t l2_lex_count(const l2_lex_t *lex) {
+    return lex ? lex->live_docs : 0;
+}
+
+// --- SCORING ---
+
+static inline float bm25_idf(uint32_t df, size_t n) {
+    return logf(1.0f + ((float)n - (float)df + 0.5f) / ((float)df + 0.5f));
+}
+
+static inline float bm25_tf(uint32_t tf, uint32_t len, float avgdl) {
+    return (float)tf * (BM25_K1 + 1.0f) / ((float)tf + BM25_K1 * (1.0f - BM25_B + BM25_B * (float)len / avgdl));
+}
+
+static inline float avg_len(const l2_lex_t *lex, uint32_t fallback) {
+    if (lex->live_docs == 0 || lex->total_len == 0) return fallback > 0 ? (float)fallback : 1.0f;
+    return (float)lex->total_len / (float)lex->live_docs;
+}
+
+// Merge tra i termini della query e quelli dell'entry (entrambi ordinati per id)
+static float score_terms(const l2_lex_t *lex, const l2_lex_query_t *query, const lex_doc_term_t *terms,
+                         uint32_t nterms, uint32_t len) {
+    if (query->max_score <= 0.0f) return 0.0f;
+    float avgdl = avg_len(lex, len);
+    float score = 0.0f;
+    int i = 0;
+    uint32_t j = 0;
+    while (i < query->count && j < nterms) {
+        if (query->terms[i].term < terms[j].term) {
+            i++;
+        } else if (query->terms[i].term > terms[j].term) {
+            j++;
+        } else {
+            score += query->terms[i].idf * bm25_tf(terms[j].tf, len, avgdl);
+            i++;
+            j++;
+        }
+    }
+    score /= query->max_score;
+    return score < 1.0f ? score : 1.0f;
+}
+
+static int compare_query_term(const void *a, const void *b) {
+    uint32_t x = ((const l2_lex_term_t *)a)->term, y = ((const l2_lex_term_t *)b)->term;
+    return (x > y) - (x < y);
+}
+
+int l2_lex_query_init(const l2_lex_t *lex, l2_lex_query_t *query, const char *text) {
+    query->count = 0;
+    query->max_score = 0.0f;
+    char buf[LEX_MAX_TEXT];
+    lex_token_t tokens[L2_LEX_MAX_QUERY_TERMS];
+    uint32_t total;
+    int count = tokenize(text, buf, sizeof(buf), tokens, L2_LEX_MAX_QUERY_TERMS, &total);
+    float avgdl = avg_len(lex, total);
+    for (int i = 0; i < count; i++) {
+        l2_lex_term_t *qt = &query->terms[i];
+        qt->term = term_find(lex, &tokens[i]);
+        qt->df = qt->term != L2_LEX_NONE ? lex->terms[qt->term].df : 0;
+        qt->qtf = tokens[i].tf;
+        // Anche i termini mai visti pesano sul massimo: nessuna entry può coprire tutta la query
+        qt->idf = bm25_idf(qt->df, lex->live_docs);
+        query->max_score += qt->idf * bm25_tf(qt->qtf, total, avgdl);
+    }
+    query->count = count;
+    qsort(query->terms, count, sizeof(l2_lex_term_t), compare_query_term);
+    return count;
+}
+
+float l2_lex_score_text(const l2_lex_t *lex, const l2_lex_query_t *query, const char *text) {
+    if (query->count == 0 || !text) return 0.0f;
+    char buf[LEX_MAX_TEXT];
+    lex_token_t tokens[LEX_MAX_DOC_TERMS];
+    lex_doc_term_t terms[LEX_MAX_DOC_TERMS];
+    uint32_t total;
+    int count = tokenize(text, buf, sizeof(buf), tokens, LEX_MAX_DOC_TERMS, &total);
+    uint32_t known = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t id = term_find(lex, &tokens[i]);
+        if (id == L2_LEX_NONE) continue;
+        terms[known].term = id;
+        terms[known].tf = tokens[i].tf;
+        known++;
+    }
+    qsort(terms, known, sizeof(lex_doc_term_t), compare_doc_term);
+    return score_terms(lex, query, terms, known, total);
+}
+
+int l2_lex_search(const l2_lex_t *lex, const l2_lex_query_t *query, const l2_text_filter_t *filter,
+                  float threshold, time_t now, l2_search_result_t *results, int k) {
+    if (!lex || query->count == 0 || lex->live_docs == 0 || k <= 0) return 0;
+    if (k > L2_MAX_TOPK) k = L2_MAX_TOPK;
+
+    // Termini noti dal più raro: le loro liste sono le più corte e pesano di più nello score
+    int order[L2_LEX_MAX_QUERY_TERMS];
+    int known = 0;
+    for (int i = 0; i < query->count; i++) {
+        if (query->terms[i].term == L2_LEX_NONE) continue;
+        int pos = known++;
+        while (pos > 0 && query->terms[order[pos - 1]].df > query->terms[i].df) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = i;
+    }
+
+    uint32_t candidates[LEX_MAX_CANDIDATES];
+    size_t n = 0;
+    for (int o = 0; o < known && n < LEX_MAX_CANDIDATES; o++) {
+        const lex_term_t *t = &lex->terms[query->terms[order[o]].term];
+        size_t take = t->df < LEX_MAX_CANDIDATES - n ? t->df : LEX_MAX_CANDIDATES - n;
+        memcpy(candidates + n, t->postings, take * sizeof(uint32_t));
+        n += take;
+    }
+    qsort(candidates, n, sizeof(uint32_t), compare_u32);
+
+    l2_candidate_t best[L2_MAX_TOPK];
+    int best_count = 0;
+    for (size_t c = 0; c < n; c++) {
+        if (c > 0 && candidates[c] == candidates[c - 1]) continue;
+        const lex_doc_t *d = &lex->docs[candidates[c]];
+        if (now > d->expire_at) continue;
+        float score = score_terms(lex, query, d->terms, d->nterms, d->len);
+        // Stessi filtri dello score vettoriale: lunghezza e feature (es. negazioni)
+        float penalized = l2_apply_hybrid_filters(filter, &d->features, score);
+        if (penalized < threshold) continue;
+        best_count = l2_candidate_push(best, best_count, k, 0, candidates[c], penalized, score);
+    }
+
+    for (int i = 0; i < best_count; i++) {
+        const lex_doc_t *d = &lex->docs[best[i].row];
+        results[i].response = vs_data(d->response);
+        results[i].prompt = d->prompt;
+        results[i].score = best[i].raw;
+        results[i].penalized_score = best[i].score;
+        results[i].expire_at = d->expire_at;
+        results[i].loc = L2_LOC_NONE; // La posizione nell'indice L2 la ritrova il backend (ops->touch)
+    }
+    return best_count;
+}
@@ -0,0 +1,99 @@
+/*
+ * Vecs Project: Implementazione Product Quantizer (IVF-PQ)
+ * (src/cache/l2_pq.c)
+ */
+
+#include "l2_pq.h"
+#include "kmeans.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PQ_TRAIN_ITERATIONS 8
+#define PQ_DEFAULT_DSUB 16
+
+struct l2_pq_s {
+    int dim;
+    int m;                // Sottoquantizzatori
+    int dsub;             // Dimensioni per sottospazio (dim / m)
+    int trained;
+    float *codebooks;     // [m x PQ_KSUB x dsub]
+    vec_kernels_t vk;     // Kernel per la dimensione dsub
+};
+
+l2_pq_t *l2_pq_create(int dim, int m) {
+    if (m <= 0) m = dim / PQ_DEFAULT_DSUB;
+    if (m < 1) m = 1;
+    if (m > dim) m = dim;
+    while (dim % m != 0) m--;
+
+    l2_pq_t *pq = calloc(1, sizeof(l2_pq_t));
+    if (!pq) return NULL;
+    pq->dim = dim;
+    pq->m = m;
+    pq->dsub = dim / m;
+    pq->codebooks = calloc((size_t)m * PQ_KSUB * pq->dsub, sizeof(float));
+    if (!pq->codebooks) {
+        free(pq);
+        return NULL;
+    }
+    vec_kernels_select(&pq->vk, pq->dsub);
+    return pq;
+}
+
+void l2_pq_destroy(l2_pq_t *pq) {
+    if (!pq) return;
+    free(pq->codebooks);
+    free(pq);
+}
+
+int l2_pq_get_m(const l2_pq_t *pq) {
+    return pq->m;
+}
+
+int l2_pq_is_trained(const l2_pq_t *pq) {
+    return pq->trained;
+}
+
+void l2_pq_reset(l2_pq_t *pq) {
+    pq->trained = 0;
+}
+
+int l2_pq_train(l2_pq_t *pq, const float *residuals, size_t n) {
+    if (n < PQ_KSUB) return -1;
+
+    for (int j = 0; j < pq->m; j++) {
+        // Ogni sottospazio è una "colonna" della matrice dei residui (stride = dim)
+        float *cb = pq->codebooks + (size_t)j * PQ_KSUB * pq->dsub;
+        if (kmeans_train(&pq->vk, residuals + (size_t)j * pq->dsub, n, pq->dim, pq->dsub,
+                         PQ_KSUB, PQ_TRAIN_ITERATIONS, 0, cb) != 0) {
+            return -1;
+        }
+    }
+    pq->trained = 1;
+    return 0;
+}
+
+void l2_pq_encode(const l2_pq_t *pq, const float *residual, uint8_t *code) {
+    for (int j = 0; j < pq->m; j++) {
+        const float *cb = pq->codebooks + (size_t)j * PQ_KSUB * pq->dsub;
+        code[j] = (uint8_t)kmeans_nearest(&pq->vk, residual + (size_t)j * pq->dsub, cb, PQ_KSUB, pq->dsub);
+    }
+}
+
+void l2_pq_decode(const l2_pq_t *pq, const uint8_t *code, float *residual) {
+    for (int j = 0; j < pq->m; j++) {
+        const float *cb = pq->codebooks + ((size_t)j * PQ_KSUB + code[j]) * pq->dsub;
+        memcpy(residual + (size_t)j * pq->dsub, cb, pq->dsub * sizeof(float));
+    }
+}
+
+void l2_pq_build_lut(const l2_pq_t *pq, const float *query, float *lut) {
+    for (int j = 0; j < pq->m; j++) {
+        const float *q = query + (size_t)j * pq->dsub;
+        const float *cb = pq->codebooks + (size_t)j * PQ_KSUB * pq->dsub;
+        for (int k = 0; k < PQ_KSUB; k++) {
+            lut[j * PQ_KSUB + k] = pq->vk.dot(q, cb + (size_t)k * pq->dsub, pq->dsub);
+        }
+    }
+}
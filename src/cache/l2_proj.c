@@ -0,0 +1,131 @@
+/*
+ * Vecs Project: Implementazione Proiezione Ridotta (prefiltro L2)
+ * (src/cache/l2_proj.c)
+ */
+
+#include "l2_proj.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PCA_ITERATIONS 16 // Passi dell'iterazione a sottospazio (bastano per il sottospazio dominante)
+
+struct l2_proj_s {
+    int dim;
+    int out_dim;
+    l2_projection_t mode;
+    int trained;
+    float *components;    // [out_dim x dim] ortonormali (solo PCA)
+    vec_kernels_t vk;     // Kernel per la dimensione dim
+    vec_kernels_t out_vk; // Kernel per la dimensione out_dim
+};
+
+l2_proj_t *l2_proj_create(int dim, int out_dim, l2_projection_t mode) {
+    if (out_dim <= 0 || out_dim > dim) return NULL;
+    l2_proj_t *proj = calloc(1, sizeof(l2_proj_t));
+    if (!proj) return NULL;
+    proj->dim = dim;
+    proj->out_dim = out_dim;
+    proj->mode = mode;
+    if (mode == L2_PROJECTION_PCA) {
+        proj->components = calloc((size_t)out_dim * dim, sizeof(float));
+        if (!proj->components) {
+            free(proj);
+            return NULL;
+        }
+    } else {
+        proj->trained = 1;
+    }
+    vec_kernels_select(&proj->vk, dim);
+    vec_kernels_select(&proj->out_vk, out_dim);
+    return proj;
+}
+
+void l2_proj_destroy(l2_proj_t *proj) {
+    if (!proj) return;
+    free(proj->components);
+    free(proj);
+}
+
+int l2_proj_get_dim(const l2_proj_t *proj) {
+    return proj->out_dim;
+}
+
+int l2_proj_is_trained(const l2_proj_t *proj) {
+    return proj->trained;
+}
+
+void l2_proj_reset(l2_proj_t *proj) {
+    if (proj->mode == L2_PROJECTION_PCA) proj->trained = 0;
+}
+
+const char *l2_proj_name(const l2_proj_t *proj) {
+    return proj->mode == L2_PROJECTION_PCA ? "pca" : "prefix";
+}
+
+// Gram-Schmidt modificato sulle righe di v [k x dim]
+static void orthonormalize(const vec_kernels_t *vk, float *v, int k, int dim) {
+    for (int j = 0; j < k; j++) {
+        float *row = v + (size_t)j * dim;
+        for (int i = 0; i < j; i++) {
+            const float *prev = v + (size_t)i * dim;
+            vk->axpby(row, prev, 1.0f, -vk->dot(row, prev, dim), dim);
+        }
+        vec_kernels_normalize(vk, row, dim);
+    }
+}
+
+int l2_proj_train(l2_proj_t *proj, const float *sample, size_t n) {
+    if (proj->mode != L2_PROJECTION_PCA) return 0;
+    if (n < (size_t)proj->out_dim) return -1;
+    int dim = proj->dim;
+    int k = proj->out_dim;
+    float *cov = calloc((size_t)dim * dim, sizeof(float));
+    float *next = malloc((size_t)k * dim * sizeof(float));
+    if (!cov || !next) {
+        free(cov); free(next);
+        return -1;
+    }
+
+    // Momenti secondi (non centrati: si vuole preservare il prodotto scalare, non la varianza).
+    // Solo il triangolo superiore, poi lo specchio
+    for (size_t s = 0; s < n; s++) {
+        const float *x = sample + s * dim;
+        for (int a = 0; a < dim; a++) {
+            proj->vk.axpby(cov + (size_t)a * dim + a, x + a, 1.0f, x[a], dim - a);
+        }
+    }
+    for (int a = 0; a < dim; a++) {
+        for (int b = 0; b < a; b++) cov[(size_t)a * dim + b] = cov[(size_t)b * dim + a];
+    }
+
+    // Iterazione a sottospazio da una base pseudo-casuale (deterministica)
+    unsigned int seed = 0x5ca1;
+    float *basis = proj->components;
+    for (size_t i = 0; i < (size_t)k * dim; i++) basis[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+    orthonormalize(&proj->vk, basis, k, dim);
+    for (int it = 0; it < PCA_ITERATIONS; it++) {
+        for (int j = 0; j < k; j++) {
+            const float *v = basis + (size_t)j * dim;
+            float *w = next + (size_t)j * dim;
+            for (int a = 0; a < dim; a++) w[a] = proj->vk.dot(cov + (size_t)a * dim, v, dim);
+        }
+        orthonormalize(&proj->vk, next, k, dim);
+        memcpy(basis, next, (size_t)k * dim * sizeof(float));
+    }
+
+    free(cov);
+    free(next);
+    proj->trained = 1;
+    return 0;
+}
+
+void l2_proj_apply(const l2_proj_t *proj, const float *v, float *out) {
+    if (proj->mode == L2_PROJECTION_PCA) {
+        for (int j = 0; j < proj->out_dim; j++) {
+            out[j] = proj->vk.dot(proj->components + (size_t)j * proj->dim, v, proj->dim);
+        }
+    } else {
+        memcpy(out, v, proj->out_dim * sizeof(float));
+    }
+    vec_kernels_normalize(&proj->out_vk, out, proj->out_dim);
+}
@@ -0,0 +1,190 @@
+/*
+ * Vecs Project: Value Log (tier freddo delle risposte L2)
+ * (src/cache/l2_vlog.c)
+ *
+ * Il file è diviso in segmenti da VLOG_SEGMENT_SIZE byte, ognuno mappato una
+ * volta sola (i puntatori restituiti non si spostano mai). Un segmento alla
+ * volta riceve le append; ogni segmento conta solo i propri valori vivi, così
+ * il rilascio non tocca le pagine su disco. Un segmento senza valori vivi
+ * torna libero: lo spazio su disco viene restituito e il segmento riusato.
+ */
+
+#include "l2_vlog.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define VLOG_SEGMENT_SIZE ((size_t)16 << 20) // Byte per segmento (anche il valore massimo nel log)
+
+typedef struct {
+    char *base;              // Mapping del segmento (fisso per tutta la vita del log)
+    size_t used;             // Byte già accodati
+    size_t live;             // Valori vivi
+    int reserved;            // Spazio su disco allocato (0 dopo il rilascio del segmento)
+} vlog_segment_t;
+
+struct l2_vlog_s {
+    int fd;
+    char *path;
+    size_t inline_max;
+    vlog_segment_t *segments; // Indice = posizione nel file (offset = indice * VLOG_SEGMENT_SIZE)
+    size_t *by_addr;         // Indici dei segmenti ordinati per indirizzo del mapping
+    size_t count;
+    size_t capacity;
+    long active;             // Segmento che riceve le append (-1 = nessuno)
+};
+
+l2_vlog_t *l2_vlog_open(const char *path, size_t inline_max) {
+    if (!path || !*path) return NULL;
+    l2_vlog_t *log = calloc(1, sizeof(l2_vlog_t));
+    if (!log) return NULL;
+    log->path = strdup(path);
+    log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (!log->path || log->fd < 0) {
+        log_error("L2 Value Log: impossibile aprire %s", path);
+        if (log->fd >= 0) close(log->fd);
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+    log->inline_max = inline_max;
+    log->active = -1;
+    return log;
+}
+
+void l2_vlog_close(l2_vlog_t *log) {
+    if (!log) return;
+    for (size_t i = 0; i < log->count; i++) munmap(log->segments[i].base, VLOG_SEGMENT_SIZE);
+    close(log->fd);
+    unlink(log->path);
+    free(log->segments);
+    free(log->by_addr);
+    free(log->path);
+    free(log);
+}
+
+// Alloca i blocchi su disco del segmento: scrivere su un buco del file con il
+// disco pieno causerebbe un SIGBUS, meglio accorgersene qui
+static int segment_reserve(l2_vlog_t *log, size_t idx) {
+    off_t offset = (off_t)(idx * VLOG_SEGMENT_SIZE);
+#if defined(__linux__)
+    if (posix_fallocate(log->fd, offset, (off_t)VLOG_SEGMENT_SIZE) != 0) return -1;
+#else
+    if (ftruncate(log->fd, offset + (off_t)VLOG_SEGMENT_SIZE) != 0) return -1;
+#endif
+    log->segments[idx].reserved = 1;
+    return 0;
+}
+
+// Restituisce al filesystem lo spazio di un segmento vuoto (dove supportato)
+static void segment_discard(l2_vlog_t *log, size_t idx) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    off_t offset = (off_t)(idx * VLOG_SEGMENT_SIZE);
+    if (fallocate(log->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, (off_t)VLOG_SEGMENT_SIZE) == 0) {
+        log->segments[idx].reserved = 0;
+    }
+#else
+    (void)log; (void)idx;
+#endif
+}
+
+// Mappa un nuovo segmento in fondo al file
+static long segment_create(l2_vlog_t *log) {
+    if (log->count == log->capacity) {
+        size_t new_cap = log->capacity ? log->capacity * 2 : 16;
+        vlog_segment_t *segments = realloc(log->segments, new_cap * sizeof(vlog_segment_t));
+        if (!segments) return -1;
+        log->segments = segments;
+        size_t *by_addr = realloc(log->by_addr, new_cap * sizeof(size_t));
+        if (!by_addr) return -1;
+        log->by_addr = by_addr;
+        log->capacity = new_cap;
+    }
+    size_t idx = log->count;
+    memset(&log->segments[idx], 0, sizeof(vlog_segment_t));
+    if (segment_reserve(log, idx) != 0) return -1;
+    char *base = mmap(NULL, VLOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd,
+                      (off_t)(idx * VLOG_SEGMENT_SIZE));
+    if (base == MAP_FAILED) return -1;
+    // Accessi sparsi (un valore per HIT): il read-ahead sprecherebbe page cache
+    posix_madvise(base, VLOG_SEGMENT_SIZE, POSIX_MADV_RANDOM);
+    log->segments[idx].base = base;
+
+    // Inserimento ordinato nell'indice per indirizzo
+    size_t pos = log->count;
+    while (pos > 0 && log->segments[log->by_addr[pos - 1]].base > base) {
+        log->by_addr[pos] = log->by_addr[pos - 1];
+        pos--;
+    }
+    log->by_addr[pos] = idx;
+    log->count++;
+    return (long)idx;
+}
+
+// Segmento per le prossime append: uno libero se c'è, altrimenti uno nuovo
+static long segment_next(l2_vlog_t *log) {
+    for (size_t i = 0; i < log->count; i++) {
+        vlog_segment_t *seg = &log->segments[i];
+        if ((long)i == log->active || seg->live > 0) continue;
+        if (!seg->reserved && segment_reserve(log, i) != 0) return -1;
+        seg->used = 0;
+        return (long)i;
+    }
+    return segment_create(log);
+}
+
+// Segmento che contiene il puntatore (ricerca binaria sui mapping), -1 se è in RAM
+static long segment_find(const l2_vlog_t *log, const char *p) {
+    size_t lo = 0, hi = log->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const vlog_segment_t *seg = &log->segments[log->by_addr[mid]];
+        if (p < seg->base) hi = mid;
+        else if (p >= seg->base + VLOG_SEGMENT_SIZE) lo = mid + 1;
+        else return (long)log->by_addr[mid];
+    }
+    return -1;
+}
+
+char *l2_vlog_store(l2_vlog_t *log, const char *value) {
+    size_t len = strlen(value);
+    if (!log || len < log->inline_max || len + 1 > VLOG_SEGMENT_SIZE) return strdup(value);
+
+    if (log->active < 0 || log->segments[log->active].used + len + 1 > VLOG_SEGMENT_SIZE) {
+        long next = segment_next(log);
+        if (next < 0) {
+            // Disco pieno o mapping fallito: il valore resta in RAM, la cache continua a funzionare
+            log_warn("L2 Value Log: nessun segmento disponibile, risposta mantenuta in RAM");
+            return strdup(value);
+        }
+        if (log->active >= 0) {
+            // Segmento completo: avvia il writeback, le sue pagine potranno uscire dalla RAM
+            msync(log->segments[log->active].base, VLOG_SEGMENT_SIZE, MS_ASYNC);
+        }
+        log->active = next;
+    }
+    vlog_segment_t *seg = &log->segments[log->active];
+    char *dst = seg->base + seg->used;
+    memcpy(dst, value, len + 1);
+    seg->used += len + 1;
+    seg->live++;
+    return dst;
+}
+
+void l2_vlog_release(l2_vlog_t *log, char *value) {
+    if (!value) return;
+    long idx = log ? segment_find(log, value) : -1;
+    if (idx < 0) {
+        free(value);
+        return;
+    }
+    vlog_segment_t *seg = &log->segments[idx];
+    if (--seg->live > 0) return;
+    // Nessun valore vivo: il segmento attivo riparte da capo, gli altri tornano liberi
+    seg->used = 0;
+    if (idx != log->active) segment_discard(log, (size_t)idx);
+}
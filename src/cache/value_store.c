@@ -0,0 +1,181 @@
+/*
+ * Vecs Project: Value Store (risposte condivise L1/L2)
+ * (src/cache/value_store.c)
+ *
+ * Tabella hash a catene indicizzata dall'hash del contenuto (FNV-1a a 64 bit).
+ * A parità di hash si confrontano lunghezza e byte, quindi le collisioni non
+ * fondono mai valori diversi. Il confronto legge i byte solo su hash uguale:
+ * i valori nel value log non vengono toccati dagli inserimenti distinti.
+ */
+
+#include "value_store.h"
+#include "l2_vlog.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define VS_INITIAL_BUCKETS 1024 // Potenza di 2: la tabella raddoppia quando values > buckets
+
+struct vs_value_s {
+    const char *data;        // Byte terminati da '\0': inline_data o value log
+    size_t len;
+    uint64_t hash;
+    size_t refs;
+    char *logged;            // Copia nel value log (NULL se in RAM)
+    struct vs_value_s *next; // Catena del bucket
+    char inline_data[];      // Copia in RAM (vuota se il valore è nel log)
+};
+
+struct value_store_s {
+    vs_value_t **buckets;
+    size_t num_buckets;      // Potenza di 2
+    vs_stats_t stats;
+    l2_vlog_t *log;          // Tier su disco (NULL = tutto in RAM)
+    size_t inline_max;
+    pthread_mutex_t lock;
+};
+
+static uint64_t hash_fnv1a(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+value_store_t *vs_create(const char *log_path, size_t inline_max) {
+    value_store_t *store = calloc(1, sizeof(value_store_t));
+    if (!store) return NULL;
+    store->num_buckets = VS_INITIAL_BUCKETS;
+    store->buckets = calloc(store->num_buckets, sizeof(vs_value_t *));
+    if (!store->buckets) {
+        free(store);
+        return NULL;
+    }
+    if (log_path && *log_path) {
+        // Senza il log si parte comunque: le risposte restano in RAM
+        store->log = l2_vlog_open(log_path, inline_max);
+        if (store->log) log_info("Value Log: risposte >= %zu byte su disco (%s)", inline_max, log_path);
+    }
+    store->inline_max = inline_max;
+    pthread_mutex_init(&store->lock, NULL);
+    return store;
+}
+
+static void value_free(value_store_t *store, vs_value_t *v) {
+    l2_vlog_release(store->log, v->logged);
+    free(v);
+}
+
+void vs_destroy(value_store_t *store) {
+    if (!store) return;
+    if (store->stats.values > 0) log_warn("Value Store: %zu valori ancora referenziati alla chiusura", store->stats.values);
+    for (size_t b = 0; b < store->num_buckets; b++) {
+        vs_value_t *v = store->buckets[b];
+        while (v) {
+            vs_value_t *next = v->next;
+            value_free(store, v);
+            v = next;
+        }
+    }
+    l2_vlog_close(store->log);
+    pthread_mutex_destroy(&store->lock);
+    free(store->buckets);
+    free(store);
+}
+
+// Raddoppia i bucket (se l'allocazione fallisce si continua con catene più lunghe)
+static void store_grow(value_store_t *store) {
+    size_t new_count = store->num_buckets * 2;
+    vs_value_t **buckets = calloc(new_count, sizeof(vs_value_t *));
+    if (!buckets) return;
+    for (size_t b = 0; b < store->num_buckets; b++) {
+        vs_value_t *v = store->buckets[b];
+        while (v) {
+            vs_value_t *next = v->next;
+            size_t idx = v->hash & (new_count - 1);
+            v->next = buckets[idx];
+            buckets[idx] = v;
+            v = next;
+        }
+    }
+    free(store->buckets);
+    store->buckets = buckets;
+    store->num_buckets = new_count;
+}
+
+vs_value_t *vs_intern(value_store_t *store, const char *value) {
+    if (!store || !value) return NULL;
+    size_t len = strlen(value);
+    uint64_t hash = hash_fnv1a(value, len);
+
+    pthread_mutex_lock(&store->lock);
+    vs_value_t **bucket = &store->buckets[hash & (store->num_buckets - 1)];
+    for (vs_value_t *v = *bucket; v; v = v->next) {
+        if (v->hash == hash && v->len == len && memcmp(v->data, value, len) == 0) {
+            v->refs++;
+            store->stats.refs++;
+            store->stats.dedup_bytes += len;
+            pthread_mutex_unlock(&store->lock);
+            return v;
+        }
+    }
+
+    // Nuovo valore: nel log se abbastanza lungo, altrimenti in coda alla struttura
+    char *logged = (store->log && len >= store->inline_max) ? l2_vlog_store(store->log, value) : NULL;
+    vs_value_t *v = malloc(sizeof(vs_value_t) + (logged ? 0 : len + 1));
+    if (!v) {
+        l2_vlog_release(store->log, logged);
+        pthread_mutex_unlock(&store->lock);
+        return NULL;
+    }
+    if (!logged) memcpy(v->inline_data, value, len + 1);
+    v->data = logged ? logged : v->inline_data;
+    v->logged = logged;
+    v->len = len;
+    v->hash = hash;
+    v->refs = 1;
+    v->next = *bucket;
+    *bucket = v;
+    store->stats.values++;
+    store->stats.refs++;
+    store->stats.bytes += len;
+    if (store->stats.values > store->num_buckets) store_grow(store);
+    pthread_mutex_unlock(&store->lock);
+    return v;
+}
+
+void vs_release(value_store_t *store, vs_value_t *value) {
+    if (!store || !value) return;
+    pthread_mutex_lock(&store->lock);
+    store->stats.refs--;
+    if (--value->refs > 0) {
+        store->stats.dedup_bytes -= value->len;
+        pthread_mutex_unlock(&store->lock);
+        return;
+    }
+    vs_value_t **link = &store->buckets[value->hash & (store->num_buckets - 1)];
+    while (*link != value) link = &(*link)->next;
+    *link = value->next;
+    store->stats.values--;
+    store->stats.bytes -= value->len;
+    value_free(store, value);
+    pthread_mutex_unlock(&store->lock);
+}
+
+const char *vs_data(const vs_value_t *value) {
+    return value->data;
+}
+
+size_t vs_len(const vs_value_t *value) {
+    return value->len;
+}
+
+void vs_get_stats(value_store_t *store, vs_stats_t *stats) {
+    pthread_mutex_lock(&store->lock);
+    *stats = store->stats;
+    pthread_mutex_unlock(&store->lock);
+}
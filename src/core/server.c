@@ -12,11 +12,14 @@
 #include "vsp_parser.h"
 #include "event_loop.h"
 #include "hash_map.h"
+#include "value_store.h"
 #include "vector_engine.h"
 #include "l2_cache.h"
+#include "l2_keys.h"
 #include "text.h"
 #include "worker_pool.h"
 #include "sys_info.h"
+#include "clock.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +36,16 @@
 #define VECS_BACKLOG 1024
 #define MAX_L1_KEY_SIZE 8192
 
+// Scadenza attiva (L1 + L2): piccoli passi a tempo dal loop eventi
+#define EXPIRE_PERIOD_US 100000   // Un ciclo ogni 100 ms
+#define EXPIRE_BUDGET_US 1000     // Durata massima di un ciclo
+#define EXPIRE_L1_BUCKETS 64      // Bucket L1 esaminati per passo
+#define EXPIRE_L2_ROWS 256        // Righe L2 esaminate per passo
+#define EXPIRE_DENSITY 4          // Si insiste finché più di 1/4 delle entry esaminate è scaduto
+
+// Scritture L2 dal loop eventi (vedi "SCRITTURE L2 DIFFERITE")
+#define L2_WRITE_MAX_DEFER_US 50000 // Oltre 50 ms di attesa la scrittura in testa blocca il loop
+
 // --- DEFAULTS (Fallback se ENV non settate) ---
 // Usiamo BGE-M3 come default robusto
 #define DEFAULT_MODEL_PATH "models/default_model.gguf"
@@ -40,8 +53,45 @@
 #define DEFAULT_L2_THRESHOLD "0.65"
 // Soglia alta per evitare duplicati quasi identici
 #define DEFAULT_L2_DEDUPE "0.95"
-// Capacità vettoriale di default
+// Capacità vettoriale di default (in tutto, condivisa dai namespace)
 #define DEFAULT_L2_CAPACITY "5000"
+// Namespace (<params>) con un indice L2 proprio (1 = un solo indice condiviso, params ignorati).
+// Le partizioni si dividono VECS_L2_CAPACITY: la memoria non cresce con il numero di namespace
+#define DEFAULT_L2_PARTITIONS "64"
+// Policy a cache L2 piena: "lru", "lfu", "ttl" (scadenza più vicina) o "none" (rifiuta)
+#define DEFAULT_L2_EVICTION "lru"
+// Indice L2: "ivf" (IVFFlat), "ivfpq" (residui PQ, per cache molto grandi) o "hnsw" (grafo)
+#define DEFAULT_L2_INDEX "ivf"
+#define DEFAULT_L2_CLUSTER_SIZE "0"
+#define DEFAULT_L2_NPROBE "4"
+// Thread dello scan IVF di una singola query (0 = automatico, 1 = seriale) e righe
+// sondate oltre cui si attivano
+#define DEFAULT_L2_SEARCH_THREADS "0"
+#define DEFAULT_L2_PARALLEL_MIN_ROWS "32768"
+#define MAX_AUTO_SEARCH_THREADS 4
+#define DEFAULT_L2_PQ_M "0"
+#define DEFAULT_L2_PQ_RERANK "1"
+#define DEFAULT_L2_HNSW_M "16"
+#define DEFAULT_L2_HNSW_EF "64"
+// Formato vettori L2 ("f32", "f16", "bf16" o "int8") e candidati int8 da rivalutare
+#define DEFAULT_L2_STORAGE "f32"
+#define DEFAULT_L2_RERANK "16"
+// Scan dei cluster: "none" (score pieno), "binary" (Hamming + re-ranking) o
+// "reduced" (copia a poche dimensioni, PCA o prefisso Matryoshka, + re-ranking)
+#define DEFAULT_L2_PREFILTER "none"
+#define DEFAULT_L2_REDUCED_DIM "128"
+#define DEFAULT_L2_PROJECTION "pca"
+// 0 = il testo dei prompt L2 non resta in RAM (i filtri ibridi usano feature precalcolate)
+#define DEFAULT_L2_STORE_PROMPTS "1"
+// Dizionario delle feature dei filtri ibridi ("" = predefinito: negazioni multilingua)
+#define DEFAULT_L2_FILTER_DICT ""
+// Indice BM25 sui prompt L2: peso nello score fuso e soglia dello shortcut lessicale (> 1 = mai)
+#define DEFAULT_L2_LEXICAL "0"
+#define DEFAULT_L2_LEXICAL_WEIGHT "0.25"
+#define DEFAULT_L2_LEXICAL_SHORTCUT "0.9"
+// File del value log delle risposte L1/L2 ("" = tutte in RAM) e soglia sotto cui restano in RAM
+#define DEFAULT_VALUE_LOG ""
+#define DEFAULT_VALUE_INLINE "512"
 #define DEFAULT_TTL "3600"
 #define DEFAULT_SAVE_INTERVAL "300"
 #define DUMP_DIR "data"
@@ -55,6 +105,29 @@ typedef struct {
     float l2_threshold;
     float l2_dedupe_threshold;
     int l2_capacity;
+    int l2_partitions;
+    l2_eviction_t l2_eviction;
+    l2_index_t l2_index;
+    int l2_cluster_size;
+    int l2_nprobe;
+    int l2_search_threads;
+    int l2_parallel_min_rows;
+    int l2_pq_m;
+    int l2_pq_rerank;
+    int l2_hnsw_m;
+    int l2_hnsw_ef_search;
+    l2_storage_t l2_storage;
+    l2_prefilter_t l2_prefilter;
+    int l2_reduced_dim;
+    l2_projection_t l2_projection;
+    int l2_rerank_k;
+    int l2_store_prompts;
+    char l2_filter_dict[512];
+    int l2_lexical;
+    float l2_lexical_weight;
+    float l2_lexical_shortcut;
+    char value_log[512];
+    int value_inline;
     int default_ttl;
     int save_interval_seconds;
     int num_workers;
@@ -72,6 +145,7 @@ struct vecs_server_s {
     vecs_config_t config;
 
     // --- CACHE LAYERS ---
+    value_store_t *values;       // Risposte internate, condivise da L1 e L2
     hash_map_t *l1_cache;        // L1: Exact Match
     vector_engine_t *vec_engine; // AI Engine
     l2_cache_t *l2_cache;        // L2: Semantic Match
@@ -80,7 +154,13 @@ struct vecs_server_s {
     int vector_dim;              // Dimensione vettori (letto dal modello)
 
     time_t last_save_time;
+    uint64_t last_expire_us;     // Inizio dell'ultimo ciclo di scadenza attiva
+    int expire_pending;          // Budget esaurito con ancora molte entry scadute
     worker_pool_t *worker_pool;
+    l2_keys_t *pending_sets;     // SET in coda ai worker: chiave (prompt, namespace) -> job
+    bg_job_t *pending_list;      // Gli stessi SET in lista (FLUSH li annulla per namespace)
+    bg_job_t *l2_writes_head;    // Scritture L2 in attesa del write lock (FIFO)
+    bg_job_t *l2_writes_tail;
 
     // Gestione connessioni
     vecs_connection_t *connections[MAX_FD];
@@ -117,6 +197,8 @@ void server_remove_connection(vecs_connection_t *conn);
 static void server_save_data(vecs_server_t *server);
 static void server_load_data(vecs_server_t *server);
 static void server_handle_worker_notification(vecs_server_t *server);
+static void server_defer_l2_write(vecs_server_t *server, bg_job_t *job);
+static void server_drain_l2_writes(vecs_server_t *server, int force);
 
 // --- Gestori Eventi (Network) ---
 
@@ -279,6 +361,168 @@ static void cmd_self_destruct(vecs_server_t *server, vecs_connection_t *conn) {
 
 // --- CORE LOGIC: L1 & L2 CACHE (Configurable) ---
 
+// Bulk string VSP: $<len>\r\n<data>\r\n
+static void append_bulk(buffer_t *buf, const char *data, size_t len) {
+    char header_buf[32];
+    snprintf(header_buf, sizeof(header_buf), "$%zu\r\n", len);
+    buffer_append_string(buf, header_buf);
+    buffer_append_data(buf, data, len);
+    buffer_append_string(buf, "\r\n");
+}
+
+// Risposta di QUERY K/WITHSCORES: array delle risposte, oppure (WITHSCORES) quattro
+// elementi per risultato: risposta, score, score penalizzato, TTL residuo in secondi
+static void append_topk_reply(buffer_t *buf, const l2_search_result_t *results, int count, int with_scores) {
+    char num_buf[64];
+    snprintf(num_buf, sizeof(num_buf), "*%d\r\n", with_scores ? count * 4 : count);
+    buffer_append_string(buf, num_buf);
+    time_t now = clock_now();
+    for (int i = 0; i < count; i++) {
+        append_bulk(buf, results[i].response, strlen(results[i].response));
+        if (!with_scores) continue;
+        int len = snprintf(num_buf, sizeof(num_buf), "%.6f", results[i].score);
+        append_bulk(buf, num_buf, (size_t)len);
+        len = snprintf(num_buf, sizeof(num_buf), "%.6f", results[i].penalized_score);
+        append_bulk(buf, num_buf, (size_t)len);
+        long ttl = results[i].expire_at > now ? (long)(results[i].expire_at - now) : 0;
+        len = snprintf(num_buf, sizeof(num_buf), "%ld", ttl);
+        append_bulk(buf, num_buf, (size_t)len);
+    }
+}
+
+// Ricerca L2 delle QUERY (dal worker, in parallelo agli altri): un'unica ricerca a
+// batch con il K più grande richiesto, poi ogni job prende il proprio prefisso (il solo
+// che conta come HIT). Le risposte vengono formattate sotto il read lock, perché i
+// risultati puntano nella cache
+void server_run_job_lookup(vecs_server_t *server, bg_job_t **jobs, int count) {
+    bg_job_t *batch[L2_MAX_BATCH];
+    const float *vectors[L2_MAX_BATCH];
+    const char *texts[L2_MAX_BATCH];
+    const char *namespaces[L2_MAX_BATCH];
+    int ks[L2_MAX_BATCH];
+    int counts[L2_MAX_BATCH];
+    int n = 0, k = 1;
+    for (int i = 0; i < count && n < L2_MAX_BATCH; i++) {
+        if (jobs[i]->type != JOB_QUERY || !jobs[i]->success) continue;
+        batch[n] = jobs[i];
+        vectors[n] = jobs[i]->vector_result;
+        texts[n] = jobs[i]->key_part_1; // Il prompt originale (usato per i filtri text-based)
+        namespaces[n] = jobs[i]->key_part_2; // I <params>: la ricerca resta nella loro partizione
+        ks[n] = jobs[i]->top_k > 0 ? jobs[i]->top_k : 1;
+        if (ks[n] > k) k = ks[n];
+        n++;
+    }
+    if (n == 0) return;
+    l2_search_result_t *results = malloc((size_t)n * k * sizeof(l2_search_result_t));
+    if (!results) return;
+
+    l2_cache_read_lock(server->l2_cache);
+    if (l2_cache_search_batch(server->l2_cache, namespaces, vectors, texts, n, server->config.l2_threshold,
+                              results, k, ks, counts) == 0) {
+        for (int j = 0; j < n; j++) {
+            bg_job_t *job = batch[j];
+            const l2_search_result_t *found = results + (size_t)j * k;
+            buffer_t *reply = buffer_create(256);
+            if (!reply) continue;
+            if (job->top_k > 0) {
+                // Top-K: array (eventualmente vuoto) dei migliori candidati sopra la threshold
+                append_topk_reply(reply, found, counts[j], job->with_scores);
+                log_info("Async L2 Top-K: %d/%d risultati", counts[j], job->top_k);
+            } else if (counts[j] > 0) {
+                // HIT L2
+                append_bulk(reply, found[0].response, strlen(found[0].response));
+                log_info("Async HIT L2 (Semantic)");
+            } else {
+                // MISS L2
+                buffer_append_string(reply, "$-1\r\n");
+                log_debug("Async MISS L2");
+            }
+            job->reply = reply;
+        }
+    }
+    l2_cache_read_unlock(server->l2_cache);
+    free(results);
+}
+
+// --- SET IN ATTESA ---
+// L'inserimento L2 di un SET avviene al ritorno dal worker, mentre DELETE agisce
+// subito (o dietro le scritture L2 già differite): un DELETE arrivato nel frattempo
+// annulla l'inserimento dei SET in coda per lo stesso prompt, altrimenti l'entry cancellata ricomparirebbe in L2.
+// La mappa è il multimap dell'indice dei prompt, con il job come posizione; FLUSH scorre
+// invece la lista di tutti i SET in coda (tutti, o quelli del suo namespace).
+
+// Chiave di un SET/DELETE: come quella di l2_cache_delete_prompt, più il namespace
+// quando la L2 è partizionata (senza partizioni DELETE cancella in tutti i namespace)
+static uint64_t pending_set_key(vecs_server_t *server, const char *prompt, const char *params) {
+    uint64_t key = l2_keys_hash(prompt);
+    if (server->config.l2_partitions > 1 && key != L2_KEY_NONE) {
+        for (const unsigned char *c = (const unsigned char *)params; *c; c++) {
+            key ^= *c;
+            key *= 0x100000001b3ULL;
+        }
+        if (key == L2_KEY_NONE) key = 1;
+    }
+    return key;
+}
+
+// Marca come annullati i SET in coda per il prompt (main thread: i job restano
+// validi finché la loro notifica non viene elaborata)
+static void cancel_pending_sets(vecs_server_t *server, const char *prompt, const char *params) {
+    uint64_t key = pending_set_key(server, prompt, params);
+    uint64_t locs[16];
+    int n;
+    while ((n = l2_keys_find(server->pending_sets, key, locs, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            bg_job_t *job = (bg_job_t *)(uintptr_t)locs[i];
+            job->l2_cancelled = 1;
+            l2_keys_remove(server->pending_sets, key, locs[i]);
+        }
+        log_debug("DELETE: %d SET in coda annullati", n);
+    }
+}
+
+// Marca come annullati i SET in coda del namespace (NULL = tutti): FLUSH non sa
+// quali prompt cercare nella mappa, quindi scorre la lista
+static void cancel_pending_sets_namespace(vecs_server_t *server, const char *params) {
+    int n = 0;
+    for (bg_job_t *job = server->pending_list; job; job = job->set_next) {
+        if (job->l2_cancelled || (params && job->key_part_2 && strcmp(job->key_part_2, params) != 0)) continue;
+        job->l2_cancelled = 1;
+        l2_keys_remove(server->pending_sets, job->pending_key, (uint64_t)(uintptr_t)job);
+        n++;
+    }
+    if (n > 0) log_debug("FLUSH: %d SET in coda annullati", n);
+}
+
+// Svuota la L2 (params = NULL) o un suo namespace dietro le scritture già differite,
+// come il DELETE esatto. Ritorna 1 se il FLUSH si è accodato (risponde dopo)
+static int server_flush_l2(vecs_server_t *server, int fd, uint64_t conn_id, const char *params) {
+    long removed = server->l2_writes_head ? L2_BUSY
+                 : params ? l2_cache_clear_namespace(server->l2_cache, params, 0)
+                          : l2_cache_clear(server->l2_cache, 0);
+    if (removed == L2_BUSY) {
+        bg_job_t *job = calloc(1, sizeof(bg_job_t));
+        if (job) {
+            job->type = JOB_FLUSH;
+            job->client_fd = fd;
+            job->conn_id = conn_id;
+            job->key_part_2 = params ? strdup(params) : NULL; // NULL = tutti i namespace
+            job->success = 1;
+            if (!params || job->key_part_2) {
+                server_defer_l2_write(server, job);
+                return 1;
+            }
+            free(job);
+        }
+        // OOM: si applicano le scritture in attesa (per l'ordine) e si svuota bloccando
+        server_drain_l2_writes(server, 1);
+        removed = params ? l2_cache_clear_namespace(server->l2_cache, params, 1) : l2_cache_clear(server->l2_cache, 1);
+    }
+    if (params) log_info("FLUSH '%s': %ld entry L2 rimosse.", params, removed);
+    else log_info("FLUSH: Cache L2 svuotata.");
+    return 0;
+}
+
 static void server_execute_command(vecs_connection_t *conn, int argc, char **argv) {
     if (conn == NULL || argc == 0) return;
 
@@ -310,7 +554,7 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
 
         // 1. Inserimento L1 (Sincrono, è velocissimo O(1))
         snprintf(key_buf, MAX_L1_KEY_SIZE, "%s|%s", argv[1], argv[2]);
-        hash_map_set(l1_cache, key_buf, argv[3], ttl);
+        hash_map_set(l1_cache, key_buf, argv[2], argv[3], ttl); // Namespace = params, per FLUSH <params>
         log_debug("SET L1 OK (Sync). Preparing Async L2...");
 
         // 2. Inserimento L2 (ASINCRONO)
@@ -334,15 +578,26 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
         // Copiamo i dati perché argv verrà distrutto al ritorno della funzione
         job->text_to_embed = strdup(clean_prompt); // Testo pulito per embedding
         job->key_part_1 = strdup(argv[1]);         // Prompt originale
+        job->key_part_2 = strdup(argv[2]);         // Params: namespace della partizione L2
         job->value = strdup(argv[3]);              // Risposta da salvare
+        job->pending_key = pending_set_key(server, argv[1], argv[2]);
         
         // Inviamo al pool
         if (wp_submit(server->worker_pool, job) != 0) {
             buffer_append_string(write_buf, "-ERR Job Queue Full\r\n");
             // Free manuale se submit fallisce
-            free(job->text_to_embed); free(job->key_part_1); free(job->value); free(job);
+            free(job->text_to_embed); free(job->key_part_1); free(job->key_part_2); free(job->value); free(job);
             el_enable_write(server->loop, fd, (void*)conn);
+            return;
+        }
+        // Registrato dopo il submit: la notifica del worker si elabora comunque su questo thread.
+        // Senza memoria per registrarlo il SET non è annullabile (solo log)
+        if (l2_keys_add(server->pending_sets, job->pending_key, (uint64_t)(uintptr_t)job) != 0) {
+            log_warn("SET: registrazione del job in coda fallita (OOM), un DELETE concorrente non lo annullerà");
         }
+        job->set_next = server->pending_list;
+        if (server->pending_list) server->pending_list->set_prev = job;
+        server->pending_list = job;
 
         // NOTA: NON inviamo "+OK" qui! 
         // Lo farà server_handle_worker_notification quando il worker avrà finito.
@@ -350,17 +605,40 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
     }
 
     // --- COMANDO QUERY ---
-    // Sintassi: QUERY <prompt> <params>
+    // Sintassi: QUERY <prompt> <params> [K <n>] [WITHSCORES]
     else if (strcasecmp(argv[0], "QUERY") == 0) {
-        if (argc != 3) {
+        if (argc < 3) {
             buffer_append_string(write_buf, "-ERR wrong number of arguments for 'QUERY'\r\n");
             el_enable_write(server->loop, fd, (void*)conn);
             return;
         }
 
-        // A. Cerca in L1 (Sincrono)
+        // Opzioni: risposta multipla dalla L2 (array) con gli score
+        int top_k = 0;
+        int with_scores = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcasecmp(argv[i], "K") == 0 && i + 1 < argc) {
+                top_k = atoi(argv[++i]);
+                if (top_k <= 0 || top_k > L2_MAX_TOPK) {
+                    snprintf(header_buf, sizeof(header_buf), "-ERR K must be between 1 and %d\r\n", L2_MAX_TOPK);
+                    buffer_append_string(write_buf, header_buf);
+                    el_enable_write(server->loop, fd, (void*)conn);
+                    return;
+                }
+            } else if (strcasecmp(argv[i], "WITHSCORES") == 0) {
+                with_scores = 1;
+            } else {
+                buffer_append_string(write_buf, "-ERR syntax error in 'QUERY' options\r\n");
+                el_enable_write(server->loop, fd, (void*)conn);
+                return;
+            }
+        }
+        if (with_scores && top_k == 0) top_k = 1;
+
+        // A. Cerca in L1 (Sincrono). Con K/WITHSCORES si va direttamente in L2:
+        // il match esatto non ha score né candidati alternativi
         snprintf(key_buf, MAX_L1_KEY_SIZE, "%s|%s", argv[1], argv[2]);
-        const char *value = hash_map_get(l1_cache, key_buf);
+        const char *value = top_k == 0 ? hash_map_get(l1_cache, key_buf) : NULL;
         
         if (value != NULL) {
             // HIT L1: Rispondiamo subito!
@@ -390,13 +668,16 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
         job->type = JOB_QUERY;
         job->client_fd = fd;
         job->conn_id = conn_id;
+        job->top_k = top_k;
+        job->with_scores = with_scores;
         
         job->text_to_embed = strdup(clean_prompt);
         job->key_part_1 = strdup(argv[1]); // Serve per i filtri semantici dopo
+        job->key_part_2 = strdup(argv[2]); // Namespace: si cerca solo nella sua partizione
 
         if (wp_submit(server->worker_pool, job) != 0) {
             buffer_append_string(write_buf, "-ERR Job Queue Full\r\n");
-            free(job->text_to_embed); free(job->key_part_1); free(job);
+            free(job->text_to_embed); free(job->key_part_1); free(job->key_part_2); free(job);
             el_enable_write(server->loop, fd, (void*)conn);
         }
 
@@ -405,20 +686,53 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
     }
 
     // --- COMANDO DELETE ---
-    // Sintassi: DELETE <prompt> <params>
+    // Sintassi: DELETE <prompt> <params> [SEMANTIC]
     else if (strcasecmp(argv[0], "DELETE") == 0) {
-        if (argc != 3) {
+        int semantic = argc == 4 && strcasecmp(argv[3], "SEMANTIC") == 0;
+        if (argc != 3 && !semantic) {
             buffer_append_string(write_buf, "-ERR wrong number of arguments for 'DELETE'\r\n");
             el_enable_write(server->loop, fd, (void*)conn);
             return;
         }
 
-        // 1. Cancella da L1 (Sincrono)
+        // 1. Cancella da L1 (Sincrono) e annulla l'inserimento L2 dei SET ancora in coda
         snprintf(key_buf, MAX_L1_KEY_SIZE, "%s|%s", argv[1], argv[2]);
         hash_map_delete(l1_cache, key_buf);
+        cancel_pending_sets(server, argv[1], argv[2]);
+
+        // 2a. Cancella da L2 il prompt esatto: la posizione viene dall'indice dei prompt,
+        // senza embedding né scan. Se le ricerche dei worker tengono il lock (o altre
+        // scritture sono già in attesa) la cancellazione si accoda e risponde dopo
+        if (!semantic) {
+            int deleted = server->l2_writes_head ? L2_BUSY
+                                                 : l2_cache_delete_prompt(server->l2_cache, argv[2], argv[1], 0);
+            if (deleted == L2_BUSY) {
+                bg_job_t *job = calloc(1, sizeof(bg_job_t));
+                if (job) {
+                    job->type = JOB_DELETE;
+                    job->client_fd = fd;
+                    job->conn_id = conn_id;
+                    job->key_part_1 = strdup(argv[1]); // Prompt esatto (nessun vettore)
+                    job->key_part_2 = strdup(argv[2]);
+                    job->success = 1;
+                    if (job->key_part_1 && job->key_part_2) {
+                        server_defer_l2_write(server, job);
+                        return;
+                    }
+                    free(job->key_part_1); free(job->key_part_2); free(job);
+                }
+                // OOM: si applicano le scritture in attesa (per l'ordine) e si cancella bloccando
+                server_drain_l2_writes(server, 1);
+                deleted = l2_cache_delete_prompt(server->l2_cache, argv[2], argv[1], 1);
+            }
+            log_debug("DELETE L2 (prompt esatto): %d entry rimosse", deleted);
+            buffer_append_string(write_buf, "+OK\r\n");
+            el_enable_write(server->loop, fd, (void*)conn);
+            return;
+        }
 
-        // 2. Cancella da L2 (ASINCRONO)
-        // Anche se DELETE è rara, calcolare l'embedding per trovarlo è lento.
+        // 2b. SEMANTIC: cancella da L2 il vicino più simile (ASINCRONO).
+        // Calcolare l'embedding per trovarlo è lento.
         normalize_text(argv[1], clean_prompt, sizeof(clean_prompt));
 
         bg_job_t *job = calloc(1, sizeof(bg_job_t));
@@ -426,13 +740,14 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
         job->client_fd = fd;
         job->conn_id = conn_id;
         job->text_to_embed = strdup(clean_prompt);
+        job->key_part_2 = strdup(argv[2]); // Namespace in cui cercare l'entry da cancellare
         // Non serve key_part_1 per delete semantic, basta il vettore
 
         if (wp_submit(server->worker_pool, job) != 0) {
              // Fallback se coda piena: rispondi OK lo stesso (L1 è cancellato)
              // o manda errore. Per robustezza, mandiamo errore.
              buffer_append_string(write_buf, "-ERR Job Queue Full\r\n");
-             free(job->text_to_embed); free(job);
+             free(job->text_to_embed); free(job->key_part_2); free(job);
         }
         
         // Attendiamo worker per la risposta definitiva
@@ -440,11 +755,68 @@ static void server_execute_command(vecs_connection_t *conn, int argc, char **arg
     }
 
     // --- COMANDO FLUSH ---
+    // Sintassi: FLUSH [params]: con i params svuota solo quel namespace.
+    // L1 subito; i SET in coda non devono far ricomparire le entry in L2, e la L2
+    // si svuota dietro le scritture differite (risposta dopo le loro, se accodato)
     else if (strcasecmp(argv[0], "FLUSH") == 0) {
-        hash_map_clear(l1_cache);
-        l2_cache_clear(server->l2_cache);
-        log_info("FLUSH: Cache L1 e L2 svuotate.");
-        buffer_append_string(write_buf, "+OK\r\n");
+        if (argc == 1) {
+            hash_map_clear(l1_cache);
+            cancel_pending_sets_namespace(server, NULL);
+            log_info("FLUSH: Cache L1 svuotata.");
+            if (server_flush_l2(server, fd, conn_id, NULL)) return;
+            buffer_append_string(write_buf, "+OK\r\n");
+        } else if (argc == 2 && server->config.l2_partitions <= 1) {
+            // L2 non partizionata: le entry non sanno a quale namespace appartengono, e
+            // svuotarla tutta cancellerebbe anche gli altri namespace. Nulla viene rimosso
+            buffer_append_string(write_buf, "-ERR FLUSH <params> requires L2 partitions (VECS_L2_PARTITIONS > 1)\r\n");
+        } else if (argc == 2) {
+            // L2: la partizione viene liberata in blocco; L1: la lista delle chiavi del namespace
+            size_t l1_removed = hash_map_delete_namespace(l1_cache, argv[1]);
+            cancel_pending_sets_namespace(server, argv[1]);
+            log_info("FLUSH '%s': %zu chiavi L1 rimosse.", argv[1], l1_removed);
+            if (server_flush_l2(server, fd, conn_id, argv[1])) return;
+            buffer_append_string(write_buf, "+OK\r\n");
+        } else {
+            buffer_append_string(write_buf, "-ERR wrong number of arguments for 'FLUSH'\r\n");
+        }
+        el_enable_write(server->loop, fd, (void*)conn);
+    }
+
+    // --- COMANDO INFO ---
+    // Statistiche in formato "campo:valore", una per riga (bulk string)
+    else if (strcasecmp(argv[0], "INFO") == 0) {
+        vs_stats_t vs;
+        vs_get_stats(server->values, &vs);
+        int max_parts = server->config.l2_partitions > 1 ? server->config.l2_partitions : 1;
+        l2_partition_stats_t *parts = malloc((size_t)max_parts * sizeof(l2_partition_stats_t));
+        buffer_t *info = buffer_create(1024);
+        if (!parts || !info) {
+            buffer_append_string(write_buf, "-ERR Out of memory\r\n");
+        } else {
+            int num_parts = l2_cache_get_stats(server->l2_cache, parts, max_parts);
+            char line[L2_STATS_NAME + 160];
+            snprintf(line, sizeof(line),
+                     "values:%zu\r\nvalue_refs:%zu\r\nvalue_bytes:%zu\r\nvalue_dedup_bytes:%zu\r\nl2_partitions:%d\r\n"
+                     "l2_partition_rejects:%llu\r\nl2_entries:%zu\r\nl2_capacity:%d\r\n",
+                     vs.values, vs.refs, vs.bytes, vs.dedup_bytes, num_parts,
+                     (unsigned long long)l2_cache_partition_rejects(server->l2_cache),
+                     l2_cache_entries(server->l2_cache), server->config.l2_capacity);
+            buffer_append_string(info, line);
+            // Una riga per partizione L2 (namespace vuoto = indice unico); il budget
+            // l2_capacity è condiviso e si riporta una volta sola
+            for (int i = 0; i < num_parts; i++) {
+                snprintf(line, sizeof(line), "l2_ns:%s entries=%zu searches=%llu hits=%llu inserts=%llu\r\n",
+                         parts[i].name, parts[i].entries, (unsigned long long)parts[i].searches,
+                         (unsigned long long)parts[i].hits, (unsigned long long)parts[i].inserts);
+                buffer_append_string(info, line);
+            }
+            snprintf(header_buf, sizeof(header_buf), "$%zu\r\n", buffer_len(info));
+            buffer_append_string(write_buf, header_buf);
+            buffer_append_data(write_buf, buffer_peek(info), buffer_len(info));
+            buffer_append_string(write_buf, "\r\n");
+        }
+        if (info) buffer_destroy(info);
+        free(parts);
         el_enable_write(server->loop, fd, (void*)conn);
     }
 
@@ -497,6 +869,19 @@ static int get_optimal_worker_count(void) {
     return 4;
 }
 
+// Thread dello scan parallelo L2: in automatico metà dei core (massimo 4),
+// l'altra metà resta ai worker degli embedding
+static int get_search_thread_count(int configured) {
+    if (configured > 0) return configured;
+
+    long nprocs = -1;
+#ifdef _SC_NPROCESSORS_ONLN
+    nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nprocs < 2) return 1;
+    return nprocs / 2 < MAX_AUTO_SEARCH_THREADS ? (int)(nprocs / 2) : MAX_AUTO_SEARCH_THREADS;
+}
+
 // --- Init & Lifecycle ---
 
 vecs_server_t* server_create(const char *port) {
@@ -516,16 +901,100 @@ vecs_server_t* server_create(const char *port) {
     server->config.l2_threshold = get_env_float("VECS_L2_THRESHOLD", DEFAULT_L2_THRESHOLD);
     server->config.l2_dedupe_threshold = get_env_float("VECS_L2_DEDUPE_THRESHOLD", DEFAULT_L2_DEDUPE);
     server->config.l2_capacity = get_env_int("VECS_L2_CAPACITY", DEFAULT_L2_CAPACITY);
+    server->config.l2_partitions = get_env_int("VECS_L2_PARTITIONS", DEFAULT_L2_PARTITIONS);
+    const char *l2_eviction = get_env_string("VECS_L2_EVICTION", DEFAULT_L2_EVICTION);
+    server->config.l2_eviction = strcasecmp(l2_eviction, "lfu") == 0  ? L2_EVICT_LFU
+                               : strcasecmp(l2_eviction, "ttl") == 0  ? L2_EVICT_TTL
+                               : strcasecmp(l2_eviction, "none") == 0 ? L2_EVICT_NONE
+                                                                      : L2_EVICT_LRU;
+    const char *l2_index = get_env_string("VECS_L2_INDEX", DEFAULT_L2_INDEX);
+    server->config.l2_index = strcasecmp(l2_index, "ivfpq") == 0  ? L2_INDEX_IVFPQ
+                            : strcasecmp(l2_index, "hnsw") == 0   ? L2_INDEX_HNSW
+                                                                  : L2_INDEX_IVF;
+    server->config.l2_cluster_size = get_env_int("VECS_L2_CLUSTER_SIZE", DEFAULT_L2_CLUSTER_SIZE);
+    server->config.l2_nprobe = get_env_int("VECS_L2_NPROBE", DEFAULT_L2_NPROBE);
+    server->config.l2_search_threads =
+        get_search_thread_count(get_env_int("VECS_L2_SEARCH_THREADS", DEFAULT_L2_SEARCH_THREADS));
+    server->config.l2_parallel_min_rows = get_env_int("VECS_L2_PARALLEL_MIN_ROWS", DEFAULT_L2_PARALLEL_MIN_ROWS);
+    server->config.l2_pq_m = get_env_int("VECS_L2_PQ_M", DEFAULT_L2_PQ_M);
+    server->config.l2_pq_rerank = get_env_int("VECS_L2_PQ_RERANK", DEFAULT_L2_PQ_RERANK);
+    server->config.l2_hnsw_m = get_env_int("VECS_L2_HNSW_M", DEFAULT_L2_HNSW_M);
+    server->config.l2_hnsw_ef_search = get_env_int("VECS_L2_HNSW_EF", DEFAULT_L2_HNSW_EF);
+    const char *l2_storage = get_env_string("VECS_L2_STORAGE", DEFAULT_L2_STORAGE);
+    server->config.l2_storage = strcasecmp(l2_storage, "int8") == 0 ? L2_STORAGE_INT8
+                              : strcasecmp(l2_storage, "f16") == 0  ? L2_STORAGE_F16
+                              : strcasecmp(l2_storage, "bf16") == 0 ? L2_STORAGE_BF16
+                                                                    : L2_STORAGE_F32;
+    server->config.l2_rerank_k = get_env_int("VECS_L2_RERANK", DEFAULT_L2_RERANK);
+    server->config.l2_store_prompts = get_env_int("VECS_L2_STORE_PROMPTS", DEFAULT_L2_STORE_PROMPTS);
+    strncpy(server->config.l2_filter_dict, get_env_string("VECS_L2_FILTER_DICT", DEFAULT_L2_FILTER_DICT), 511);
+    server->config.l2_lexical = get_env_int("VECS_L2_LEXICAL", DEFAULT_L2_LEXICAL);
+    server->config.l2_lexical_weight = get_env_float("VECS_L2_LEXICAL_WEIGHT", DEFAULT_L2_LEXICAL_WEIGHT);
+    server->config.l2_lexical_shortcut = get_env_float("VECS_L2_LEXICAL_SHORTCUT", DEFAULT_L2_LEXICAL_SHORTCUT);
+    strncpy(server->config.value_log, get_env_string("VECS_VALUE_LOG", DEFAULT_VALUE_LOG), 511);
+    server->config.value_inline = get_env_int("VECS_VALUE_INLINE", DEFAULT_VALUE_INLINE);
+    const char *l2_prefilter = get_env_string("VECS_L2_PREFILTER", DEFAULT_L2_PREFILTER);
+    server->config.l2_prefilter = strcasecmp(l2_prefilter, "binary") == 0  ? L2_PREFILTER_BINARY
+                                : strcasecmp(l2_prefilter, "reduced") == 0 ? L2_PREFILTER_REDUCED
+                                                                           : L2_PREFILTER_NONE;
+    server->config.l2_reduced_dim = get_env_int("VECS_L2_REDUCED_DIM", DEFAULT_L2_REDUCED_DIM);
+    server->config.l2_projection = strcasecmp(get_env_string("VECS_L2_PROJECTION", DEFAULT_L2_PROJECTION), "prefix") == 0
+                                       ? L2_PROJECTION_PREFIX : L2_PROJECTION_PCA;
     server->config.default_ttl = get_env_int("VECS_TTL_DEFAULT", DEFAULT_TTL);
     server->config.save_interval_seconds = get_env_int("VECS_SAVE_INTERVAL", DEFAULT_SAVE_INTERVAL);
     server->config.num_workers = get_optimal_worker_count();
-    server->last_save_time = time(NULL);
+    server->last_save_time = clock_now();
 
     log_info("=== VECS CONFIG ===");
     log_info("Model Path:   %s", server->config.model_path);
     log_info("L2 Threshold: %.2f", server->config.l2_threshold);
     log_info("L2 Dedupe:    %.2f", server->config.l2_dedupe_threshold);
-    log_info("L2 Capacity:  %d vectors", server->config.l2_capacity);
+    if (server->config.l2_partitions > 1) {
+        log_info("L2 Capacity:  %d vectors shared by up to %d namespaces", server->config.l2_capacity,
+                 server->config.l2_partitions);
+    } else {
+        log_info("L2 Capacity:  %d vectors (shared by all namespaces)", server->config.l2_capacity);
+    }
+    log_info("L2 Eviction:  %s", server->config.l2_eviction == L2_EVICT_LFU  ? "lfu"
+                               : server->config.l2_eviction == L2_EVICT_TTL  ? "ttl"
+                               : server->config.l2_eviction == L2_EVICT_NONE ? "none" : "lru");
+    log_info("L2 Index:     %s", server->config.l2_index == L2_INDEX_IVFPQ ? "ivfpq"
+                               : server->config.l2_index == L2_INDEX_HNSW  ? "hnsw" : "ivf");
+    if (server->config.l2_cluster_size > 0) {
+        log_info("L2 Cluster:   %d vectors", server->config.l2_cluster_size);
+    } else {
+        log_info("L2 Cluster:   auto (L2 cache)");
+    }
+    log_info("L2 Nprobe:    %d (max)", server->config.l2_nprobe);
+    if (server->config.l2_search_threads > 1) {
+        log_info("L2 Search:    %d threads over %d probed rows", server->config.l2_search_threads,
+                 server->config.l2_parallel_min_rows);
+    } else {
+        log_info("L2 Search:    serial");
+    }
+    log_info("L2 Storage:   %s", server->config.l2_storage == L2_STORAGE_INT8 ? "int8"
+                               : server->config.l2_storage == L2_STORAGE_F16  ? "f16"
+                               : server->config.l2_storage == L2_STORAGE_BF16 ? "bf16" : "f32");
+    if (server->config.l2_prefilter == L2_PREFILTER_REDUCED) {
+        log_info("L2 Prefilter: reduced (%d dims, %s)", server->config.l2_reduced_dim,
+                 server->config.l2_projection == L2_PROJECTION_PREFIX ? "prefix" : "pca");
+    } else {
+        log_info("L2 Prefilter: %s", server->config.l2_prefilter == L2_PREFILTER_BINARY ? "binary" : "none");
+    }
+    log_info("L2 Prompts:   %s", server->config.l2_store_prompts ? "stored" : "dropped (filter features only)");
+    log_info("L2 Filters:   %s", server->config.l2_filter_dict[0] ? server->config.l2_filter_dict : "builtin (negation)");
+    if (server->config.l2_lexical) {
+        log_info("L2 Lexical:   BM25 fused with weight %.2f, shortcut at %.2f", server->config.l2_lexical_weight,
+                 server->config.l2_lexical_shortcut);
+    } else {
+        log_info("L2 Lexical:   off (vector score only)");
+    }
+    if (server->config.value_log[0]) {
+        log_info("Values:       shared, disk log %s (responses >= %d bytes)", server->config.value_log,
+                 server->config.value_inline);
+    } else {
+        log_info("Values:       shared, in RAM");
+    }
     log_info("Default TTL:  %d seconds", server->config.default_ttl);
     log_info("Auto-Save:    Every %d seconds", server->config.save_interval_seconds);
     log_info("AI Workers:   %d threads", server->config.num_workers);
@@ -552,8 +1021,14 @@ vecs_server_t* server_create(const char *port) {
         return NULL; 
     }
     
-    // 2. L1 Cache
-    server->l1_cache = hash_map_create(1024);
+    // 2. Value store condiviso e L1 Cache
+    size_t value_inline = server->config.value_inline > 0 ? (size_t)server->config.value_inline : 0;
+    server->values = vs_create(server->config.value_log, value_inline);
+    if (!server->values) {
+        log_fatal("Impossibile creare il Value Store.");
+        return NULL;
+    }
+    server->l1_cache = hash_map_create(1024, server->values);
     if (!server->l1_cache) {
         log_fatal("Impossibile creare L1 Cache.");
         return NULL;
@@ -611,6 +1086,11 @@ vecs_server_t* server_create(const char *port) {
 
     // Crea pool con 4 worker (o pari a nproc)
     server->worker_pool = wp_create(server, num_workers, queue_limit);
+    server->pending_sets = l2_keys_create();
+    if (!server->pending_sets) {
+        log_fatal("OOM allocazione della mappa dei SET in coda.");
+        return NULL;
+    }
     
     // Aggiungi la PIPE di notifica all'Event Loop usando worker_pool come ID, non server.
     int notify_fd = wp_get_notify_fd(server->worker_pool);
@@ -622,7 +1102,36 @@ vecs_server_t* server_create(const char *port) {
     server->vector_dim = vector_engine_get_dim(server->vec_engine);
     
     // 4. L2 Cache
-    server->l2_cache = l2_cache_create(server->vector_dim, server->config.l2_capacity);
+    l2_config_t l2_conf = {0};
+    l2_conf.vector_dim = server->vector_dim;
+    l2_conf.max_capacity = server->config.l2_capacity;
+    l2_conf.max_partitions = server->config.l2_partitions;
+    l2_conf.eviction = server->config.l2_eviction;
+    l2_conf.storage = server->config.l2_storage;
+    l2_conf.prefilter = server->config.l2_prefilter;
+    l2_conf.rerank_k = server->config.l2_rerank_k;
+    l2_conf.reduced_dim = server->config.l2_reduced_dim;
+    l2_conf.projection = server->config.l2_projection;
+    l2_conf.index = server->config.l2_index;
+    l2_conf.cluster_size = server->config.l2_cluster_size;
+    l2_conf.nprobe = server->config.l2_nprobe;
+    l2_conf.search_threads = server->config.l2_search_threads;
+    l2_conf.parallel_min_rows = server->config.l2_parallel_min_rows > 0 ? (size_t)server->config.l2_parallel_min_rows : 0;
+    l2_conf.pq_m = server->config.l2_pq_m;
+    l2_conf.pq_rerank = server->config.l2_pq_rerank;
+    l2_conf.drop_prompts = !server->config.l2_store_prompts;
+    l2_conf.filter_dict = server->config.l2_filter_dict;
+    l2_conf.lexical = server->config.l2_lexical;
+    l2_conf.lexical_weight = server->config.l2_lexical_weight;
+    l2_conf.lexical_shortcut = server->config.l2_lexical_shortcut;
+    l2_conf.values = server->values;
+    l2_conf.hnsw_m = server->config.l2_hnsw_m;
+    l2_conf.hnsw_ef_search = server->config.l2_hnsw_ef_search;
+    server->l2_cache = l2_cache_create(&l2_conf);
+    if (!server->l2_cache) {
+        log_fatal("Impossibile creare la cache L2.");
+        return NULL;
+    }
     
     // 5. Buffer temporaneo per embedding
     server->tmp_vector_buf = malloc(server->vector_dim * sizeof(float));
@@ -651,6 +1160,8 @@ vecs_server_t* server_create(const char *port) {
 
 void server_destroy(vecs_server_t *server) {
     if (server == NULL) return;
+    // Le scritture L2 in attesa finiscono nello snapshot
+    server_drain_l2_writes(server, 1);
     server_save_data(server);
 
     log_info("Arresto server...");
@@ -666,12 +1177,17 @@ void server_destroy(vecs_server_t *server) {
     
     hash_map_destroy(server->l1_cache);
     
+    // Prima i worker: usano il motore e (in lettura) la cache L2
+    wp_destroy(server->worker_pool);
+    l2_keys_destroy(server->pending_sets);
+
     // Cleanup componenti AI
     vector_engine_destroy(server->vec_engine);
     l2_cache_destroy(server->l2_cache);
+    // Ultimo: L1 e L2 hanno rilasciato tutti i riferimenti
+    vs_destroy(server->values);
     free(server->tmp_vector_buf);
 
-    wp_destroy(server->worker_pool);
     el_destroy(server->loop);
     free(server->events);
     free(server);
@@ -679,11 +1195,48 @@ void server_destroy(vecs_server_t *server) {
     log_info("Server terminato.");
 }
 
+// Ciclo di scadenza attiva: le entry scadute ma mai più lette non restano in memoria
+// fino all'eviction. Ogni passo esamina un blocco di L1 e di L2; si continua (entro il
+// budget di tempo) solo sulla cache in cui il campione era ancora denso di scadute.
+// Ritorna 1 se il budget si è esaurito con lavoro ancora in sospeso
+static int server_expire_cycle(vecs_server_t *server) {
+    uint64_t start = clock_monotonic_us();
+    if (!server->expire_pending && start - server->last_expire_us < EXPIRE_PERIOD_US) return 0;
+    server->last_expire_us = start;
+
+    size_t removed_l1 = 0, removed_l2 = 0;
+    int l1_more = 1, l2_more = 1;
+    do {
+        size_t seen;
+        if (l1_more) {
+            size_t removed = hash_map_expire_cycle(server->l1_cache, EXPIRE_L1_BUCKETS, &seen);
+            removed_l1 += removed;
+            l1_more = removed * EXPIRE_DENSITY > seen;
+        }
+        if (l2_more) {
+            size_t removed = l2_cache_expire_cycle(server->l2_cache, EXPIRE_L2_ROWS, &seen);
+            removed_l2 += removed;
+            l2_more = removed * EXPIRE_DENSITY > seen;
+        }
+    } while ((l1_more || l2_more) && clock_monotonic_us() - start < EXPIRE_BUDGET_US);
+
+    if (removed_l1 > 0 || removed_l2 > 0) {
+        log_debug("Scadenza attiva: rimosse %zu entry L1 e %zu entry L2", removed_l1, removed_l2);
+    }
+    return l1_more || l2_more;
+}
+
 int server_run(vecs_server_t *server) {
     log_info("Loop eventi in esecuzione...");
 
+    int l2_pending = 0;
     while (1) {
-        int num_events = el_poll(server->loop, server->events, 1000);
+        // Con manutenzione L2 in sospeso (es. migrazione dei centroidi) il loop si sveglia più spesso,
+        // con scritture L2 in attesa del lock ancora più spesso
+        int timeout = server->l2_writes_head ? 1 : (l2_pending || server->expire_pending) ? 10 : 1000;
+        int num_events = el_poll(server->loop, server->events, timeout);
+        // Un solo time() per giro: le operazioni sulle cache leggono l'orologio in cache
+        clock_update();
 
         if (num_events == -1) {
             if (errno == EINTR) continue;
@@ -713,8 +1266,15 @@ int server_run(vecs_server_t *server) {
             }
         }
 
+        // Scritture L2 rimandate perché il lock era occupato dalle ricerche dei worker
+        server_drain_l2_writes(server, 0);
+
+        // Lavoro incrementale dell'indice L2 (a blocchi, non blocca le richieste)
+        l2_pending = l2_cache_maintenance(server->l2_cache);
+        server->expire_pending = server_expire_cycle(server);
+
         if (server->config.save_interval_seconds > 0) {
-            time_t now = time(NULL);
+            time_t now = clock_now();
             if (now - server->last_save_time >= server->config.save_interval_seconds) {
                 // È ora di salvare!
                 log_debug("Auto-save timer scattato.");
@@ -816,99 +1376,170 @@ static void server_load_data(vecs_server_t *server) {
     fclose(f);
 }
 
+// --- SCRITTURE L2 DIFFERITE ---
+// Le scritture L2 del loop eventi (inserimento dei SET, DELETE, FLUSH) non attendono le
+// ricerche a batch dei worker: con il write lock occupato il job resta in una coda
+// FIFO e si riprova al giro successivo, senza fermare il loop. Le scritture vengono
+// applicate nell'ordine di arrivo; oltre L2_WRITE_MAX_DEFER_US quella in testa
+// attende il lock (un flusso continuo di ricerche non la rimanda all'infinito).
+
+static void job_free(vecs_server_t *server, bg_job_t *job) {
+    // Libera la memoria del Job (e la sua registrazione tra i SET in attesa)
+    if (job->type == JOB_SET) {
+        l2_keys_remove(server->pending_sets, job->pending_key, (uint64_t)(uintptr_t)job);
+        if (job->set_prev) job->set_prev->set_next = job->set_next;
+        else if (server->pending_list == job) server->pending_list = job->set_next;
+        if (job->set_next) job->set_next->set_prev = job->set_prev;
+    }
+    if (job->text_to_embed) free(job->text_to_embed);
+    if (job->key_part_1) free(job->key_part_1);
+    if (job->key_part_2) free(job->key_part_2);
+    if (job->value) free(job->value);
+    if (job->vector_result) free(job->vector_result);
+    if (job->reply) buffer_destroy(job->reply);
+    free(job);
+}
+
+// Connessione che attende la risposta del job, NULL se il client si è disconnesso
+static vecs_connection_t *job_connection(vecs_server_t *server, bg_job_t *job) {
+    // Dobbiamo verificare che esista ancora e che sia LA STESSA connessione
+    // (il socket potrebbe essere stato chiuso e riaperto da un altro client)
+    if (job->client_fd < 0 || job->client_fd >= MAX_FD) {
+        log_warn("Async Job: FD non valido (%d)", job->client_fd);
+        return NULL;
+    }
+    vecs_connection_t *conn = server->connections[job->client_fd];
+    if (!conn || connection_get_id(conn) != job->conn_id) {
+        log_info("Async Job ignorato: il client (fd %d) si è disconnesso.", job->client_fd);
+        return NULL;
+    }
+    return conn;
+}
+
+// Applica la scrittura L2 del job. Ritorna la risposta per il client,
+// NULL se wait = 0 e il write lock era occupato (nulla è stato fatto)
+static const char *server_apply_l2_write(vecs_server_t *server, bg_job_t *job, int wait) {
+    if (job->type == JOB_SET && job->l2_cancelled) {
+        // Un DELETE o FLUSH successivo ha già cancellato il prompt: come se fosse arrivato dopo l'inserimento
+        log_info("Async SET L2 Skipped: prompt cancellato mentre era in coda.");
+        return "+OK\r\n";
+    }
+
+    if (job->type == JOB_FLUSH) {
+        long removed = job->key_part_2 ? l2_cache_clear_namespace(server->l2_cache, job->key_part_2, wait)
+                                       : l2_cache_clear(server->l2_cache, wait);
+        if (removed == L2_BUSY) return NULL;
+        log_info("Async FLUSH L2 completed (%s).", job->key_part_2 ? job->key_part_2 : "tutti i namespace");
+        return "+OK\r\n";
+    }
+
+    if (job->type == JOB_SET) {
+        // Il vettore è calcolato. Ora DEDUPLICA e INSERIMENTO L2 in un solo passaggio,
+        // sotto il write lock: nessuno può inserire tra la ricerca e l'inserimento.
+        l2_upsert_t outcome = l2_cache_upsert(
+            server->l2_cache,
+            job->key_part_2, // Namespace: i duplicati contano solo nella stessa partizione
+            job->vector_result,
+            job->key_part_1, // Il prompt originale
+            job->value,
+            job->ttl,
+            server->config.l2_dedupe_threshold,
+            wait
+        );
+
+        // L1 è già aggiornata: il client riceve sempre +OK, con l'esito L2 come suffisso
+        if (outcome == L2_UPSERT_BUSY) return NULL;
+        if (outcome == L2_UPSERT_DEDUPED) {
+            log_info("Async SET L2 Skipped: Concetto già presente.");
+            return "+OK DEDUPED\r\n";
+        }
+        if (outcome == L2_UPSERT_REJECTED) {
+            log_warn("Async SET L2 Fallito: cache piena (eviction %s) o memoria esaurita.",
+                     server->config.l2_eviction == L2_EVICT_NONE ? "disattivata" : "non riuscita");
+            return "+OK L1_ONLY\r\n";
+        }
+        log_info("Async SET L2 OK.");
+        return "+OK\r\n";
+    }
+
+    // JOB_DELETE: senza vettore è la cancellazione del prompt esatto rimandata dal loop,
+    // altrimenti il vettore del prompt da cancellare è pronto (SEMANTIC)
+    int deleted = job->vector_result
+        ? l2_cache_delete_semantic(server->l2_cache, job->key_part_2, job->vector_result, wait)
+        : l2_cache_delete_prompt(server->l2_cache, job->key_part_2, job->key_part_1, wait);
+    if (deleted == L2_BUSY) return NULL;
+    log_info("Async DELETE L2 completed. Removed: %d", deleted);
+    return "+OK\r\n";
+}
+
+static void server_defer_l2_write(vecs_server_t *server, bg_job_t *job) {
+    job->next = NULL;
+    job->deferred_us = clock_monotonic_us();
+    if (server->l2_writes_tail) server->l2_writes_tail->next = job;
+    else server->l2_writes_head = job;
+    server->l2_writes_tail = job;
+}
+
+// Applica le scritture in attesa finché il lock è libero (force = 1: le applica tutte).
+// La scrittura avviene anche se il client si è disconnesso; si perde solo la risposta
+static void server_drain_l2_writes(vecs_server_t *server, int force) {
+    while (server->l2_writes_head) {
+        bg_job_t *job = server->l2_writes_head;
+        int wait = force || clock_monotonic_us() - job->deferred_us >= L2_WRITE_MAX_DEFER_US;
+        const char *reply = server_apply_l2_write(server, job, wait);
+        if (!reply) break; // Ricerche in corso: si riprova al prossimo giro del loop
+
+        server->l2_writes_head = job->next;
+        if (!server->l2_writes_head) server->l2_writes_tail = NULL;
+
+        vecs_connection_t *conn = job_connection(server, job);
+        if (conn) {
+            buffer_append_string(connection_get_write_buffer(conn), reply);
+            el_enable_write(server->loop, job->client_fd, (void*)conn);
+        }
+        job_free(server, job);
+    }
+}
+
 static void server_handle_worker_notification(vecs_server_t *server) {
     while (1) {
         // 1. Legge il puntatore al job dalla pipe
         bg_job_t *job = wp_read_completed_job(server->worker_pool);
         if (!job) break; // Pipe vuota, nessun altro lavoro completato
 
-        // 2. Recupera la connessione associata
-        // Attenzione: dobbiamo verificare che esista ancora e che sia LA STESSA connessione
-        // (il socket potrebbe essere stato chiuso e riaperto da un altro client)
-        if (job->client_fd < 0 || job->client_fd >= MAX_FD) {
-            log_warn("Async Job: FD non valido (%d)", job->client_fd);
-            goto cleanup;
-        }
-
-        vecs_connection_t *conn = server->connections[job->client_fd];
-
-        // Se la connessione è nulla o l'ID non corrisponde, il client si è disconnesso nel frattempo.
-        if (!conn || connection_get_id(conn) != job->conn_id) {
-            log_info("Async Job ignorato: il client (fd %d) si è disconnesso.", job->client_fd);
-            goto cleanup;
+        // 2. Le scritture L2 (SET, DELETE SEMANTIC) passano dalla coda delle scritture
+        // differite: rispondono quando sono applicate, nell'ordine di arrivo
+        if (job->success && job->type != JOB_QUERY) {
+            server_defer_l2_write(server, job);
+            continue;
         }
 
-        buffer_t *write_buf = connection_get_write_buffer(conn);
-        char header_buf[64];
-
-        if (!job->success) {
-            // Caso Errore nel Worker (es. fallimento allocazione o modello)
-            buffer_append_string(write_buf, "-ERR Vector Embedding Failed\r\n");
-        } else {
-            // --- LOGICA SPECIFICA PER TIPO DI JOB ---
-
-            if (job->type == JOB_SET) {
-                // Il vettore è calcolato. Ora facciamo la DEDUPLICA e INSERIMENTO L2.
-                // Questo avviene nel Main Thread, quindi è thread-safe per la cache.
-                
-                const char *existing = l2_cache_search(
-                    server->l2_cache, 
-                    job->vector_result, 
-                    job->key_part_1, // Il prompt originale
-                    server->config.l2_dedupe_threshold
-                );
-                
-                if (existing != NULL) {
-                    log_info("Async SET L2 Skipped: Concetto già presente.");
-                } else {
-                    l2_cache_insert(server->l2_cache, job->vector_result, job->key_part_1, job->value, job->ttl);
-                    log_info("Async SET L2 OK.");
-                }
-                
-                buffer_append_string(write_buf, "+OK\r\n");
-
-            } else if (job->type == JOB_QUERY) {
-                // Il vettore query è pronto. Eseguiamo la ricerca L2.
-                
-                const char *semantic_val = l2_cache_search(
-                    server->l2_cache,
-                    job->vector_result,
-                    job->key_part_1, // Il prompt originale (usato per i filtri text-based)
-                    server->config.l2_threshold
-                );
-
-                if (semantic_val != NULL) {
-                    // HIT L2
-                    size_t val_len = strlen(semantic_val);
-                    snprintf(header_buf, sizeof(header_buf), "$%zu\r\n", val_len);
-                    buffer_append_string(write_buf, header_buf);
-                    buffer_append_data(write_buf, semantic_val, val_len);
-                    buffer_append_string(write_buf, "\r\n");
-                    log_info("Async HIT L2 (Semantic)");
+        // 3. Recupera la connessione associata
+        vecs_connection_t *conn = job_connection(server, job);
+        if (conn) {
+            buffer_t *write_buf = connection_get_write_buffer(conn);
+
+            if (!job->success) {
+                // Caso Errore nel Worker (es. fallimento allocazione o modello)
+                buffer_append_string(write_buf, "-ERR Vector Embedding Failed\r\n");
+            } else {
+                // La ricerca L2 è già stata fatta dal worker; se non ha potuto
+                // preparare la risposta (OOM) si riprova qui
+                if (!job->reply) server_run_job_lookup(server, &job, 1);
+                if (job->reply) {
+                    buffer_append_data(write_buf, buffer_peek(job->reply), buffer_len(job->reply));
                 } else {
-                    // MISS L2
-                    buffer_append_string(write_buf, "$-1\r\n");
-                    log_debug("Async MISS L2");
+                    buffer_append_string(write_buf, "-ERR Server OOM\r\n");
                 }
-
-            } else if (job->type == JOB_DELETE) {
-                // Il vettore del prompt da cancellare è pronto.
-                int deleted = l2_cache_delete_semantic(server->l2_cache, job->vector_result);
-                log_info("Async DELETE L2 completed. Removed: %d", deleted);
-                buffer_append_string(write_buf, "+OK\r\n");
             }
-        }
 
-        // 3. Abilita la scrittura sul socket per inviare la risposta al client
-        el_enable_write(server->loop, job->client_fd, (void*)conn);
+            // 4. Abilita la scrittura sul socket per inviare la risposta al client
+            el_enable_write(server->loop, job->client_fd, (void*)conn);
+        }
 
-cleanup:
-        // 4. Libera tutta la memoria del Job
-        if (job->text_to_embed) free(job->text_to_embed);
-        if (job->key_part_1) free(job->key_part_1);
-        if (job->key_part_2) free(job->key_part_2);
-        if (job->value) free(job->value);
-        if (job->vector_result) free(job->vector_result);
-        free(job);
+        // 5. Libera tutta la memoria del Job
+        job_free(server, job);
     }
-}
\ No newline at end of file
+    // Le scritture appena accodate si applicano subito se il lock è libero
+    server_drain_l2_writes(server, 0);
+}
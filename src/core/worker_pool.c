@@ -37,6 +37,10 @@ struct worker_pool_s {
     int pipe_fd[2];
 };
 
+// QUERY prese insieme da un worker quando la coda è in arretrato: una sola
+// ricerca L2 a batch legge i cluster sondati una volta per tutte
+#define QUERY_BATCH 8
+
 // Struttura per passare argomenti ai thread
 typedef struct {
     worker_pool_t *pool;
@@ -54,7 +58,8 @@ static void *worker_routine(void *arg) {
     //log_debug("Worker %d: Thread avviato.", my_id);
 
     while (1) {
-        bg_job_t *job = NULL;
+        bg_job_t *batch[QUERY_BATCH];
+        int count = 0;
 
         // 2. Dequeue (Thread Safe)
         pthread_mutex_lock(&pool->lock);
@@ -67,47 +72,61 @@ static void *worker_routine(void *arg) {
             break;
         }
 
-        job_node_t *node = pool->head;
-        job = node->job;
-        pool->head = node->next;
-        if (pool->head == NULL) pool->tail = NULL;
-        pool->current_jobs--;
-        free(node);
+        // Con più job in coda che worker, le QUERY consecutive in testa si prendono
+        // insieme (gli altri worker hanno comunque lavoro)
+        do {
+            job_node_t *node = pool->head;
+            batch[count++] = node->job;
+            pool->head = node->next;
+            if (pool->head == NULL) pool->tail = NULL;
+            pool->current_jobs--;
+            free(node);
+        } while (count < QUERY_BATCH && batch[0]->type == JOB_QUERY && pool->head &&
+                 pool->head->job->type == JOB_QUERY && pool->current_jobs >= pool->num_workers);
         pthread_mutex_unlock(&pool->lock);
 
         // 3. ESECUZIONE EMBEDDING
-        log_debug("Worker %d: Job %lu preso. Allocazione memoria...", my_id, job->conn_id);
-        
-        vector_engine_t *engine = server_get_engine(pool->server);
-        
-        // ALLOCAZIONE MEMORIA VETTORE ---
-        int dim = vector_engine_get_dim(engine);
-        job->vector_result = malloc(dim * sizeof(float));
-        
-        if (!job->vector_result) {
-            log_error("Worker %d: OOM allocazione vettore risultato", my_id);
-            job->success = 0;
-        } else {
-            // Ora vector_result è valido, l'engine non ritornerà -1 subito
-            int ret = vector_engine_embed(engine, my_id, job->text_to_embed, job->vector_result);
-            job->success = (ret == 0) ? 1 : 0;
-        }
-        // ----------------------------------------
-
-        if (job->success) {
-            log_debug("Worker %d: Embedding OK.", my_id);
-        } else {
-            log_error("Worker %d: Embedding FALLITO.", my_id);
-            // Cleanup in caso di fallimento parziale
-            if (job->vector_result) {
-                free(job->vector_result);
-                job->vector_result = NULL;
+        for (int b = 0; b < count; b++) {
+            bg_job_t *job = batch[b];
+            log_debug("Worker %d: Job %lu preso. Allocazione memoria...", my_id, job->conn_id);
+
+            vector_engine_t *engine = server_get_engine(pool->server);
+
+            // ALLOCAZIONE MEMORIA VETTORE ---
+            int dim = vector_engine_get_dim(engine);
+            job->vector_result = malloc(dim * sizeof(float));
+
+            if (!job->vector_result) {
+                log_error("Worker %d: OOM allocazione vettore risultato", my_id);
+                job->success = 0;
+            } else {
+                // Ora vector_result è valido, l'engine non ritornerà -1 subito
+                int ret = vector_engine_embed(engine, my_id, job->text_to_embed, job->vector_result);
+                job->success = (ret == 0) ? 1 : 0;
+            }
+            // ----------------------------------------
+
+            if (job->success) {
+                log_debug("Worker %d: Embedding OK.", my_id);
+            } else {
+                log_error("Worker %d: Embedding FALLITO.", my_id);
+                // Cleanup in caso di fallimento parziale
+                if (job->vector_result) {
+                    free(job->vector_result);
+                    job->vector_result = NULL;
+                }
             }
         }
 
+        // Le QUERY si cercano qui, in parallelo agli altri worker: il main thread
+        // deve solo accodare la risposta
+        server_run_job_lookup(pool->server, batch, count);
+
         // 4. Notifica
-        if (write(pool->pipe_fd[1], &job, sizeof(bg_job_t *)) == -1) {
-             log_error("Worker %d: Errore pipe", my_id);
+        for (int b = 0; b < count; b++) {
+            if (write(pool->pipe_fd[1], &batch[b], sizeof(bg_job_t *)) == -1) {
+                log_error("Worker %d: Errore pipe", my_id);
+            }
         }
     }
     return NULL;
@@ -0,0 +1,29 @@
+/*
+ * Vecs Project: Implementazione Clock
+ * (src/utils/clock.c)
+ */
+
+#include "clock.h"
+#include <stdatomic.h>
+
+// Scritto solo dal main thread, letto anche dai worker
+static _Atomic time_t cached_now = 0;
+
+void clock_update(void) {
+    atomic_store_explicit(&cached_now, time(NULL), memory_order_relaxed);
+}
+
+time_t clock_now(void) {
+    time_t now = atomic_load_explicit(&cached_now, memory_order_relaxed);
+    if (now == 0) {
+        clock_update();
+        now = atomic_load_explicit(&cached_now, memory_order_relaxed);
+    }
+    return now;
+}
+
+uint64_t clock_monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
@@ -0,0 +1,281 @@
+/*
+ * Vecs Project: Filtro a Parole Chiave (Aho-Corasick)
+ * (src/utils/keyword_filter.c)
+ *
+ * L'automa è un DFA completo: la tabella delle transizioni include già i
+ * failure link, quindi la scansione fa un accesso per byte. L'alfabeto è
+ * compresso nelle sole classi di byte che compaiono nelle parole chiave
+ * (tutti gli altri byte riportano alla radice): la tabella resta piccola.
+ */
+
+#include "keyword_filter.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+typedef struct {
+    char *text;              // Parola chiave in minuscolo
+    uint32_t mask;
+} kwf_keyword_t;
+
+typedef struct {
+    uint32_t mask;           // Feature delle parole chiave che terminano in questo stato
+    uint32_t depth;          // Lunghezza del prefisso riconosciuto
+    int32_t fail;
+    int32_t out;             // Stato più vicino sulla catena dei fail con mask != 0 (-1 = nessuno)
+} kwf_state_t;
+
+struct keyword_filter_s {
+    char *features[KWF_MAX_FEATURES];
+    int num_features;
+    kwf_keyword_t *keywords;
+    size_t num_keywords;
+    size_t cap_keywords;
+
+    // Automa (valido dopo kwf_compile)
+    uint8_t classes[256];    // Byte -> classe (0 = byte assente da ogni parola chiave)
+    int num_classes;
+    int32_t *next;           // [num_states x num_classes]
+    kwf_state_t *states;
+    int32_t num_states;
+};
+
+// Le parole chiave corrispondono solo a parole intere (UTF-8 multibyte = lettera)
+static inline int is_word_byte(unsigned char c) {
+    return c >= 0x80 || isalnum(c);
+}
+
+keyword_filter_t *kwf_create(void) {
+    return calloc(1, sizeof(keyword_filter_t));
+}
+
+void kwf_destroy(keyword_filter_t *kwf) {
+    if (!kwf) return;
+    for (int i = 0; i < kwf->num_features; i++) free(kwf->features[i]);
+    for (size_t i = 0; i < kwf->num_keywords; i++) free(kwf->keywords[i].text);
+    free(kwf->keywords);
+    free(kwf->next);
+    free(kwf->states);
+    free(kwf);
+}
+
+static int feature_bit(keyword_filter_t *kwf, const char *feature) {
+    for (int i = 0; i < kwf->num_features; i++) {
+        if (strcmp(kwf->features[i], feature) == 0) return i;
+    }
+    if (kwf->num_features == KWF_MAX_FEATURES) return -1;
+    char *name = strdup(feature);
+    if (!name) return -1;
+    kwf->features[kwf->num_features] = name;
+    return kwf->num_features++;
+}
+
+int kwf_add(keyword_filter_t *kwf, const char *feature, const char *keyword) {
+    int bit = feature_bit(kwf, feature);
+    if (bit < 0) return -1;
+    if (keyword[0] == '\0') return bit;
+
+    if (kwf->num_keywords == kwf->cap_keywords) {
+        size_t new_cap = kwf->cap_keywords ? kwf->cap_keywords * 2 : 16;
+        kwf_keyword_t *grown = realloc(kwf->keywords, new_cap * sizeof(kwf_keyword_t));
+        if (!grown) return -1;
+        kwf->keywords = grown;
+        kwf->cap_keywords = new_cap;
+    }
+    char *text = strdup(keyword);
+    if (!text) return -1;
+    for (char *p = text; *p; p++) *p = (char)tolower((unsigned char)*p);
+    kwf->keywords[kwf->num_keywords].text = text;
+    kwf->keywords[kwf->num_keywords].mask = 1u << bit;
+    kwf->num_keywords++;
+    return bit;
+}
+
+// Rimuove gli spazi iniziali e finali in-place
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+int kwf_load_string(keyword_filter_t *kwf, const char *spec) {
+    char *copy = strdup(spec);
+    if (!copy) return -1;
+
+    int added = 0;
+    int line_no = 0;
+    char *line = copy;
+    while (line) {
+        char *next_line = strchr(line, '\n');
+        if (next_line) *next_line++ = '\0';
+        line_no++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        line = trim(line);
+        if (*line == '\0') { line = next_line; continue; }
+
+        char *colon = strchr(line, ':');
+        if (!colon) {
+            log_error("Dizionario filtri: riga %d senza ':' (formato 'feature: parola, parola')", line_no);
+            free(copy);
+            return -1;
+        }
+        *colon = '\0';
+        char *feature = trim(line);
+        if (*feature == '\0') {
+            log_error("Dizionario filtri: riga %d senza nome della feature", line_no);
+            free(copy);
+            return -1;
+        }
+
+        char *keyword = colon + 1;
+        while (keyword) {
+            char *comma = strchr(keyword, ',');
+            if (comma) *comma++ = '\0';
+            if (kwf_add(kwf, feature, trim(keyword)) < 0) {
+                log_error("Dizionario filtri: troppe feature (max %d) o memoria esaurita", KWF_MAX_FEATURES);
+                free(copy);
+                return -1;
+            }
+            added++;
+            keyword = comma;
+        }
+        line = next_line;
+    }
+    free(copy);
+    return added;
+}
+
+int kwf_load_file(keyword_filter_t *kwf, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        log_error("Dizionario filtri: impossibile aprire '%s'", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *spec = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (!spec) { fclose(f); return -1; }
+    size_t read = fread(spec, 1, (size_t)size, f);
+    spec[read] = '\0';
+    fclose(f);
+
+    int added = kwf_load_string(kwf, spec);
+    free(spec);
+    return added;
+}
+
+int kwf_compile(keyword_filter_t *kwf) {
+    free(kwf->next);
+    free(kwf->states);
+    kwf->next = NULL;
+    kwf->states = NULL;
+
+    // 1. Classi di byte: una per ogni byte usato (maiuscole ASCII = minuscole)
+    memset(kwf->classes, 0, sizeof(kwf->classes));
+    int classes = 1;
+    size_t max_states = 1;
+    for (size_t k = 0; k < kwf->num_keywords; k++) {
+        for (const unsigned char *p = (const unsigned char *)kwf->keywords[k].text; *p; p++) {
+            if (kwf->classes[*p] == 0) kwf->classes[*p] = (uint8_t)classes++;
+            max_states++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; c++) kwf->classes[c] = kwf->classes[tolower(c)];
+    kwf->num_classes = classes;
+
+    kwf->next = calloc(max_states * classes, sizeof(int32_t));
+    kwf->states = calloc(max_states, sizeof(kwf_state_t));
+    int32_t *queue = malloc(max_states * sizeof(int32_t));
+    if (!kwf->next || !kwf->states || !queue) {
+        free(kwf->next); free(kwf->states); free(queue);
+        kwf->next = NULL;
+        kwf->states = NULL;
+        return -1;
+    }
+
+    // 2. Trie (0 = nessun figlio: la radice non è mai figlia di nessuno)
+    int32_t count = 1;
+    for (size_t k = 0; k < kwf->num_keywords; k++) {
+        int32_t s = 0;
+        for (const unsigned char *p = (const unsigned char *)kwf->keywords[k].text; *p; p++) {
+            int32_t *slot = &kwf->next[(size_t)s * classes + kwf->classes[*p]];
+            if (*slot == 0) {
+                kwf->states[count].depth = kwf->states[s].depth + 1;
+                *slot = count++;
+            }
+            s = *slot;
+        }
+        kwf->states[s].mask |= kwf->keywords[k].mask;
+    }
+    kwf->num_states = count;
+
+    // 3. BFS: failure link e transizioni mancanti (la riga di fail è già completa)
+    size_t head = 0, tail = 0;
+    kwf->states[0].out = -1;
+    for (int c = 0; c < classes; c++) {
+        int32_t u = kwf->next[c];
+        if (u) {
+            kwf->states[u].fail = 0;
+            kwf->states[u].out = -1;
+            queue[tail++] = u;
+        }
+    }
+    while (head < tail) {
+        int32_t s = queue[head++];
+        int32_t fail = kwf->states[s].fail;
+        for (int c = 0; c < classes; c++) {
+            int32_t *slot = &kwf->next[(size_t)s * classes + c];
+            int32_t fallback = kwf->next[(size_t)fail * classes + c];
+            if (*slot) {
+                int32_t u = *slot;
+                kwf->states[u].fail = fallback;
+                kwf->states[u].out = kwf->states[fallback].mask ? fallback : kwf->states[fallback].out;
+                queue[tail++] = u;
+            } else {
+                *slot = fallback;
+            }
+        }
+    }
+    free(queue);
+    return 0;
+}
+
+uint32_t kwf_match(const keyword_filter_t *kwf, const char *text, size_t *len) {
+    const unsigned char *t = (const unsigned char *)text;
+    uint32_t mask = 0;
+    size_t i = 0;
+    if (!kwf || !kwf->next) {
+        if (len) *len = strlen(text);
+        return 0;
+    }
+
+    int32_t s = 0;
+    for (; t[i]; i++) {
+        s = kwf->next[(size_t)s * kwf->num_classes + kwf->classes[t[i]]];
+        int32_t o = kwf->states[s].mask ? s : kwf->states[s].out;
+        if (o < 0) continue;
+        // Parola intera: nessuna lettera subito prima dell'inizio e subito dopo la fine
+        if (is_word_byte(t[i + 1])) continue;
+        for (; o >= 0; o = kwf->states[o].out) {
+            size_t start = i + 1 - kwf->states[o].depth;
+            if (start == 0 || !is_word_byte(t[start - 1])) mask |= kwf->states[o].mask;
+        }
+    }
+    if (len) *len = i;
+    return mask;
+}
+
+int kwf_feature_count(const keyword_filter_t *kwf) {
+    return kwf ? kwf->num_features : 0;
+}
+
+const char *kwf_feature_name(const keyword_filter_t *kwf, int bit) {
+    return (kwf && bit >= 0 && bit < kwf->num_features) ? kwf->features[bit] : NULL;
+}
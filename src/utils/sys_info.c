@@ -121,4 +121,35 @@ void sys_get_gpu_info(char *buffer, size_t size) {
         pclose(p);
     }
 #endif
-}
\ No newline at end of file
+}
+size_t sys_get_l2_cache_size(void) {
+#if defined(__APPLE__)
+    // Apple Silicon espone la L2 dei core performance, Intel quella classica
+    int64_t l2 = 0;
+    size_t len = sizeof(l2);
+    if (sysctlbyname("hw.perflevel0.l2cachesize", &l2, &len, NULL, 0) == 0 && l2 > 0) return (size_t)l2;
+    len = sizeof(l2);
+    if (sysctlbyname("hw.l2cachesize", &l2, &len, NULL, 0) == 0 && l2 > 0) return (size_t)l2;
+#elif defined(__linux__)
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0) return (size_t)l2;
+#endif
+    // Fallback (musl, ARM): sysfs riporta es. "1024K"
+    FILE *f = fopen("/sys/devices/system/cpu/cpu0/cache/index2/size", "r");
+    if (f) {
+        char line[32];
+        size_t bytes = 0;
+        if (fgets(line, sizeof(line), f)) {
+            char *end;
+            unsigned long v = strtoul(line, &end, 10);
+            if (*end == 'K') v *= 1024UL;
+            else if (*end == 'M') v *= 1024UL * 1024UL;
+            bytes = v;
+        }
+        fclose(f);
+        return bytes;
+    }
+#endif
+    return 0;
+}
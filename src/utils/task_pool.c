@@ -0,0 +1,142 @@
+/*
+ * Vecs Project: Task Pool (fork-join)
+ * (src/utils/task_pool.c)
+ *
+ * Ogni tp_run apre una nuova "generazione": i thread la vedono, prendono
+ * task con un contatore atomico finché ce ne sono, poi segnalano la fine.
+ * Il chiamante lavora come gli altri e aspetta che tutti abbiano finito,
+ * quindi fn/ctx restano validi per tutta la durata del lavoro.
+ */
+
+#include "task_pool.h"
+#include "logger.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct task_pool_s {
+    pthread_t *threads;
+    int num_threads;
+    int running;
+
+    // Lavoro corrente (scritto sotto lock prima del broadcast)
+    uint64_t generation;
+    task_fn fn;
+    void *ctx;
+    int num_tasks;
+    atomic_int next_task;
+    int active;              // Thread del pool non ancora usciti dal lavoro corrente
+
+    pthread_mutex_t run_lock; // Un lavoro alla volta: gli altri chiamanti procedono da soli
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+};
+
+static void run_tasks(task_pool_t *pool, task_fn fn, void *ctx, int num_tasks) {
+    int task;
+    while ((task = atomic_fetch_add_explicit(&pool->next_task, 1, memory_order_relaxed)) < num_tasks) {
+        fn(ctx, task);
+    }
+}
+
+static void *task_routine(void *arg) {
+    task_pool_t *pool = arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->running && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (!pool->running) break;
+        seen = pool->generation;
+        task_fn fn = pool->fn;
+        void *ctx = pool->ctx;
+        int num_tasks = pool->num_tasks;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(pool, fn, ctx, num_tasks);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+task_pool_t *tp_create(int num_threads) {
+    if (num_threads <= 0) return NULL;
+    task_pool_t *pool = calloc(1, sizeof(task_pool_t));
+    if (!pool) return NULL;
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!pool->threads) { free(pool); return NULL; }
+
+    pool->running = 1;
+    atomic_init(&pool->next_task, 0);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, task_routine, pool) != 0) {
+            log_error("Task pool: creazione del thread %d fallita", i);
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads == 0) {
+        tp_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void tp_destroy(task_pool_t *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->running = 0;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->threads);
+    free(pool);
+}
+
+int tp_parallelism(const task_pool_t *pool) {
+    return pool ? pool->num_threads + 1 : 1;
+}
+
+void tp_run(task_pool_t *pool, task_fn fn, void *ctx, int num_tasks) {
+    // Pool già occupato da un altro chiamante: aspettarlo costerebbe più che lavorare da soli
+    if (!pool || num_tasks <= 1 || pthread_mutex_trylock(&pool->run_lock) != 0) {
+        for (int task = 0; task < num_tasks; task++) fn(ctx, task);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->num_tasks = num_tasks;
+    atomic_store_explicit(&pool->next_task, 0, memory_order_relaxed);
+    pool->active = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, fn, ctx, num_tasks);
+
+    // I risultati scritti dai thread sono visibili dopo il lock (barriera del mutex)
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+}
@@ -0,0 +1,175 @@
+/*
+ * Vecs Project: Implementazione K-Means
+ * (src/vector/kmeans.c)
+ */
+
+#include "kmeans.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+// Distanza euclidea al quadrato, via dot product: ||x||^2 - 2 x.c + ||c||^2
+static inline float sq_dist(const vec_kernels_t *vk, const float *x, const float *c, float x_norm, float c_norm, int dim) {
+    float d = x_norm - 2.0f * vk->dot(x, c, dim) + c_norm;
+    return d > 0.0f ? d : 0.0f;
+}
+
+int kmeans_nearest(const vec_kernels_t *vk, const float *x, const float *centroids, int k, int dim) {
+    int best = 0;
+    float best_d = FLT_MAX;
+    for (int j = 0; j < k; j++) {
+        const float *c = centroids + (size_t)j * dim;
+        // ||x||^2 è costante rispetto a j: basta ||c||^2 - 2 x.c
+        float d = vk->dot(c, c, dim) - 2.0f * vk->dot(x, c, dim);
+        if (d < best_d) {
+            best_d = d;
+            best = j;
+        }
+    }
+    return best;
+}
+
+// Inizializzazione k-means++: ogni nuovo seme è scelto con probabilità ~ D(x)^2
+static void kmeans_pp_init(const vec_kernels_t *vk, const float *data, size_t n, size_t stride, int dim,
+                           int k, const float *x_norm, float *min_d, float *centroids, unsigned int *seed) {
+    size_t first = (size_t)rand_r(seed) % n;
+    memcpy(centroids, data + first * stride, dim * sizeof(float));
+    for (size_t i = 0; i < n; i++) min_d[i] = FLT_MAX;
+
+    for (int j = 1; j < k; j++) {
+        const float *prev = centroids + (size_t)(j - 1) * dim;
+        float prev_norm = vk->dot(prev, prev, dim);
+        double total = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            float d = sq_dist(vk, data + i * stride, prev, x_norm[i], prev_norm, dim);
+            if (d < min_d[i]) min_d[i] = d;
+            total += min_d[i];
+        }
+
+        size_t pick = (size_t)rand_r(seed) % n;
+        if (total > 0.0) {
+            double r = ((double)rand_r(seed) / (double)RAND_MAX) * total;
+            for (size_t i = 0; i < n; i++) {
+                r -= min_d[i];
+                if (r <= 0.0) { pick = i; break; }
+            }
+        }
+        memcpy(centroids + (size_t)j * dim, data + pick * stride, dim * sizeof(float));
+    }
+}
+
+int kmeans_train(const vec_kernels_t *vk, const float *data, size_t n, size_t stride, int dim,
+                 int k, int iterations, int spherical, float *centroids) {
+    if (n < (size_t)k || k <= 0) return -1;
+
+    float *x_norm = malloc(n * sizeof(float));
+    float *min_d = malloc(n * sizeof(float));
+    int *assign = malloc(n * sizeof(int));
+    size_t *counts = malloc(k * sizeof(size_t));
+    float *c_norm = malloc(k * sizeof(float));
+    if (!x_norm || !min_d || !assign || !counts || !c_norm) {
+        free(x_norm); free(min_d); free(assign); free(counts); free(c_norm);
+        return -1;
+    }
+
+    unsigned int seed = 0x5eed;
+    for (size_t i = 0; i < n; i++) x_norm[i] = vk->dot(data + i * stride, data + i * stride, dim);
+    kmeans_pp_init(vk, data, n, stride, dim, k, x_norm, min_d, centroids, &seed);
+
+    for (int it = 0; it < iterations; it++) {
+        // 1. Assegnazione
+        for (int j = 0; j < k; j++) {
+            const float *c = centroids + (size_t)j * dim;
+            c_norm[j] = vk->dot(c, c, dim);
+        }
+        size_t changed = 0;
+        for (size_t i = 0; i < n; i++) {
+            const float *x = data + i * stride;
+            int best = 0;
+            float best_d = FLT_MAX;
+            for (int j = 0; j < k; j++) {
+                float d = c_norm[j] - 2.0f * vk->dot(x, centroids + (size_t)j * dim, dim);
+                if (d < best_d) { best_d = d; best = j; }
+            }
+            if (it == 0 || assign[i] != best) changed++;
+            assign[i] = best;
+        }
+        if (it > 0 && changed == 0) break;
+
+        // 2. Aggiornamento (media dei punti assegnati)
+        memset(centroids, 0, (size_t)k * dim * sizeof(float));
+        memset(counts, 0, k * sizeof(size_t));
+        for (size_t i = 0; i < n; i++) {
+            vk->axpby(centroids + (size_t)assign[i] * dim, data + i * stride, 1.0f, 1.0f, dim);
+            counts[assign[i]]++;
+        }
+        for (int j = 0; j < k; j++) {
+            float *c = centroids + (size_t)j * dim;
+            if (counts[j] == 0) {
+                // Cluster vuoto: riseminato su un punto a caso
+                memcpy(c, data + ((size_t)rand_r(&seed) % n) * stride, dim * sizeof(float));
+                continue;
+            }
+            vk->scale(c, 1.0f / (float)counts[j], dim);
+            if (spherical) vec_kernels_normalize(vk, c, dim);
+        }
+    }
+
+    free(x_norm); free(min_d); free(assign); free(counts); free(c_norm);
+    return 0;
+}
+
+int kmeans_train_minibatch(const vec_kernels_t *vk, const float *data, size_t n, size_t stride, int dim,
+                           int k, size_t batch, int iterations, int spherical, float *centroids) {
+    if (n < (size_t)k || k <= 0) return -1;
+    if (batch == 0 || batch > n) batch = n;
+
+    float *x_norm = malloc(n * sizeof(float));
+    float *min_d = malloc(n * sizeof(float));
+    size_t *idx = malloc(batch * sizeof(size_t));
+    int *assign = malloc(batch * sizeof(int));
+    size_t *counts = calloc(k, sizeof(size_t));
+    float *c_norm = malloc(k * sizeof(float));
+    if (!x_norm || !min_d || !idx || !assign || !counts || !c_norm) {
+        free(x_norm); free(min_d); free(idx); free(assign); free(counts); free(c_norm);
+        return -1;
+    }
+
+    unsigned int seed = 0x5eed;
+    for (size_t i = 0; i < n; i++) x_norm[i] = vk->dot(data + i * stride, data + i * stride, dim);
+    kmeans_pp_init(vk, data, n, stride, dim, k, x_norm, min_d, centroids, &seed);
+
+    for (int it = 0; it < iterations; it++) {
+        // 1. Assegnazione del mini-batch con i centroidi correnti
+        for (int j = 0; j < k; j++) {
+            const float *c = centroids + (size_t)j * dim;
+            c_norm[j] = vk->dot(c, c, dim);
+        }
+        for (size_t b = 0; b < batch; b++) {
+            idx[b] = (size_t)rand_r(&seed) % n;
+            const float *x = data + idx[b] * stride;
+            int best = 0;
+            float best_d = FLT_MAX;
+            for (int j = 0; j < k; j++) {
+                float d = c_norm[j] - 2.0f * vk->dot(x, centroids + (size_t)j * dim, dim);
+                if (d < best_d) { best_d = d; best = j; }
+            }
+            assign[b] = best;
+        }
+
+        // 2. Aggiornamento con learning rate 1/count per centroide (Sculley, 2010)
+        for (size_t b = 0; b < batch; b++) {
+            int j = assign[b];
+            counts[j]++;
+            float eta = 1.0f / (float)counts[j];
+            vk->axpby(centroids + (size_t)j * dim, data + idx[b] * stride, 1.0f - eta, eta, dim);
+        }
+    }
+
+    if (spherical) {
+        for (int j = 0; j < k; j++) vec_kernels_normalize(vk, centroids + (size_t)j * dim, dim);
+    }
+
+    free(x_norm); free(min_d); free(idx); free(assign); free(counts); free(c_norm);
+    return 0;
+}
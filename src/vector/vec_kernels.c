@@ -0,0 +1,878 @@
+/*
+ * Vecs Project: Implementazione Kernel Vettoriali (SIMD)
+ * (src/vector/vec_kernels.c)
+ *
+ * Ogni kernel esiste in versione scalare e in versione SIMD compilata con
+ * __attribute__((target)), così il binario resta portabile (niente -march)
+ * e il dispatch avviene a runtime con __builtin_cpu_supports.
+ * Le varianti per 384/768/1024 hanno trip count costante: il compilatore
+ * srotola completamente il loop ed elimina la coda scalare.
+ */
+
+#include "vec_kernels.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VK_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define VK_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef enum {
+    VK_ISA_SCALAR = 0,
+    VK_ISA_NEON,
+    VK_ISA_AVX2,
+    VK_ISA_AVX512
+} vk_isa_t;
+
+static const char *ISA_NAMES[] = { "scalar", "neon", "avx2+fma", "avx512f" };
+
+static vk_isa_t detected_isa = VK_ISA_SCALAR;
+static int has_avx512bw = 0;    // Kernel int8 a 512 bit
+static int has_avx512vnni = 0;  // vpdpbusd
+static int has_popcnt = 0;      // popcnt hardware (x86)
+static int has_vpopcntdq = 0;   // vpopcntq a 512 bit
+static int has_f16c = 0;        // vcvtph2ps (fp16 -> float) con AVX2
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+// --- SCALARE (Fallback) ---
+
+static float dot_scalar(const float *a, const float *b, int dim) {
+    // 4 accumulatori indipendenti: rompe la catena di dipendenze delle somme
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void dot4_scalar(const float *a, const float *const *q, float *out, int dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        float x = a[i];
+        s0 += x * q[0][i];
+        s1 += x * q[1][i];
+        s2 += x * q[2][i];
+        s3 += x * q[3][i];
+    }
+    out[0] = s0; out[1] = s1; out[2] = s2; out[3] = s3;
+}
+
+static void axpby_scalar(float *y, const float *x, float alpha, float beta, int dim) {
+    for (int i = 0; i < dim; i++) y[i] = y[i] * alpha + x[i] * beta;
+}
+
+static void scale_scalar(float *y, float s, int dim) {
+    for (int i = 0; i < dim; i++) y[i] *= s;
+}
+
+static int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int dim) {
+    int32_t res = 0;
+    for (int i = 0; i < dim; i++) res += (int32_t)a[i] * (int32_t)b[i];
+    return res;
+}
+
+static int hamming_scalar(const uint64_t *a, const uint64_t *b, int words) {
+    int res = 0;
+    for (int i = 0; i < words; i++) {
+        // Conteggio bit portabile (SWAR), usato se manca popcnt hardware
+        uint64_t x = a[i] ^ b[i];
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        res += (int)((x * 0x0101010101010101ULL) >> 56);
+    }
+    return res;
+}
+
+static float dot_f32_i8_scalar(const float *a, const int8_t *b, int dim) {
+    float s0 = 0.0f, s1 = 0.0f;
+    int i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += a[i] * (float)b[i];
+        s1 += a[i + 1] * (float)b[i + 1];
+    }
+    for (; i < dim; i++) s0 += a[i] * (float)b[i];
+    return s0 + s1;
+}
+
+// --- MEZZA PRECISIONE (fp16 / bf16) ---
+
+static inline float f16_to_f32(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0) {
+        // Zero o subnormale: mant * 2^-24
+        float v = (float)mant * (1.0f / 16777216.0f);
+        memcpy(&bits, &v, sizeof(bits));
+        bits |= sign;
+    } else if (exp == 31) {
+        bits = sign | 0x7f800000u | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Arrotondamento al pari più vicino; oltre 65504 satura a infinito
+static inline uint16_t f32_to_f16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7fffffffu;
+    if (abs >= 0x7f800000u) return sign | (abs > 0x7f800000u ? 0x7e00 : 0x7c00);
+    if (abs >= 0x477ff000u) return sign | 0x7c00;
+    if (abs < 0x38800000u) {
+        // Subnormale in fp16: multiplo di 2^-24 (1024 = il primo normale, codifica identica)
+        float v;
+        memcpy(&v, &abs, sizeof(v));
+        return sign | (uint16_t)lrintf(v * 16777216.0f);
+    }
+    abs += 0xfffu + ((abs >> 13) & 1u);
+    return sign | (uint16_t)((abs - 0x38000000u) >> 13);
+}
+
+static inline float bf16_to_f32(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t f32_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffffu) > 0x7f800000u) return (uint16_t)((x >> 16) | 0x40); // NaN resta NaN
+    return (uint16_t)((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+}
+
+static float dot_f32_f16_scalar(const float *a, const uint16_t *b, int dim) {
+    float s0 = 0.0f, s1 = 0.0f;
+    int i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += a[i] * f16_to_f32(b[i]);
+        s1 += a[i + 1] * f16_to_f32(b[i + 1]);
+    }
+    for (; i < dim; i++) s0 += a[i] * f16_to_f32(b[i]);
+    return s0 + s1;
+}
+
+static float dot_f32_bf16_scalar(const float *a, const uint16_t *b, int dim) {
+    float s0 = 0.0f, s1 = 0.0f;
+    int i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += a[i] * bf16_to_f32(b[i]);
+        s1 += a[i + 1] * bf16_to_f32(b[i + 1]);
+    }
+    for (; i < dim; i++) s0 += a[i] * bf16_to_f32(b[i]);
+    return s0 + s1;
+}
+
+// --- x86: AVX2 + FMA / AVX-512F ---
+
+#ifdef VK_X86
+
+#define VK_AVX2 __attribute__((target("avx2,fma")))
+#define VK_AVX512 __attribute__((target("avx512f")))
+#define VK_INLINE static inline __attribute__((always_inline))
+
+VK_INLINE VK_AVX2 float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+    return _mm_cvtss_f32(lo);
+}
+
+// Corpo comune: 4 accumulatori da 8 float (32 float per iterazione)
+VK_INLINE VK_AVX2 float dot_avx2_body(const float *a, const float *b, int dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i),      acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8),  acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float res = hsum256(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < dim; i++) res += a[i] * b[i];
+    return res;
+}
+
+static VK_AVX2 float dot_avx2(const float *a, const float *b, int dim) {
+    return dot_avx2_body(a, b, dim);
+}
+static VK_AVX2 float dot_avx2_384(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx2_body(a, b, 384);
+}
+static VK_AVX2 float dot_avx2_768(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx2_body(a, b, 768);
+}
+static VK_AVX2 float dot_avx2_1024(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx2_body(a, b, 1024);
+}
+
+// Un vettore contro 4 query: ogni blocco di a è caricato una volta per 4 FMA
+static VK_AVX2 void dot4_avx2(const float *a, const float *const *q, float *out, int dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        acc0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(q[0] + i), acc0);
+        acc1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(q[1] + i), acc1);
+        acc2 = _mm256_fmadd_ps(va, _mm256_loadu_ps(q[2] + i), acc2);
+        acc3 = _mm256_fmadd_ps(va, _mm256_loadu_ps(q[3] + i), acc3);
+    }
+    out[0] = hsum256(acc0);
+    out[1] = hsum256(acc1);
+    out[2] = hsum256(acc2);
+    out[3] = hsum256(acc3);
+    for (; i < dim; i++) {
+        out[0] += a[i] * q[0][i];
+        out[1] += a[i] * q[1][i];
+        out[2] += a[i] * q[2][i];
+        out[3] += a[i] * q[3][i];
+    }
+}
+
+static VK_AVX2 void axpby_avx2(float *y, const float *x, float alpha, float beta, int dim) {
+    __m256 va = _mm256_set1_ps(alpha);
+    __m256 vb = _mm256_set1_ps(beta);
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 vy = _mm256_mul_ps(_mm256_loadu_ps(y + i), va);
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), vb, vy));
+    }
+    for (; i < dim; i++) y[i] = y[i] * alpha + x[i] * beta;
+}
+
+static VK_AVX2 void scale_avx2(float *y, float s, int dim) {
+    __m256 vs = _mm256_set1_ps(s);
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_mul_ps(_mm256_loadu_ps(y + i), vs));
+    }
+    for (; i < dim; i++) y[i] *= s;
+}
+
+VK_INLINE VK_AVX2 int32_t hsum256_epi32(__m256i v) {
+    __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(lo);
+}
+
+// int8 x int8: estensione a int16 + madd (esatto, nessuna saturazione come maddubs)
+static VK_AVX2 int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int dim) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i a1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i + 16)));
+        __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(a0, b0));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(a1, b1));
+    }
+    int32_t res = hsum256_epi32(_mm256_add_epi32(acc0, acc1));
+    for (; i < dim; i++) res += (int32_t)a[i] * (int32_t)b[i];
+    return res;
+}
+
+// float x int8 (re-ranking asimmetrico: la query non viene quantizzata)
+static VK_AVX2 float dot_f32_i8_avx2(const float *a, const int8_t *b, int dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m128i raw = _mm_loadu_si128((const __m128i *)(b + i));
+        __m256 b0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(raw));
+        __m256 b1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(raw, 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, acc1);
+    }
+    float res = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * (float)b[i];
+    return res;
+}
+
+// Corpo comune: 4 accumulatori da 16 float (64 float per iterazione)
+VK_INLINE VK_AVX512 float dot_avx512_body(const float *a, const float *b, int dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i),      _mm512_loadu_ps(b + i),      acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        // Coda mascherata: nessun loop scalare
+        __mmask16 m = (__mmask16)((1u << (dim - i)) - 1u);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+static VK_AVX512 float dot_avx512(const float *a, const float *b, int dim) {
+    return dot_avx512_body(a, b, dim);
+}
+static VK_AVX512 float dot_avx512_384(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx512_body(a, b, 384);
+}
+static VK_AVX512 float dot_avx512_768(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx512_body(a, b, 768);
+}
+static VK_AVX512 float dot_avx512_1024(const float *a, const float *b, int dim) {
+    (void)dim; return dot_avx512_body(a, b, 1024);
+}
+
+static VK_AVX512 void dot4_avx512(const float *a, const float *const *q, float *out, int dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 va = _mm512_loadu_ps(a + i);
+        acc0 = _mm512_fmadd_ps(va, _mm512_loadu_ps(q[0] + i), acc0);
+        acc1 = _mm512_fmadd_ps(va, _mm512_loadu_ps(q[1] + i), acc1);
+        acc2 = _mm512_fmadd_ps(va, _mm512_loadu_ps(q[2] + i), acc2);
+        acc3 = _mm512_fmadd_ps(va, _mm512_loadu_ps(q[3] + i), acc3);
+    }
+    if (i < dim) {
+        __mmask16 m = (__mmask16)((1u << (dim - i)) - 1u);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+        acc0 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, q[0] + i), acc0);
+        acc1 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, q[1] + i), acc1);
+        acc2 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, q[2] + i), acc2);
+        acc3 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, q[3] + i), acc3);
+    }
+    out[0] = _mm512_reduce_add_ps(acc0);
+    out[1] = _mm512_reduce_add_ps(acc1);
+    out[2] = _mm512_reduce_add_ps(acc2);
+    out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+static VK_AVX512 void axpby_avx512(float *y, const float *x, float alpha, float beta, int dim) {
+    __m512 va = _mm512_set1_ps(alpha);
+    __m512 vb = _mm512_set1_ps(beta);
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 vy = _mm512_mul_ps(_mm512_loadu_ps(y + i), va);
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(_mm512_loadu_ps(x + i), vb, vy));
+    }
+    for (; i < dim; i++) y[i] = y[i] * alpha + x[i] * beta;
+}
+
+static VK_AVX512 void scale_avx512(float *y, float s, int dim) {
+    __m512 vs = _mm512_set1_ps(s);
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_mul_ps(_mm512_loadu_ps(y + i), vs));
+    }
+    for (; i < dim; i++) y[i] *= s;
+}
+
+// Mezza precisione: conversione a float nel registro (fp16 con vcvtph2ps, bf16 con
+// uno shift di 16 bit) e FMA in float32, la query resta in piena precisione
+#define VK_F16C __attribute__((target("avx2,fma,f16c")))
+
+static VK_F16C float dot_f32_f16_avx2(const float *a, const uint16_t *b, int dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256 b1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b + i + 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, acc1);
+    }
+    float res = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * f16_to_f32(b[i]);
+    return res;
+}
+
+static VK_AVX2 float dot_f32_bf16_avx2(const float *a, const uint16_t *b, int dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256i raw = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256 b0 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)), 16));
+        __m256 b1 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)), 16));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, acc1);
+    }
+    float res = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * bf16_to_f32(b[i]);
+    return res;
+}
+
+static VK_AVX512 float dot_f32_f16_avx512(const float *a, const uint16_t *b, int dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 b0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + i)));
+        __m512 b1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(b + i + 16)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), b1, acc1);
+    }
+    float res = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * f16_to_f32(b[i]);
+    return res;
+}
+
+static VK_AVX512 float dot_f32_bf16_avx512(const float *a, const uint16_t *b, int dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512i w0 = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(b + i)));
+        __m512i w1 = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(b + i + 16)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_castsi512_ps(_mm512_slli_epi32(w0, 16)), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_castsi512_ps(_mm512_slli_epi32(w1, 16)), acc1);
+    }
+    float res = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * bf16_to_f32(b[i]);
+    return res;
+}
+
+#define VK_POPCNT __attribute__((target("popcnt")))
+#define VK_VPOPCNTDQ __attribute__((target("avx512f,avx512vpopcntdq")))
+
+static VK_POPCNT int hamming_popcnt(const uint64_t *a, const uint64_t *b, int words) {
+    int r0 = 0, r1 = 0;
+    int i = 0;
+    for (; i + 2 <= words; i += 2) {
+        r0 += __builtin_popcountll(a[i] ^ b[i]);
+        r1 += __builtin_popcountll(a[i + 1] ^ b[i + 1]);
+    }
+    for (; i < words; i++) r0 += __builtin_popcountll(a[i] ^ b[i]);
+    return r0 + r1;
+}
+
+static VK_VPOPCNTDQ int hamming_avx512(const uint64_t *a, const uint64_t *b, int words) {
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    if (i < words) {
+        __mmask8 m = (__mmask8)((1u << (words - i)) - 1u);
+        __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, a + i), _mm512_maskz_loadu_epi64(m, b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return (int)_mm512_reduce_add_epi64(acc);
+}
+
+#define VK_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#define VK_AVX512VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+
+static VK_AVX512BW int32_t dot_i8_avx512bw(const int8_t *a, const int8_t *b, int dim) {
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512i a0 = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(a + i)));
+        __m512i b0 = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(a0, b0));
+    }
+    int32_t res = _mm512_reduce_add_epi32(acc);
+    for (; i < dim; i++) res += (int32_t)a[i] * (int32_t)b[i];
+    return res;
+}
+
+// VNNI: vpdpbusd moltiplica u8 x s8. Si trasla a di +128 (xor del bit di segno)
+// e si sottrae 128 * sum(b), calcolato con un secondo vpdpbusd indipendente.
+static VK_AVX512VNNI int32_t dot_i8_avx512vnni(const int8_t *a, const int8_t *b, int dim) {
+    const __m512i sign = _mm512_set1_epi8((char)0x80);
+    __m512i acc = _mm512_setzero_si512();
+    __m512i corr = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        __m512i va = _mm512_xor_si512(_mm512_loadu_si512(a + i), sign);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        acc = _mm512_dpbusd_epi32(acc, va, vb);
+        corr = _mm512_dpbusd_epi32(corr, sign, vb);
+    }
+    int32_t res = _mm512_reduce_add_epi32(_mm512_sub_epi32(acc, corr));
+    for (; i < dim; i++) res += (int32_t)a[i] * (int32_t)b[i];
+    return res;
+}
+
+static VK_AVX512 float dot_f32_i8_avx512(const float *a, const int8_t *b, int dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 b0 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(b + i))));
+        __m512 b1 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(b + i + 16))));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), b1, acc1);
+    }
+    float res = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * (float)b[i];
+    return res;
+}
+
+#endif // VK_X86
+
+// --- ARM: NEON (Apple Silicon, Graviton) ---
+
+#ifdef VK_NEON
+
+static inline __attribute__((always_inline)) float dot_neon_body(const float *a, const float *b, int dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i),      vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4),  vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8),  vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float res = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < dim; i++) res += a[i] * b[i];
+    return res;
+}
+
+static float dot_neon(const float *a, const float *b, int dim) {
+    return dot_neon_body(a, b, dim);
+}
+static float dot_neon_384(const float *a, const float *b, int dim) {
+    (void)dim; return dot_neon_body(a, b, 384);
+}
+static float dot_neon_768(const float *a, const float *b, int dim) {
+    (void)dim; return dot_neon_body(a, b, 768);
+}
+static float dot_neon_1024(const float *a, const float *b, int dim) {
+    (void)dim; return dot_neon_body(a, b, 1024);
+}
+
+static void dot4_neon(const float *a, const float *const *q, float *out, int dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t va = vld1q_f32(a + i);
+        acc0 = vfmaq_f32(acc0, va, vld1q_f32(q[0] + i));
+        acc1 = vfmaq_f32(acc1, va, vld1q_f32(q[1] + i));
+        acc2 = vfmaq_f32(acc2, va, vld1q_f32(q[2] + i));
+        acc3 = vfmaq_f32(acc3, va, vld1q_f32(q[3] + i));
+    }
+    out[0] = vaddvq_f32(acc0);
+    out[1] = vaddvq_f32(acc1);
+    out[2] = vaddvq_f32(acc2);
+    out[3] = vaddvq_f32(acc3);
+    for (; i < dim; i++) {
+        out[0] += a[i] * q[0][i];
+        out[1] += a[i] * q[1][i];
+        out[2] += a[i] * q[2][i];
+        out[3] += a[i] * q[3][i];
+    }
+}
+
+static void axpby_neon(float *y, const float *x, float alpha, float beta, int dim) {
+    float32x4_t va = vdupq_n_f32(alpha);
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t vy = vmulq_f32(vld1q_f32(y + i), va);
+        vst1q_f32(y + i, vfmaq_n_f32(vy, vld1q_f32(x + i), beta));
+    }
+    for (; i < dim; i++) y[i] = y[i] * alpha + x[i] * beta;
+}
+
+static void scale_neon(float *y, float s, int dim) {
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        vst1q_f32(y + i, vmulq_n_f32(vld1q_f32(y + i), s));
+    }
+    for (; i < dim; i++) y[i] *= s;
+}
+
+static int32_t dot_i8_neon(const int8_t *a, const int8_t *b, int dim) {
+    int32x4_t acc = vdupq_n_s32(0);
+    int i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    int32_t res = vaddvq_s32(acc);
+    for (; i < dim; i++) res += (int32_t)a[i] * (int32_t)b[i];
+    return res;
+}
+
+static int hamming_neon(const uint64_t *a, const uint64_t *b, int words) {
+    uint64x2_t acc = vdupq_n_u64(0);
+    int i = 0;
+    for (; i + 2 <= words; i += 2) {
+        uint8x16_t x = veorq_u8(vreinterpretq_u8_u64(vld1q_u64(a + i)), vreinterpretq_u8_u64(vld1q_u64(b + i)));
+        acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(vcntq_u8(x))));
+    }
+    int res = (int)vaddvq_u64(acc);
+    for (; i < words; i++) res += __builtin_popcountll(a[i] ^ b[i]);
+    return res;
+}
+
+static float dot_f32_i8_neon(const float *a, const int8_t *b, int dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        int16x8_t w = vmovl_s8(vld1_s8(b + i));
+        float32x4_t b0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)));
+        float32x4_t b1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(w)));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), b0);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), b1);
+    }
+    float res = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * (float)b[i];
+    return res;
+}
+
+#if defined(__aarch64__)
+static float dot_f32_f16_neon(const float *a, const uint16_t *b, int dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(b + i));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vcvt_f32_f16(vget_low_f16(h)));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vcvt_high_f32_f16(h));
+    }
+    float res = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * f16_to_f32(b[i]);
+    return res;
+}
+#endif
+
+static float dot_f32_bf16_neon(const float *a, const uint16_t *b, int dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        uint16x8_t w = vld1q_u16(b + i);
+        float32x4_t b0 = vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(w), 16));
+        float32x4_t b1 = vreinterpretq_f32_u32(vshll_n_u16(vget_high_u16(w), 16));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), b0);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), b1);
+    }
+    float res = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; i++) res += a[i] * bf16_to_f32(b[i]);
+    return res;
+}
+
+#endif // VK_NEON
+
+// --- DISPATCH ---
+
+static void detect_cpu(void) {
+    detected_isa = VK_ISA_SCALAR;
+#if defined(VK_X86)
+    __builtin_cpu_init();
+    has_popcnt = __builtin_cpu_supports("popcnt");
+    if (__builtin_cpu_supports("avx512f")) {
+        detected_isa = VK_ISA_AVX512;
+        has_avx512bw = __builtin_cpu_supports("avx512bw");
+        has_avx512vnni = has_avx512bw && __builtin_cpu_supports("avx512vnni");
+        has_vpopcntdq = __builtin_cpu_supports("avx512vpopcntdq");
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        detected_isa = VK_ISA_AVX2;
+    }
+    has_f16c = detected_isa >= VK_ISA_AVX2 && __builtin_cpu_supports("f16c");
+#elif defined(VK_NEON)
+    detected_isa = VK_ISA_NEON;
+#endif
+
+    // Override manuale (debug/benchmark): può solo abbassare il livello rilevato
+    const char *force = getenv("VECS_SIMD");
+    if (force && *force) {
+        for (int i = VK_ISA_SCALAR; i <= VK_ISA_AVX512; i++) {
+#ifndef VK_NEON
+            if (i == VK_ISA_NEON) continue;
+#endif
+            if (strncasecmp(force, ISA_NAMES[i], strlen(force)) == 0 && (vk_isa_t)i <= detected_isa) {
+                detected_isa = (vk_isa_t)i;
+                if (detected_isa != VK_ISA_AVX512) has_avx512bw = has_avx512vnni = has_vpopcntdq = 0;
+                if (detected_isa < VK_ISA_AVX2) has_f16c = 0;
+                if (detected_isa == VK_ISA_SCALAR) has_popcnt = 0;
+                break;
+            }
+        }
+    }
+}
+
+void vec_kernels_select(vec_kernels_t *out, int dim) {
+    pthread_once(&detect_once, detect_cpu);
+
+    out->isa = ISA_NAMES[detected_isa];
+    out->specialized = 0;
+    out->dot = dot_scalar;
+    out->dot4 = dot4_scalar;
+    out->axpby = axpby_scalar;
+    out->scale = scale_scalar;
+    out->isa_i8 = "scalar";
+    out->dot_i8 = dot_i8_scalar;
+    out->dot_f32_i8 = dot_f32_i8_scalar;
+    out->hamming = hamming_scalar;
+    out->isa_f16 = "scalar";
+    out->dot_f32_f16 = dot_f32_f16_scalar;
+    out->dot_f32_bf16 = dot_f32_bf16_scalar;
+#if defined(VK_X86)
+    if (has_vpopcntdq) out->hamming = hamming_avx512;
+    else if (has_popcnt) out->hamming = hamming_popcnt;
+#elif defined(VK_NEON)
+    if (detected_isa == VK_ISA_NEON) out->hamming = hamming_neon;
+#endif
+
+    switch (detected_isa) {
+#if defined(VK_X86)
+    case VK_ISA_AVX512:
+        out->dot4 = dot4_avx512;
+        out->axpby = axpby_avx512;
+        out->scale = scale_avx512;
+        out->dot_f32_i8 = dot_f32_i8_avx512;
+        out->dot_f32_f16 = dot_f32_f16_avx512;
+        out->dot_f32_bf16 = dot_f32_bf16_avx512;
+        out->isa_f16 = "avx512f";
+        if (has_avx512vnni) { out->dot_i8 = dot_i8_avx512vnni; out->isa_i8 = "avx512vnni"; }
+        else if (has_avx512bw) { out->dot_i8 = dot_i8_avx512bw; out->isa_i8 = "avx512bw"; }
+        else { out->dot_i8 = dot_i8_avx2; out->isa_i8 = "avx2"; }
+        out->specialized = 1;
+        if (dim == 384) out->dot = dot_avx512_384;
+        else if (dim == 768) out->dot = dot_avx512_768;
+        else if (dim == 1024) out->dot = dot_avx512_1024;
+        else { out->dot = dot_avx512; out->specialized = 0; }
+        break;
+    case VK_ISA_AVX2:
+        out->dot4 = dot4_avx2;
+        out->axpby = axpby_avx2;
+        out->scale = scale_avx2;
+        out->dot_i8 = dot_i8_avx2;
+        out->dot_f32_i8 = dot_f32_i8_avx2;
+        out->dot_f32_bf16 = dot_f32_bf16_avx2;
+        out->isa_f16 = "avx2";
+        if (has_f16c) { out->dot_f32_f16 = dot_f32_f16_avx2; out->isa_f16 = "avx2+f16c"; }
+        out->isa_i8 = "avx2";
+        out->specialized = 1;
+        if (dim == 384) out->dot = dot_avx2_384;
+        else if (dim == 768) out->dot = dot_avx2_768;
+        else if (dim == 1024) out->dot = dot_avx2_1024;
+        else { out->dot = dot_avx2; out->specialized = 0; }
+        break;
+#elif defined(VK_NEON)
+    case VK_ISA_NEON:
+        out->dot4 = dot4_neon;
+        out->axpby = axpby_neon;
+        out->scale = scale_neon;
+        out->dot_i8 = dot_i8_neon;
+        out->dot_f32_i8 = dot_f32_i8_neon;
+        out->dot_f32_bf16 = dot_f32_bf16_neon;
+        out->isa_f16 = "neon";
+#if defined(__aarch64__)
+        out->dot_f32_f16 = dot_f32_f16_neon;
+#endif
+        out->isa_i8 = "neon";
+        out->specialized = 1;
+        if (dim == 384) out->dot = dot_neon_384;
+        else if (dim == 768) out->dot = dot_neon_768;
+        else if (dim == 1024) out->dot = dot_neon_1024;
+        else { out->dot = dot_neon; out->specialized = 0; }
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+void vec_kernels_normalize(const vec_kernels_t *vk, float *v, int dim) {
+    float norm = sqrtf(vk->dot(v, v, dim));
+    if (norm > 1e-9f) {
+        vk->scale(v, 1.0f / norm, dim);
+    }
+}
+
+float vec_kernels_quantize_i8(const float *v, int8_t *out, int dim) {
+    float max_abs = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        float a = fabsf(v[i]);
+        if (a > max_abs) max_abs = a;
+    }
+    if (max_abs < 1e-12f) {
+        memset(out, 0, (size_t)dim);
+        return 0.0f;
+    }
+    float inv = 127.0f / max_abs;
+    for (int i = 0; i < dim; i++) {
+        long q = lrintf(v[i] * inv);
+        out[i] = (int8_t)(q > 127 ? 127 : (q < -127 ? -127 : q));
+    }
+    return max_abs / 127.0f;
+}
+
+void vec_kernels_sign_bits(const float *v, uint64_t *out, int dim) {
+    int words = (dim + 63) / 64;
+    memset(out, 0, (size_t)words * sizeof(uint64_t));
+    for (int i = 0; i < dim; i++) {
+        if (v[i] > 0.0f) out[i >> 6] |= 1ULL << (i & 63);
+    }
+}
+
+void vec_kernels_to_f16(const float *v, uint16_t *out, int dim) {
+    for (int i = 0; i < dim; i++) out[i] = f32_to_f16(v[i]);
+}
+
+void vec_kernels_from_f16(const uint16_t *h, float *out, int dim) {
+    for (int i = 0; i < dim; i++) out[i] = f16_to_f32(h[i]);
+}
+
+void vec_kernels_to_bf16(const float *v, uint16_t *out, int dim) {
+    for (int i = 0; i < dim; i++) out[i] = f32_to_bf16(v[i]);
+}
+
+void vec_kernels_from_bf16(const uint16_t *h, float *out, int dim) {
+    for (int i = 0; i < dim; i++) out[i] = bf16_to_f32(h[i]);
+}